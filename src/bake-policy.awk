@@ -0,0 +1,260 @@
+# bake-policy.awk: turns the lists in a libtrash configuration file into C
+#
+# Used by --with-baked-policy=FILE (see configure.ac and src/Makefile.am), which
+# runs it on FILE to generate baked-policy.h. For each of UNREMOVABLE_DIRS,
+# TEMPORARY_DIRS, REMOVABLE_MEDIA_MOUNT_POINTS, EXCEPTIONS and
+# IGNORE_EXTENSIONS which FILE sets, the header
+#
+# - replaces the compile-time default configure.ac defined with the value in FILE,
+# - defines BAKED_<KEY>, and
+# - defines a matcher which answers the same question as found_under_dir(),
+#   is_an_exception() or ends_in_ignored_extension() (in helpers.c) for that
+#   very list, with the list unrolled into character comparisons: dirs and
+#   exceptions are dispatched on their second character (the one after the
+#   leading slash), extensions on their length. (The extension matcher takes
+#   the extension lex_path() found, not the whole path.)
+#
+# helpers.c uses a matcher whenever the list in a snapshot is still the one
+# baked in (i.e., no configuration file read at run-time changed it); keys
+# FILE doesn't set get a matcher which is never used.
+#
+# FILE is read exactly as read_config_from_file() reads configuration files:
+# lines starting with '#' are ignored, the key ends at the first white space or
+# at the '=', the value is the first word after the '=' and the last
+# occurrence of a key wins. All the other keys are left alone.
+#
+# Must be run in the C locale.
+
+BEGIN {
+	nkeys = split("UNREMOVABLE_DIRS TEMPORARY_DIRS REMOVABLE_MEDIA_MOUNT_POINTS EXCEPTIONS IGNORE_EXTENSIONS", keys, " ")
+
+	for (i = 1; i <= nkeys; i++)
+		wanted[keys[i]] = 1
+
+	function_name["UNREMOVABLE_DIRS"] = "baked_under_unremovable_dirs"
+	function_name["TEMPORARY_DIRS"] = "baked_under_temporary_dirs"
+	function_name["REMOVABLE_MEDIA_MOUNT_POINTS"] = "baked_under_removable_media_mount_points"
+	function_name["EXCEPTIONS"] = "baked_is_an_exception"
+	function_name["IGNORE_EXTENSIONS"] = "baked_ends_in_ignored_extension"
+
+	space = "[ \t\r\f\v]"
+}
+
+/^#/ {
+	next
+}
+
+{
+	equal_sign = index($0, "=")
+
+	if (!equal_sign)
+		next
+
+	key = substr($0, 1, equal_sign - 1)
+	sub("^" space "+", "", key)
+
+	if (key == "")
+		next
+
+	if (match(key, space))
+		key = substr(key, 1, RSTART - 1)
+
+	if (!(key in wanted))
+		next
+
+	value = substr($0, equal_sign + 1)
+	sub("^" space "+", "", value)
+
+	if (match(value, space))
+		value = substr(value, 1, RSTART - 1)
+
+	values[key] = value
+}
+
+# A C string literal holding s:
+
+function c_string(s,    escaped, c, i)
+{
+	escaped = ""
+
+	for (i = 1; i <= length(s); i++)
+	{
+		c = substr(s, i, 1)
+		escaped = escaped ((c == "\\" || c == "\"") ? "\\" : "") c
+	}
+
+	return "\"" escaped "\""
+}
+
+# A C character constant holding the single character c:
+
+function c_char(c)
+{
+	if (c == "\\" || c == "'")
+		return "'\\" c "'"
+
+	return "'" c "'"
+}
+
+# The condition under which the string s, starting at offset first of variable, equals
+# text (which must be printable ASCII for the unrolled form; anything else is compared
+# with strncmp()):
+
+function compare(variable, first, text,    condition, i)
+{
+	if (text ~ /[^ -~]/)
+		return "!strncmp(" variable " + " first ", " c_string(text) ", " length(text) ")"
+
+	condition = ""
+
+	for (i = 1; i <= length(text); i++)
+		condition = condition (condition == "" ? "" : " && ") variable "[" (first + i - 1) "] == " c_char(substr(text, i, 1))
+
+	return condition == "" ? "1" : condition
+}
+
+# a && b, where either may be "1" or empty (meaning true):
+
+function conjunction(a, b)
+{
+	if (a == "1" || a == "")
+		return b == "" ? "1" : b
+
+	return b == "" ? a : a " && " b
+}
+
+# Splits a list into entries[1..n] the way helpers.c walks it: a ';' at the very end
+# doesn't start another entry. Returns n.
+
+function split_list(list,    n)
+{
+	if (list == "")
+		return 0
+
+	n = split(list, entries, ";")
+
+	if (substr(list, length(list)) == ";")
+		n--
+
+	return n
+}
+
+# found_under_dir() (strip_slash set) and is_an_exception() (strip_slash unset):
+
+function emit_path_matcher(key, strip_slash,    n, i, entry, test, first, cases, order, ncases, c)
+{
+	n = split_list(values[key])
+	ncases = 0
+
+	printf "static inline int %s(const char *path)\n{\n", function_name[key]
+
+	for (i = 1; i <= n; i++)
+	{
+		entry = entries[i]
+
+		if (strip_slash && substr(entry, length(entry)) == "/")
+			entry = substr(entry, 1, length(entry) - 1)
+
+		test = strip_slash ? "path[" length(entry) "] == '/'" : ""
+
+		if (substr(entry, 1, 1) != "/" || length(entry) < 2 || entry ~ /^.[^ -~]/)
+		{
+			# Entries we can't dispatch on (e.g., an empty one, which matches everything):
+
+			printf "\tif (%s)\n\t\treturn 1;\n\n", conjunction(compare("path", 0, entry), test)
+			continue
+		}
+
+		first = substr(entry, 2, 1)
+
+		if (!(first in cases))
+		{
+			order[++ncases] = first
+			cases[first] = ""
+		}
+
+		cases[first] = cases[first] "\t\t\tif (" conjunction(compare("path", 2, substr(entry, 3)), test) ")\n\t\t\t\treturn 1;\n"
+	}
+
+	if (ncases > 0)
+	{
+		printf "\tif (path[0] != '/')\n\t\treturn 0;\n\n\tswitch (path[1])\n\t{\n"
+
+		for (i = 1; i <= ncases; i++)
+		{
+			c = order[i]
+			printf "\t\tcase %s:\n%s\t\t\tbreak;\n", c_char(c), cases[c]
+		}
+
+		printf "\t}\n\n"
+	}
+
+	printf "\treturn 0;\n}\n\n"
+}
+
+# ends_in_ignored_extension():
+
+function emit_extension_matcher(key,    n, i, entry, len, lengths, order, nlengths)
+{
+	n = split_list(values[key])
+	nlengths = 0
+
+	printf "static inline int %s(const char *extension, size_t length)\n{\n", function_name[key]
+	printf "\tif (!extension)\n\t\treturn 0;\n\n"
+
+	for (i = 1; i <= n; i++)
+	{
+		entry = entries[i]
+		len = length(entry)
+
+		if (len == 0 || index(entry, ".")) # these never match an extension
+			continue
+
+		if (!(len in lengths))
+		{
+			order[++nlengths] = len
+			lengths[len] = ""
+		}
+
+		lengths[len] = lengths[len] "\t\t\tif (" compare("extension", 0, entry) ")\n\t\t\t\treturn 1;\n"
+	}
+
+	if (nlengths > 0)
+	{
+		printf "\tswitch (length)\n\t{\n"
+
+		for (i = 1; i <= nlengths; i++)
+			printf "\t\tcase %d:\n%s\t\t\tbreak;\n", order[i], lengths[order[i]]
+
+		printf "\t}\n\n"
+	}
+
+	printf "\treturn 0;\n}\n\n"
+}
+
+END {
+	printf "/* Generated by bake-policy.awk from %s. Do not edit. */\n\n", FILENAME
+	printf "#include <string.h>\n\n"
+
+	for (i = 1; i <= nkeys; i++)
+	{
+		key = keys[i]
+
+		if (!(key in values))
+		{
+			printf "/* %s isn't set in %s: */\n\n", key, FILENAME
+			if (key == "IGNORE_EXTENSIONS")
+				printf "static inline int %s(const char *extension, size_t length)\n{\n\t(void) extension;\n\t(void) length;\n\treturn 0;\n}\n\n", function_name[key]
+			else
+				printf "static inline int %s(const char *path)\n{\n\t(void) path;\n\treturn 0;\n}\n\n", function_name[key]
+			continue
+		}
+
+		printf "#undef %s\n#define %s %s\n\n#define BAKED_%s 1\n\n", key, key, c_string(values[key]), key
+
+		if (key == "IGNORE_EXTENSIONS")
+			emit_extension_matcher(key)
+		else
+			emit_path_matcher(key, key != "EXCEPTIONS")
+	}
+}
@@ -0,0 +1,70 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* The run-time control page, shared by libtrash and libtrash-ctl:
+ *
+ * Every user may have a small POSIX shared memory object, CONTROL_PAGE_PREFIX followed by the
+ * user's uid (e.g., /dev/shm/libtrash-1000), which every process running libtrash with that
+ * effective uid maps read-only. Only libtrash-ctl creates it (exclusively, so it never adopts a
+ * page somebody else left there); libtrash ignores a page which isn't owned by its user, and
+ * looks for one on every tick of the coarse clock for as long as there is none. Whoever can write to it (the user, or root) can use libtrash-ctl to
+ * switch libtrash off, to stop it from intercepting some of the functions it wraps or to stop
+ * it from preserving large files, and every running process notices at once: no restart, no
+ * change in the environment.
+ *
+ * The page can only make libtrash do less than its configuration says; it can never make it
+ * intercept something it was configured not to, or preserve a file it would otherwise delete.
+ * A zero-filled page (which is what libtrash-ctl creates) changes nothing.
+ *
+ * The wrappers read flags with a single atomic load. A writer which sets CONTROL_SIZE_LIMIT
+ * stores size_limit first, so a reader which sees the flag also sees the limit, and bumps
+ * generation after every change, so that libtrash-ctl can tell whether the page changed
+ * under its feet. */
+
+#include <stdint.h>
+
+#define CONTROL_PAGE_PREFIX  "/libtrash-"
+
+#define CONTROL_VERSION      1
+
+/* Bits of control_page.flags: */
+
+#define CONTROL_OFF          (1 << 0)  /* act as if TRASH_OFF were set to YES */
+#define CONTROL_NO_UNLINK    (1 << 1)  /* act as if INTERCEPT_UNLINK were set to NO */
+#define CONTROL_NO_RENAME    (1 << 2)  /* act as if INTERCEPT_RENAME were set to NO */
+#define CONTROL_NO_FOPEN     (1 << 3)  /* act as if INTERCEPT_FOPEN were set to NO */
+#define CONTROL_NO_FREOPEN   (1 << 4)  /* act as if INTERCEPT_FREOPEN were set to NO */
+#define CONTROL_NO_OPEN      (1 << 5)  /* act as if INTERCEPT_OPEN were set to NO */
+#define CONTROL_SIZE_LIMIT   (1 << 6)  /* don't preserve files of size_limit bytes or more */
+
+typedef struct
+{
+	uint32_t version;     /* 0 until libtrash-ctl first writes to the page */
+	uint32_t reserved;
+	uint64_t generation;
+	uint64_t flags;
+	uint64_t size_limit;
+}
+control_page;
+
+/* How the wrappers read the flags of the control page of the snapshot cfg (if it has none, nothing
+ * is switched off): */
+
+#define CONTROL_FLAGS(cfg) \
+	((cfg)->control ? __atomic_load_n(&(cfg)->control->flags, __ATOMIC_ACQUIRE) : 0)
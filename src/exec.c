@@ -0,0 +1,115 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* This file defines the wrappers for the GNU libc functions execve(), execv(), execvp() and
+ * execvpe(), which are only built if libtrash was configured with --enable-policy-inherit: they
+ * are where the compiled policy is handed down to the program being run (see policy.c). None of
+ * them looks at the configuration: they may be called in a child of vfork(), which shares our
+ * memory, or of fork() in a multithreaded program, so they don't allocate memory or take locks
+ * (the new environment lives on the stack), and they leave environ alone.
+ *
+ * GNU libc's execv() and execvp() call its own execve() and execvpe() directly, so they are wrapped
+ * too, and are run as the two of them with environ (which is all they do anyway). The execl*()
+ * functions, fexecve() and posix_spawn() aren't wrapped: the programs they run simply build their
+ * configuration themselves. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE /* for access to execvpe() inside unistd.h */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <alloca.h>
+
+#include "trash.h"
+
+#ifdef POLICY_INHERIT
+
+extern char **environ;
+
+PUBLIC int execve(const char *path, char *const argv[], char *const envp[])
+{
+	int (*real_execve) (const char*, char *const[], char *const[]) = get_real_function(EXECVE);
+	char variable[POLICY_FD_ENTRY_SIZE];
+	char **environment = NULL;
+	int fd = -1;
+	int retval = 0;
+
+	/* Isn't a pointer to GNU libc's execve() available? In that case, there's nothing we can do: */
+
+	if (!real_execve)
+	{
+		errno = 0;
+		return -1;
+	}
+
+	fd = policy_exec_fd(envp);
+
+	if (fd != -1)
+		environment = alloca(policy_exec_environment_size(envp));
+
+	retval = (*real_execve) (path, argv, policy_exec_environment(envp, environment, variable, fd));
+
+	/* If we got here, execve() failed (and set errno): */
+
+	policy_exec_failed(fd);
+
+	return retval;
+}
+
+PUBLIC int execv(const char *path, char *const argv[])
+{
+	return execve(path, argv, environ);
+}
+
+PUBLIC int execvpe(const char *file, char *const argv[], char *const envp[])
+{
+	int (*real_execvpe) (const char*, char *const[], char *const[]) = get_real_function(EXECVPE);
+	char variable[POLICY_FD_ENTRY_SIZE];
+	char **environment = NULL;
+	int fd = -1;
+	int retval = 0;
+
+	if (!real_execvpe)
+	{
+		errno = 0;
+		return -1;
+	}
+
+	fd = policy_exec_fd(envp);
+
+	if (fd != -1)
+		environment = alloca(policy_exec_environment_size(envp));
+
+	retval = (*real_execvpe) (file, argv, policy_exec_environment(envp, environment, variable, fd));
+
+	policy_exec_failed(fd);
+
+	return retval;
+}
+
+PUBLIC int execvp(const char *file, char *const argv[])
+{
+	return execvpe(file, argv, environ);
+}
+
+#endif /* POLICY_INHERIT */
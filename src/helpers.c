@@ -28,15 +28,20 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
 #include <pwd.h>
 #include <regex.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
 
 #include "trash.h"
 
@@ -47,9 +52,7 @@
 
 /* There isn't any need to export these functions (they are mere "helper helper functions" :-) ): */
 
-static char** read_config_from_file(char *conf_file, int number_of_keys, config *cfg, ...);
-
-static char *readline(FILE* stream, int *errors);
+static int read_config_from_file(const char *path, char **values, char **buffer_ptr);
 
 static int reformulate_new_path(char **new_path, char **first_null);
 
@@ -61,10 +64,131 @@ static int is_empty_file(const char *path);
 
 static int file_is_too_large(const char *path, off_t preserve_files_larger_than_limit);
 
-static int matches_re(const char *path, const char *regexp);
+static int matches_re(const char *path, config *cfg);
+
+static char* lookup_home_dir(uid_t euid);
+
+static char* trusted_home_dir(uid_t euid);
+
+static char* copy_string(const char *str);
+
+static int trash_dir_ok(const char *pathname, dev_t *dev, ino_t *ino, int record);
+
+static int trash_dir_unchanged(const char *pathname, dev_t dev, ino_t ino);
+
+static long coarse_seconds(void);
+
+static int decide_action_by_name(const lexed_path *lexed, config *cfg);
+
+static int known_canonical_dir(const char *dir, size_t length, config *cfg);
+
+static unsigned dir_lists_naming(const char *dir, size_t length, config *cfg);
+
+static int under_unremovable_dirs(const char *path, config *cfg);
+
+static int under_temporary_dirs(const char *path, config *cfg);
+
+static int under_removable_media_mount_points(const char *path, config *cfg);
+
+static int exception_listed(const char *path, config *cfg);
+
+static unsigned dir_lists_containing(const lexed_path *lexed, config *cfg);
+
+static unsigned dir_lists_of(const lexed_path *lexed, config *cfg);
+
+static int extension_set_contains(const config *cfg, const char *extension, size_t length);
 
 /* Definition of helper functions: */
 
+/* ------------------------------------------------------------------------ */
+
+/* The arena of a snapshot is a bump allocator: strings are never freed one by one, only all at
+ * once together with the snapshot. Its first block is the arena[] at the end of the snapshot;
+ * the extra blocks (which are only needed when the first one turns out to be too small) are
+ * chained to cfg->arena_overflow, the newest one first: */
+
+struct arena_block
+{
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/* arena_alloc() returns size bytes from the arena of cfg, or NULL if we run out of memory: */
+
+char* arena_alloc(config *cfg, size_t size)
+{
+	struct arena_block *block = cfg->arena_overflow;
+	char *ptr = NULL;
+
+	if (cfg->arena_size - cfg->arena_used >= size)
+	{
+		ptr = cfg->arena + cfg->arena_used;
+		cfg->arena_used += size;
+		return ptr;
+	}
+
+	if (!block || block->size - block->used < size)
+	{
+		block = malloc(sizeof(struct arena_block) + (size > ARENA_SIZE ? size : ARENA_SIZE));
+
+		if (!block)
+			return NULL;
+
+		block->size = size > ARENA_SIZE ? size : ARENA_SIZE;
+		block->used = 0;
+		block->next = cfg->arena_overflow;
+		cfg->arena_overflow = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+
+	return ptr;
+}
+
+/* arena_strdup() returns a copy of str in the arena of cfg, or NULL: */
+
+char* arena_strdup(config *cfg, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = arena_alloc(cfg, len);
+
+	if (copy)
+		memcpy(copy, str, len);
+
+	return copy;
+}
+
+/* arena_total() tells how many bytes of its arena cfg uses (libtrash_init() sizes the next
+ * snapshot after it), and arena_free() frees the extra blocks (the snapshot itself must then
+ * be free()d by the caller): */
+
+size_t arena_total(config *cfg)
+{
+	struct arena_block *block = NULL;
+	size_t total = cfg->arena_used;
+
+	for (block = cfg->arena_overflow; block; block = block->next)
+		total += block->used;
+
+	return total;
+}
+
+void arena_free(config *cfg)
+{
+	struct arena_block *block = cfg->arena_overflow, *next = NULL;
+
+	for ( ; block; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+
+	cfg->arena_overflow = NULL;
+}
+
 /* ------------------------------------------------------------------------ */
 
 	static inline int
@@ -181,6 +305,483 @@ static int is_an_exception(const char *path, const char *exceptions)
 	return 0;
 }
 
+/* ---------------------------------------------------------------------- */
+
+/* decide_action() looks the lists which may have been baked in at build time (see
+ * bake-policy.awk) up through these, which use the generated matchers as long as the snapshot
+ * still holds the baked lists and fall back on found_under_dir() and is_an_exception()
+ * otherwise (ends_in_ignored_extension() does the same by itself): */
+
+static int under_unremovable_dirs(const char *path, config *cfg)
+{
+#ifdef BAKED_POLICY
+	if (cfg->baked_lists & BAKED_LIST_UNREMOVABLE_DIRS)
+		return baked_under_unremovable_dirs(path);
+#endif
+	return found_under_dir(path, cfg->unremovable_dirs);
+}
+
+static int under_temporary_dirs(const char *path, config *cfg)
+{
+#ifdef BAKED_POLICY
+	if (cfg->baked_lists & BAKED_LIST_TEMPORARY_DIRS)
+		return baked_under_temporary_dirs(path);
+#endif
+	return found_under_dir(path, cfg->temporary_dirs);
+}
+
+static int under_removable_media_mount_points(const char *path, config *cfg)
+{
+#ifdef BAKED_POLICY
+	if (cfg->baked_lists & BAKED_LIST_REMOVABLE_MEDIA_MOUNT_POINTS)
+		return baked_under_removable_media_mount_points(path);
+#endif
+	return found_under_dir(path, cfg->removable_media_mount_points);
+}
+
+static int exception_listed(const char *path, config *cfg)
+{
+#ifdef BAKED_POLICY
+	if (cfg->baked_lists & BAKED_LIST_EXCEPTIONS)
+		return baked_is_an_exception(path);
+#endif
+	return is_an_exception(path, cfg->exceptions);
+}
+
+#ifdef BAKED_POLICY
+/* Called by build_config() once the lists of the snapshot cfg are final, wherever they came from
+ * (the compile-time defaults, the configuration files or a compiled policy): sets the bit in
+ * cfg->baked_lists of each list which is still exactly the one baked in. */
+
+void mark_baked_lists(config *cfg)
+{
+	cfg->baked_lists = 0;
+
+#ifdef BAKED_UNREMOVABLE_DIRS
+	if (!strcmp(cfg->unremovable_dirs, UNREMOVABLE_DIRS))
+		cfg->baked_lists |= BAKED_LIST_UNREMOVABLE_DIRS;
+#endif
+#ifdef BAKED_TEMPORARY_DIRS
+	if (!strcmp(cfg->temporary_dirs, TEMPORARY_DIRS))
+		cfg->baked_lists |= BAKED_LIST_TEMPORARY_DIRS;
+#endif
+#ifdef BAKED_REMOVABLE_MEDIA_MOUNT_POINTS
+	if (!strcmp(cfg->removable_media_mount_points, REMOVABLE_MEDIA_MOUNT_POINTS))
+		cfg->baked_lists |= BAKED_LIST_REMOVABLE_MEDIA_MOUNT_POINTS;
+#endif
+#ifdef BAKED_EXCEPTIONS
+	if (!strcmp(cfg->exceptions, EXCEPTIONS))
+		cfg->baked_lists |= BAKED_LIST_EXCEPTIONS;
+#endif
+#ifdef BAKED_IGNORE_EXTENSIONS
+	if (!strcmp(cfg->ignore_extensions, IGNORE_EXTENSIONS))
+		cfg->baked_lists |= BAKED_LIST_IGNORE_EXTENSIONS;
+#endif
+
+#ifdef DEBUG
+	fprintf(stderr, "Baked lists in use: 0x%x.\n", cfg->baked_lists);
+#endif
+}
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+/* decide_action() needs to know whether a path lies under any of up to seven directory lists
+ * (unremovable_dirs, uncovered_dirs, temporary_dirs, user_temporary_dirs,
+ * removable_media_mount_points, home and absolute_trash_can), and calling found_under_dir() for
+ * each of them means going through every entry of every list for every file. So, once the lists
+ * of a snapshot are known, build_dir_trie() compiles all of them into a single trie of path
+ * components, each node of which is tagged with the lists which have an entry ending there, and
+ * dir_lists_containing() answers all the questions at once with a single walk down the path.
+ *
+ * An entry matches exactly as in found_under_dir(): the path must start with the entry (minus
+ * one trailing slash) followed by a slash. Splitting both the entry and the path at every slash
+ * (empty components included) turns that into "the components of the entry are the first
+ * components of the path, and the path has at least one more", which is what the walk checks.
+ *
+ * The nodes (struct dir_trie_node, in trash.h) live in an array in the arena of the snapshot.
+ * The children of a node are contiguous and sorted (by length, then by their bytes), so that each
+ * step of the walk is a binary search; the names point into the lists themselves, which live as
+ * long as the snapshot. Lists which are still the ones baked in at build time are left out: their
+ * generated matchers are faster still. A compiled policy image carries the trie of the policy it
+ * holds, so a snapshot built from one usually gets it ready-made (see policy_split_lists()). */
+
+#define DIR_LIST_TRASH_CAN                     (1 << 0)
+#define DIR_LIST_UNCOVERED_DIRS                (1 << 1)
+#define DIR_LIST_UNREMOVABLE_DIRS              (1 << 2)
+#define DIR_LIST_TEMPORARY_DIRS                (1 << 3)
+#define DIR_LIST_USER_TEMPORARY_DIRS           (1 << 4)
+#define DIR_LIST_REMOVABLE_MEDIA_MOUNT_POINTS  (1 << 5)
+#define DIR_LIST_HOME                          (1 << 6)
+
+/* While it is being built, the trie is a plain tree (node 0 is the root, which stands for no
+ * components at all): */
+
+typedef struct
+{
+	const char *name;
+	unsigned length;
+	unsigned lists;
+	int first_child;
+	int next_sibling;
+}
+dir_trie_draft_node;
+
+typedef struct
+{
+	dir_trie_draft_node *nodes;
+	unsigned count;
+	unsigned size;
+}
+dir_trie_draft;
+
+/* Returns the child of node called name (length characters), adding it if there's none yet, or
+ * -1 if we run out of memory: */
+
+static int draft_child(dir_trie_draft *draft, int node, const char *name, unsigned length)
+{
+	dir_trie_draft_node *nodes = NULL;
+	int child = draft->nodes[node].first_child;
+
+	for (; child != -1; child = draft->nodes[child].next_sibling)
+		if (draft->nodes[child].length == length && !memcmp(draft->nodes[child].name, name, length))
+			return child;
+
+	if (draft->count == draft->size)
+	{
+		nodes = realloc(draft->nodes, draft->size * REALLOC_FACTOR * sizeof(dir_trie_draft_node));
+
+		if (!nodes)
+			return -1;
+
+		draft->nodes = nodes;
+		draft->size *= REALLOC_FACTOR;
+	}
+
+	child = draft->count++;
+
+	draft->nodes[child].name = name;
+	draft->nodes[child].length = length;
+	draft->nodes[child].lists = 0;
+	draft->nodes[child].first_child = -1;
+	draft->nodes[child].next_sibling = draft->nodes[node].first_child;
+
+	draft->nodes[node].first_child = child;
+
+	return child;
+}
+
+/* Adds every entry of dir_list (a semi-colon separated list of directories, which is split up
+ * just like found_under_dir() does it) to the draft, tagged with list. Returns 0 if we run out
+ * of memory: */
+
+static int draft_add_list(dir_trie_draft *draft, const char *dir_list, unsigned list)
+{
+	const char *beg_name = dir_list, *end_name = NULL;
+	const char *component = NULL, *end_component = NULL;
+	int node = 0;
+
+	if (dir_list == NULL)
+		return 1;
+
+	while (*beg_name != '\0')
+	{
+		end_name = strchrnul(beg_name, ';');
+
+		/* (An empty entry stays empty, and a lone "/" becomes one: both match any absolute path.) */
+
+		if (end_name > beg_name && end_name[-1] == '/')
+			end_name--;
+
+		for (node = 0, component = beg_name; ; component = end_component + 1)
+		{
+			end_component = memchr(component, '/', end_name - component);
+
+			if (!end_component)
+				end_component = end_name;
+
+			node = draft_child(draft, node, component, end_component - component);
+
+			if (node == -1)
+				return 0;
+
+			if (end_component == end_name)
+				break;
+		}
+
+		draft->nodes[node].lists |= list;
+
+		beg_name = strchrnul(beg_name, ';');
+
+		if (*beg_name == ';')
+			beg_name++;
+	}
+
+	return 1;
+}
+
+static int compare_dir_trie_nodes(const void *a, const void *b)
+{
+	const struct dir_trie_node *node_a = a, *node_b = b;
+
+	if (node_a->length != node_b->length)
+		return node_a->length < node_b->length ? -1 : 1;
+
+	return memcmp(node_a->name, node_b->name, node_a->length);
+}
+
+/* Called by build_config() once the lists of the snapshot cfg are final (and after
+ * mark_baked_lists()); if we run out of memory, cfg->dir_trie stays NULL and
+ * dir_lists_containing() goes through the lists one by one. */
+
+void build_dir_trie(config *cfg)
+{
+	dir_trie_draft draft;
+	struct dir_trie_node *trie = NULL;
+	char *memory = NULL;
+	unsigned i = 0, next = 1, first = 0;
+	int child = -1;
+	int ok = 1;
+
+	cfg->dir_trie = NULL;
+	cfg->dir_trie_nodes = 0;
+
+	draft.size = 64;
+	draft.count = 1;
+	draft.nodes = malloc(draft.size * sizeof(dir_trie_draft_node));
+
+	if (!draft.nodes)
+		return;
+
+	draft.nodes[0].name = "";
+	draft.nodes[0].length = 0;
+	draft.nodes[0].lists = 0;
+	draft.nodes[0].first_child = -1;
+	draft.nodes[0].next_sibling = -1;
+
+	ok = draft_add_list(&draft, cfg->absolute_trash_can, DIR_LIST_TRASH_CAN) &&
+		draft_add_list(&draft, cfg->uncovered_dirs, DIR_LIST_UNCOVERED_DIRS) &&
+		draft_add_list(&draft, cfg->user_temporary_dirs, DIR_LIST_USER_TEMPORARY_DIRS) &&
+		draft_add_list(&draft, cfg->home, DIR_LIST_HOME);
+
+	if (!(cfg->baked_lists & BAKED_LIST_UNREMOVABLE_DIRS))
+		ok = ok && draft_add_list(&draft, cfg->unremovable_dirs, DIR_LIST_UNREMOVABLE_DIRS);
+
+	if (!(cfg->baked_lists & BAKED_LIST_TEMPORARY_DIRS))
+		ok = ok && draft_add_list(&draft, cfg->temporary_dirs, DIR_LIST_TEMPORARY_DIRS);
+
+	if (!(cfg->baked_lists & BAKED_LIST_REMOVABLE_MEDIA_MOUNT_POINTS))
+		ok = ok && draft_add_list(&draft, cfg->removable_media_mount_points, DIR_LIST_REMOVABLE_MEDIA_MOUNT_POINTS);
+
+	/* (The arena makes no promise about alignment, so we align the array ourselves.) */
+
+	if (ok)
+		memory = arena_alloc(cfg, draft.count * sizeof(struct dir_trie_node) + sizeof(void *) - 1);
+
+	if (!memory)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to build the directory trie, falling back on found_under_dir().\n");
+#endif
+		free(draft.nodes);
+		return;
+	}
+
+	trie = (struct dir_trie_node *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+
+	/* Lay the tree out breadth first, so that the children of every node end up next to each
+	 * other. Until a node's own children have been laid out, its children field holds the
+	 * index of its draft node: */
+
+	trie[0].name = draft.nodes[0].name;
+	trie[0].length = 0;
+	trie[0].lists = draft.nodes[0].lists;
+	trie[0].children = 0;
+	trie[0].child_count = 0;
+
+	for (i = 0; i < next; i++)
+	{
+		first = next;
+
+		for (child = draft.nodes[trie[i].children].first_child; child != -1; child = draft.nodes[child].next_sibling)
+		{
+			trie[next].name = draft.nodes[child].name;
+			trie[next].length = draft.nodes[child].length;
+			trie[next].lists = draft.nodes[child].lists;
+			trie[next].children = child;
+			trie[next].child_count = 0;
+			next++;
+		}
+
+		qsort(trie + first, next - first, sizeof(struct dir_trie_node), compare_dir_trie_nodes);
+
+		trie[i].children = first;
+		trie[i].child_count = next - first;
+	}
+
+#ifdef DEBUG
+	fprintf(stderr, "Directory trie built: %u nodes.\n", draft.count);
+#endif
+
+	free(draft.nodes);
+
+	cfg->dir_trie = trie;
+	cfg->dir_trie_nodes = next;
+}
+
+/* Returns the child of node called name (length characters), or NULL: */
+
+static const struct dir_trie_node* dir_trie_child(const struct dir_trie_node *trie, const struct dir_trie_node *node,
+		const char *name, unsigned length)
+{
+	unsigned low = node->children, high = node->children + node->child_count, middle = 0;
+	int comparison = 0;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+
+		if (trie[middle].length != length)
+			comparison = trie[middle].length < length ? -1 : 1;
+		else
+			comparison = memcmp(trie[middle].name, name, length);
+
+		if (comparison == 0)
+			return trie + middle;
+
+		if (comparison < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return NULL;
+}
+
+/* Returns the DIR_LIST_xxx bits of the lists which hold a directory the path lexed lies under: */
+
+static unsigned dir_lists_containing(const lexed_path *lexed, config *cfg)
+{
+	const struct dir_trie_node *node = cfg->dir_trie;
+	const char *path = lexed->path, *component = lexed->path, *end = NULL;
+	unsigned lists = 0, i = 0;
+
+	if (!node)
+	{
+		/* No trie: */
+
+		return (found_under_dir(path, cfg->absolute_trash_can) ? DIR_LIST_TRASH_CAN : 0) |
+			(found_under_dir(path, cfg->uncovered_dirs) ? DIR_LIST_UNCOVERED_DIRS : 0) |
+			(under_unremovable_dirs(path, cfg) ? DIR_LIST_UNREMOVABLE_DIRS : 0) |
+			(under_temporary_dirs(path, cfg) ? DIR_LIST_TEMPORARY_DIRS : 0) |
+			(found_under_dir(path, cfg->user_temporary_dirs) ? DIR_LIST_USER_TEMPORARY_DIRS : 0) |
+			(under_removable_media_mount_points(path, cfg) ? DIR_LIST_REMOVABLE_MEDIA_MOUNT_POINTS : 0) |
+			(found_under_dir(path, cfg->home) ? DIR_LIST_HOME : 0);
+	}
+
+	/* (Only the ends of the first LEXED_PATH_COMPONENTS components are recorded; in a deeper
+	 * path, we look for the ends of the others ourselves.) */
+
+	for (i = 0; node->child_count > 0; i++)
+	{
+		end = (i < LEXED_PATH_COMPONENTS) ? path + lexed->component_end[i] : strchrnul(component, '/');
+		node = dir_trie_child(cfg->dir_trie, node, component, end - component);
+
+		if (!node || *end != '/')
+			break;
+
+		lists |= node->lists;
+		component = end + 1;
+	}
+
+#ifdef BAKED_POLICY
+	/* The baked lists aren't in the trie: */
+
+	if ((cfg->baked_lists & BAKED_LIST_UNREMOVABLE_DIRS) && baked_under_unremovable_dirs(path))
+		lists |= DIR_LIST_UNREMOVABLE_DIRS;
+
+	if ((cfg->baked_lists & BAKED_LIST_TEMPORARY_DIRS) && baked_under_temporary_dirs(path))
+		lists |= DIR_LIST_TEMPORARY_DIRS;
+
+	if ((cfg->baked_lists & BAKED_LIST_REMOVABLE_MEDIA_MOUNT_POINTS) && baked_under_removable_media_mount_points(path))
+		lists |= DIR_LIST_REMOVABLE_MEDIA_MOUNT_POINTS;
+#endif
+
+	return lists;
+}
+
+/* rm -rf, make clean and git clean remove thousands of files from the same few directories, and
+ * what dir_lists_containing() says about a file only depends on the directory it is in (the walk
+ * stops before the last component, and the lists are all lists of directories) and on the
+ * snapshot. So dir_lists_of() asks it once per directory: each thread keeps its answers for the
+ * last DIR_DECISIONS_SIZE directories, together with the generation of the snapshot they were
+ * worked out from, so that all of them go stale at once when the snapshot is replaced. The
+ * directory is the canonical one build_absolute_path() came up with (the key is its path, with
+ * the trailing slash), and since the answers only depend on that path, its device and inode
+ * needn't be part of the key: a directory replaced by another one gets the same answers. Like
+ * known_dirs[], the entries are per thread, so that nothing needs to be locked. */
+
+#define DIR_DECISIONS_SIZE 8
+
+#define DIR_DECISION_MAX 256
+
+typedef struct
+{
+	unsigned long generation;	/* 0 if this entry is unused */
+	size_t length;
+	unsigned lists;
+	char dir[DIR_DECISION_MAX];
+}
+dir_decision;
+
+static __thread dir_decision dir_decisions[DIR_DECISIONS_SIZE];
+
+static __thread int dir_decisions_next = 0; /* the entry which gets replaced next */
+
+static __thread int dir_decisions_last = 0; /* the entry which was last used */
+
+static unsigned dir_lists_of(const lexed_path *lexed, config *cfg)
+{
+	size_t length = lexed->basename - lexed->path;
+	dir_decision *entry = &dir_decisions[dir_decisions_last];
+	int i = 0;
+
+	/* (failed_config has no generation of its own:) */
+
+	if (cfg->generation == 0 || length > DIR_DECISION_MAX)
+		return dir_lists_containing(lexed, cfg);
+
+	/* Most of the time, it's the same directory as last time: */
+
+	if (entry->generation != cfg->generation || entry->length != length ||
+			memcmp(entry->dir, lexed->path, length))
+	{
+		for (i = 0, entry = NULL; i < DIR_DECISIONS_SIZE; i++)
+			if (dir_decisions[i].generation == cfg->generation && dir_decisions[i].length == length &&
+					!memcmp(dir_decisions[i].dir, lexed->path, length))
+			{
+				entry = &dir_decisions[i];
+				break;
+			}
+
+		if (!entry)
+		{
+			i = dir_decisions_next;
+			dir_decisions_next = (dir_decisions_next + 1) % DIR_DECISIONS_SIZE;
+
+			entry = &dir_decisions[i];
+			entry->lists = dir_lists_containing(lexed, cfg);
+			entry->length = length;
+			memcpy(entry->dir, lexed->path, length);
+			entry->generation = cfg->generation;
+		}
+
+		dir_decisions_last = i;
+	}
+
+	return entry->lists;
+}
+
 /* --------------------------------------------- */
 
 /* This function tests the existence and permissions of the dir's pathname; if it exists and has
@@ -259,20 +860,151 @@ int dir_ok(const char *pathname, int *name_collision)
 
 		error = chmod(pathname, S_IWUSR | S_IRUSR | S_IXUSR);
 
-		if (error)
-		{
-			/*
-			 * If the pointer name_collision isn't NULL, this means we should sign that we are returning
-			 * 0 because of a name collision: */
+		if (error)
+		{
+			/*
+			 * If the pointer name_collision isn't NULL, this means we should sign that we are returning
+			 * 0 because of a name collision: */
+
+			if(name_collision)
+				*name_collision = 1;
+			return 0;
+		}
+		else
+			return 1;
+	}
+
+}
+
+/* -------------------------------------------------------------- */
+
+/* trash_dirs_ok() checks absolute_trash_can and, if global_protection is set, absolute_trash_system_root
+ * with dir_ok() (which creates them or fixes their permissions if necessary). If record is YES (we are
+ * building the snapshot cfg), it remembers their device and inode numbers; otherwise it insists that
+ * they haven't changed, because a trash can which was removed and recreated behind our back means that
+ * the snapshot should be rebuilt. Returns 1 if they are fine (and notes the time at which we found
+ * that out), 0 otherwise. */
+
+int trash_dirs_ok(config *cfg, int record)
+{
+	if (!trash_dir_ok(cfg->absolute_trash_can, &cfg->trash_can_dev, &cfg->trash_can_ino, record))
+		return 0;
+
+	if (cfg->global_protection &&
+			!trash_dir_ok(cfg->absolute_trash_system_root, &cfg->trash_system_root_dev, &cfg->trash_system_root_ino, record))
+		return 0;
+
+	__atomic_store_n(&cfg->trash_dirs_checked, coarse_seconds(), __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+/* Returns 1 if it is time to run trash_dirs_ok() on the snapshot cfg again, 0 otherwise: */
+
+int trash_dirs_need_check(config *cfg)
+{
+	long checked = __atomic_load_n(&cfg->trash_dirs_checked, __ATOMIC_RELAXED);
+
+	return checked == 0 || coarse_seconds() - checked >= cfg->trash_check_interval;
+}
+
+/* trash_dirs_ok() for a single dir: */
+
+static int trash_dir_ok(const char *pathname, dev_t *dev, ino_t *ino, int record)
+{
+	struct stat dir_stat;
+
+	if (!dir_ok(pathname, NULL) || stat(pathname, &dir_stat))
+		return 0;
+
+	if (record)
+	{
+		*dev = dir_stat.st_dev;
+		*ino = dir_stat.st_ino;
+		return 1;
+	}
+
+	return dir_stat.st_dev == *dev && dir_stat.st_ino == *ino;
+}
+
+/* Returns 1 if pathname is still the directory with the given identity we found when we last checked it,
+ * and we still have write- and search-permission to it; 0 otherwise. Unlike dir_ok(), it never changes
+ * anything: */
+
+static int trash_dir_unchanged(const char *pathname, dev_t dev, ino_t ino)
+{
+	struct stat dir_stat;
+
+	return !stat(pathname, &dir_stat) && S_ISDIR(dir_stat.st_mode) &&
+		dir_stat.st_dev == dev && dir_stat.st_ino == ino &&
+		!access(pathname, W_OK | X_OK);
+}
+
+/* We only need to know roughly how long ago we last checked the trash dirs (or the configuration
+ * files), so we use the coarse monotonic clock, which doesn't even need a system call. It ticks
+ * once every few milliseconds: */
+
+long long coarse_nanoseconds(void)
+{
+	struct timespec now;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &now))
+#endif
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long) now.tv_sec * 1000000000LL + now.tv_nsec + 1; /* never 0, which means "not checked yet" */
+}
+
+static long coarse_seconds(void)
+{
+	return (long) (coarse_nanoseconds() / 1000000000LL) + 1;
+}
+
+/* -------------------------------------------------------------- */
+
+/* get_file_identity() fills in identity with what stat() tells us about the file at path (if there
+ * is no such file, identity->exists is NO and the rest is zeroed), and same_file_identity() tells
+ * whether two identities describe the same, unmodified file: */
+
+void get_file_identity(const char *path, file_identity *identity)
+{
+	struct stat file_stat;
+
+	memset(identity, 0, sizeof(file_identity));
+
+	if (stat(path, &file_stat))
+		return;
+
+	identity->exists = YES;
+	identity->dev = file_stat.st_dev;
+	identity->ino = file_stat.st_ino;
+	identity->size = file_stat.st_size;
+	identity->uid = file_stat.st_uid;
+	identity->mode = file_stat.st_mode;
+	identity->mtime = file_stat.st_mtim;
+	identity->ctime = file_stat.st_ctim;
+}
+
+int same_file_identity(const file_identity *a, const file_identity *b)
+{
+	if (!a->exists || !b->exists)
+		return a->exists == b->exists;
+
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+		a->uid == b->uid && a->mode == b->mode &&
+		a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec &&
+		a->ctime.tv_sec == b->ctime.tv_sec && a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
 
-			if(name_collision)
-				*name_collision = 1;
-			return 0;
-		}
-		else
-			return 1;
-	}
+/* The system-wide configuration file is only read if it is a regular file which belongs to root
+ * and which nobody else can write to; otherwise any user who managed to change it could decide
+ * what happens to everybody else's files: */
 
+int system_conf_trusted(const file_identity *identity)
+{
+	return identity->exists && S_ISREG(identity->mode) && identity->uid == 0 &&
+		!(identity->mode & (S_IWGRP | S_IWOTH));
 }
 
 /* -------------------------------------------------------------- */
@@ -508,6 +1240,57 @@ int graft_file(const char *new_top_dir, const char *old_path, const char *what_t
 			* is unlink(), since it needs to set errno itself. */
 }
 
+/* ------------------------------------------------------------------------ */
+
+/* save_in_trash() is what the wrappers use to store the file absolute_path in the trash can: under
+ * absolute_trash_can if it lies under the user's home dir, or under absolute_trash_system_root
+ * otherwise. It returns what graft_file() returned.
+ *
+ * Since we don't check the trash dirs on every call any more (see config_still_valid() in main.c),
+ * they may have been removed (or had their permissions changed) since we last looked at them. So
+ * if graft_file() fails and the trash dir we were using is no longer what we found when we built
+ * the snapshot, we mark the snapshot to be checked again by the next wrapper, try to set things
+ * right with dir_ok() and give graft_file() a second chance. If the trash dir is fine, the failure
+ * was due to something else and we leave errno as graft_file() set it. */
+
+int save_in_trash(const char *absolute_path, config *cfg)
+{
+	int under_home = found_under_dir(absolute_path, cfg->home);
+	const char *top_dir = under_home ? cfg->absolute_trash_can : cfg->absolute_trash_system_root;
+	const char *what_to_cut = under_home ? cfg->home : NULL;
+	int retval = 0;
+	int saved_errno = 0;
+
+	retval = graft_file(top_dir, absolute_path, what_to_cut, cfg);
+
+	if (!retval)
+		return retval;
+
+	saved_errno = errno;
+
+	if (trash_dir_unchanged(cfg->absolute_trash_can, cfg->trash_can_dev, cfg->trash_can_ino) &&
+			(under_home ||
+			 trash_dir_unchanged(top_dir, cfg->trash_system_root_dev, cfg->trash_system_root_ino)))
+	{
+		errno = saved_errno;
+		return retval;
+	}
+
+#ifdef DEBUG
+	fprintf(stderr, "graft_file() failed and %s has changed since we last checked it, trying again.\n", top_dir);
+#endif
+
+	__atomic_store_n(&cfg->trash_dirs_checked, 0, __ATOMIC_RELAXED);
+
+	if (!dir_ok(cfg->absolute_trash_can, NULL) || (!under_home && !dir_ok(top_dir, NULL)))
+	{
+		errno = saved_errno;
+		return retval;
+	}
+
+	return graft_file(top_dir, absolute_path, what_to_cut, cfg);
+}
+
 /* ------------------------------------------------------------------------------- */
 
 /* reformulate_new_path()
@@ -740,24 +1523,6 @@ int reformulate_new_path(char **new_path, char **first_null)
 
 /* --------------------------------------------------------------------------- */
 
-/* hidden_file().
- *
- * This function returns 1 if the specified file is either a hidden file (i.e., its name
- * begins with a dot) or resides under a hidden directory (i.e., under a directory whose
- * name begins with a dot). It returns 0 otherwise.
- *
- * Because absolute_path has already been "canonicalized", there's no need to worry about symlinks such as ".." and ".".
- *
- */
-
-int hidden_file(const char *absolute_path)
-{
-	if (strstr(absolute_path, "/."))
-		return 1;
-	else
-		return 0;
-}
-
 /* ---------------------------------------------------------------------------- */
 
 /* What this function does: being passed a (either relative or absolute)
@@ -850,6 +1615,12 @@ char* build_absolute_path(const char *path, int should_follow_final_symlink)
 	if (dirname)
 	{
 		abs_dirname = canonicalize_file_name(dirname);
+
+		/* Let decide_action_from_path() know that this dir contains no symlinks: */
+
+		if (abs_dirname && !strcmp(abs_dirname, dirname))
+			remember_canonical_dir(abs_dirname);
+
 		free(dirname); /* get_current_dir_name() malloc()s the memory it returns a pointer to, just us we do */
 
 		if (abs_dirname)
@@ -884,39 +1655,133 @@ char* build_absolute_path(const char *path, int should_follow_final_symlink)
 }
 
 /* ----------------------------------------------------------------------- */
-/* What this function does: if pathname ends in one of the extensions listed in ignore_extensions,
- * it returns 1; otherwise, it returns 0. We don't use strtok() because that would require a copy
- * of the ignore_extensions buffer and creating one would expose us to nasty exception handling
- * problems:
- */
 
-int ends_in_ignored_extension(const char *filename, config *cfg)
+/* Rather than going through ignore_extensions for every file, build_config() has
+ * build_extension_set() compile it into a hash set: a power-of-two table with open addressing,
+ * at most half full, in the arena of the snapshot. Each slot holds an extension (pointing into
+ * ignore_extensions itself), its length and its hash, so that a lookup hashes the extension of
+ * the file once and nearly always compares it to a single slot. A slot whose name is NULL is
+ * empty. If ignore_extensions is still the list baked in at build time, the generated matcher is
+ * used instead, and there is no set. Just like the directory trie, the set comes ready-made with
+ * a compiled policy image. */
+
+/* FNV-1a, over the first length characters of name: */
+
+static unsigned extension_hash(const char *name, size_t length)
 {
-	const char *beg_extension = NULL, *end_extension = NULL;
-	const char *semi_colon = NULL, *last_slash = NULL, *last_dot = NULL;
-	const char *filename_ext = NULL;
+	unsigned hash = 2166136261U;
+	size_t i = 0;
 
-	/* Point beg_extension to the beginning of the first extension listed in ignore_extensions: */
+	for (i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char) name[i]) * 16777619U;
 
-	beg_extension = cfg->ignore_extensions;
+	return hash;
+}
+
+void build_extension_set(config *cfg)
+{
+	struct extension_slot *set = NULL;
+	const char *extension = NULL, *end = NULL;
+	char *memory = NULL;
+	unsigned entries = 0, size = 2, i = 0;
+	unsigned hash = 0;
+
+	cfg->extension_set = NULL;
+	cfg->extension_set_mask = 0;
+
+	if (cfg->baked_lists & BAKED_LIST_IGNORE_EXTENSIONS)
+		return;
+
+	for (extension = cfg->ignore_extensions; *extension != '\0'; extension = *end ? end + 1 : end)
+	{
+		end = strchrnul(extension, ';');
+		entries++;
+	}
+
+	while (size < 2 * entries)
+		size *= 2;
+
+	/* (The arena makes no promise about alignment, so we align the table ourselves.) */
+
+	memory = arena_alloc(cfg, size * sizeof(struct extension_slot) + sizeof(void *) - 1);
+
+	if (!memory)
+		return;
+
+	set = (struct extension_slot *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+
+	for (i = 0; i < size; i++)
+		set[i].name = NULL;
+
+	/* An empty extension, or one with a dot in it, can never match the extension of a file (which
+	 * starts after the last dot), so those are left out: */
+
+	for (extension = cfg->ignore_extensions; *extension != '\0'; extension = *end ? end + 1 : end)
+	{
+		end = strchrnul(extension, ';');
+
+		if (end == extension || memchr(extension, '.', end - extension))
+			continue;
+
+		hash = extension_hash(extension, end - extension);
+
+		for (i = hash & (size - 1); set[i].name; i = (i + 1) & (size - 1))
+			if (set[i].hash == hash && set[i].length == (unsigned) (end - extension) &&
+					!memcmp(set[i].name, extension, end - extension))
+				break;
 
-	/* Point filename_ext to the beginning of the extension of filename, if any (in this case return 0): */
+		set[i].name = extension;
+		set[i].length = end - extension;
+		set[i].hash = hash;
+	}
+
+	cfg->extension_set = set;
+	cfg->extension_set_mask = size - 1;
+}
+
+/* Is extension (length characters) in the set of cfg? */
+
+static int extension_set_contains(const config *cfg, const char *extension, size_t length)
+{
+	unsigned hash = extension_hash(extension, length);
+	unsigned i = 0;
+
+	for (i = hash & cfg->extension_set_mask; cfg->extension_set[i].name; i = (i + 1) & cfg->extension_set_mask)
+		if (cfg->extension_set[i].hash == hash && cfg->extension_set[i].length == length &&
+				!memcmp(cfg->extension_set[i].name, extension, length))
+			return 1;
 
-	last_dot = strrchr(filename, '.');
+	return 0;
+}
+
+/* ----------------------------------------------------------------------- */
+/* What this function does: if extension (length characters, as found by lex_path(); NULL if the
+ * file has none) is one of the extensions listed in ignore_extensions, it returns 1; otherwise, it
+ * returns 0. We don't use strtok() because that would require a copy of the ignore_extensions
+ * buffer and creating one would expose us to nasty exception handling problems:
+ */
 
-	last_slash = strrchr(filename, '/');
+int ends_in_ignored_extension(const char *extension, size_t length, config *cfg)
+{
+	const char *beg_extension = NULL, *end_extension = NULL;
+	const char *semi_colon = NULL;
 
-	/* If the filename contains a dot and a slash and the last slash in it
-	 * comes _after_ the last dot then that dot doesn't mark the beginning
-	 * of an extension and we return 0, because this filename has no
-	 * extension at all: */
+#ifdef BAKED_POLICY
+	if (cfg->baked_lists & BAKED_LIST_IGNORE_EXTENSIONS)
+		return baked_ends_in_ignored_extension(extension, length);
+#endif
 
-	if (!last_dot ||
-			(last_slash && last_dot < last_slash) ||
-			*(last_dot + 1) == '\0')
+	if (!extension)
 		return 0;
 
-	filename_ext = last_dot + 1; /* this pointer points to the extension in the filename we are testing */
+	if (cfg->extension_set)
+		return extension_set_contains(cfg, extension, length);
+
+	/* Point beg_extension to the beginning of the first extension listed in ignore_extensions: */
+
+	beg_extension = cfg->ignore_extensions;
+
+	/* (No hash set: we ran out of memory building it.) */
 
 	while (*beg_extension != '\0')
 	{
@@ -927,11 +1792,11 @@ int ends_in_ignored_extension(const char *filename, config *cfg)
 		else /* if there aren't any more semi-colons, point end_extension to the '\0' at the end of cfg->ignore_extensions: */
 			end_extension = cfg->ignore_extensions + strlen(cfg->ignore_extensions);
 
-		/* If the (recognized) extension beg_extension now points to is the same as the one at the end of filename,
+		/* If the (recognized) extension beg_extension now points to is the same as the one of the file,
 		 * return 1: */
 
-		if (!strncmp(beg_extension, filename_ext, end_extension - beg_extension) &&
-				filename_ext[end_extension - beg_extension] == '\0')
+		if ((size_t) (end_extension - beg_extension) == length &&
+				!memcmp(beg_extension, extension, length))
 			return 1;
 
 		if (semi_colon)
@@ -940,454 +1805,836 @@ int ends_in_ignored_extension(const char *filename, config *cfg)
 			beg_extension = end_extension;
 	}
 
-	/* If we get to this point, return signalling that filename doesn't end in any of the extensions listed in
+	/* If we get to this point, return signalling that the file doesn't end in any of the extensions listed in
 	 * ignore_extensions: */
 
 	return 0;
 
 }
 
-/* -------------------------------------------------------------------- */
+/* ----------------------------------------------------------------------- */
 
-/* What this function does: passed an integer (number_of_keys) and
- * number_of_keys pointers to char, it either opens a file called filepath in the user's
- * home dir (if filepath is a relative path) or a system-wide configuration
- * file (if filepath is an absolute_path) and tries to extract the values
- * matching those keys from lines which have the form of (key) = (value)
+/* IGNORE_GLOB is a list of shell-style patterns, separated by ';'s, which are matched against the
+ * absolute path of a file one path component (segment) at a time: '*', '?' and bracket
+ * expressions ("[a-z]", "[!0-9]") never match a '/', and a segment which is just "**" matches any
+ * number of whole segments, none included. A pattern which starts with a '/' has to match from
+ * the root; any other one may start at any segment. A pattern which matches a directory covers
+ * everything under it too, so that "node_modules" ignores every file in every node_modules
+ * directory, and "/srv/scratch" every file under /srv/scratch.
  *
- * If it succeeds, it returns a pointer to an array of pointers to the read
- * values, which are stored in the same order as the one used in the
- * argument list (i.e., the value matching key1 is the first in the
- * returned array, the value matching key2 is the second, etc...). For each
- * key for which we couldn't read a value, a NULL pointer is stored in the
- * corresponding array slot (i.e., if no value was found for key3,
- * values_array[2] will be NULL). In case a serious error happened (not
- * being able to read a value for one of the keys provided DOESN'T qualify:
- * handling such situations is something better left to the caller), a NULL
- * pointer is returned. */
+ * build_config() has compile_ignore_glob() split every pattern into its segments once, in the
+ * arena of the snapshot: a segment without wildcards is compared with memcmp(), a "**" one is
+ * tried at every segment which follows, and only the rest go through glob_segment_matches().
+ * Before any of that, each pattern is rejected at once if the path doesn't contain its needle,
+ * the longest run of literal characters which every path it matches has to contain ("/.cache/"
+ * for ".cache/x", ".tmp." for "*.tmp.*"), which a single strstr() tells. Most paths match none
+ * of the patterns, and for most of them that is all it takes.
+ *
+ * If we run out of memory compiling the patterns, IGNORE_GLOB is left out altogether: files are
+ * then preserved rather than deleted, which is the safe side to err on. */
+
+#define GLOB_LITERAL   0  /* no wildcards: compared with memcmp() */
+#define GLOB_WILDCARD  1  /* matched by glob_segment_matches() */
+#define GLOB_ANY_DIRS  2  /* "**": any number of segments */
 
-static char** read_config_from_file(char *filepath, int number_of_keys, config *cfg, ...)
+struct glob_segment
 {
+	const char *text;	/* not null-terminated; unescaped if kind is GLOB_LITERAL */
+	unsigned length;
+	int kind;		/* GLOB_xxx */
+};
 
-	FILE *conf_file = NULL;
+struct glob_pattern
+{
+	const struct glob_segment *segments;
+	unsigned segment_count;
+	int anchored;		/* starts with a '/' */
+	const char *needle;	/* a literal every path it matches contains, or NULL */
+	const char *source;	/* the pattern as listed (not null-terminated) */
+	unsigned source_length;
+};
+
+/* Points end at the ';' or '\0' which ends the pattern at pattern, and returns the number of
+ * segments it has (a run of "**" segments counts once): */
+
+static unsigned count_glob_segments(const char *pattern, const char **end)
+{
+	const char *c = pattern, *segment = NULL;
+	unsigned count = 0;
+	int any_dirs = NO;
 
-	struct passwd *userinfo = NULL;
+	*end = strchrnul(pattern, ';');
 
-	char *conf_file_path = NULL;
+	while (c < *end)
+	{
+		while (c < *end && *c == '/')
+			c++;
 
-	char *line = NULL;
+		if (c == *end)
+			break;
 
-	va_list arg_list;
+		segment = c;
 
-	int i = 0;
+		while (c < *end && *c != '/')
+			c++;
 
-	int error = 0;
+		if (c - segment == 2 && segment[0] == '*' && segment[1] == '*')
+		{
+			if (any_dirs)
+				continue;
 
-	/* Each of these arrays will store number_of_keys pointers to the keys and the read values, respectively: */
+			any_dirs = YES;
+		}
+		else
+			any_dirs = NO;
+
+		count++;
+	}
 
-	const char **keys_array = NULL;
+	return count;
+}
 
-	char **values_array = NULL;
+static const char* glob_bracket(const char *bracket, const char *end, unsigned char c, int *matched);
 
-	/* Make sure that we are able to use the real fopen(): */
+/* Writes the needle of pattern (see above) to needle, which must have room for twice the length
+ * of the pattern plus four characters, and returns its length (0 if it has none worth looking
+ * for): the longest of its literal segments, with the slash which always precedes a segment in an
+ * absolute path (and the one which follows it if another segment must follow: a "**" may match
+ * no segment at all), or of the runs of ordinary characters in its other segments. */
 
-	if (!cfg->real_fopen)
+static unsigned find_glob_needle(const struct glob_pattern *pattern, char *needle)
+{
+	const struct glob_segment *segment = NULL;
+	const char *g = NULL, *end = NULL, *next = NULL;
+	char *run = NULL;
+	unsigned i = 0, best = 0, length = 0;
+	int slash_after = NO, ordinary = NO, matched = NO;
+
+	for (i = 0; i < pattern->segment_count; i++)
 	{
+		segment = &pattern->segments[i];
 
-#ifdef DEBUG
-		fprintf(stderr, "real_fopen is not available, bailing out! (read_config_from_file()).\n");
-#endif
+		if (segment->kind == GLOB_LITERAL)
+		{
+			slash_after = (i + 1 < pattern->segment_count && pattern->segments[i + 1].kind != GLOB_ANY_DIRS);
 
-		return NULL;
+			if (segment->length + 1 + slash_after > best)
+			{
+				needle[0] = '/';
+				memcpy(needle + 1, segment->text, segment->length);
+				best = segment->length + 1;
+
+				if (slash_after)
+					needle[best++] = '/';
+			}
+		}
+		else if (segment->kind == GLOB_WILDCARD)
+		{
+			/* Each run is gathered right after the best needle so far, and moved to the
+			 * front if it beats it: */
+
+			run = needle + best + 1;
+			length = 0;
+
+			for (g = segment->text, end = g + segment->length; ; g = next)
+			{
+				ordinary = (g < end);
+
+				if (g == end)
+					next = g;
+				else if (*g == '*' || *g == '?')
+					ordinary = NO, next = g + 1;
+				else if (*g == '[' && (next = glob_bracket(g, end, 0, &matched)))
+					ordinary = NO;
+				else if (*g == '\\' && g + 1 < end)
+					run[length++] = g[1], next = g + 2;
+				else
+					run[length++] = *g, next = g + 1;
+
+				if (!ordinary)
+				{
+					if (length > best && length > 1)
+					{
+						memmove(needle, run, length);
+						best = length;
+						run = needle + best + 1;
+					}
+
+					length = 0;
+				}
+
+				if (g == end)
+					break;
+			}
+		}
 	}
 
-	/* Allocate memory for the keys_array (which we will use to store the keys passed as an argument) and
-	   the values_array (to which we will return a pointer if we succeed): */
+	needle[best] = '\0';
+
+	return best;
+}
+
+void compile_ignore_glob(config *cfg)
+{
+	struct glob_pattern *patterns = NULL;
+	struct glob_segment *segments = NULL;
+	const char *pattern = NULL, *end = NULL, *c = NULL, *start = NULL;
+	char *memory = NULL, *text = NULL;
+	unsigned pattern_count = 0, segment_count = 0, count = 0, i = 0, s = 0, length = 0;
+	size_t size = 0;
+	int kind = GLOB_LITERAL;
+
+	cfg->glob_patterns = NULL;
+	cfg->glob_pattern_count = 0;
+
+	for (pattern = cfg->ignore_glob; *pattern != '\0'; pattern = *end ? end + 1 : end)
+		if ((count = count_glob_segments(pattern, &end)) > 0)
+		{
+			pattern_count++;
+			segment_count += count;
+		}
+
+	if (pattern_count == 0)
+		return;
+
+	/* The patterns, their segments, the unescaped literal segments and the needles (see
+	 * find_glob_needle() for the room each one needs) all go into a single block. (The arena
+	 * makes no promise about alignment, so we align it ourselves.) */
 
-	keys_array   = malloc(number_of_keys * sizeof(char*)); /* this is an "internal" array */
+	size = pattern_count * sizeof(struct glob_pattern) + segment_count * sizeof(struct glob_segment);
 
-	if (!keys_array)
+	memory = arena_alloc(cfg, size + sizeof(void *) - 1 + 3 * strlen(cfg->ignore_glob) + 4 * pattern_count);
+
+	if (!memory)
 	{
 #ifdef DEBUG
-		fprintf(stderr, "Insufficient memory (read_config_from_file()).\n");
+		fprintf(stderr, "Unable to compile IGNORE_GLOB, leaving it out.\n");
 #endif
-
-		return NULL;
+		return;
 	}
 
-	values_array = malloc(number_of_keys * sizeof(char*)); /* this is the array we will return in case of success */
+	patterns = (struct glob_pattern *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+	segments = (struct glob_segment *) (patterns + pattern_count);
+	text = (char *) (segments + segment_count);
 
-	if (!values_array)
+	for (pattern = cfg->ignore_glob; *pattern != '\0'; pattern = *end ? end + 1 : end)
 	{
-#ifdef DEBUG
-		fprintf(stderr, "Insufficient memory (read_config_from_file()).\n");
-#endif
+		if (count_glob_segments(pattern, &end) == 0)
+			continue;
 
-		/* Free already allocated memory: */
+		patterns[i].segments = segments + s;
+		patterns[i].anchored = (*pattern == '/');
+		patterns[i].needle = NULL;
+		patterns[i].source = pattern;
+		patterns[i].source_length = end - pattern;
 
-		free(keys_array);
+		for (c = pattern; c < end; )
+		{
+			while (c < end && *c == '/')
+				c++;
 
-		return NULL;
-	}
+			if (c == end)
+				break;
+
+			for (start = c, kind = GLOB_LITERAL; c < end && *c != '/'; c++)
+				if (*c == '*' || *c == '?' || *c == '[')
+					kind = GLOB_WILDCARD;
+				else if (*c == '\\' && c + 1 < end && c[1] != '/')
+					c++;
+
+			if (c - start == 2 && start[0] == '*' && start[1] == '*')
+			{
+				if (segments + s > patterns[i].segments && segments[s - 1].kind == GLOB_ANY_DIRS)
+					continue;
 
-	/* If both allocations succeeded, "zero" the values_array, so that if we can't find a value for
-	 * one of the keys in the keys_array we don't need to do anything at all
-	 * because that slot will already be set to NULL (which the caller
-	 * interprets as meaning that no value could be found/read for that
-	 * key): */
+				kind = GLOB_ANY_DIRS;
+			}
 
-	for (i = 0; i < number_of_keys; i++)
-		values_array[i] = NULL;
+			segments[s].kind = kind;
+			segments[s].text = start;
+			segments[s].length = c - start;
 
-	/* Read the arguments we were passed and store them in the keys_array:  */
+			/* Literal segments lose their backslashes: */
 
-	va_start(arg_list, cfg);
+			if (kind == GLOB_LITERAL)
+			{
+				segments[s].text = text;
 
-	for (i = 0; i < number_of_keys; i++)
-		keys_array[i] = va_arg(arg_list, char*);
+				for (length = 0; start < c; start++)
+				{
+					if (*start == '\\' && start + 1 < c)
+						start++;
 
-	va_end(arg_list);
+					text[length++] = *start;
+				}
 
-	/* From this point we must act according to the string in filepath: should we read
-	 * a system-wide configuration file or a personal one? If filepath holds an absolute_path,
-	 * we read a system-wide configuration file and we don't need to create an absolute path to
-	 * that file; if filepath holds a relative path, we must build an absolute path to that
-	 * file in the user's home dir: */
+				segments[s].length = length;
+				text += length;
+			}
 
-	if (filepath[0] == '/') /* holds an absolute path, nothing for us to do (at least for now... :)) */
-		conf_file_path = filepath;
-	else /* filepath holds a path relative to the user's home dir: */
-	{
-		userinfo = getpwuid(geteuid());
+			s++;
+		}
 
-		/* If it failed, we just return  NULL: */
+		patterns[i].segment_count = (segments + s) - patterns[i].segments;
 
-		if (!userinfo)
+		if ((length = find_glob_needle(&patterns[i], text)) > 0)
 		{
-#ifdef DEBUG
-			fprintf(stderr, "Unable to determine information about the user.\n");
-#endif
+			patterns[i].needle = text;
+			text += length + 1;
+		}
 
-			/* Free memory: */
+		i++;
+	}
 
-			free(keys_array);
-			free(values_array);
+	cfg->glob_patterns = patterns;
+	cfg->glob_pattern_count = pattern_count;
+}
 
-			return NULL;
-		}
+/* bracket points at the '[' of a bracket expression in a glob which ends at end; sets *matched
+ * to whether c matches it, and returns a pointer to the character which follows it (or NULL if it
+ * isn't closed, in which case the '[' is an ordinary character): */
 
-		/* We will now compose the absolute path to the user's configuration file... : */
+static const char* glob_bracket(const char *bracket, const char *end, unsigned char c, int *matched)
+{
+	const char *g = bracket + 1, *first = NULL;
+	unsigned char low = 0, high = 0;
+	int negated = NO, found = NO;
 
-		conf_file_path = malloc(strlen(userinfo->pw_dir) + 1 + strlen(filepath) + 1);
+	if (g < end && (*g == '!' || *g == '^'))
+	{
+		negated = YES;
+		g++;
+	}
 
-		if (!conf_file_path)
-		{
-#ifdef DEBUG
-			fprintf(stderr, "Memory allocation error inside read_config_from_file().\n");
-#endif
-			/* Free memory: */
+	/* A ']' right after the '[' (or the '!') stands for itself: */
 
-			free(keys_array);
-			free(values_array);
+	for (first = g; g < end && (*g != ']' || g == first); )
+	{
+		low = *g++;
 
-			return NULL;
-		}
+		if (low == '\\' && g < end)
+			low = *g++;
 
-		strcpy(conf_file_path, userinfo->pw_dir);
+		high = low;
 
-		strcat(conf_file_path, "/");
+		if (g + 1 < end && *g == '-' && g[1] != ']')
+		{
+			high = g[1];
+			g += 2;
+
+			if (high == '\\' && g < end)
+				high = *g++;
+		}
 
-		strcat(conf_file_path, filepath);
+		if (low <= c && c <= high)
+			found = YES;
 	}
 
-	/* ... and use it in a call to the real fopen(): */
+	if (g >= end)
+		return NULL;
 
-	conf_file = (*cfg->real_fopen) (conf_file_path, "r");
+	*matched = (found != negated);
 
-	/* Did fopen() succeed? */
+	return g + 1;
+}
 
-	if (!conf_file)
-	{
-#ifdef DEBUG
-		fprintf(stderr, "Unable to open config file at %s.\n", conf_file_path);
-#endif
+/* Does the segment of a path between s and s_end match the glob between g and g_end? A '*'
+ * which doesn't lead to a match is retried one character further on; since a segment holds no
+ * '/', only the last '*' ever needs retrying. */
 
-		if (conf_file_path != filepath)
-			free(conf_file_path); /* If conf_file_path isn't pointing to the first argument, then free memory: */
+static int glob_segment_matches(const char *g, const char *g_end, const char *s, const char *s_end)
+{
+	const char *star_g = NULL, *star_s = NULL, *next = NULL;
+	int matched = NO;
 
-		/* Free memory: */
+	while (s < s_end)
+	{
+		matched = NO;
 
-		free(keys_array);
-		free(values_array);
+		if (g < g_end)
+		{
+			if (*g == '*')
+			{
+				star_g = ++g;
+				star_s = s;
+				continue;
+			}
 
-		return NULL;
+			if (*g == '?')
+				next = g + 1, matched = YES;
+			else if (*g == '[' && (next = glob_bracket(g, g_end, *s, &matched)))
+				;
+			else if (*g == '\\' && g + 1 < g_end)
+				next = g + 2, matched = (g[1] == *s);
+			else
+				next = g + 1, matched = (*g == *s);
+		}
+
+		if (matched)
+		{
+			g = next;
+			s++;
+		}
+		else if (star_g)
+		{
+			g = star_g;
+			s = ++star_s;
+		}
+		else
+			return NO;
 	}
 
-	if (conf_file_path != filepath) /* If conf_file_path isn't pointing to the first argument, then free memory: */
-		free(conf_file_path);
+	while (g < g_end && *g == '*')
+		g++;
 
-	/* Read each line of the file; compare the portion before the '=' to each of the items in the keys_array;
-	 * if there's a match with the nth key, store the corresponding value in the nth position of the values_array.
-	 */
+	return g == g_end;
+}
 
-	while ( (line = readline(conf_file, &error)) )
-	{
-		char *beg_key = NULL , *end_key = NULL, *beg_value = NULL, *end_value = NULL,
-		     *ptr = NULL;
+/* Do the segments of pattern from the index-th on match the path from s on? s points to the
+ * beginning of a segment, or to the '\0' at the end of the path. */
 
-		char *equal_sign = NULL;
+static int glob_matches_from(const struct glob_pattern *pattern, unsigned index, const char *s)
+{
+	const struct glob_segment *segment = NULL;
+	const char *end = NULL;
+
+	for (; index < pattern->segment_count; index++)
+	{
+		segment = &pattern->segments[index];
 
-		/* Now we extract the key from this line and compare it to the ones listed in keys_array: */
+		if (segment->kind == GLOB_ANY_DIRS)
+		{
+			/* If the rest of the pattern matches the rest of the path, starting at any of its
+			 * segments (or at its end), we are done: */
 
-		/* We begin by marking the beginning and the end of the key and the value in the string line
-		 * with the above declared pointers: */
+			for (;;)
+			{
+				if (glob_matches_from(pattern, index + 1, s))
+					return YES;
 
-		equal_sign = strchr(line, '=');
+				if (*s == '\0')
+					return NO;
 
-		ptr = line;
+				s = strchrnul(s, '/');
+				s += (*s == '/');
+			}
+		}
 
-		while (isspace(*ptr)) /* skip any leading white space */
-			ptr++;
+		if (*s == '\0')
+			return NO;
 
-		/* Does this line
-		 * (a) start with a '#' or
-		 * (b) lack an equal sign (also detects empty lines) or
-		 * (c) start with white space followed by an equal sign (i.e., no key available)? */
+		end = strchrnul(s, '/');
 
-		if (line[0] == '#' || !equal_sign || ptr == equal_sign)
+		if (segment->kind == GLOB_LITERAL)
 		{
-			/* Free memory (each time it is called, readline allocates a new buffer and returns it): */
+			if ((unsigned) (end - s) != segment->length || memcmp(s, segment->text, segment->length))
+				return NO;
+		}
+		else if (!glob_segment_matches(segment->text, segment->text + segment->length, s, end))
+			return NO;
+
+		s = end + (*end == '/');
+	}
+
+	/* Every segment matched: the path either ends here or lies under the directory which
+	 * matched. */
+
+	return YES;
+}
+
+/* Does absolute_path match any of the patterns in IGNORE_GLOB? */
+
+int matches_ignored_glob(const lexed_path *lexed, config *cfg)
+{
+	const struct glob_pattern *pattern = NULL;
+	const char *absolute_path = lexed->path, *s = NULL;
+	unsigned i = 0, k = 0;
 
-			free(line);
+	for (i = 0; i < cfg->glob_pattern_count; i++)
+	{
+		pattern = &cfg->glob_patterns[i];
+
+		if (pattern->needle && !strstr(absolute_path, pattern->needle))
+			continue;
+
+		s = absolute_path + (*absolute_path == '/');
+
+		if (pattern->anchored)
+		{
+			if (glob_matches_from(pattern, 0, s))
+				break;
 
 			continue;
 		}
 
-		/* -> Line seems OK */
+		/* Any segment may be the first one to match (lex_path() has found where they start): */
+
+		for (k = (*absolute_path == '/'); ; k++)
+		{
+			if (glob_matches_from(pattern, 0, s))
+				break;
+
+			if (k + 1 >= lexed->component_count)
+			{
+				s = NULL;
+				break;
+			}
+
+			s = (k < LEXED_PATH_COMPONENTS) ? absolute_path + lexed->component_end[k] + 1 : strchr(s, '/') + 1;
+		}
 
-		/* Key: */
+		if (s)
+			break;
+	}
 
-		beg_key = ptr; /* key begins here */
+	if (i == cfg->glob_pattern_count)
+		return 0;
 
-		ptr = strchr(beg_key, ' ');
+#ifdef DEBUG
+	fprintf(stderr, "file %s matches %.*s (IGNORE_GLOB)\n", absolute_path,
+			(int) cfg->glob_patterns[i].source_length, cfg->glob_patterns[i].source);
+#endif
 
-		if (ptr && ptr < equal_sign) /* if we found white space before the equal sign, */
-			end_key = ptr - 1; /* the key ends here */
-		else  /* if we didn't find white space or only found it after the equal sign */
-			end_key = equal_sign - 1; /* the key ends here */
+	return 1;
+}
 
-		/* Value: */
+/* -------------------------------------------------------------------- */
 
-		ptr = equal_sign + 1; /* skip equal sign */
+/* These are the keys which may appear in the configuration file. The position of each key in
+ * this enum is the position of its value in the array filled in by read_config_from_file(): */
 
-		while (isspace(*ptr)) /* skip white space */
-			ptr++;
+enum config_key
+{
+	KEY_TRASH_CAN,
+	KEY_IN_CASE_OF_FAILURE,
+	KEY_SHOULD_WARN,
+	KEY_IGNORE_HIDDEN,
+	KEY_IGNORE_EDITOR_BACKUP,
+	KEY_PROTECT_TRASH,
+	KEY_GLOBAL_PROTECTION,
+	KEY_TRASH_SYSTEM_ROOT,
+	KEY_TEMPORARY_DIRS,
+	KEY_USER_TEMPORARY_DIRS,
+	KEY_UNREMOVABLE_DIRS,
+	KEY_IGNORE_EXTENSIONS,
+	KEY_INTERCEPT_UNLINK,
+	KEY_INTERCEPT_RENAME,
+	KEY_INTERCEPT_FOPEN,
+	KEY_INTERCEPT_FREOPEN,
+	KEY_INTERCEPT_OPEN,
+	KEY_LIBTRASH_CONFIG_FILE_UNREMOVABLE,
+	KEY_REMOVABLE_MEDIA_MOUNT_POINTS,
+	KEY_IGNORE_EDITOR_TEMPORARY,
+	KEY_EXCEPTIONS,
+	KEY_IGNORE_RE,
+	KEY_PRESERVE_FILES_LARGER_THAN,
+	KEY_TRASH_CHECK_INTERVAL,
+	KEY_IGNORE_USERS,
+	KEY_IGNORE_UIDS,
+	KEY_IGNORE_GLOB,
+
+	NUMBER_OF_CONFIG_OPTIONS
+};
+
+/* An array of arrays rather than of pointers, so that the table needs no relocation when the
+ * library is loaded (the size is that of the longest key, LIBTRASH_CONFIG_FILE_UNREMOVABLE): */
+
+#define CONFIG_KEY_MAX 33
+
+static const char config_keys[NUMBER_OF_CONFIG_OPTIONS][CONFIG_KEY_MAX] =
+{
+	"TRASH_CAN",
+	"IN_CASE_OF_FAILURE",
+	"SHOULD_WARN",
+	"IGNORE_HIDDEN",
+	"IGNORE_EDITOR_BACKUP",
+	"PROTECT_TRASH",
+	"GLOBAL_PROTECTION",
+	"TRASH_SYSTEM_ROOT",
+	"TEMPORARY_DIRS",
+	"USER_TEMPORARY_DIRS",
+	"UNREMOVABLE_DIRS",
+	"IGNORE_EXTENSIONS",
+	"INTERCEPT_UNLINK",
+	"INTERCEPT_RENAME",
+	"INTERCEPT_FOPEN",
+	"INTERCEPT_FREOPEN",
+	"INTERCEPT_OPEN",
+	"LIBTRASH_CONFIG_FILE_UNREMOVABLE",
+	"REMOVABLE_MEDIA_MOUNT_POINTS",
+	"IGNORE_EDITOR_TEMPORARY",
+	"EXCEPTIONS",
+	"IGNORE_RE",
+	"PRESERVE_FILES_LARGER_THAN",
+	"TRASH_CHECK_INTERVAL",
+	"IGNORE_USERS",
+	"IGNORE_UIDS",
+	"IGNORE_GLOB"
+};
+
+/* Keys are looked up with a perfect hash: CONFIG_KEY_HASH() combines the length of a key with its
+ * first, middle, last and "one third" characters, and none of the keys above share a value. Since
+ * the macro only involves integer constants when applied to character literals, the case labels
+ * in find_config_key() are computed by the compiler, which also refuses to compile the switch if
+ * a new key ever collides with an existing one (in that case, pick another CONFIG_KEY_MULTIPLIER).
+ * The hash only tells us which key a word might be, so it is always confirmed with memcmp(). */
+
+#define CONFIG_KEY_MULTIPLIER 57
+
+#define CONFIG_KEY_HASH(len, first, middle, last, third)			\
+	((((((unsigned) (len) * CONFIG_KEY_MULTIPLIER + (unsigned char) (first))	\
+	     * CONFIG_KEY_MULTIPLIER + (unsigned char) (middle))		\
+	    * CONFIG_KEY_MULTIPLIER + (unsigned char) (last))			\
+	   * CONFIG_KEY_MULTIPLIER + (unsigned char) (third)) % 128)
+
+static int config_key_candidate(const char *key, size_t len)
+{
+	switch (CONFIG_KEY_HASH(len, key[0], key[len / 2], key[len - 1], key[len / 3]))
+	{
+		case CONFIG_KEY_HASH(9, 'T', 'H', 'N', 'S'):  return KEY_TRASH_CAN;
+		case CONFIG_KEY_HASH(18, 'I', 'F', 'E', 'E'): return KEY_IN_CASE_OF_FAILURE;
+		case CONFIG_KEY_HASH(11, 'S', 'D', 'N', 'U'): return KEY_SHOULD_WARN;
+		case CONFIG_KEY_HASH(13, 'I', '_', 'N', 'R'): return KEY_IGNORE_HIDDEN;
+		case CONFIG_KEY_HASH(20, 'I', 'T', 'P', '_'): return KEY_IGNORE_EDITOR_BACKUP;
+		case CONFIG_KEY_HASH(13, 'P', 'T', 'H', 'E'): return KEY_PROTECT_TRASH;
+		case CONFIG_KEY_HASH(17, 'G', 'R', 'N', 'L'): return KEY_GLOBAL_PROTECTION;
+		case CONFIG_KEY_HASH(17, 'T', 'S', 'T', '_'): return KEY_TRASH_SYSTEM_ROOT;
+		case CONFIG_KEY_HASH(14, 'T', 'R', 'S', 'O'): return KEY_TEMPORARY_DIRS;
+		case CONFIG_KEY_HASH(19, 'U', 'O', 'S', 'E'): return KEY_USER_TEMPORARY_DIRS;
+		case CONFIG_KEY_HASH(16, 'U', 'B', 'S', 'O'): return KEY_UNREMOVABLE_DIRS;
+		case CONFIG_KEY_HASH(17, 'I', 'X', 'S', 'E'): return KEY_IGNORE_EXTENSIONS;
+		case CONFIG_KEY_HASH(16, 'I', 'T', 'K', 'C'): return KEY_INTERCEPT_UNLINK;
+		case CONFIG_KEY_HASH(16, 'I', 'T', 'E', 'C'): return KEY_INTERCEPT_RENAME;
+		case CONFIG_KEY_HASH(15, 'I', 'P', 'N', 'C'): return KEY_INTERCEPT_FOPEN;
+		case CONFIG_KEY_HASH(17, 'I', 'T', 'N', 'C'): return KEY_INTERCEPT_FREOPEN;
+		case CONFIG_KEY_HASH(14, 'I', 'P', 'N', 'R'): return KEY_INTERCEPT_OPEN;
+		case CONFIG_KEY_HASH(32, 'L', 'F', 'E', 'O'): return KEY_LIBTRASH_CONFIG_FILE_UNREMOVABLE;
+		case CONFIG_KEY_HASH(28, 'R', 'A', 'S', '_'): return KEY_REMOVABLE_MEDIA_MOUNT_POINTS;
+		case CONFIG_KEY_HASH(23, 'I', 'O', 'Y', 'E'): return KEY_IGNORE_EDITOR_TEMPORARY;
+		case CONFIG_KEY_HASH(10, 'E', 'T', 'S', 'E'): return KEY_EXCEPTIONS;
+		case CONFIG_KEY_HASH(9, 'I', 'R', 'E', 'O'):  return KEY_IGNORE_RE;
+		case CONFIG_KEY_HASH(26, 'P', 'S', 'N', '_'): return KEY_PRESERVE_FILES_LARGER_THAN;
+		case CONFIG_KEY_HASH(20, 'T', 'K', 'L', 'C'): return KEY_TRASH_CHECK_INTERVAL;
+		case CONFIG_KEY_HASH(12, 'I', '_', 'S', 'R'): return KEY_IGNORE_USERS;
+		case CONFIG_KEY_HASH(11, 'I', 'E', 'S', 'O'): return KEY_IGNORE_UIDS;
+		case CONFIG_KEY_HASH(11, 'I', 'E', 'B', 'O'): return KEY_IGNORE_GLOB;
+		default:                                      return -1;
+	}
+}
 
-		/* ptr either points to the beginning of a value or to the '\0'. */
+/* Returns the position of the key of length len starting at key in config_keys[], or -1 if it
+ * isn't one of them: */
 
-		if (*ptr == '\0')    /* (If there's nothing after equal_sign, we set beg_value to NULL.) */
-			beg_value = NULL;
-		else
-		{
-			beg_value = ptr;
+static int find_config_key(const char *key, size_t len)
+{
+	int index = -1;
 
-			while (*ptr != '\0' && !isspace(*ptr)) /* move to the first character after the value */
-				ptr++;
+	if (len == 0)
+		return -1;
 
-			end_value = ptr - 1;
-		}
+	index = config_key_candidate(key, len);
 
-		/* Done marking key/value. We now compare the string between beg_key and end_key to those
-		   listed in key_array: */
+	if (index == -1 || strlen(config_keys[index]) != len || memcmp(key, config_keys[index], len))
+		return -1;
 
-		for (i = 0; i < number_of_keys; i++)
-			if (!strncmp(beg_key, keys_array[i], end_key - beg_key + 1))
-			{
-				char *tmp = NULL;
+	return index;
+}
 
-				if (beg_value == NULL) /* empty value, one byte is enough */
-					tmp = malloc(1);
-				else
-					tmp = malloc(end_value - beg_value + 2); /* (2 is not a typo!) */
+/* -------------------------------------------------------------------- */
 
-				if (!tmp)
-				{
-#ifdef DEBUG
-					fprintf(stderr, "Insufficient memory (read_config_from_file()).\n");
-#endif
-					/* Free memory: */
+/* What this function does: it reads the configuration file at path (an absolute path) into memory
+ * with a single read() and extracts the values of the keys listed in config_keys[] from lines which
+ * have the form (key) = (value).
+ *
+ * The file is tokenized in place: each value is null-terminated inside the buffer and
+ * values[KEY_xxx] is pointed at it, so there isn't a malloc() per value. The buffer is handed over
+ * to the caller through buffer_ptr: get_config_from_file() copies the values it keeps into the
+ * arena of the snapshot and then free()s the buffer in one go. For each key for which no value was
+ * found, values[] holds a NULL pointer (if a key appears more than once, the last value wins).
+ *
+ * Returns 1 if it succeeds; in case a serious error happened (not being able to read a value for
+ * one of the keys DOESN'T qualify: handling such situations is something better left to the
+ * caller), it returns 0. */
 
-					for (i = 0; i < number_of_keys; i++)
-						if (values_array[i] != NULL)
-							free(values_array[i]);
+static int read_config_from_file(const char *path, char **values, char **buffer_ptr)
+{
+	int (*real_open) (const char *path, int flags, ...) = NULL;
 
-					free(keys_array);
-					free(values_array);
+	int fd = -1;
 
-					free(line);
+	struct stat conf_stat;
 
-					/* Close config file: */
+	char *buffer = NULL;
 
-					fclose(conf_file);
+	char *line = NULL, *end_of_buffer = NULL;
 
-					return NULL;
-				}
+	size_t bytes_read = 0;
 
-				if (beg_value == NULL) /* empty value, just store '\0' */
-					*tmp = '\0';
-				else
-				{
-					strncpy(tmp, beg_value, end_value - beg_value + 1);
-					tmp[end_value - beg_value + 1] = '\0';
-				}
+	int i = 0;
 
-				/* Store a pointer to this string in the values_array: */
+	for (i = 0; i < NUMBER_OF_CONFIG_OPTIONS; i++)
+		values[i] = NULL;
 
-				values_array[i] = tmp;
+	/* Make sure that we are able to use the real open(): */
 
-				/* Done. */
+	real_open = get_real_function(OPEN);
 
-				break; /* from the for loop, since we have already found a match. */
-			}
+	if (!real_open)
+	{
 
-		/* Whether we filled in a slot of the values_array or not, we now skip to the next line,
-		 * not forgetting to free the memory which currently holds the previously read line: */
+#ifdef DEBUG
+		fprintf(stderr, "real_open is not available, bailing out! (read_config_from_file()).\n");
+#endif
 
-		free(line);
+		return 0;
 	}
 
-	/* (No memory is pointed to by line, since read_line() failed (and no memory was malloc()ed inside it).) */
-
-	/* Close file: */
+	fd = (*real_open) (path, O_RDONLY | O_CLOEXEC);
 
-	fclose(conf_file);
+	if (fd == -1)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to open config file at %s.\n", path);
+#endif
+		return 0;
+	}
 
-	/* Free keys_array, since we don't need that memory any more: */
+	/* Read the whole file into a buffer with room for a final '\0' (the file may grow while we read
+	 * it; if it does, we simply ignore the rest, and config_still_valid() will notice the change): */
 
-	free(keys_array);
+	if (fstat(fd, &conf_stat) || conf_stat.st_size < 0 || (unsigned long long) conf_stat.st_size >= SIZE_MAX)
+	{
+		close(fd);
+		return 0;
+	}
 
-	/* We exited the loop because readline returned NULL; but was this due to EOF or to an error? */
+	buffer = malloc(conf_stat.st_size + 1);
 
-	if (error == NOMEM || error == FERROR)
+	if (!buffer)
 	{
 #ifdef DEBUG
-		if (error == FERROR)
-			fprintf(stderr, "Error reading from disk (readline).\n");
-		else /* if (error == NOMEM) */
-			fprintf(stderr, "Error while reading from disk (readline()).\n");
+		fprintf(stderr, "Insufficient memory (read_config_from_file()).\n");
 #endif
-		/* Free all memory and return NULL: */
+		close(fd);
+		return 0;
+	}
 
-		for (i = 0; i < number_of_keys; i++)
-			if (values_array[i] != NULL)
-				free(values_array[i]);
+	while (bytes_read < (size_t) conf_stat.st_size)
+	{
+		ssize_t n = read(fd, buffer + bytes_read, conf_stat.st_size - bytes_read);
 
-		free(values_array);
+		if (n == -1 && errno == EINTR)
+			continue;
 
-		return NULL;
+		if (n == -1)
+		{
+#ifdef DEBUG
+			fprintf(stderr, "Error reading from disk (read_config_from_file()).\n");
+#endif
+			free(buffer);
+			close(fd);
+			return 0;
+		}
+
+		if (n == 0) /* the file shrank */
+			break;
+
+		bytes_read += n;
 	}
 
-	/* No error occurred, return values_array: */
+	close(fd);
 
-	return values_array;
-}
+	buffer[bytes_read] = '\0';
+	end_of_buffer = buffer + bytes_read;
 
-/* ------------------------*/
+	/* Go through each line of the file; look up the portion before the '=' in config_keys[];
+	 * if it is the nth key, null-terminate the value and store a pointer to it in values[n]. */
 
-/* This function reads an entire line from the file pointer stream,
- * and returns a pointer to it (it is stored in malloc()ed memory). In
- * case of error it returns NULL and sets *errors to the appropriate
- * value. It is only used by read_config_from_file():
- */
+	for (line = buffer; line < end_of_buffer; )
+	{
+		char *end_of_line = memchr(line, '\n', end_of_buffer - line);
+		char *beg_key = NULL, *end_key = NULL, *beg_value = NULL, *end_value = NULL;
+		char *equal_sign = NULL;
+		char *next_line = NULL;
+		int key = -1;
 
-static char * readline(FILE *stream, int *errors)
-{
+		if (!end_of_line)
+			end_of_line = end_of_buffer;
 
-#ifndef REALLOC_FACTOR
-# define REALLOC_FACTOR 2
-#endif
+		next_line = end_of_line + 1;
 
-#ifndef DEFAULT_BUF_SIZE
-# define DEFAULT_BUF_SIZE 100
-#endif
+		/* Does this line
+		 * (a) start with a '#' or
+		 * (b) lack an equal sign (also detects empty lines) or
+		 * (c) start with white space followed by an equal sign (i.e., no key available)? */
 
-	char *line = NULL, *ptr = NULL;
+		equal_sign = memchr(line, '=', end_of_line - line);
 
-	int ch = 0;
+		beg_key = line;
 
-	size_t line_len = DEFAULT_BUF_SIZE;
+		while (beg_key < end_of_line && isspace((unsigned char) *beg_key)) /* skip any leading white space */
+			beg_key++;
 
-	/* Set error indicator to zero: */
+		if (line[0] == '#' || !equal_sign || beg_key == equal_sign)
+		{
+			line = next_line;
+			continue;
+		}
 
-	*errors = 0;
+		/* -> Line seems OK */
 
-	line = malloc(line_len + 1);
+		/* Key (ends at the first white space or at the equal sign): */
 
-	if (!line)
-	{
-		*errors = NOMEM;
-		return NULL;
-	}
+		end_key = beg_key;
 
-	ptr = line;
+		while (end_key < equal_sign && !isspace((unsigned char) *end_key))
+			end_key++;
 
-	while ((ch = fgetc(stream)) != EOF && ch != '\n')
-	{
-		*ptr++ = ch;
+		key = find_config_key(beg_key, end_key - beg_key);
 
-		if ((unsigned) (ptr - line) == line_len)
+		if (key != -1)
 		{
-			char *tmp = NULL;
-			tmp = realloc(line, REALLOC_FACTOR * line_len + 1);
+			/* Value (from the first non-white space character after the equal sign to the next white
+			 * space or the end of the line; possibly empty): */
 
-			if (!tmp)
-			{
-				free(line);
-				*errors = NOMEM;
-				return NULL;
-			}
+			beg_value = equal_sign + 1;
 
-			line = tmp;
+			while (beg_value < end_of_line && isspace((unsigned char) *beg_value))
+				beg_value++;
 
-			ptr = line + line_len;
+			end_value = beg_value;
 
-			line_len *= REALLOC_FACTOR;
-		}
-	}
+			while (end_value < end_of_line && !isspace((unsigned char) *end_value))
+				end_value++;
 
-	*ptr = '\0';
+			*end_value = '\0'; /* either white space, the '\n' or the '\0' at the end of the buffer */
 
-	if (ferror(stream))
-	{
-		free(line);
-		*errors = FERROR;
-		return NULL;
-	}
+			values[key] = beg_value;
+		}
 
-	if (strlen(line) == 0 && feof(stream))
-	{
-		free(line);
-		return NULL;
+		line = next_line;
 	}
 
-	return line;
+	/* The values now live in buffer, which the caller must free(): */
+
+	*buffer_ptr = buffer;
+
+	return 1;
 }
 
 /* ----------------------------------------------------------------------------- */
 
-/* This function tries to read the configuration values from a user-specific file called
- * PERSONAL_CONF_FILE in the user's home dir. If that fails, it leaves the
- * compile-time defaults unchanged. */
+/* This function reads the configuration values from the system-wide configuration file
+ * SYSTEM_CONF_FILE and from the user-specific file PERSONAL_CONF_FILE in the user's home dir
+ * (cfg->conf_file_path). A value from the personal file overrides the same setting in the
+ * system-wide one, which in turn overrides the compile-time default. If neither file can be
+ * read, the compile-time defaults are left unchanged. */
 
 /* ---------------------------------------------- */
 
-/* These macros are used by the function get_config_from_file(): */
-
-#define NUMBER_OF_CONFIG_OPTIONS 23 /* number of options listed below in the call to read_config_from_file(). */
-
-/* ---------------------------- */
+/* This macro is used by the function get_config_from_file(): */
 
-#define SET_INTEGER_FREE_MEMORY(var,str,str1,str2,int1,int2,intdef)	\
+#define SET_INTEGER(var,str,str1,str2,int1,int2,intdef)			\
 {									\
 	if (!str)							\
 	var = intdef;							\
@@ -1397,8 +2644,6 @@ static char * readline(FILE *stream, int *errors)
 	var = int2;							\
 	else								\
 	var = intdef;							\
-	if (str)							\
-	free(str);							\
 }
 
 /* ------------------------------------------------ */
@@ -1406,184 +2651,204 @@ static char * readline(FILE *stream, int *errors)
 void get_config_from_file(config *cfg)
 {
 
-	char **config_values = NULL;
-
-	/* We first try to read the user specific file: */
-
-	/* Call read_config_from_file() with the approriate arguments: */
-
-	config_values = read_config_from_file(PERSONAL_CONF_FILE, NUMBER_OF_CONFIG_OPTIONS, cfg,
-			"TRASH_CAN",
-			"IN_CASE_OF_FAILURE",
-			"SHOULD_WARN",
-			"IGNORE_HIDDEN",
-			"IGNORE_EDITOR_BACKUP",
-			"PROTECT_TRASH",
-			"GLOBAL_PROTECTION",
-			"TRASH_SYSTEM_ROOT",
-			"TEMPORARY_DIRS",
-			"USER_TEMPORARY_DIRS",
-			"UNREMOVABLE_DIRS",
-			"IGNORE_EXTENSIONS",
-			"INTERCEPT_UNLINK",
-			"INTERCEPT_RENAME",
-			"INTERCEPT_FOPEN",
-			"INTERCEPT_FREOPEN",
-			"INTERCEPT_OPEN",
-			"LIBTRASH_CONFIG_FILE_UNREMOVABLE",
-			"REMOVABLE_MEDIA_MOUNT_POINTS",
-			"IGNORE_EDITOR_TEMPORARY",
-			"EXCEPTIONS",
-			"IGNORE_RE",
-			"PRESERVE_FILES_LARGER_THAN");
-
-	/* Did read_config_from_file() fail? If it did, we quit and leave the compile-time defaults unchanged: */
-
-	if (!config_values)
+	char *config_values[NUMBER_OF_CONFIG_OPTIONS];
+
+	char *system_config_values[NUMBER_OF_CONFIG_OPTIONS];
+
+	char *buffer = NULL, *system_buffer = NULL;
+
+	int read_system_file = NO, read_personal_file = NO;
+
+	int i = 0;
+
+	/* We first try to read the system-wide file (build_config() has already stat()ed it): */
+
+	if (system_conf_trusted(&cfg->system_conf_identity))
+		read_system_file = read_config_from_file(SYSTEM_CONF_FILE, system_config_values, &system_buffer);
+#ifdef DEBUG
+	else if (cfg->system_conf_identity.exists)
+		fprintf(stderr, "Ignoring %s, which isn't a regular file owned by root and writable only by it.\n", SYSTEM_CONF_FILE);
+#endif
+
+	/* and then the user specific file: */
+
+	read_personal_file = read_config_from_file(cfg->conf_file_path, config_values, &buffer);
+
+	/* Did read_config_from_file() fail both times? If it did, we quit and leave the compile-time defaults unchanged: */
+
+	if (!read_system_file && !read_personal_file)
 		return;
 
-	/* If we managed to read the configuration file in the user's home directory,
-	 * we now proceed to set the configuration variables to the values read_config_from_file() returned to us: */
+	/* Merge the two layers: the personal file wins wherever it sets a value. */
+
+	for (i = 0; i < NUMBER_OF_CONFIG_OPTIONS; i++)
+		if (!read_personal_file || !config_values[i])
+			config_values[i] = read_system_file ? system_config_values[i] : NULL;
+
+#ifdef FROZEN_POLICY
+	/* The lists baked in at build time can't be changed at run-time: */
+
+#ifdef BAKED_UNREMOVABLE_DIRS
+	config_values[KEY_UNREMOVABLE_DIRS] = NULL;
+#endif
+#ifdef BAKED_TEMPORARY_DIRS
+	config_values[KEY_TEMPORARY_DIRS] = NULL;
+#endif
+#ifdef BAKED_REMOVABLE_MEDIA_MOUNT_POINTS
+	config_values[KEY_REMOVABLE_MEDIA_MOUNT_POINTS] = NULL;
+#endif
+#ifdef BAKED_EXCEPTIONS
+	config_values[KEY_EXCEPTIONS] = NULL;
+#endif
+#ifdef BAKED_IGNORE_EXTENSIONS
+	config_values[KEY_IGNORE_EXTENSIONS] = NULL;
+#endif
+
+#endif
+	/* Copy the values we are left with into the arena of the snapshot, and get rid of the files
+	 * (most of which is comments, anyway). A value which doesn't fit is treated as missing: */
+
+	for (i = 0; i < NUMBER_OF_CONFIG_OPTIONS; i++)
+		if (config_values[i])
+			config_values[i] = arena_strdup(cfg, config_values[i]);
+
+	free(buffer);
+	free(system_buffer);
+
+	/* If we managed to read the configuration files, we now proceed to set the configuration
+	 * variables to the values read_config_from_file() returned to us: */
 
 	/* Configuration variables which are integers used as "flags" are set by the
-	 * SET_INTEGER_FREE_MEMORY(var, str,str1,str2,int1,int2,intdef) macro, which translates the string str
+	 * SET_INTEGER(var, str,str1,str2,int1,int2,intdef) macro, which translates the string str
 	 * to the matching macro-defined (integer) value and sets the integer var to that value:
 	 *
 	 * - if the string str is equal to str1, then var is set to int1;
 	 * - if the string str is equal to str2, then var is set to int2;
 	 * - if the string str is neither equal to str1 nor equal to str2, then var is set to intdef.
 	 *
-	 * Memory used by strings which are translated into an integer value is then free()d. */
+	 * The strings themselves live in the arena of cfg, so there is nothing to free() here. */
 
 	/* Name of trash can (must be a string with more than 0 characters): */
 
-	if (config_values[0]) /* memory was malloc()ed */
-	{
-		if (strlen(config_values[0]) > 0) /* something we can use, will be free()d at the end of _init(): */
-			cfg->relative_trash_can = config_values[0];
-		else /* empty string, just free() the memory right away and use the compile-time default: */
-			free(config_values[0]);
-	}
+	if (config_values[KEY_TRASH_CAN] && strlen(config_values[KEY_TRASH_CAN]) > 0) /* if empty, use the compile-time default */
+		cfg->relative_trash_can = config_values[KEY_TRASH_CAN];
 
 	/* What to do in case of failure: */
 
-	SET_INTEGER_FREE_MEMORY(cfg->in_case_of_failure, config_values[1], "ALLOW_DESTRUCTION", "PROTECT",
+	SET_INTEGER(cfg->in_case_of_failure, config_values[KEY_IN_CASE_OF_FAILURE], "ALLOW_DESTRUCTION", "PROTECT",
 			ALLOW_DESTRUCTION, PROTECT, IN_CASE_OF_FAILURE);
 
 	/* Whether we should inform the user that libtrash is disabled: */
 
-	SET_INTEGER_FREE_MEMORY(cfg->should_warn, config_values[2], "YES", "NO",
+	SET_INTEGER(cfg->should_warn, config_values[KEY_SHOULD_WARN], "YES", "NO",
 			YES, NO, SHOULD_WARN);
 
 	/* Whether to ignore hidden files (or files under hidden dirs): */
 
-	SET_INTEGER_FREE_MEMORY(cfg->ignore_hidden, config_values[3], "YES", "NO",
+	SET_INTEGER(cfg->ignore_hidden, config_values[KEY_IGNORE_HIDDEN], "YES", "NO",
 			YES, NO, IGNORE_HIDDEN);
 
 	/* Whether to ignore back-up files used by text editors: */
 
-	SET_INTEGER_FREE_MEMORY(cfg->ignore_editor_backup, config_values[4], "YES", "NO",
+	SET_INTEGER(cfg->ignore_editor_backup, config_values[KEY_IGNORE_EDITOR_BACKUP], "YES", "NO",
 			YES, NO, IGNORE_EDITOR_BACKUP);
 
 	/* What to do when the loss of a file inside the user's trash can may result: */
 
-	SET_INTEGER_FREE_MEMORY(cfg->protect_trash, config_values[5], "YES", "NO",
+	SET_INTEGER(cfg->protect_trash, config_values[KEY_PROTECT_TRASH], "YES", "NO",
 			YES, NO, PROTECT_TRASH);
 
 	/* What to do when the loss of a file outside of the user's home dir may result: */
 
-	SET_INTEGER_FREE_MEMORY(cfg->global_protection, config_values[6], "YES", "NO",
+	SET_INTEGER(cfg->global_protection, config_values[KEY_GLOBAL_PROTECTION], "YES", "NO",
 			YES, NO, GLOBAL_PROTECTION);
 
 	/* Which name to use for the dir under which we store "alien" files if global_protection is set: */
 
-	if (config_values[7]) /* points to malloc()ed memory */
-	{
-		if (cfg->global_protection && strlen(config_values[7]) > 0) /* global_protection is set and this is a "valid" string */
-			cfg->relative_trash_system_root = config_values[7];       /* will be free() near the end of _init() */
-		else /* if malloc()ed memory is pointed to by config_values[7] but we won't be using it, free() it right away and */
-			free(config_values[7]); /* use the compile-time default */
-	}
+	if (config_values[KEY_TRASH_SYSTEM_ROOT] &&
+			cfg->global_protection && strlen(config_values[KEY_TRASH_SYSTEM_ROOT]) > 0) /* global_protection is set and this is a "valid" string */
+		cfg->relative_trash_system_root = config_values[KEY_TRASH_SYSTEM_ROOT];
 
 	/* No test for strlen() > 0 for these three because the user can legitimately set any of these values to the empty
 	   string (meaning that she doesn't wish to enable these features): */
 
-	if (config_values[8])
-		cfg->temporary_dirs = config_values[8];
+	if (config_values[KEY_TEMPORARY_DIRS])
+		cfg->temporary_dirs = config_values[KEY_TEMPORARY_DIRS];
 
-	if (config_values[9])
-		cfg->user_temporary_dirs = config_values[9];
+	if (config_values[KEY_USER_TEMPORARY_DIRS])
+		cfg->user_temporary_dirs = config_values[KEY_USER_TEMPORARY_DIRS];
 
-	if (config_values[10])
-		cfg->unremovable_dirs = config_values[10];
+	if (config_values[KEY_UNREMOVABLE_DIRS])
+		cfg->unremovable_dirs = config_values[KEY_UNREMOVABLE_DIRS];
 
-	if (config_values[11])
-		cfg->ignore_extensions = config_values[11];
-
-	/* (All of the memory pointed to by these three pointers will be free()d in _fini().)  */
+	if (config_values[KEY_IGNORE_EXTENSIONS])
+		cfg->ignore_extensions = config_values[KEY_IGNORE_EXTENSIONS];
 
 	/* Should we (dis)enable any function specifically? */
 
-	SET_INTEGER_FREE_MEMORY(cfg->intercept_unlink, config_values[12], "YES", "NO",
+	SET_INTEGER(cfg->intercept_unlink, config_values[KEY_INTERCEPT_UNLINK], "YES", "NO",
 			YES, NO, INTERCEPT_UNLINK);
 
-	SET_INTEGER_FREE_MEMORY(cfg->intercept_rename, config_values[13], "YES", "NO",
+	SET_INTEGER(cfg->intercept_rename, config_values[KEY_INTERCEPT_RENAME], "YES", "NO",
 			YES, NO, INTERCEPT_RENAME);
 
-	SET_INTEGER_FREE_MEMORY(cfg->intercept_fopen, config_values[14], "YES", "NO",
+	SET_INTEGER(cfg->intercept_fopen, config_values[KEY_INTERCEPT_FOPEN], "YES", "NO",
 			YES, NO, INTERCEPT_FOPEN);
 
-	SET_INTEGER_FREE_MEMORY(cfg->intercept_freopen, config_values[15], "YES", "NO",
+	SET_INTEGER(cfg->intercept_freopen, config_values[KEY_INTERCEPT_FREOPEN], "YES", "NO",
 			YES, NO, INTERCEPT_FREOPEN);
 
-	SET_INTEGER_FREE_MEMORY(cfg->intercept_open, config_values[16], "YES", "NO",
+	SET_INTEGER(cfg->intercept_open, config_values[KEY_INTERCEPT_OPEN], "YES", "NO",
 			YES, NO, INTERCEPT_OPEN);
 
 	/* Should we allow the destruction of the user's libtrash configuration file? */
 
-	SET_INTEGER_FREE_MEMORY(cfg->libtrash_config_file_unremovable, config_values[17], "YES", "NO",
+	SET_INTEGER(cfg->libtrash_config_file_unremovable, config_values[KEY_LIBTRASH_CONFIG_FILE_UNREMOVABLE], "YES", "NO",
 			YES, NO, LIBTRASH_CONFIG_FILE_UNREMOVABLE);
 
 	/* Are there any directories under which files should be really destroyed because they are used as mount-points
 	 * for removable media? (equivalent to temporary_dirs) */
 
-	if (config_values[18])
-		cfg->removable_media_mount_points = config_values[18];
+	if (config_values[KEY_REMOVABLE_MEDIA_MOUNT_POINTS])
+		cfg->removable_media_mount_points = config_values[KEY_REMOVABLE_MEDIA_MOUNT_POINTS];
 
-	SET_INTEGER_FREE_MEMORY(cfg->ignore_editor_temporary, config_values[19], "YES", "NO",
+	SET_INTEGER(cfg->ignore_editor_temporary, config_values[KEY_IGNORE_EDITOR_TEMPORARY], "YES", "NO",
 			YES, NO, IGNORE_EDITOR_TEMPORARY);
 
 	/* Are there any files which would typically be covered by libtrash which the user decided to list
 	 * as "exceptions"? */
 
-	if (config_values[20])
-		cfg->exceptions = config_values[20];
+	if (config_values[KEY_EXCEPTIONS])
+		cfg->exceptions = config_values[KEY_EXCEPTIONS];
+
+	if (config_values[KEY_IGNORE_RE])
+		cfg->ignore_re = config_values[KEY_IGNORE_RE];
 
-	if (config_values[21])
-		cfg->ignore_re = config_values[21];
+	if (config_values[KEY_IGNORE_GLOB])
+		cfg->ignore_glob = config_values[KEY_IGNORE_GLOB];
 
 	/* check if PRESERVE_FILES_LARGER_THAN is specified and convert to unsigned long long */
 
 	cfg->preserve_files_larger_than_limit = 0; // unless we can successfully read and convert a different value (below), this will default to 0 (which means no max file size)
 
-	if (config_values[22])
+	if (config_values[KEY_PRESERVE_FILES_LARGER_THAN])
 	{
 		off_t preserve_files_larger_than_limit = 0;
 
-		int len_of_string = strlen(config_values[22]);
+		int len_of_string = strlen(config_values[KEY_PRESERVE_FILES_LARGER_THAN]);
 
-		if (len_of_string >= 1 && config_values[22][0] != '-') // make sure user didn't screw up and entered a negative number (plus ensure len_of_string >= 1 makes it safe to access [len_of_string-1] below)
+		if (len_of_string >= 1 && config_values[KEY_PRESERVE_FILES_LARGER_THAN][0] != '-') // make sure user didn't screw up and entered a negative number (plus ensure len_of_string >= 1 makes it safe to access [len_of_string-1] below)
 		{
-			char m_or_g = config_values[22][len_of_string-1]; // remember the megabyte or gigabyte suffix
+			char m_or_g = config_values[KEY_PRESERVE_FILES_LARGER_THAN][len_of_string-1]; // remember the megabyte or gigabyte suffix
 
 			if ( m_or_g == 'M' || m_or_g == 'm' ||  m_or_g == 'G' || m_or_g == 'g') // has a valid suffix
 			{
-				config_values[22][len_of_string-1] = '\0'; // chop off the suffix
+				config_values[KEY_PRESERVE_FILES_LARGER_THAN][len_of_string-1] = '\0'; // chop off the suffix
 				char* end; /* used for strtoll to signal whether the whole string was converted */
 
 				errno = 0; // required for us to be able to properly check whether strtoll succeeded
 
-				preserve_files_larger_than_limit = strtoll(config_values[22], &end, 10);
+				preserve_files_larger_than_limit = strtoll(config_values[KEY_PRESERVE_FILES_LARGER_THAN], &end, 10);
 
 				if (errno == 0 && *end == '\0') // strtoll() is happy with the string we passed it (meaning: it was a valid long long)
 				{
@@ -1603,7 +2868,7 @@ void get_config_from_file(config *cfg)
 				{
 #ifdef DEBUG
 					fprintf(stderr,"libtrash warning: Invalid PRESERVE_FILES_LARGER_THAN setting in libtrash.conf: %s%c. Ignored.\n",
-							config_values[22],m_or_g);
+							config_values[KEY_PRESERVE_FILES_LARGER_THAN],m_or_g);
 #endif
 					;
 				}
@@ -1626,12 +2891,26 @@ void get_config_from_file(config *cfg)
 		}
 	}
 
-	/* Done. */
+	/* How many seconds may go by before we check again that the trash can is still there (a
+	 * non-negative integer; anything else leaves the compile-time default in place): */
 
-	/* We no longer need the config_values array, since we already copied/used
-	   the pointers it held: */
+	if (config_values[KEY_TRASH_CHECK_INTERVAL])
+	{
+		char *end = NULL;
+		long interval = 0;
+
+		errno = 0;
+
+		interval = strtol(config_values[KEY_TRASH_CHECK_INTERVAL], &end, 10);
 
-	free(config_values);
+		if (errno == 0 && *end == '\0' && end != config_values[KEY_TRASH_CHECK_INTERVAL] && interval >= 0 && interval <= INT_MAX)
+			cfg->trash_check_interval = (int) interval;
+#ifdef DEBUG
+		else
+			fprintf(stderr,"libtrash warning: Invalid TRASH_CHECK_INTERVAL setting in libtrash.conf: %s. Ignored.\n",
+					config_values[KEY_TRASH_CHECK_INTERVAL]);
+#endif
+	}
 
 	/* Done: */
 
@@ -1640,6 +2919,256 @@ void get_config_from_file(config *cfg)
 
 /* ----------------------------------------------------------------------------------- */
 
+/* IGNORE_USERS (user names) and IGNORE_UIDS (numeric uids) list the accounts for which libtrash does
+ * nothing at all, typically daemons which remove lots of spool and cache files. Both are only read
+ * from the system-wide configuration file (an ignored account needn't even have a home dir, let
+ * alone a personal configuration file), and are compiled into a hash set of uids: a power-of-two
+ * table with open addressing, in which NO_UID marks an empty slot. euid_ignored() copies it into
+ * the arena of every snapshot, and build_config() asks it about the euid before anything else.
+ *
+ * Compiling the set means asking the password database about every name, so the last set compiled
+ * is kept in ignored_uids_cache (which, like everything else build_config() uses, is protected by
+ * config_lock) and used for as long as the system-wide file doesn't change. A name which only
+ * appears in the password database after that is noticed the next time the file changes. */
+
+#define NO_UID ((uid_t) -1)
+
+static struct
+{
+	int valid;
+	file_identity system_conf_identity;
+	uid_t *uids;
+	unsigned mask;
+}
+ignored_uids_cache;
+
+static unsigned uid_slot(uid_t uid, unsigned mask)
+{
+	unsigned hash = (unsigned) uid * 2654435761U;
+
+	return (hash ^ (hash >> 16)) & mask;
+}
+
+/* Adds uid to the set in uids (which always has at least one empty slot): */
+
+static void add_ignored_uid(uid_t *uids, unsigned mask, uid_t uid)
+{
+	unsigned i = uid_slot(uid, mask);
+
+	while (uids[i] != NO_UID && uids[i] != uid)
+		i = (i + 1) & mask;
+
+	uids[i] = uid;
+}
+
+/* Returns the number of entries in the semi-colon delimited list list: */
+
+static unsigned count_list_entries(const char *list)
+{
+	unsigned entries = 0;
+
+	while (*list != '\0')
+	{
+		entries++;
+		list += strcspn(list, ";");
+
+		if (*list == ';')
+			list++;
+	}
+
+	return entries;
+}
+
+/* Looks up the user called name (the first len characters of it) in the password database; returns
+ * 1 and sets *uid if it is there, 0 otherwise: */
+
+static int lookup_uid(const char *name, size_t len, uid_t *uid)
+{
+	struct passwd userinfo;
+	struct passwd *result = NULL;
+	char *buf = NULL;
+	char *user = NULL;
+	long buf_size = sysconf(_SC_GETPW_R_SIZE_MAX);
+	int error = 0;
+
+	if (buf_size <= 0)
+		buf_size = 16384;
+
+	user = strndup(name, len);
+
+	if (!user)
+		return 0;
+
+	while (1)
+	{
+		buf = malloc(buf_size);
+
+		if (!buf)
+		{
+			free(user);
+			return 0;
+		}
+
+		error = getpwnam_r(user, &userinfo, buf, buf_size, &result);
+
+		if (error != ERANGE || buf_size >= 1024 * 1024)
+			break;
+
+		free(buf);
+		buf_size *= 2;
+	}
+
+	if (!error && result)
+		*uid = result->pw_uid;
+
+#ifdef DEBUG
+	if (error || !result)
+		fprintf(stderr, "IGNORE_USERS lists %s, who isn't in the password database.\n", user);
+#endif
+
+	free(buf);
+	free(user);
+
+	return !error && result;
+}
+
+/* Compiles the lists users (names) and uids (numbers) into ignored_uids_cache. Entries which don't
+ * name an account are skipped. Returns 0 if we ran out of memory: */
+
+static int compile_ignored_uids(const char *users, const char *uids)
+{
+	unsigned entries = count_list_entries(users) + count_list_entries(uids);
+	unsigned size = 2;
+	unsigned i = 0;
+	const char *entry = NULL;
+	size_t len = 0;
+	uid_t uid = 0;
+	unsigned long number = 0;
+	char *end = NULL;
+	uid_t *table = NULL;
+
+	free(ignored_uids_cache.uids);
+
+	ignored_uids_cache.uids = NULL;
+	ignored_uids_cache.mask = 0;
+
+	if (entries == 0)
+		return 1;
+
+	/* At most half full, so that a lookup hardly ever probes more than a slot or two: */
+
+	while (size < 2 * entries)
+		size *= 2;
+
+	table = malloc(size * sizeof(uid_t));
+
+	if (!table)
+		return 0;
+
+	for (i = 0; i < size; i++)
+		table[i] = NO_UID;
+
+	for (entry = users; *entry != '\0'; entry += len + (entry[len] == ';'))
+	{
+		len = strcspn(entry, ";");
+
+		if (len > 0 && lookup_uid(entry, len, &uid))
+			add_ignored_uid(table, size - 1, uid);
+	}
+
+	for (entry = uids; *entry != '\0'; entry += len + (entry[len] == ';'))
+	{
+		len = strcspn(entry, ";");
+
+		errno = 0;
+		number = strtoul(entry, &end, 10);
+
+		if (len > 0 && end == entry + len && isdigit((unsigned char) *entry) && errno == 0 &&
+				number == (unsigned long) (uid_t) number && (uid_t) number != NO_UID)
+			add_ignored_uid(table, size - 1, (uid_t) number);
+#ifdef DEBUG
+		else if (len > 0)
+			fprintf(stderr, "libtrash warning: Invalid entry in IGNORE_UIDS: %.*s. Ignored.\n", (int) len, entry);
+#endif
+	}
+
+	ignored_uids_cache.uids = table;
+	ignored_uids_cache.mask = size - 1;
+
+	return 1;
+}
+
+/* Sets cfg->ignored_uids and cfg->ignored_uids_mask (cfg->system_conf_identity must already be
+ * known) and tells whether cfg->euid is in the set: */
+
+int euid_ignored(config *cfg)
+{
+	char *values[NUMBER_OF_CONFIG_OPTIONS];
+	char *buffer = NULL;
+	const char *users = IGNORE_USERS;
+	const char *uids = IGNORE_UIDS;
+	size_t bytes = 0;
+	char *copy = NULL;
+
+	cfg->ignored_uids = NULL;
+	cfg->ignored_uids_mask = 0;
+
+	if (!ignored_uids_cache.valid ||
+			!same_file_identity(&cfg->system_conf_identity, &ignored_uids_cache.system_conf_identity))
+	{
+		if (system_conf_trusted(&cfg->system_conf_identity) &&
+				read_config_from_file(SYSTEM_CONF_FILE, values, &buffer))
+		{
+			if (values[KEY_IGNORE_USERS])
+				users = values[KEY_IGNORE_USERS];
+
+			if (values[KEY_IGNORE_UIDS])
+				uids = values[KEY_IGNORE_UIDS];
+		}
+
+		ignored_uids_cache.valid = compile_ignored_uids(users, uids);
+		ignored_uids_cache.system_conf_identity = cfg->system_conf_identity;
+
+		free(buffer);
+	}
+
+	if (!ignored_uids_cache.uids)
+		return NO;
+
+	/* (The arena makes no promise about alignment, so we align the copy ourselves.) */
+
+	bytes = (ignored_uids_cache.mask + 1) * sizeof(uid_t);
+	copy = arena_alloc(cfg, bytes + sizeof(uid_t) - 1);
+
+	if (!copy)
+		return NO;
+
+	cfg->ignored_uids = (uid_t *) (((uintptr_t) copy + sizeof(uid_t) - 1) & ~(uintptr_t) (sizeof(uid_t) - 1));
+	cfg->ignored_uids_mask = ignored_uids_cache.mask;
+
+	memcpy(cfg->ignored_uids, ignored_uids_cache.uids, bytes);
+
+	return uid_ignored(cfg, cfg->euid);
+}
+
+/* Is uid in the set of cfg? */
+
+int uid_ignored(const config *cfg, uid_t uid)
+{
+	unsigned i = 0;
+
+	if (!cfg->ignored_uids)
+		return NO;
+
+	for (i = uid_slot(uid, cfg->ignored_uids_mask); cfg->ignored_uids[i] != NO_UID; i = (i + 1) & cfg->ignored_uids_mask)
+		if (cfg->ignored_uids[i] == uid)
+			return YES;
+
+	return NO;
+}
+
+/* ----------------------------------------------------------------------------------- */
+
 /* decide_action() takes an absolute canonical path and the current config settings as its arguments and indicates
    to the caller how this file should be handled. It returns one of three possible values:
  *
@@ -1652,30 +3181,77 @@ void get_config_from_file(config *cfg)
  - BE_LEFT_UNTOUCHED: according to the user's preferences, this file shouldn't be changed
  at all and the caller should return an error code, refusing to proceed. */
 
-int decide_action(const char *absolute_path, config *cfg)
+/* Most of the decision only depends on the path itself; that part is made by
+ * decide_action_by_name(), which returns UNDECIDED if it has to be left to the tests which look
+ * at the file (whether it is empty, or too large). Its tests used to go through the path one
+ * after the other (a strstr() for hidden files, a strlen() for backups, two strrchr()s for
+ * temporary files and two more for the extension, ...); now lex_path() reads it once and they
+ * all look at what it found: */
+
+int decide_action(const char *absolute_path, config *cfg)
+{
+	lexed_path lexed;
+	int action = UNDECIDED;
+
+	lex_path(absolute_path, &lexed);
+
+	action = decide_action_by_name(&lexed, cfg);
+
+	if (action != UNDECIDED)
+		return action;
+
+	/* Tell the caller to remove (without saving) empty files: */
+
+	if (is_empty_file(absolute_path))                                                	/* zero byte-count in regular file */
+		return BE_REMOVED;
+
+	/* Tell the caller not to remove large files. Use TRASH_OFF=YES to override */
+
+	if (file_is_too_large(absolute_path, cfg->preserve_files_larger_than_limit))       	/* file is bigger than the max file size limit and user */
+		return BE_LEFT_UNTOUCHED;							/* wants us to refuse to move to it to the trash and return an error    */
+
+	/* The control page may have told us to stop preserving large files (see control.h): */
+
+	if ((CONTROL_FLAGS(cfg) & CONTROL_SIZE_LIMIT) &&
+			file_is_too_large(absolute_path, __atomic_load_n(&cfg->control->size_limit, __ATOMIC_RELAXED)))
+		return BE_REMOVED;
+
+	/* If the file doesn't fall into any of these categories, it means that it is a file which the user wants to
+	   save a copy of rather than permanently destroying it; it is up to the caller to determine whether this file
+	   resides in or outside of the user's home directory and act accordingly: */
+
+	return BE_SAVED;
+}
+
+static int decide_action_by_name(const lexed_path *lexed, config *cfg)
 {
-	const char *tmp = NULL;
+	const char *absolute_path = lexed->path;
+
+	/* Which of the directory lists hold a directory absolute_path lies under (see build_dir_trie()
+	 * and dir_lists_of()): */
+
+	unsigned dirs = dir_lists_of(lexed, cfg);
 
 	/* Tell the caller to handle the files already under the user's trash can according to the
 	   value of cfg->protect_trash, also taking into consideration whether (or not) the trash can
 	   is currently listed in UNCOVER_DIRS: */
 
-	if (found_under_dir(absolute_path, cfg->absolute_trash_can))
+	if (dirs & DIR_LIST_TRASH_CAN)
 	{
 		if (cfg->protect_trash == NO ||
-				found_under_dir(absolute_path, cfg->uncovered_dirs)) /* user temporarily disabled PROTECT_TRASH via UNCOVER_DIRS */
+				(dirs & DIR_LIST_UNCOVERED_DIRS)) /* user temporarily disabled PROTECT_TRASH via UNCOVER_DIRS */
 			return BE_REMOVED;
-		else /* if cfg->protect_trash == YES && !found_under_dir(absolute_path, cfg->uncover_dirs) */
+		else /* if cfg->protect_trash == YES && the trash can isn't uncovered */
 			return BE_LEFT_UNTOUCHED;
 	}
 
 	/* Tell the caller to return an error code and don't even touch these files: */
 
-	if ( (found_under_dir(absolute_path, cfg->unremovable_dirs) &&
-				!found_under_dir(absolute_path, cfg->uncovered_dirs)  &&
-				!is_an_exception(absolute_path, cfg->exceptions) ) || /* (a) */
+	if ( ((dirs & DIR_LIST_UNREMOVABLE_DIRS) &&
+				!(dirs & DIR_LIST_UNCOVERED_DIRS)  &&
+				!exception_listed(absolute_path, cfg) ) || /* (a) */
 			(cfg->libtrash_config_file_unremovable                && /* (b) */
-			 (found_under_dir(absolute_path, cfg->home) && !strcmp(absolute_path + strlen(cfg->home) + 1, PERSONAL_CONF_FILE)) ) ) /* (c) */
+			 ((dirs & DIR_LIST_HOME) && !strcmp(absolute_path + strlen(cfg->home) + 1, PERSONAL_CONF_FILE)) ) ) /* (c) */
 		return BE_LEFT_UNTOUCHED;
 
 	/* Notes:
@@ -1687,45 +3263,224 @@ int decide_action(const char *absolute_path, config *cfg)
 
 	/* Tell the caller to remove (without saving) the following kinds of files: */
 
-	if ( (cfg->ignore_hidden && hidden_file(absolute_path)) ||                           /* is a hidden file and we were told
-											      * to ignore these; */
-			(cfg->ignore_editor_backup && absolute_path[strlen(absolute_path) - 1] == '~') || /* is an editor backup file and
+	if ( (cfg->ignore_hidden && lexed->hidden) ||                                        /* is a hidden file (or lies under a
+											      * hidden dir) and we were told to
+											      * ignore these; */
+			(cfg->ignore_editor_backup && lexed->length > 0 &&
+			 absolute_path[lexed->length - 1] == '~')                               ||      /* is an editor backup file and
 													   * we were told to ignore these; */
 
-			(cfg->ignore_editor_temporary &&                                             /* is a temporary file used by a text */
-			 ((tmp = strrchr(absolute_path, '/')) ? *(tmp + 1) == '#' :                  /* editor */
-			  absolute_path[0] == '#') )                                            ||
+			(cfg->ignore_editor_temporary && lexed->basename[0] == '#')             ||      /* is a temporary file used by a text
+													 * editor */
 
-			found_under_dir(absolute_path, cfg->temporary_dirs)                     ||      /* is a (normal) temporary file; */
+			(dirs & DIR_LIST_TEMPORARY_DIRS)                                        ||      /* is a (normal) temporary file; */
 
-			found_under_dir(absolute_path, cfg->user_temporary_dirs)                ||      /* is a temporary file in a dir under $HOME; */
+			(dirs & DIR_LIST_USER_TEMPORARY_DIRS)                                   ||      /* is a temporary file in a dir under $HOME; */
 
-			(!found_under_dir(absolute_path, cfg->home) && !cfg->global_protection) ||      /* is outside of the user's dir and
+			(!(dirs & DIR_LIST_HOME) && !cfg->global_protection)                    ||      /* is outside of the user's dir and
 													   the user doesn't want us to protect
 													   these files. */
 
-			ends_in_ignored_extension(absolute_path, cfg)                           ||      /* filename ends in an extension
+			ends_in_ignored_extension(lexed->extension, lexed->extension_length, cfg) ||      /* filename ends in an extension
 													 * we were told to ignore */
 
-			*cfg->ignore_re != '\0' && matches_re(absolute_path, cfg->ignore_re)	 ||   /* file name matches the IGNORE_RE */
-
-			found_under_dir(absolute_path, cfg->removable_media_mount_points)       ||      /* file is on a removable medium */
+			matches_ignored_glob(lexed, cfg)                                ||      /* path matches one of the
+													 * IGNORE_GLOB patterns */
 
-			is_empty_file(absolute_path))                                            	/* zero byte-count in regular file */
+			*cfg->ignore_re != '\0' && matches_re(absolute_path, cfg)		 ||   /* file name matches the IGNORE_RE */
 
+			(dirs & DIR_LIST_REMOVABLE_MEDIA_MOUNT_POINTS))                                 /* file is on a removable medium */
 
 			return BE_REMOVED;
 
-	/* Tell the caller not to remove large files. Use TRASH_OFF=YES to override */
+	/* None of the above can be told without looking at the file itself: */
 
-	if (file_is_too_large(absolute_path, cfg->preserve_files_larger_than_limit))       	/* file is bigger than the max file size limit and user */
-		return BE_LEFT_UNTOUCHED;							/* wants us to refuse to move to it to the trash and return an error    */
+	return UNDECIDED;
+}
 
-	/* If the file doesn't fall into any of these categories, it means that it is a file which the user wants to
-	   save a copy of rather than permanently destroying it; it is up to the caller to determine whether this file
-	   resides in or outside of the user's home directory and act accordingly: */
+/* ----------------------------------------------------------------------------------- */
 
-	return BE_SAVED;
+/* decide_action_from_path() lets unlink() and rename() skip the lstat()s and the canonicalization
+ * which precede decide_action() when the path they were passed is enough to tell that the file
+ * may simply be removed (e.g., /tmp/foo or /home/user/src/foo.o). It returns either BE_REMOVED or,
+ * if the caller has to go the long way, UNDECIDED.
+ *
+ * This is only safe if pathname is exactly what build_absolute_path() would turn it into: it has
+ * to be absolute, without empty, "." or ".." components, and its directory part mustn't contain
+ * any symlinks. (The last component may be one, since neither unlink() and rename() nor
+ * build_absolute_path() follow it.) Whether the directory contains symlinks can't be told without
+ * system calls, so we rely on build_absolute_path() having found out recently: every time it
+ * canonicalizes a directory and gets the same path back, it records it, and the device and inode
+ * numbers of the directory it found there, with remember_canonical_dir(). For the next
+ * KNOWN_DIR_TTL seconds, such a directory is taken to be free of symlinks as long as an lstat() of
+ * its path still finds a directory with the same numbers: one system call instead of the lstat()s
+ * and the readlink()s of the long way. (A directory which has been replaced by a symlink, or by
+ * another directory, fails that check at once; what it doesn't catch is a symlink slipped into a
+ * component further up which leads back to the very same directory, and that leaves the file
+ * we are asked about where it was.) Each thread keeps the last KNOWN_DIRS_SIZE such dirs for
+ * itself, so that nothing needs to be locked.
+ *
+ * Most of the files removed this way lie right in one of the TEMPORARY_DIRS or
+ * USER_TEMPORARY_DIRS (/tmp/cc1234.s), and even that lstat() is most of what it costs to remove
+ * them. So once the check has found such a directory unchanged, it isn't made again for as long
+ * as the snapshot lasts: the entry records the generation of the snapshot, and that is what it
+ * is taken on from then on. (A temporary dir replaced by a symlink goes unnoticed until the
+ * snapshot is replaced, or the thread's entry for it is; the dirs below it are still checked
+ * every time.) */
+
+#define KNOWN_DIRS_SIZE 8
+
+#define KNOWN_DIR_MAX 256
+
+#define KNOWN_DIR_TTL 5 /* seconds */
+
+typedef struct
+{
+	size_t length;		/* 0 if this entry is unused */
+	long checked;		/* coarse_seconds() when build_absolute_path() last canonicalized it */
+	unsigned long generation; /* the snapshot it is known to be a temporary dir of, or 0 */
+	dev_t dev;		/* and what it found there then */
+	ino_t ino;
+	char path[KNOWN_DIR_MAX];
+}
+known_dir;
+
+static __thread known_dir known_dirs[KNOWN_DIRS_SIZE];
+
+static __thread int known_dirs_next = 0; /* the entry which gets replaced next */
+
+int decide_action_from_path(const char *pathname, config *cfg)
+{
+	lexed_path lexed;
+	const char *slash = NULL;
+
+	if (pathname == NULL)
+		return UNDECIDED;
+
+	lex_path(pathname, &lexed);
+
+	if (!lexed.clean)
+		return UNDECIDED;
+
+	slash = lexed.basename - 1;
+
+	/* (The root dir is canonical, of course:) */
+
+	if (slash != pathname && !known_canonical_dir(pathname, slash - pathname, cfg))
+		return UNDECIDED;
+
+	return decide_action_by_name(&lexed, cfg) == BE_REMOVED ? BE_REMOVED : UNDECIDED;
+}
+
+/* Returns 1 if the first length characters of dir are the path to a directory which this thread
+ * has recently found to be canonical, and which is still the same directory (or which is one of
+ * the temporary dirs of cfg, and was still the same when this thread last checked it with cfg): */
+
+static int known_canonical_dir(const char *dir, size_t length, config *cfg)
+{
+	long now = coarse_seconds();
+	char path[KNOWN_DIR_MAX];
+	struct stat dir_stat;
+	int previous_errno = 0;
+	int i = 0, same = 0;
+
+	for (i = 0; i < KNOWN_DIRS_SIZE; i++)
+		if (known_dirs[i].length == length &&
+				(known_dirs[i].generation == cfg->generation || now - known_dirs[i].checked < KNOWN_DIR_TTL) &&
+				!memcmp(known_dirs[i].path, dir, length))
+			break;
+
+	if (i == KNOWN_DIRS_SIZE)
+		return 0;
+
+	if (known_dirs[i].generation == cfg->generation)
+		return 1;
+
+	memcpy(path, dir, length);
+	path[length] = '\0';
+
+	/* (Our caller's caller reports its own errno, whatever happens here:) */
+
+	previous_errno = errno;
+
+	same = !lstat(path, &dir_stat) && S_ISDIR(dir_stat.st_mode) &&
+		dir_stat.st_dev == known_dirs[i].dev && dir_stat.st_ino == known_dirs[i].ino;
+
+	errno = previous_errno;
+
+	if (!same)
+		known_dirs[i].length = 0;
+	else if (dir_lists_naming(dir, length, cfg) & (DIR_LIST_TEMPORARY_DIRS | DIR_LIST_USER_TEMPORARY_DIRS))
+		known_dirs[i].generation = cfg->generation;
+
+	return same;
+}
+
+/* Returns the DIR_LIST_xxx bits of the lists which have an entry naming the directory dir (length
+ * characters, without a trailing slash) itself. Only the trie is asked: lists which are still the
+ * ones baked in are never found. */
+
+static unsigned dir_lists_naming(const char *dir, size_t length, config *cfg)
+{
+	const struct dir_trie_node *node = cfg->dir_trie;
+	const char *component = dir, *end = dir + length, *slash = NULL;
+
+	while (node)
+	{
+		slash = memchr(component, '/', end - component);
+
+		if (!slash)
+			slash = end;
+
+		node = dir_trie_child(cfg->dir_trie, node, component, slash - component);
+
+		if (node && slash == end)
+			return node->lists;
+
+		component = slash + 1;
+	}
+
+	return 0;
+}
+
+/* Called by build_absolute_path() whenever canonicalize_file_name() left the absolute path dir
+ * unchanged: */
+
+void remember_canonical_dir(const char *dir)
+{
+	size_t length = strlen(dir);
+	struct stat dir_stat;
+	int previous_errno = errno;
+	int i = 0;
+
+	if (length <= 1 || length >= KNOWN_DIR_MAX) /* there's no point in remembering "/" */
+		return;
+
+	if (lstat(dir, &dir_stat) || !S_ISDIR(dir_stat.st_mode))
+	{
+		errno = previous_errno;
+		return;
+	}
+
+	for (i = 0; i < KNOWN_DIRS_SIZE; i++)
+		if (known_dirs[i].length == length && !memcmp(known_dirs[i].path, dir, length))
+			break;
+
+	if (i == KNOWN_DIRS_SIZE)
+	{
+		i = known_dirs_next;
+		known_dirs_next = (known_dirs_next + 1) % KNOWN_DIRS_SIZE;
+
+		memcpy(known_dirs[i].path, dir, length);
+		known_dirs[i].length = length;
+		known_dirs[i].generation = 0;
+	}
+	else if (dir_stat.st_dev != known_dirs[i].dev || dir_stat.st_ino != known_dirs[i].ino)
+		known_dirs[i].generation = 0;
+
+	known_dirs[i].dev = dir_stat.st_dev;
+	known_dirs[i].ino = dir_stat.st_ino;
+	known_dirs[i].checked = coarse_seconds();
 }
 
 /* --------------------------------------------------------------------------- */
@@ -1935,71 +3690,360 @@ static int move(const char *old_path, const char *new_path, config *cfg)
 
 	new_file = (cfg->real_fopen) (new_path, "wb");
 
-	if (!new_file)
-	{
-#ifdef DEBUG
-		fprintf(stderr, "move() unable to open file at new_path for writing.\n");
-#endif
-		fclose(old_file); /* try to close successfully opened file */
+	if (!new_file)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "move() unable to open file at new_path for writing.\n");
+#endif
+		fclose(old_file); /* try to close successfully opened file */
+
+		return -1;
+	}
+
+	/* Copy byte-after-byte until either no more characters are available for reading (due to EOF or
+	 * IO error) or a write-error occurs: */
+
+	while ( (byte_read = fgetc(old_file)) != EOF &&
+			(byte_written = fputc(byte_read, new_file)) != EOF )
+		;
+
+	/* We exited the loop; but why? */
+
+	if (byte_read == EOF) /* we exited the loop because no character could be read ... */
+	{
+		if (feof(old_file) && !ferror(old_file)) /* due to a "real" EOF; everything's OK */
+			error1 = 0;
+		else                                     /* due to an error while reading; signal failure */
+			error1 = 1;
+	}
+	else /* we exited the loop due to a write-error (byte_written == EOF) */
+		error1 = 1;
+
+	/* Anyway, try to close both files: */
+
+	fclose(old_file); /* A failure to close this file should result neither in data loss (since the file wasn't open for
+			   * writing) nor in undefined behaviour at the time of the call to unlink(), since the man pages states
+			   * that "if the name was the last link to a file but any processes still have the file open the file will
+			   * remain in existence until the last file descriptor referring to it is closed." For that reason, it is
+			   * ignored. Should we handle this in a different way? */
+
+	error2 = fclose(new_file); /* On the other hand, failing to close the file we had opened in write-mode does lead us to
+				    * return an error code. */
+
+	/* If either (a) a IO error occurred while copying or (b) we couldn't close the new_file, we return -1 right away: */
+
+	if (error1 || error2)
+		return -1;
+
+	/* Else (i.e., if we are sure that a copy of old_file is currently available at new_path),
+	 * try to ("really") unlink() the old file and return 0 if the real unlink() succeeds, -2 if it fails due to EACCES,
+	 * EPERM or EROFS, and -1 if it fails for any other reason: */
+
+	error1 = (cfg->real_unlink) (old_path); /* once again, should we worry about the possibility of unlink()ing a currently open
+						 * file? (possible since we don't abort if the first call to fclose() fails) */
+
+	if (error1 &&
+			(errno == EACCES || /* We have already done this tests above, trying to prevent a unnecessary copy from being made. */
+			 errno == EPERM  || /* But if something changed since then, must return -2 nonetheless to graft_file(). */
+			 errno == EROFS) )
+		return -2;
+	else /* either unlink() succeeded or it failed for some other reason: */
+		return error1;
+}
+
+/* get_home_dir() returns a malloc()ed copy of the home directory of the user with effective
+ * uid euid, or NULL if we can't find out what it is.
+ *
+ * Looking the user up in the password database can be slow: on systems where it is served by
+ * NSS modules talking to LDAP, sssd or NIS it can take milliseconds. Since processes may keep
+ * switching between effective uids (Samba does it all the time), we remember the home dirs of
+ * the last PASSWD_CACHE_SIZE uids we have looked up. An entry expires after PASSWD_CACHE_TTL
+ * seconds, so that changes to the password database are eventually noticed; failed lookups are
+ * never remembered. Entries are only read and replaced while holding passwd_cache_lock, and the
+ * caller always gets a copy of its own, but the lookup itself is done without the lock so that
+ * a slow NSS server doesn't hold up threads asking about somebody else.
+ *
+ * If the user sets TRASH_TRUST_HOME to YES in his environment, we don't consult the password
+ * database at all and use $HOME instead, provided it passes the tests in trusted_home_dir(). */
+
+#define PASSWD_CACHE_SIZE 8
+
+#define PASSWD_CACHE_TTL 300 /* seconds */
+
+typedef struct
+{
+	uid_t euid;
+	char *home;	/* NULL if this entry is unused */
+	time_t expires;
+}
+passwd_cache_entry;
+
+static passwd_cache_entry passwd_cache[PASSWD_CACHE_SIZE];
+
+static int passwd_cache_next = 0; /* the entry which gets replaced next */
+
+static pthread_mutex_t passwd_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char* get_home_dir(uid_t euid)
+{
+	struct timespec now;
+	char *home = NULL;
+	int i = 0;
+
+	home = trusted_home_dir(euid);
+
+	if (home)
+		return home;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&passwd_cache_lock);
+
+	for (i = 0; i < PASSWD_CACHE_SIZE; i++)
+		if (passwd_cache[i].home && passwd_cache[i].euid == euid && passwd_cache[i].expires > now.tv_sec)
+		{
+			home = copy_string(passwd_cache[i].home);
+			break;
+		}
+
+	pthread_mutex_unlock(&passwd_cache_lock);
+
+	if (i < PASSWD_CACHE_SIZE) /* found it (copy_string() may still have failed, but then so would the rest) */
+		return home;
+
+	home = lookup_home_dir(euid);
+
+	if (!home)
+		return NULL;
+
+	pthread_mutex_lock(&passwd_cache_lock);
+
+	/* Replace an older entry for this uid if there is one, or else the least recently added: */
+
+	for (i = 0; i < PASSWD_CACHE_SIZE; i++)
+		if (passwd_cache[i].home && passwd_cache[i].euid == euid)
+			break;
+
+	if (i == PASSWD_CACHE_SIZE)
+	{
+		i = passwd_cache_next;
+		passwd_cache_next = (passwd_cache_next + 1) % PASSWD_CACHE_SIZE;
+	}
+
+	free(passwd_cache[i].home);
+
+	passwd_cache[i].euid = euid;
+	passwd_cache[i].home = copy_string(home);
+	passwd_cache[i].expires = now.tv_sec + PASSWD_CACHE_TTL;
+
+	pthread_mutex_unlock(&passwd_cache_lock);
+
+	return home;
+}
+
+/* fork() handlers for the cache above (see prepare_fork() in main.c): passwd_cache_lock is held
+ * across fork(), so that the child neither inherits it locked by a thread which doesn't exist
+ * there nor finds an entry half-replaced. */
+
+void lock_passwd_cache(void)
+{
+	pthread_mutex_lock(&passwd_cache_lock);
+}
+
+void unlock_passwd_cache(void)
+{
+	pthread_mutex_unlock(&passwd_cache_lock);
+}
+
+/* Returns a string (in the arena of cfg) holding the path to the personal configuration file of
+ * the user whose home dir is home, or NULL if we run out of memory: */
+
+char* personal_conf_path(config *cfg, const char *home)
+{
+	char *path = arena_alloc(cfg, strlen(home) + 1 + strlen(PERSONAL_CONF_FILE) + 1);
+
+	if (path)
+	{
+		strcpy(path, home);
+		strcat(path, "/");
+		strcat(path, PERSONAL_CONF_FILE);
+	}
+
+	return path;
+}
+
+/* map_control_page() maps (read-only) the run-time control page of the user with uid euid (see
+ * control.h). Only libtrash-ctl creates pages: we never do, since any user could otherwise
+ * create (or replace) a page in the name of another one before that user's first libtrash
+ * process did. It returns NULL if there is no page, if it belongs to anybody but that user or
+ * could be written by anybody else, or if it is too small, in which case libtrash simply does
+ * what its configuration says. */
+
+const control_page* map_control_page(uid_t euid)
+{
+	char name[sizeof(CONTROL_PAGE_PREFIX) + 3 * sizeof(uid_t) + 1];
+	struct stat page_stat;
+	void *page = MAP_FAILED;
+	int fd = -1;
+
+	sprintf(name, "%s%lu", CONTROL_PAGE_PREFIX, (unsigned long) euid);
+
+	fd = shm_open(name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC, 0);
+
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &page_stat)                                   ||
+			page_stat.st_uid != euid                            ||
+			(page_stat.st_mode & (S_IWGRP | S_IWOTH))           ||
+			page_stat.st_size < (off_t) sizeof(control_page))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Not using the control page %s (wrong owner, permissions or size).\n", name);
+#endif
+		close(fd);
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(control_page), PROT_READ, MAP_SHARED, fd, 0);
+
+	close(fd); /* the mapping stays valid */
+
+	if (page == MAP_FAILED)
+		return NULL;
+
+	/* A page written by a newer libtrash-ctl which we don't understand is ignored: */
+
+	if (((const control_page *) page)->version > CONTROL_VERSION)
+	{
+		munmap(page, sizeof(control_page));
+		return NULL;
+	}
+
+	return page;
+}
+
+/* Returns YES if the user with uid euid now has a control page we would use, NO otherwise (see
+ * config_still_valid() in main.c): */
+
+int control_page_appeared(uid_t euid)
+{
+	const control_page *page = map_control_page(euid);
+
+	if (!page)
+		return NO;
+
+	munmap((void *) page, sizeof(control_page));
+
+	return YES;
+}
+
+/* Asks the password database about the user with uid euid. We use getpwuid_r() rather than
+ * getpwuid(), because the static buffer of the latter is shared with the program we are
+ * running in (and with its other threads): */
+
+static char* lookup_home_dir(uid_t euid)
+{
+	struct passwd userinfo;
+	struct passwd *result = NULL;
+	char *buf = NULL;
+	char *home = NULL;
+	long buf_size = sysconf(_SC_GETPW_R_SIZE_MAX);
+	int error = 0;
+
+	if (buf_size <= 0)
+		buf_size = 16384;
+
+	while (1)
+	{
+		buf = malloc(buf_size);
+
+		if (!buf)
+			return NULL;
+
+		error = getpwuid_r(euid, &userinfo, buf, buf_size, &result);
+
+		if (error != ERANGE || buf_size >= 1024 * 1024)
+			break;
+
+		free(buf);
+		buf_size *= 2;
+	}
+
+	if (!error && result)
+		home = copy_string(result->pw_dir);
+
+#ifdef DEBUG
+	if (!home)
+		fprintf(stderr, "Unable to find uid %ld in the password database.\n", (long) euid);
+#endif
+
+	free(buf);
+
+	return home;
+}
+
+/* If TRASH_TRUST_HOME is set to YES, returns a malloc()ed copy of $HOME, provided that it is
+ * safe to use it as the home dir of euid: (i) we are not running with somebody else's
+ * privileges (setuid/setgid programs, or a server which switched its effective uid to act on
+ * behalf of another user: in either case $HOME belongs to somebody else), (ii) it is an
+ * absolute, canonical path (the paths we compare it to are canonical) to (iii) a directory
+ * owned by euid which nobody else can write to. Otherwise, returns NULL and the password
+ * database gets consulted. */
+
+static char* trusted_home_dir(uid_t euid)
+{
+	char *trust = getenv("TRASH_TRUST_HOME");
+	char *home = NULL;
+	char *canonical_home = NULL;
+	struct stat home_stat;
+
+	if (!trust || strcmp(trust, "YES"))
+		return NULL;
 
-		return -1;
-	}
+	if (getuid() != euid || getgid() != getegid())
+		return NULL;
 
-	/* Copy byte-after-byte until either no more characters are available for reading (due to EOF or
-	 * IO error) or a write-error occurs: */
+	home = getenv("HOME");
 
-	while ( (byte_read = fgetc(old_file)) != EOF &&
-			(byte_written = fputc(byte_read, new_file)) != EOF )
-		;
+	if (!home || home[0] != '/')
+		return NULL;
 
-	/* We exited the loop; but why? */
+	canonical_home = canonicalize_file_name(home);
 
-	if (byte_read == EOF) /* we exited the loop because no character could be read ... */
+	if (!canonical_home || strcmp(canonical_home, home) ||
+			stat(canonical_home, &home_stat) || !S_ISDIR(home_stat.st_mode) ||
+			home_stat.st_uid != euid || (home_stat.st_mode & (S_IWGRP | S_IWOTH)))
 	{
-		if (feof(old_file) && !ferror(old_file)) /* due to a "real" EOF; everything's OK */
-			error1 = 0;
-		else                                     /* due to an error while reading; signal failure */
-			error1 = 1;
+#ifdef DEBUG
+		fprintf(stderr, "Not trusting HOME=%s, consulting the password database.\n", home);
+#endif
+		free(canonical_home);
+		return NULL;
 	}
-	else /* we exited the loop due to a write-error (byte_written == EOF) */
-		error1 = 1;
-
-	/* Anyway, try to close both files: */
 
-	fclose(old_file); /* A failure to close this file should result neither in data loss (since the file wasn't open for
-			   * writing) nor in undefined behaviour at the time of the call to unlink(), since the man pages states
-			   * that "if the name was the last link to a file but any processes still have the file open the file will
-			   * remain in existence until the last file descriptor referring to it is closed." For that reason, it is
-			   * ignored. Should we handle this in a different way? */
+	return canonical_home;
+}
 
-	error2 = fclose(new_file); /* On the other hand, failing to close the file we had opened in write-mode does lead us to
-				    * return an error code. */
+/* Returns a malloc()ed copy of str (or NULL if we run out of memory): */
 
-	/* If either (a) a IO error occurred while copying or (b) we couldn't close the new_file, we return -1 right away: */
+static char* copy_string(const char *str)
+{
+	char *copy = malloc(strlen(str) + 1);
 
-	if (error1 || error2)
-		return -1;
+	if (copy)
+		strcpy(copy, str);
 
-	/* Else (i.e., if we are sure that a copy of old_file is currently available at new_path),
-	 * try to ("really") unlink() the old file and return 0 if the real unlink() succeeds, -2 if it fails due to EACCES,
-	 * EPERM or EROFS, and -1 if it fails for any other reason: */
+	return copy;
+}
 
-	error1 = (cfg->real_unlink) (old_path); /* once again, should we worry about the possibility of unlink()ing a currently open
-						 * file? (possible since we don't abort if the first call to fclose() fails) */
+/* ------------------------------------------------------------------------ */
 
-	if (error1 &&
-			(errno == EACCES || /* We have already done this tests above, trying to prevent a unnecessary copy from being made. */
-			 errno == EPERM  || /* But if something changed since then, must return -2 nonetheless to graft_file(). */
-			 errno == EROFS) )
-		return -2;
-	else /* either unlink() succeeded or it failed for some other reason: */
-		return error1;
-}
+/* convert_relative_into_absolute_paths() returns a copy (in the arena of cfg) of the semicolon-separated
+ * list relative_paths, in which each path has been prefixed with home and a slash: */
 
-char * convert_relative_into_absolute_paths(const char *relative_paths)
+char * convert_relative_into_absolute_paths(config *cfg, const char *relative_paths, const char *home)
 {
-	struct passwd *userinfo = NULL;
-
 	char *new_list = NULL;
 
 	const char *orig_ptr = NULL;
@@ -2007,11 +4051,9 @@ char * convert_relative_into_absolute_paths(const char *relative_paths)
 
 	unsigned int semicolon_count = 0;
 
-	userinfo = getpwuid(geteuid());
-
-	/* If it failed, we just return  NULL: */
+	/* If we don't know the user's home dir, we just return NULL: */
 
-	if (!userinfo)
+	if (!home)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Unable to determine information about the user.\n");
@@ -2033,7 +4075,7 @@ char * convert_relative_into_absolute_paths(const char *relative_paths)
 	/* We allocate space for (i) the entire string we were passed, (ii) a trailing null char and (iii) a string holding
 	 * the user's home dir and a slash for each relative path in our argument (the number of paths is given by semicolon_count+1): */
 
-	new_list = malloc(strlen(relative_paths) + 1 + (semicolon_count + 1) * (strlen(userinfo->pw_dir) + 1));
+	new_list = arena_alloc(cfg, strlen(relative_paths) + 1 + (semicolon_count + 1) * (strlen(home) + 1));
 
 	if (!new_list)
 	{
@@ -2051,8 +4093,8 @@ char * convert_relative_into_absolute_paths(const char *relative_paths)
 
 	/* First dir name also gets a prefix: */
 
-	strcpy(new_ptr, userinfo->pw_dir);
-	new_ptr += strlen(userinfo->pw_dir);
+	strcpy(new_ptr, home);
+	new_ptr += strlen(home);
 	*new_ptr++ = '/';
 
 	while (*orig_ptr != '\0')
@@ -2062,8 +4104,8 @@ char * convert_relative_into_absolute_paths(const char *relative_paths)
 		else //if (*orig_ptr == ';')
 		{
 			*new_ptr++ = ';';
-			strcpy(new_ptr, userinfo->pw_dir);
-			new_ptr += strlen(userinfo->pw_dir);
+			strcpy(new_ptr, home);
+			new_ptr += strlen(home);
 			*new_ptr = '/';
 		}
 
@@ -2126,8 +4168,75 @@ static int file_is_too_large(const char *path, off_t preserve_files_larger_than_
 		return 0;
 }
 
-/* The following two user-contributed functions implement support for the IGNORE_RE
-   feature. */
+/* The following functions implement support for the IGNORE_RE feature.
+ *
+ * IGNORE_RE is a list of regular expressions, separated by ';'s; a file is ignored if its path
+ * matches any of them. A ';' which is escaped ("\;") or inside a bracket expression or
+ * parentheses doesn't end a pattern, so a pattern which used to match a ';' keeps doing so as
+ * long as it doesn't do it with a bare ';' at its top level. Empty patterns are left out. What
+ * an escaped ';' means is undefined in an ERE, so the backslash of a "\;" is removed before the
+ * pattern is compiled (see unescape_semicolons()). IGNORE_RE used to be a single expression, and
+ * one which has a bare ';' at its top level now means something else: if the whole of it is
+ * still a valid expression, compile_ignore_re() says so on stderr (with --enable-debug, or if
+ * SHOULD_WARN is set) unless it already has a "\;" in it.
+ *
+ * Compiling a regular expression costs far more than matching a path against it, so rather than
+ * calling regcomp() and regfree() for every file, build_config() has compile_ignore_re() compile
+ * every pattern once, into the snapshot itself; they are freed along with the snapshot (see
+ * free_ignore_re()). A snapshot, and so its compiled patterns, is shared by every thread of the
+ * process, and regexec() may be called by several threads at once with the same regex_t: GNU
+ * libc takes a lock of its own, inside the regex_t, around the state it caches there. That lock
+ * is the problem: a child fork()ed while another thread was inside regexec() would inherit it
+ * held, and its first regexec() on the inherited snapshot would never return. So each compiled
+ * pattern comes with a lock of ours, which is held around every regexec() on it, and which
+ * prepare_fork() (in main.c) takes, for every pattern of every snapshot a thread may still be
+ * matching paths against, with lock_ignore_re(): nobody is ever inside regexec() when a fork()
+ * happens. GNU libc holds its own lock for the whole match anyway, so ours only makes threads
+ * wait for each other when they would have waited regardless, on the same pattern; threads
+ * matching different patterns (or other snapshots) never touch the same lock.
+ *
+ * We only want to know whether a path matches, not where, so we compile with REG_NOSUB, which
+ * lets regexec() skip working out the subexpressions.
+ *
+ * With --enable-re-dfa, compile_ignore_re() also compiles all the patterns it can into a single
+ * DFA (see re-dfa.c), which matches_re() asks first: a single pass over the path then tells
+ * whether any of them matches, so that hundreds of patterns cost about as much as one. regexec()
+ * only gets the patterns (and the paths) the DFA can't answer for. */
+
+#define IGNORE_RE_COMPILED    1  /* compiled holds the pattern */
+#define IGNORE_RE_INVALID     2  /* it isn't a valid regular expression, so it never matches */
+#define IGNORE_RE_UNCOMPILED  3  /* we ran out of memory compiling it, so it's compiled on every call */
+
+struct ignore_pattern
+{
+	const char *source;
+	regex_t compiled;
+	pthread_mutex_t lock;	/* held around regexec() on compiled (IGNORE_RE_COMPILED only) */
+	int state;	/* IGNORE_RE_xxx */
+	int in_dfa;	/* matched by the DFA of the snapshot (--enable-re-dfa) */
+};
+
+/* fork() handlers for the locks of the patterns of cfg (see prepare_fork() in main.c). Nothing
+ * else is ever locked while one of them is held, so these may be called with or without the other
+ * locks; a child may release the locks the thread which called fork() took: */
+
+void lock_ignore_re(config *cfg)
+{
+	unsigned i = 0;
+
+	for (i = 0; i < cfg->ignore_pattern_count; i++)
+		if (cfg->ignore_patterns[i].state == IGNORE_RE_COMPILED)
+			pthread_mutex_lock(&cfg->ignore_patterns[i].lock);
+}
+
+void unlock_ignore_re(config *cfg)
+{
+	unsigned i = 0;
+
+	for (i = 0; i < cfg->ignore_pattern_count; i++)
+		if (cfg->ignore_patterns[i].state == IGNORE_RE_COMPILED)
+			pthread_mutex_unlock(&cfg->ignore_patterns[i].lock);
+}
 
 #ifdef DEBUG
 static void regex_report_error (int errcode, regex_t *compiled)
@@ -2141,39 +4250,345 @@ static void regex_report_error (int errcode, regex_t *compiled)
 }
 #endif
 
-static int matches_re (const char *absolute_path, const char *regexp)
+/* bracket points at the '[' which opens a bracket expression; returns a pointer to the ']' which
+ * closes it (or to the last character of the list, if none does): */
+
+static const char* end_of_bracket(const char *bracket)
+{
+	const char *c = bracket + 1, *close = NULL;
+	char delimiter[3] = { '\0', ']', '\0' };
+
+	if (*c == '^')
+		c++;
+
+	if (*c == ']')
+		c++;
+
+	while (*c != '\0' && *c != ']')
+	{
+		/* "[:alpha:]" and friends may hold a ']' of their own: */
+
+		if (*c == '[' && (c[1] == ':' || c[1] == '=' || c[1] == '.'))
+		{
+			delimiter[0] = c[1];
+
+			if ((close = strstr(c + 2, delimiter)))
+			{
+				c = close + 2;
+				continue;
+			}
+		}
+
+		c++;
+	}
+
+	return *c ? c : c - 1;
+}
+
+/* Returns a pointer to the ';' which ends the pattern starting at pattern, or to the '\0' which
+ * ends IGNORE_RE: */
+
+static const char* end_of_pattern(const char *pattern)
+{
+	const char *c = pattern;
+	int depth = 0;
+
+	for (c = pattern; *c != '\0'; c++)
+	{
+		if (*c == '\\' && c[1] != '\0')
+			c++;
+		else if (*c == '[')
+			c = end_of_bracket(c);
+		else if (*c == '(')
+			depth++;
+		else if (*c == ')' && depth > 0)
+			depth--;
+		else if (*c == ';' && depth == 0)
+			break;
+	}
+
+	return c;
+}
+
+/* Removes the backslash from every "\;" outside a bracket expression in the pattern source (in
+ * place): */
+
+static void unescape_semicolons(char *source)
+{
+	char *from = source, *to = source;
+	const char *end = NULL;
+
+	while (*from != '\0')
+	{
+		if (*from == '\\' && from[1] == ';')
+			from++;
+		else if (*from == '\\' && from[1] != '\0')
+			*to++ = *from++;
+		else if (*from == '[')
+			for (end = end_of_bracket(from); from < end; )
+				*to++ = *from++;
+
+		*to++ = *from++;
+	}
+
+	*to = '\0';
+}
+
+/* IGNORE_RE used to be a single expression: tells the user if cfg's would have been a valid one,
+ * but is now split in two or more at a bare ';' (unless it has a "\;" in it, which only makes sense
+ * in a list). Only done if anybody is going to read it, since it means compiling the whole list. */
+
+static void warn_of_split_ignore_re(config *cfg)
+{
+	regex_t compiled;
+
+#ifndef DEBUG
+	if (!cfg->should_warn)
+		return;
+#endif
+
+	if (*end_of_pattern(cfg->ignore_re) == '\0' || strstr(cfg->ignore_re, "\\;") ||
+			regcomp(&compiled, cfg->ignore_re, REG_EXTENDED | REG_NOSUB))
+		return;
+
+	regfree(&compiled);
+
+	fprintf(stderr, "libtrash: IGNORE_RE is a list of expressions separated by ';'s, so \"%s\" no longer "
+			"means what it did as a single expression (write \"\\;\" for a ';' which belongs to one).\n",
+			cfg->ignore_re);
+}
+
+void compile_ignore_re(config *cfg)
+{
+	struct ignore_pattern *patterns = NULL;
+	const char *pattern = NULL, *end = NULL;
+	char *memory = NULL, *sources = NULL, *source = NULL, *next = NULL;
+	unsigned count = 0, i = 0;
+	int ret = 0;
+#ifdef RE_DFA
+	const char **dfa_sources = NULL;
+	int *in_dfa = NULL;
+#endif
+
+	cfg->ignore_patterns = NULL;
+	cfg->ignore_pattern_count = 0;
+	cfg->ignore_re_dfa = NULL;
+
+	if (*cfg->ignore_re == '\0')
+		return;
+
+	warn_of_split_ignore_re(cfg);
+
+	for (pattern = cfg->ignore_re; *pattern != '\0'; pattern = *end ? end + 1 : end)
+		if ((end = end_of_pattern(pattern)) != pattern)
+			count++;
+
+	if (count == 0)
+		return;
+
+	/* (The arena makes no promise about alignment, so we align the array ourselves.) If we run
+	 * out of memory here, matches_re() compiles the patterns on every call, as it used to: */
+
+	memory = arena_alloc(cfg, count * sizeof(struct ignore_pattern) + sizeof(void *) - 1);
+	sources = arena_strdup(cfg, cfg->ignore_re);
+
+	if (!memory || !sources)
+		return;
+
+	patterns = (struct ignore_pattern *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+
+	for (source = sources; *source != '\0'; source = next)
+	{
+		end = end_of_pattern(source);
+		next = (char *) end + (*end != '\0');
+
+		if (end == source)
+			continue;
+
+		/* Each pattern ends where its ';' used to be: */
+
+		*(char *) end = '\0';
+
+		unescape_semicolons(source);
+
+		patterns[i].source = source;
+		patterns[i].in_dfa = NO;
+
+		/* An invalid pattern never matches anything; but if we merely ran out of memory,
+		 * matches_re() tries again on every call: */
+
+		ret = regcomp (&patterns[i].compiled, source, REG_EXTENDED | REG_NOSUB);
+
+		if (ret == 0)
+		{
+			patterns[i].state = IGNORE_RE_COMPILED;
+			pthread_mutex_init(&patterns[i].lock, NULL);
+		}
+		else
+		{
+#ifdef DEBUG
+			regex_report_error (ret, &patterns[i].compiled);
+#endif
+			patterns[i].state = (ret == REG_ESPACE) ? IGNORE_RE_UNCOMPILED : IGNORE_RE_INVALID;
+		}
+
+		i++;
+	}
+
+	cfg->ignore_patterns = patterns;
+	cfg->ignore_pattern_count = count;
+
+#ifdef RE_DFA
+	/* The DFA only gets the patterns regcomp() accepted: */
+
+	dfa_sources = malloc(count * sizeof(const char *));
+	in_dfa = malloc(count * sizeof(int));
+
+	if (dfa_sources && in_dfa)
+	{
+		for (i = 0; i < count; i++)
+			dfa_sources[i] = (patterns[i].state == IGNORE_RE_COMPILED) ? patterns[i].source : NULL;
+
+		cfg->ignore_re_dfa = re_dfa_compile(dfa_sources, count, in_dfa);
+
+		for (i = 0; i < count; i++)
+			patterns[i].in_dfa = cfg->ignore_re_dfa && in_dfa[i];
+	}
+
+	free(dfa_sources);
+	free(in_dfa);
+#endif
+}
+
+void free_ignore_re(config *cfg)
+{
+	unsigned i = 0;
+
+	for (i = 0; i < cfg->ignore_pattern_count; i++)
+		if (cfg->ignore_patterns[i].state == IGNORE_RE_COMPILED)
+		{
+			regfree(&cfg->ignore_patterns[i].compiled);
+			pthread_mutex_destroy(&cfg->ignore_patterns[i].lock);
+		}
+
+#ifdef RE_DFA
+	re_dfa_free(cfg->ignore_re_dfa);
+#endif
+}
+
+/* Compiles source, matches absolute_path against it and throws it away, as we used to do for
+ * every file: */
+
+static int matches_source (const char *absolute_path, const char *source)
 {
-	regmatch_t matches[1];
 	regex_t    compiled;
 	int        ret;
 
-	ret = regcomp (&compiled, regexp, REG_EXTENDED);
+	ret = regcomp (&compiled, source, REG_EXTENDED | REG_NOSUB);
 
 	if (ret)
 	{
 #ifdef DEBUG
 		regex_report_error (ret, &compiled);
 #endif
-		goto exit_matches_re;
+		return 0;
 	}
 
-	ret = regexec (&compiled, absolute_path, 1, matches, 0);
+	ret = regexec (&compiled, absolute_path, 0, NULL, 0);
+
+	regfree (&compiled);
+
+	return (ret == 0);
+}
+
+static int matches_pattern (const char *absolute_path, struct ignore_pattern *pattern)
+{
+	int ret;
 
+	switch (pattern->state)
+	{
+		case IGNORE_RE_COMPILED:
+			pthread_mutex_lock(&pattern->lock);
+			ret = regexec (&pattern->compiled, absolute_path, 0, NULL, 0);
+			pthread_mutex_unlock(&pattern->lock);
 #ifdef DEBUG
-	if (ret && ret != REG_NOMATCH)
+			if (ret && ret != REG_NOMATCH)
+			{
+				regex_report_error (ret, &pattern->compiled);
+			}
+#endif
+			return (ret == 0);
+
+		case IGNORE_RE_UNCOMPILED:
+			return matches_source (absolute_path, pattern->source);
+
+		default:
+			return 0;
+	}
+}
+
+static int matches_re (const char *absolute_path, config *cfg)
+{
+	const char *pattern = NULL, *end = NULL;
+	char *source = NULL;
+	unsigned i = 0;
+	int check_dfa_patterns = YES;
+	int ret = 0;
+
+	/* If we couldn't even make room for the patterns, they are compiled on every call: */
+
+	if (!cfg->ignore_patterns)
 	{
-		regex_report_error (ret, &compiled);
+		for (pattern = cfg->ignore_re; *pattern != '\0' && !ret; pattern = *end ? end + 1 : end)
+		{
+			end = end_of_pattern(pattern);
+
+			if (end != pattern && (source = strndup(pattern, end - pattern)))
+			{
+				unescape_semicolons(source);
+				ret = matches_source (absolute_path, source);
+				free (source);
+			}
+		}
+
+		return ret;
 	}
-	if (ret == 0)
+
+#ifdef RE_DFA
+	if (cfg->ignore_re_dfa)
 	{
-		fprintf (stderr, "file %s matches %s\n", absolute_path, regexp);
+		ret = re_dfa_matches (cfg->ignore_re_dfa, absolute_path);
+
+		if (ret > 0)
+		{
+#ifdef DEBUG
+			fprintf (stderr, "file %s matches %s (built-in matcher)\n", absolute_path,
+					cfg->ignore_patterns[ret - 1].source);
+#endif
+			return 1;
+		}
+
+		/* If the DFA is sure none of its patterns match, only the others are left: */
+
+		check_dfa_patterns = (ret == RE_DFA_UNSURE);
 	}
 #endif
 
-exit_matches_re:
-	regfree (&compiled);
+	for (i = 0; i < cfg->ignore_pattern_count; i++)
+	{
+		if (cfg->ignore_patterns[i].in_dfa && !check_dfa_patterns)
+			continue;
 
-	return (ret == 0);
+		if (matches_pattern (absolute_path, &cfg->ignore_patterns[i]))
+		{
+#ifdef DEBUG
+			fprintf (stderr, "file %s matches %s\n", absolute_path, cfg->ignore_patterns[i].source);
+#endif
+			return 1;
+		}
+	}
+
+	return 0;
 }
 
 
@@ -2301,19 +4716,75 @@ char* make_absolute_path_from_dirfd_relpath(int dirfd, const char *arg_pathname)
 #endif
 
 
-/* This function, get_real_function, takes as its only argument  one of the
- * function-name macros defined in trash.h  and returns a pointer to that function.
- * We do NOT use dlsym() but instead a fancier more cumbersome system relying on
- * (i) dlvsym() and (ii) knowledge of the version of the corresponding version to
- * which the run-time linker would actually link. This avoids the problem inherent
- * in the way dlsym() (no 'v') behaves: when asked for 'fopen', it will give us a
- * pointer to the older version of that function present in GNU libc, while run-time
- * linking of a program invokign fopen() would get the most recent version of fopen()
+/* get_real_function() takes as its only argument one of the function-name macros defined in
+ * trash.h and returns a pointer to the GNU libc function of that name. We do NOT use dlsym()
+ * but instead a fancier more cumbersome system relying on (i) dlvsym() and (ii) knowledge of
+ * the version of the corresponding version to which the run-time linker would actually link.
+ * This avoids the problem inherent in the way dlsym() (no 'v') behaves: when asked for 'fopen',
+ * it will give us a pointer to the older version of that function present in GNU libc, while
+ * run-time linking of a program invokign fopen() would get the most recent version of fopen()
  * found in the system's GNU libc to be executed.
- * Returns NULL in case of error/being unable to get a pointer to the specified
- * function. */
+ *
+ * Since the wrappers need these pointers on every call (read-only open()s, which are passed
+ * straight through, are by far the most frequent ones), all of them are looked up the first
+ * time any of them is needed and stored in real_functions[]. The table is filled in by a single
+ * thread, which then sets real_functions_state to RESOLVED with release semantics: from then on
+ * getting a pointer is a single load from the table. A thread which finds the table being
+ * filled in by someone else (or a wrapper invoked from inside dlvsym() itself) doesn't wait for
+ * it; it just looks up the one function it needs, as we used to do on every call. The table is
+ * never modified once it has been published, so a child created by fork() can keep using it.
+ *
+ * Returns NULL in case of error/being unable to get a pointer to the specified function. */
+
+#define UNRESOLVED 0
+#define RESOLVING  1
+#define RESOLVED   2
+
+static void *real_functions[NUMBER_OF_REAL_FUNCTIONS];
+
+static int real_functions_state = UNRESOLVED;
+
+static void* lookup_real_function(int function_name);
 
 void* get_real_function(int function_name)
+{
+	int state = __atomic_load_n(&real_functions_state, __ATOMIC_ACQUIRE);
+	int i = 0;
+
+	if (state == RESOLVED)
+		return real_functions[function_name];
+
+	if (state == UNRESOLVED &&
+			__atomic_compare_exchange_n(&real_functions_state, &state, RESOLVING, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		register_fork_handlers();
+
+		for (i = 1; i < NUMBER_OF_REAL_FUNCTIONS; i++)
+			real_functions[i] = lookup_real_function(i);
+
+		__atomic_store_n(&real_functions_state, RESOLVED, __ATOMIC_RELEASE);
+
+		return real_functions[function_name];
+	}
+
+	return lookup_real_function(function_name);
+}
+
+/* Called in the child after fork(): if the table was being filled in by another thread, that
+ * thread doesn't exist in the child, so the next call has to start over (otherwise the child
+ * would keep looking up every function on every call): */
+
+void real_functions_after_fork(void)
+{
+	int state = RESOLVING;
+
+	__atomic_compare_exchange_n(&real_functions_state, &state, UNRESOLVED, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* This is where the actual lookup happens: */
+
+static void* lookup_real_function(int function_name)
 {
 	dlerror();
 
@@ -2344,6 +4815,28 @@ void* get_real_function(int function_name)
 
 		case OPEN64: p = dlvsym(RTLD_NEXT, "open64", OPEN64_VERSION);
 			     break;
+
+#ifdef AT_FUNCTIONS
+		case OPENAT: p = dlvsym(RTLD_NEXT, "openat", OPENAT_VERSION);
+			     break;
+
+		case OPENAT64: p = dlvsym(RTLD_NEXT, "openat64", OPENAT64_VERSION);
+			       break;
+
+		case RENAMEAT: p = dlvsym(RTLD_NEXT, "renameat", RENAMEAT_VERSION);
+			       break;
+
+		case UNLINKAT: p = dlvsym(RTLD_NEXT, "unlinkat", UNLINKAT_VERSION);
+			       break;
+#endif
+
+#ifdef POLICY_INHERIT
+		case EXECVE: p = dlvsym(RTLD_NEXT, "execve", EXECVE_VERSION);
+			     break;
+
+		case EXECVPE: p = dlvsym(RTLD_NEXT, "execvpe", EXECVPE_VERSION);
+			      break;
+#endif
 	}
 
 	if (dlerror())
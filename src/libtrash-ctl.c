@@ -0,0 +1,338 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* libtrash-ctl reads and writes the run-time control page of a user (see control.h), which every
+ * process running libtrash with that effective uid consults on every call:
+ *
+ *   libtrash-ctl [-u UID] status
+ *   libtrash-ctl [-u UID] off | on
+ *   libtrash-ctl [-u UID] intercept unlink|rename|fopen|freopen|open yes|no
+ *   libtrash-ctl [-u UID] limit SIZE[M|G] | none
+ *   libtrash-ctl [-u UID] reset
+ *
+ * Without -u, the page of the user running it is used. Only that user and root can change it. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "control.h"
+
+static const struct
+{
+	const char *name;
+	uint64_t flag;
+}
+intercept_flags[] =
+{
+	{ "unlink",  CONTROL_NO_UNLINK  },
+	{ "rename",  CONTROL_NO_RENAME  },
+	{ "fopen",   CONTROL_NO_FOPEN   },
+	{ "freopen", CONTROL_NO_FREOPEN },
+	{ "open",    CONTROL_NO_OPEN    },
+	{ NULL,      0                  }
+};
+
+static void usage(void);
+
+static control_page* open_control_page(uid_t uid, int create);
+
+static void change_flags(control_page *page, uint64_t set, uint64_t clear);
+
+static int print_status(const control_page *page, uid_t uid);
+
+/* ------------------------------------------------------------------------ */
+
+int main(int argc, char *argv[])
+{
+	control_page *page = NULL;
+	uid_t uid = getuid();
+	char *end = NULL;
+	unsigned long long size = 0;
+	int option = 0;
+	int i = 0;
+
+	while ((option = getopt(argc, argv, "u:h")) != -1)
+	{
+		switch (option)
+		{
+			case 'u':
+				errno = 0;
+				uid = strtoul(optarg, &end, 10);
+
+				if (errno || *optarg == '\0' || *end != '\0')
+				{
+					fprintf(stderr, "libtrash-ctl: invalid uid '%s'\n", optarg);
+					return 1;
+				}
+				break;
+
+			default:
+				usage();
+				return option == 'h' ? 0 : 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+	{
+		usage();
+		return 1;
+	}
+
+	/* "status" doesn't create the page if it doesn't exist yet: */
+
+	page = open_control_page(uid, strcmp(argv[0], "status") != 0);
+
+	if (!page)
+		return 1;
+
+	if (!strcmp(argv[0], "status") && argc == 1)
+		return print_status(page, uid);
+
+	else if (!strcmp(argv[0], "off") && argc == 1)
+		change_flags(page, CONTROL_OFF, 0);
+
+	else if (!strcmp(argv[0], "on") && argc == 1)
+		change_flags(page, 0, CONTROL_OFF);
+
+	else if (!strcmp(argv[0], "reset") && argc == 1)
+		change_flags(page, 0, ~(uint64_t) 0);
+
+	else if (!strcmp(argv[0], "intercept") && argc == 3)
+	{
+		for (i = 0; intercept_flags[i].name; i++)
+			if (!strcmp(argv[1], intercept_flags[i].name))
+				break;
+
+		if (!intercept_flags[i].name || (strcmp(argv[2], "yes") && strcmp(argv[2], "no")))
+		{
+			usage();
+			return 1;
+		}
+
+		if (!strcmp(argv[2], "no"))
+			change_flags(page, intercept_flags[i].flag, 0);
+		else
+			change_flags(page, 0, intercept_flags[i].flag);
+	}
+
+	else if (!strcmp(argv[0], "limit") && argc == 2)
+	{
+		if (!strcmp(argv[1], "none"))
+		{
+			change_flags(page, 0, CONTROL_SIZE_LIMIT);
+			return 0;
+		}
+
+		/* The same syntax as PRESERVE_FILES_LARGER_THAN: */
+
+		errno = 0;
+		size = strtoull(argv[1], &end, 10);
+
+		if (!strcmp(end, "M"))
+			size *= 1048576ULL;
+		else if (!strcmp(end, "G"))
+			size *= 1073741824ULL;
+		else if (*end != '\0')
+			size = 0;
+
+		if (errno || size == 0)
+		{
+			fprintf(stderr, "libtrash-ctl: invalid size '%s'\n", argv[1]);
+			return 1;
+		}
+
+		/* The limit is stored before the flag which tells libtrash to use it: */
+
+		__atomic_store_n(&page->size_limit, size, __ATOMIC_RELEASE);
+		change_flags(page, CONTROL_SIZE_LIMIT, 0);
+	}
+
+	else
+	{
+		usage();
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void usage(void)
+{
+	fprintf(stderr,
+			"Usage: libtrash-ctl [-u UID] COMMAND\n"
+			"\n"
+			"Commands:\n"
+			"  status                    show the current state of the control page\n"
+			"  off | on                  switch libtrash off (as TRASH_OFF=YES would) or back on\n"
+			"  intercept FUNCTION yes|no stop (no) or resume (yes) intercepting FUNCTION, one of\n"
+			"                            unlink, rename, fopen, freopen and open\n"
+			"  limit SIZE[M|G] | none    don't preserve files of SIZE bytes or more, or stop doing so\n"
+			"  reset                     undo all of the above\n"
+			"\n"
+			"Changes take effect at once in every process running libtrash as UID (by default,\n"
+			"the user running libtrash-ctl). They can only make libtrash do less than its\n"
+			"configuration files say.\n");
+}
+
+/* Maps the control page of uid for reading and writing. If create is set, the page is created
+ * if it doesn't exist yet (and handed over to uid, if we are root); otherwise NULL is returned.
+ * NULL is also returned, after an error message, if anything goes wrong. A page is only ever
+ * created with O_EXCL: one which already exists is used as it is, and only if it belongs to uid. */
+
+static control_page* open_control_page(uid_t uid, int create)
+{
+	char name[sizeof(CONTROL_PAGE_PREFIX) + 3 * sizeof(uid_t) + 1];
+	struct stat page_stat;
+	void *page = MAP_FAILED;
+	int fd = -1, created = 0;
+
+	sprintf(name, "%s%lu", CONTROL_PAGE_PREFIX, (unsigned long) uid);
+
+	if (create)
+	{
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+		created = (fd != -1);
+	}
+
+	if (fd == -1 && (!create || errno == EEXIST))
+		fd = shm_open(name, O_RDWR | O_NOFOLLOW | O_CLOEXEC, 0);
+
+	if (fd == -1 && errno == ENOENT)
+	{
+		printf("There is no control page for uid %lu yet: libtrash does what its configuration says.\n",
+				(unsigned long) uid);
+		return NULL;
+	}
+
+	if (fd == -1 || fstat(fd, &page_stat))
+	{
+		fprintf(stderr, "libtrash-ctl: %s: %s\n", name, strerror(errno));
+
+		if (fd != -1)
+			close(fd);
+
+		return NULL;
+	}
+
+	/* The page we have just created is handed over to uid (libtrash ignores a page which belongs
+	 * to anybody else, or which can be written by other users): */
+
+	if (created && page_stat.st_uid != uid)
+	{
+		if (fchown(fd, uid, (gid_t) -1))
+		{
+			fprintf(stderr, "libtrash-ctl: unable to give %s to uid %lu: %s\n",
+					name, (unsigned long) uid, strerror(errno));
+			shm_unlink(name);
+			close(fd);
+			return NULL;
+		}
+
+		page_stat.st_uid = uid;
+	}
+
+	if (page_stat.st_uid != uid || (page_stat.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		fprintf(stderr, "libtrash-ctl: %s has the wrong owner or permissions, so libtrash ignores it.\n"
+				"Remove it and run libtrash-ctl again.\n", name);
+		close(fd);
+		return NULL;
+	}
+
+	if (page_stat.st_size < (off_t) sizeof(control_page) && ftruncate(fd, sizeof(control_page)))
+	{
+		fprintf(stderr, "libtrash-ctl: %s: %s\n", name, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(control_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (page == MAP_FAILED)
+	{
+		fprintf(stderr, "libtrash-ctl: %s: %s\n", name, strerror(errno));
+		return NULL;
+	}
+
+	if (((control_page *) page)->version > CONTROL_VERSION)
+	{
+		fprintf(stderr, "libtrash-ctl: %s was written by a newer version of libtrash-ctl.\n", name);
+		return NULL;
+	}
+
+	return page;
+}
+
+/* Sets the bits in set and clears the ones in clear, without losing a change made at the same time
+ * by another libtrash-ctl, and then bumps the generation counter: */
+
+static void change_flags(control_page *page, uint64_t set, uint64_t clear)
+{
+	uint64_t old_flags = __atomic_load_n(&page->flags, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&page->flags, &old_flags, (old_flags & ~clear) | set,
+				0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	__atomic_store_n(&page->version, CONTROL_VERSION, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&page->generation, 1, __ATOMIC_RELEASE);
+}
+
+static int print_status(const control_page *page, uid_t uid)
+{
+	uint64_t flags = __atomic_load_n(&page->flags, __ATOMIC_ACQUIRE);
+	char label[16];
+	int i = 0;
+
+	printf("uid:        %lu\n", (unsigned long) uid);
+	printf("generation: %llu\n", (unsigned long long) __atomic_load_n(&page->generation, __ATOMIC_RELAXED));
+	printf("libtrash:   %s\n", (flags & CONTROL_OFF) ? "off" : "as configured");
+
+	for (i = 0; intercept_flags[i].name; i++)
+	{
+		snprintf(label, sizeof(label), "%s:", intercept_flags[i].name);
+		printf("%-12s%s\n", label, (flags & intercept_flags[i].flag) ? "not intercepted" : "as configured");
+	}
+
+	if (flags & CONTROL_SIZE_LIMIT)
+		printf("size limit: files of %llu bytes or more aren't preserved\n",
+				(unsigned long long) __atomic_load_n(&page->size_limit, __ATOMIC_RELAXED));
+	else
+		printf("size limit: as configured\n");
+
+	return 0;
+}
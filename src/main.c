@@ -26,9 +26,12 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <pwd.h>
+#include <errno.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "trash.h"
 
@@ -36,6 +39,8 @@
 
 static char default_ignore_re[] = IGNORE_RE;
 
+static char default_ignore_glob[] = IGNORE_GLOB;
+
 static char default_ignore_extensions[] = IGNORE_EXTENSIONS;
 
 static char default_unremovable_dirs[] = UNREMOVABLE_DIRS;
@@ -69,18 +74,623 @@ static char default_relative_trash_system_root[] = TRASH_SYSTEM_ROOT;
  * _init() collected had already become out of date (e.g., processes
  * which change UIDs (<-Samba), etc). */
 
-/* libtrash_init() is passed a pointer to a cfg structure (defined in trash.h), which it
- * uses to communicate to the wrapper which called it the current configuration settings: */
+/* Building a configuration is expensive (it reads the user's configuration
+ * file, looks up the user in the password database and resolves symbols), so
+ * the result is kept in a process-wide snapshot which is shared by all the
+ * wrappers and only rebuilt when one of its sources changes: the effective
+ * uid, the environment variables TRASH_OFF, UNCOVER_DIRS and TRASH_TRUST_HOME
+ * (and HOME, if the latter is set) or the identity
+ * (inode, size and mtime) of the personal configuration file. A snapshot is
+ * never modified after it has been built.
+ *
+ * Multithreaded programs (e.g., a pool of threads which keep writing and rotating files) call
+ * the wrappers concurrently, so reading the current snapshot must not serialize them: a wrapper
+ * only ever does an atomic load of current_config, and never takes a lock unless the snapshot
+ * turns out to be out of date. Replacing it is done under config_lock by whichever thread
+ * noticed: it builds a new snapshot, swaps it into current_config and "retires" the old one,
+ * which other threads may still be using.
+ *
+ * Retired snapshots are free()d once no wrapper can still be holding them, using epochs: every
+ * thread has a reader_slot, in which libtrash_init() records the value of global_epoch when the
+ * wrapper starts and libtrash_fini() stores 0 when it is done. A snapshot is retired with the
+ * epoch current at the time it was swapped out, and global_epoch is then incremented; a wrapper
+ * which started in a later epoch can only have seen its replacement. So once every slot holds
+ * either 0 or an epoch newer than that of a retired snapshot, the latter can go. Nothing ever
+ * waits for that to happen: whoever replaces a snapshot, and the first wrapper to finish
+ * afterwards which finds config_lock free, simply free()s whatever can be free()d already. */
+
+static config *current_config = NULL; /* accessed atomically */
+
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long global_epoch = 1; /* accessed atomically; 0 means "not reading" */
 
-void libtrash_init(config *cfg)
+/* Snapshots which have been replaced, but might still be in use (protected by config_lock,
+ * except that libtrash_fini() peeks at whether there are any): */
+
+static config *retired_configs = NULL;
+
+/* Each slot takes a cache line of its own, so that threads don't slow each other down by
+ * writing to theirs. Slots are never free()d: when a thread exits its slot is handed to the
+ * next thread which needs one. */
+
+typedef struct reader_slot
 {
+	unsigned long epoch;		/* accessed atomically */
+	int in_use;			/* accessed atomically */
+	struct reader_slot *next;	/* never changes once the slot is in reader_slots */
+}
+__attribute__((aligned(64)))
+reader_slot;
 
-	/* Variables: */
+static reader_slot *reader_slots = NULL; /* accessed atomically */
+
+/* A thread which couldn't get a slot (we ran out of memory) counts itself here instead while
+ * it is inside a wrapper; nothing is free()d while this isn't 0: */
+
+static unsigned long unregistered_readers = 0;
+
+static __thread reader_slot *my_reader_slot = NULL;
+
+/* How many libtrash_init()s this thread is inside of; only the outermost one touches its slot: */
+
+static __thread int reader_depth = 0;
+
+static pthread_key_t reader_slot_key;
+
+static pthread_once_t reader_slot_key_once = PTHREAD_ONCE_INIT;
+
+static int reader_slot_key_ok = NO;
+
+/* Set while this thread is building a snapshot, so that a wrapper invoked by one of the
+ * functions build_config() calls doesn't try to take config_lock a second time: */
+
+static __thread int building_config = NO;
+
+/* Used when we can't even allocate memory for a snapshot (or can't build one at all): */
+
+static config failed_config;
+
+static pthread_once_t failed_config_once = PTHREAD_ONCE_INIT;
+
+/* How much arena the next snapshot gets: as much as the last one used, if that's more than
+ * ARENA_SIZE (protected by config_lock): */
+
+static size_t arena_size_hint = ARENA_SIZE;
+
+/* The generation of the last snapshot built (protected by config_lock): */
+
+static unsigned long last_generation = 0;
+
+/* fork() from a multithreaded program only duplicates the thread which calls it, so the child
+ * could inherit config_lock (or passwd_cache_lock, in helpers.c) locked by a thread which doesn't
+ * exist there, a snapshot half-way through being replaced, or reader slots which will never be
+ * cleared. So fork() takes both locks before it runs (waiting for a snapshot which is being
+ * built, if any) and releases them afterwards; in the child, the slots of the threads which didn't
+ * come along are also handed back. The snapshot itself is never modified, so the child goes on
+ * using the one it inherited, and only rebuilds it if the child changes its environment or its
+ * euid. The handlers are installed the first time libtrash needs any of this state. vfork() and
+ * posix_spawn() don't run them: a child which shares our memory only to exec() doesn't need
+ * them, and doesn't pay for them. */
+
+static pthread_once_t fork_handlers_once = PTHREAD_ONCE_INIT;
+
+static void install_fork_handlers(void);
+
+static void prepare_fork(void);
+
+static void parent_after_fork(void);
+
+static void child_after_fork(void);
+
+static void lock_ignore_patterns(int lock);
+
+static void init_failed_config(void);
+
+static config* replace_config(config *stale);
+
+static void reader_enter(void);
+
+static void reader_exit(void);
+
+static reader_slot* claim_reader_slot(void);
+
+static void create_reader_slot_key(void);
+
+static void release_reader_slot(void *slot);
+
+static void reclaim_retired_configs(void);
+
+static void build_config(config *cfg);
+
+static void free_config(config *cfg);
+
+static int config_still_valid(config *cfg);
+
+static int same_env_value(const char *cached, const char *current);
+
+static char* copy_env_value(config *cfg, const char *name);
+
+/* libtrash_init() returns a pointer to a cfg structure (defined in trash.h), which the wrapper
+ * which called it uses to learn the current configuration settings. The wrapper must hand
+ * that pointer back to libtrash_fini() once it is done with it: */
+
+config* libtrash_init(void)
+{
+	config *cfg = NULL;
+
+	reader_enter();
+
+	if (building_config)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "libtrash_init() invoked while building a configuration, returning failed_config.\n");
+#endif
+		pthread_once(&failed_config_once, init_failed_config);
+		return &failed_config;
+	}
+
+	cfg = __atomic_load_n(&current_config, __ATOMIC_SEQ_CST);
+
+	if (cfg && config_still_valid(cfg))
+		return cfg;
+
+	return replace_config(cfg);
+}
+
+/* Builds a new snapshot to replace stale (the one our caller found in current_config, or NULL if
+ * there was none), publishes it and returns it: */
+
+static config* replace_config(config *stale)
+{
+	config *cfg = NULL;
+	config *old = NULL;
+
+	register_fork_handlers();
+
+	pthread_mutex_lock(&config_lock);
+
+	/* Another thread might have replaced stale while we were waiting for the lock: */
+
+	cfg = __atomic_load_n(&current_config, __ATOMIC_SEQ_CST);
+
+	if (cfg && cfg != stale && config_still_valid(cfg))
+	{
+		pthread_mutex_unlock(&config_lock);
+		return cfg;
+	}
+
+#ifdef DEBUG
+	if (cfg)
+		fprintf(stderr, "Cached configuration is out of date, rebuilding it.\n");
+#endif
+
+	cfg = malloc(sizeof(config) + arena_size_hint);
+
+	if (!cfg)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to allocate memory for the configuration snapshot.\n");
+#endif
+		pthread_mutex_unlock(&config_lock);
+
+		pthread_once(&failed_config_once, init_failed_config);
+		return &failed_config;
+	}
+
+	cfg->arena_size = arena_size_hint;
+	cfg->arena_used = 0;
+	cfg->arena_overflow = NULL;
+
+	building_config = YES;
+	build_config(cfg);
+	building_config = NO;
+
+	/* (What a thread has worked out from a snapshot, and kept for itself, is only good for that
+	 * very snapshot; see dir_lists_of() in helpers.c:) */
+
+	cfg->generation = ++last_generation;
+
+	if (arena_total(cfg) > arena_size_hint)
+		arena_size_hint = arena_total(cfg);
+
+	/* Publish the new snapshot, then retire the old one in the epoch which is ending: */
+
+	old = __atomic_exchange_n(&current_config, cfg, __ATOMIC_SEQ_CST);
+
+	if (old)
+	{
+		old->retired_epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+		old->retired_next = retired_configs;
+		__atomic_store_n(&retired_configs, old, __ATOMIC_RELAXED);
+	}
+
+	__atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+
+	reclaim_retired_configs();
+
+	pthread_mutex_unlock(&config_lock);
+
+	return cfg;
+}
+
+/* Records in this thread's slot that it is using a snapshot, i.e., that nothing retired from
+ * now on may be free()d until reader_exit(). The slot must be written before current_config is
+ * read (hence the sequentially consistent store); everything else is cheap. */
+
+static void reader_enter(void)
+{
+	if (reader_depth++ > 0)
+		return;
+
+	if (!my_reader_slot)
+		my_reader_slot = claim_reader_slot();
+
+	if (my_reader_slot)
+		__atomic_store_n(&my_reader_slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	else
+		__atomic_add_fetch(&unregistered_readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void reader_exit(void)
+{
+	if (--reader_depth > 0)
+		return;
+
+	if (my_reader_slot)
+		__atomic_store_n(&my_reader_slot->epoch, 0, __ATOMIC_RELEASE);
+	else
+		__atomic_sub_fetch(&unregistered_readers, 1, __ATOMIC_RELEASE);
+}
+
+/* Finds a slot for this thread: one left behind by a thread which has exited, or a new one.
+ * Returns NULL if there's none and we can't allocate one. */
+
+static reader_slot* claim_reader_slot(void)
+{
+	reader_slot *slot = __atomic_load_n(&reader_slots, __ATOMIC_ACQUIRE);
+	void *memory = NULL;
+	int free_slot = 0;
+
+	for (; slot; slot = slot->next)
+	{
+		free_slot = 0;
+
+		if (!__atomic_load_n(&slot->in_use, __ATOMIC_RELAXED) &&
+				__atomic_compare_exchange_n(&slot->in_use, &free_slot, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if (!slot)
+	{
+		if (posix_memalign(&memory, sizeof(reader_slot), sizeof(reader_slot)))
+			return NULL;
+
+		slot = memory;
+		slot->epoch = 0;
+		slot->in_use = 1;
+		slot->next = __atomic_load_n(&reader_slots, __ATOMIC_RELAXED);
+
+		while (!__atomic_compare_exchange_n(&reader_slots, &slot->next, slot, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	/* Have the slot handed back when this thread exits: */
+
+	pthread_once(&reader_slot_key_once, create_reader_slot_key);
+
+	if (reader_slot_key_ok)
+		pthread_setspecific(reader_slot_key, slot);
+
+	return slot;
+}
+
+static void create_reader_slot_key(void)
+{
+	reader_slot_key_ok = !pthread_key_create(&reader_slot_key, release_reader_slot);
+}
+
+/* Runs in an exiting thread, which can't be inside a wrapper any more. If one of the other
+ * destructors calls a wrapper after this, the thread will simply claim a slot again. */
+
+static void release_reader_slot(void *slot)
+{
+	my_reader_slot = NULL;
 
-	struct passwd *userinfo = NULL;
+	__atomic_store_n(&((reader_slot *) slot)->epoch, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&((reader_slot *) slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* free()s every retired snapshot which no thread can still be using. Must be called with
+ * config_lock held. */
+
+static void reclaim_retired_configs(void)
+{
+	unsigned long oldest = (unsigned long) -1;
+	unsigned long epoch = 0;
+	reader_slot *slot = NULL;
+	config **link = &retired_configs;
+	config *cfg = NULL;
+
+	if (__atomic_load_n(&unregistered_readers, __ATOMIC_ACQUIRE))
+		return;
+
+	for (slot = __atomic_load_n(&reader_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next)
+	{
+		epoch = __atomic_load_n(&slot->epoch, __ATOMIC_ACQUIRE);
+
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	while ((cfg = *link) != NULL)
+	{
+		if (cfg->retired_epoch < oldest)
+		{
+			__atomic_store_n(link, cfg->retired_next, __ATOMIC_RELAXED);
+			free_config(cfg);
+		}
+		else
+			link = &cfg->retired_next;
+	}
+}
+
+void register_fork_handlers(void)
+{
+	pthread_once(&fork_handlers_once, install_fork_handlers);
+}
+
+static void install_fork_handlers(void)
+{
+	if (pthread_atfork(prepare_fork, parent_after_fork, child_after_fork))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to install the fork() handlers.\n");
+#endif
+	}
+}
+
+/* Locks are always taken in this order (build_config() looks up home dirs with config_lock held).
+ * A thread which is building a snapshot already holds config_lock, and nobody else can be inside
+ * the passwd cache, so if it fork()s (through some NSS module, say) we leave both alone. Other
+ * threads may still be matching paths against the current snapshot, or a retired one, though,
+ * so the locks of their IGNORE_RE patterns (see matches_pattern() in helpers.c), none of which
+ * is ever held along with another lock, are always taken. Either way config_lock is held by
+ * this thread, so the snapshots can't change under us: */
+
+static void prepare_fork(void)
+{
+	if (!building_config)
+	{
+		pthread_mutex_lock(&config_lock);
+		lock_passwd_cache();
+	}
+
+	lock_ignore_patterns(YES);
+}
+
+static void parent_after_fork(void)
+{
+	lock_ignore_patterns(NO);
+
+	if (building_config)
+		return;
+
+	unlock_passwd_cache();
+	pthread_mutex_unlock(&config_lock);
+}
+
+static void child_after_fork(void)
+{
+	reader_slot *slot = NULL;
+
+	/* Only this thread made it into the child: whatever the others were reading, they won't
+	 * be reading it here. */
+
+	for (slot = __atomic_load_n(&reader_slots, __ATOMIC_RELAXED); slot; slot = slot->next)
+		if (slot != my_reader_slot)
+		{
+			__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&slot->in_use, 0, __ATOMIC_RELAXED);
+		}
+
+	__atomic_store_n(&unregistered_readers, (reader_depth > 0 && !my_reader_slot) ? 1 : 0, __ATOMIC_RELAXED);
+
+	real_functions_after_fork();
+
+	lock_ignore_patterns(NO);
+
+	if (building_config)
+		return;
+
+	unlock_passwd_cache();
+	pthread_mutex_unlock(&config_lock);
+}
+
+/* Takes (lock = YES) or releases (NO) the locks of the compiled IGNORE_RE patterns of every
+ * snapshot a thread may be matching paths against: the current one and the retired ones which
+ * haven't been free()d yet. Must be called with config_lock held. */
+
+static void lock_ignore_patterns(int lock)
+{
+	config *current = __atomic_load_n(&current_config, __ATOMIC_SEQ_CST);
+	config *cfg = NULL;
+
+	/* (current isn't in the list:) */
+
+	for (cfg = current ? current : retired_configs; cfg; cfg = (cfg == current) ? retired_configs : cfg->retired_next)
+	{
+		if (lock)
+			lock_ignore_re(cfg);
+		else
+			unlock_ignore_re(cfg);
+	}
+}
+
+/* Fills in failed_config, which has general_failure set and nothing else but the pointers
+ * to the real functions: */
+
+static void init_failed_config(void)
+{
+	failed_config.in_case_of_failure = IN_CASE_OF_FAILURE;
+	failed_config.general_failure = YES;
+	failed_config.real_unlink = get_real_function(UNLINK);
+	failed_config.real_rename = get_real_function(RENAME);
+	failed_config.real_fopen = get_real_function(FOPEN);
+}
+
+/* This function checks whether the snapshot cfg still reflects the current state of the
+ * sources it was built from. Snapshots built after a general failure are never reused, so
+ * that we keep retrying (just like we did before snapshots were introduced). */
+
+static int config_still_valid(config *cfg)
+{
+	file_identity identity;
+
+	long long now;
+
+	if (cfg->general_failure)
+		return NO;
+
+	/* A snapshot built for an account listed in IGNORE_USERS or IGNORE_UIDS does for any such
+	 * account, whatever its environment says, for as long as the system-wide configuration file
+	 * doesn't change: a lookup in the hash set, and a stat() per tick of the coarse clock. */
+
+	if (cfg->user_ignored)
+	{
+		if (!uid_ignored(cfg, geteuid()))
+			return NO;
+
+		now = coarse_nanoseconds();
+
+		if (__atomic_load_n(&cfg->conf_checked, __ATOMIC_RELAXED) != now)
+		{
+			get_file_identity(SYSTEM_CONF_FILE, &identity);
+
+			if (!same_file_identity(&identity, &cfg->system_conf_identity))
+				return NO;
+
+			__atomic_store_n(&cfg->conf_checked, now, __ATOMIC_RELAXED);
+		}
+
+		return YES;
+	}
+
+	if (cfg->euid != geteuid())
+		return NO;
+
+	if (!same_env_value(cfg->env_trash_off, getenv("TRASH_OFF")) ||
+			!same_env_value(cfg->env_uncover_dirs, getenv("UNCOVER_DIRS")) ||
+			!same_env_value(cfg->env_trust_home, getenv("TRASH_TRUST_HOME")) ||
+			(cfg->env_trust_home && !same_env_value(cfg->env_home, getenv("HOME"))))
+		return NO;
+
+	if (cfg->libtrash_off) /* the configuration file wasn't even read */
+		return YES;
+
+	/* Both configuration files are stat()ed at most once per tick of the coarse clock (as is the
+	 * control page looked for, if there was none): a burst of calls shares a single pair of stat()s,
+	 * and an edit is still noticed within a few milliseconds.
+	 * (Two threads may race to do the check; that only costs a redundant stat().) */
+
+	now = coarse_nanoseconds();
+
+	if (__atomic_load_n(&cfg->conf_checked, __ATOMIC_RELAXED) != now)
+	{
+		get_file_identity(cfg->conf_file_path, &identity);
+
+		if (!same_file_identity(&identity, &cfg->conf_identity))
+			return NO;
+
+		get_file_identity(SYSTEM_CONF_FILE, &identity);
+
+		if (!same_file_identity(&identity, &cfg->system_conf_identity))
+			return NO;
+
+		/* libtrash-ctl may have created the control page since we last looked for it: */
+
+		if (!cfg->control && control_page_appeared(cfg->euid))
+			return NO;
+
+		__atomic_store_n(&cfg->conf_checked, now, __ATOMIC_RELAXED);
+	}
+
+	/* The trash can might have been removed since the snapshot was built. We don't look every
+	 * time (save_in_trash() notices if it happened), only once every trash_check_interval seconds: */
+
+	if (trash_dirs_need_check(cfg) && !trash_dirs_ok(cfg, NO))
+		return NO;
+
+	return YES;
+}
+
+/* NULL-safe comparison between a cached copy of an environment variable and its current value: */
+
+static int same_env_value(const char *cached, const char *current)
+{
+	if (cached == NULL || current == NULL)
+		return cached == current;
+
+	return !strcmp(cached, current);
+}
+
+/* Returns a copy (in the arena of cfg) of the environment variable name, or NULL if it isn't set
+ * (or if we run out of memory, in which case the snapshot will simply be considered stale next time): */
+
+static char* copy_env_value(config *cfg, const char *name)
+{
+	char *value = getenv(name);
+
+	return value ? arena_strdup(cfg, value) : NULL;
+}
+
+/* build_config() fills in a freshly allocated snapshot: */
+
+static void build_config(config *cfg)
+{
+
+	/* Variables: */
 
 	char *tmp = NULL;
 
+	/* 0- Identity of the sources this snapshot is built from (see config_still_valid()): */
+
+	cfg->euid = geteuid();
+
+	/* Is this one of the accounts listed in IGNORE_USERS or IGNORE_UIDS? That only depends on the
+	 * system-wide configuration file, which is stat()ed before it is read: */
+
+	get_file_identity(SYSTEM_CONF_FILE, &cfg->system_conf_identity);
+
+	cfg->user_ignored = euid_ignored(cfg);
+
+	/* The run-time control page of this euid, which the wrappers consult on every call (even if
+	 * building the rest of the snapshot fails). An ignored account has no use for it: */
+
+	cfg->control = cfg->user_ignored ? NULL : map_control_page(cfg->euid);
+
+	cfg->env_trash_off = copy_env_value(cfg, "TRASH_OFF");
+
+	cfg->env_uncover_dirs = copy_env_value(cfg, "UNCOVER_DIRS");
+
+	cfg->env_trust_home = copy_env_value(cfg, "TRASH_TRUST_HOME");
+
+	cfg->env_home = cfg->env_trust_home ? copy_env_value(cfg, "HOME") : NULL;
+
+	cfg->conf_file_path = NULL;
+
+	memset(&cfg->conf_identity, 0, sizeof(file_identity));
+
+	cfg->conf_checked = 0;
+
+	cfg->policy_image = NULL;
+
+	cfg->policy_map = NULL;
+
+	cfg->policy_map_len = 0;
+
+	cfg->policy_fd = -1;
+
 	cfg->in_case_of_failure = IN_CASE_OF_FAILURE;
 
 	/* Holds a regular expression which causes files matching this r.e. to be
@@ -89,6 +699,12 @@ void libtrash_init(config *cfg)
 
 	cfg->ignore_re = default_ignore_re;
 
+	/* Holds a list of shell-style patterns which cause the files whose paths match them to be
+	 * ignored by libtrash:
+	 */
+
+	cfg->ignore_glob = default_ignore_glob;
+
 	/* Holds a list of file name extensions which cause files of these types to be ignored
 	 * by libtrash:
 	 */
@@ -178,7 +794,7 @@ void libtrash_init(config *cfg)
 
 	cfg->absolute_trash_system_root = NULL;
 
-	/* (The following paths need only be accessed by libtrash_init() and get_config_from_file().) */
+	/* (The following paths need only be accessed by build_config() and get_config_from_file().) */
 
 	/* Name of directory under the user's home directory in which we store deleted files (i.e., "trash can"): */
 
@@ -209,13 +825,46 @@ void libtrash_init(config *cfg)
 
 	cfg->intercept_open   = INTERCEPT_OPEN;
 
-	/* Used by libtrash_init() to signal to the called functions that libtrash is disabled either at the request of the
+	/* Used by build_config() to signal to the called functions that libtrash is disabled either at the request of the
 	   user or because a serious error occurred: */
 
 	cfg->libtrash_off = NO;
 
 	cfg->general_failure = NO;
 
+	/* 0 means that PRESERVE_FILES_LARGER_THAN isn't in use (get_config_from_file() changes it if the user set it): */
+
+	cfg->preserve_files_larger_than_limit = 0;
+
+	/* How often we make sure that the trash can is still there (see config_still_valid()): */
+
+	cfg->trash_check_interval = TRASH_CHECK_INTERVAL;
+
+	cfg->trash_dirs_checked = 0;
+
+	/* Set once all the lists are known (see mark_baked_lists()): */
+
+	cfg->baked_lists = 0;
+
+	/* Built once all the lists are known (see build_dir_trie(), build_extension_set(),
+	 * compile_ignore_re() and compile_ignore_glob()): */
+
+	cfg->dir_trie = NULL;
+
+	cfg->dir_trie_nodes = 0;
+
+	cfg->extension_set = NULL;
+
+	cfg->ignore_patterns = NULL;
+
+	cfg->ignore_pattern_count = 0;
+
+	cfg->ignore_re_dfa = NULL;
+
+	cfg->glob_patterns = NULL;
+
+	cfg->glob_pattern_count = 0;
+
 	/* These are pointers to the GNU libc functions which we need to do our own stuff: */
 
 	cfg->real_unlink = get_real_function(UNLINK); /* used in move() */
@@ -235,6 +884,18 @@ void libtrash_init(config *cfg)
 		return;
 	}
 
+	/* An ignored account gets a snapshot in which libtrash is off, and nothing else: */
+
+	if (cfg->user_ignored)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "uid %ld is listed in IGNORE_USERS or IGNORE_UIDS, setting libtrash_off.\n", (long) cfg->euid);
+#endif
+		cfg->libtrash_off = YES;
+
+		return;
+	}
+
 	/* Has the user asked us to become temporarily inactive by setting the environment variable TRASH_OFF to
 	   YES? */
 
@@ -259,18 +920,65 @@ void libtrash_init(config *cfg)
 #ifdef DEBUG
 		fprintf(stderr, "UNCOVER_DIRS is set, directories %s won't be considered \"unremovable\".\n", tmp);
 #endif
-		cfg->uncovered_dirs = malloc(strlen(tmp) + 1);
-
-		if (cfg->uncovered_dirs) /* if malloc() failed, there's nothing we can do so
-					  * we just leave the pointer set to NULL -- that will
-					  * be interpreted as meaning that there are no uncovered dirs */
-		{
-			strcpy(cfg->uncovered_dirs, tmp);
-		}
+		cfg->uncovered_dirs = arena_strdup(cfg, tmp); /* if that failed, there's nothing we can do so
+							       * we just leave the pointer set to NULL -- that will
+							       * be interpreted as meaning that there are no uncovered dirs */
 	}
 
 	/* ------------------------------------------- */
 
+#ifdef POLICY_INHERIT
+	/* If our parent (or some other ancestor) handed us a compiled policy which still matches the
+	 * configuration files, we use it and skip everything up to the check of the trash can,
+	 * looking up the home dir included: */
+
+	if (policy_inherit(cfg))
+		goto check_trash_dirs;
+#endif
+
+	/* Find out the user's home directory. This is the only place where we do so (besides
+	 * policy_inherit(), in some cases): everything else which needs it (reading the configuration file, building absolute paths) uses
+	 * cfg->home. get_home_dir() remembers the answer, so that rebuilding a snapshot doesn't
+	 * mean asking the password database again. */
+
+	tmp = get_home_dir(cfg->euid);
+
+	if (tmp)
+	{
+		cfg->home = arena_strdup(cfg, tmp);
+		free(tmp);
+	}
+
+	/* Remember which configuration file we are about to read (the user's own one, which is layered
+	 * on top of the system-wide one, stat()ed above), and its identity. We stat() it before
+	 * reading it, so that a change which happens while we read it is noticed the next time
+	 * this snapshot is validated: */
+
+	if (cfg->home)
+	{
+		cfg->conf_file_path = personal_conf_path(cfg, cfg->home);
+
+		if (cfg->conf_file_path)
+			get_file_identity(cfg->conf_file_path, &cfg->conf_identity);
+	}
+
+	if (!cfg->conf_file_path)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to determine the path to the configuration file.\ngeneral_failure set.\n");
+#endif
+		cfg->general_failure = YES;
+		return;
+	}
+
+#ifdef POLICY_CACHE
+	/* If a compiled policy matching this configuration file is available, use it instead of
+	 * parsing the file and building the paths ourselves: */
+
+	if (policy_load(cfg, cfg->home)) /* cfg->home now points into the image */
+		goto check_trash_dirs;
+#endif
+
 	/* Override compile-time defaults with values from the user-specific configuration file: */
 
 	get_config_from_file(cfg);
@@ -279,7 +987,7 @@ void libtrash_init(config *cfg)
 
 	if (strlen(cfg->user_temporary_dirs) > 0)
 	{
-		tmp = convert_relative_into_absolute_paths(cfg->user_temporary_dirs);
+		tmp = convert_relative_into_absolute_paths(cfg, cfg->user_temporary_dirs, cfg->home);
 
 		if (tmp)
 			cfg->user_temporary_dirs = tmp;
@@ -289,23 +997,14 @@ void libtrash_init(config *cfg)
 			fprintf(stderr, "convert_relative_into_absolute_paths failed.\n");
 #endif
 
-			/* Free memory allocated inside get_config_from_files() which should be free()d inside this function: */
-
-			if (cfg->relative_trash_can != default_relative_trash_can)
-				free(cfg->relative_trash_can);
-
-			if (cfg->relative_trash_system_root != default_relative_trash_system_root)
-				free(cfg->relative_trash_system_root);
-
 			cfg->general_failure = YES;
 
 			return;
 		}
 	}
 
-	/* (All the configuration variables are by now set. The allocated memory which needs to be free()d will
-	   be deallocated in libtrash_fini(), except for relative_trash_(can|system_root), which will be free()d before
-	   this function (libtrash_init()) returns.) */
+	/* (All the configuration variables are by now set. Whatever they point to which isn't a compile-time
+	   default lives in the arena of cfg, which goes away with it in free_config().) */
 
 #ifdef DEBUG
 	fprintf(stderr,
@@ -332,8 +1031,10 @@ void libtrash_init(config *cfg)
 			"REMOVABLE_MEDIA_MOUNT_POINTS:      %s\n"
 			"EXCEPTIONS:                        %s\n"
 			"IGNORE_RE:                         %s\n"
+			"IGNORE_GLOB:                       %s\n"
 			"UNCOVER_DIRS:                      %s\n"
-			"PRESERVE_FILES_LARGER_THAN:        %llu\n\n",
+			"PRESERVE_FILES_LARGER_THAN:        %llu\n"
+			"TRASH_CHECK_INTERVAL:              %d\n\n",
 		cfg->relative_trash_can, cfg->in_case_of_failure, cfg->should_warn, cfg->ignore_hidden,
 		cfg->ignore_editor_backup, cfg->ignore_editor_temporary, cfg->protect_trash, cfg->global_protection,
 		cfg->relative_trash_system_root, cfg->temporary_dirs, cfg->user_temporary_dirs, cfg->unremovable_dirs,
@@ -343,96 +1044,40 @@ void libtrash_init(config *cfg)
 		cfg->removable_media_mount_points,
 		cfg->exceptions,
 		*cfg->ignore_re != '\0' ? cfg->ignore_re : "not set",
+		*cfg->ignore_glob != '\0' ? cfg->ignore_glob : "not set",
 		cfg->uncovered_dirs != NULL ? cfg->uncovered_dirs : "not set",
-		cfg->preserve_files_larger_than_limit);
+		cfg->preserve_files_larger_than_limit,
+		cfg->trash_check_interval);
 #endif
 
 	/* ------------------------------------------------------ */
 
 	/* Things left to do:
-	 * Get information about the user, form two strings containing the absolute
-	 * pathname of the trash can and the relative_trash_system_root under it (if global_protection
-	 * is set), see if those dirs exist (try to create it them they don't) and store the user's
-	 * login and home directory in memory.
+	 * Form two strings containing the absolute pathname of the trash can and the
+	 * relative_trash_system_root under it (if global_protection is set) and see if those
+	 * dirs exist (try to create it them they don't).
 	 */
 
-	/* I got this from (2) getlogin()'s man page: */
-
-	userinfo = getpwuid(geteuid());
-
-	if (!userinfo)
-	{
-#ifdef DEBUG
-		fprintf(stderr, "Unable to determine necessary data about the user.\ngeneral_failure set.\n");
-#endif
-		/* Free memory allocated inside get_config_from_files() which should be free()d inside this function: */
-
-		if (cfg->relative_trash_can != default_relative_trash_can)
-			free(cfg->relative_trash_can);
-
-		if (cfg->relative_trash_system_root != default_relative_trash_system_root)
-			free(cfg->relative_trash_system_root);
-
-		cfg->general_failure = YES;
-		return;
-	}
-
-	/* Information which the functions we will be overriding need: home, absolute_trash_can and
+	/* Information which the functions we will be overriding need: absolute_trash_can and
 	 * possibly absolute_trash_system_root. */
 
-	/* This memory will be free()d in libtrash_fini() : */
-
-	cfg->home = malloc(strlen(userinfo->pw_dir) + 1);
-
-	cfg->absolute_trash_can = malloc(strlen(userinfo->pw_dir) + 1 + strlen(cfg->relative_trash_can) + 1);
+	cfg->absolute_trash_can = arena_alloc(cfg, strlen(cfg->home) + 1 + strlen(cfg->relative_trash_can) + 1);
 
 	if (cfg->global_protection)
-		cfg->absolute_trash_system_root = malloc(strlen(userinfo->pw_dir) + 1 + strlen(cfg->relative_trash_can)
+		cfg->absolute_trash_system_root = arena_alloc(cfg, strlen(cfg->home) + 1 + strlen(cfg->relative_trash_can)
 				+ 1 + strlen(cfg->relative_trash_system_root) + 1);
 
-	if (!cfg->home || !cfg->absolute_trash_can ||
+	if (!cfg->absolute_trash_can ||
 			(cfg->global_protection && !cfg->absolute_trash_system_root))
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Unable to allocate sufficient memory.\ngeneral_failure set.\n");
 #endif
-		/* Free any successfully allocated memory and point the respective pointer to NULL, so that libtrash_fini() doesn't
-		   try to free() that memory again: */
-
-		if (cfg->home)
-		{
-			free(cfg->home);
-			cfg->home = NULL;
-		}
-
-		if (cfg->absolute_trash_can)
-		{
-			free(cfg->absolute_trash_can);
-			cfg->absolute_trash_can = NULL;
-		}
-
-		if (cfg->absolute_trash_system_root)
-		{
-			free(cfg->absolute_trash_system_root);
-			cfg->absolute_trash_system_root = NULL;
-		}
-
-		/* Free memory previously allocated inside get_config_from_files() (no need to point it to NULL since libtrash_fini() never
-		   tries to free() the memory these pointers point at): */
-
-		if (cfg->relative_trash_can != default_relative_trash_can)
-			free(cfg->relative_trash_can);
-
-		if (cfg->relative_trash_system_root != default_relative_trash_system_root)
-			free(cfg->relative_trash_system_root);
-
 		cfg->general_failure = YES;
 
 		return;
 	}
 
-	strcpy(cfg->home, userinfo->pw_dir);
-
 	strcpy(cfg->absolute_trash_can, cfg->home);
 	strcat(cfg->absolute_trash_can, "/");
 	strcat(cfg->absolute_trash_can, cfg->relative_trash_can);
@@ -444,41 +1089,66 @@ void libtrash_init(config *cfg)
 		strcat(cfg->absolute_trash_system_root, cfg->relative_trash_system_root);
 	}
 
-	/* This is a good time to free() the memory pointed to by relative_trash_can and relative_trash_system_root,
-	 * if they are pointing to dynamically allocated memory: we have already used the information they contain. */
+#ifdef POLICY_CACHE
+check_trash_dirs:
+#endif
+#ifdef BAKED_POLICY
+	/* Whichever way the lists were arrived at, note those which are still the ones baked in: */
+
+	mark_baked_lists(cfg);
+
+#endif
+	/* Compile all the directory lists into a single trie, ignore_extensions into a hash set, the
+	 * patterns in ignore_re into regex_ts and those in ignore_glob into lists of segments (see
+	 * build_dir_trie(), build_extension_set(), compile_ignore_re() and compile_ignore_glob()).
+	 * A compiled image comes with the first two already built (see policy_split_lists()): */
+
+#ifdef POLICY_CACHE
+	policy_split_lists(cfg);
+#endif
+
+	if (!cfg->dir_trie)
+		build_dir_trie(cfg);
 
-	if (cfg->relative_trash_can != default_relative_trash_can)
-		free(cfg->relative_trash_can);
+	if (!cfg->extension_set)
+		build_extension_set(cfg);
 
-	if (cfg->relative_trash_system_root != default_relative_trash_system_root)
-		free(cfg->relative_trash_system_root);
+	compile_ignore_re(cfg);
+
+	compile_ignore_glob(cfg);
+
+#ifdef POLICY_CACHE
+	/* Unless that's where it came from, store the result in compiled form, so that other processes
+	 * can skip all the work above: */
+
+	if (!cfg->policy_image)
+		policy_save(cfg, cfg->home);
+#endif
+
+#ifdef POLICY_INHERIT
+	/* and hand it down to the programs we exec() (unless we inherited it ourselves): */
+
+	if (!cfg->policy_map)
+		policy_publish(cfg);
+#endif
 
 	/* Now we will check the existence and permissions of absolute_trash_can and, if
 	 * global_protection is set, absolute_trash_system_root, and create them if they don't
-	 * already exist:
+	 * already exist. trash_dirs_ok() also records their identity, which later checks compare to:
 	 */
 
-	if (!dir_ok(cfg->absolute_trash_can, NULL))
+	if (!trash_dirs_ok(cfg, YES))
 	{
 #ifdef DEBUG
-		fprintf(stderr, "The TRASH_CAN dir (%s) either doesn't exist (and its creation failed) or has insufficient "
-				"permissions which we were unable to change.\ngeneral_failure set.\n", cfg->absolute_trash_can);
+		fprintf(stderr, "The TRASH_CAN dir (%s) or the TRASH_CAN/SYSTEM_ROOT dir (%s) either doesn't exist (and its creation "
+				"failed) or has insufficient permissions which we were unable to change.\ngeneral_failure set.\n",
+				cfg->absolute_trash_can, cfg->global_protection ? cfg->absolute_trash_system_root : "not used");
 #endif
 		cfg->general_failure = YES;
 		return;
 	}
 
-	if (cfg->global_protection && !dir_ok(cfg->absolute_trash_system_root, NULL))
-	{
-#ifdef DEBUG
-		fprintf(stderr, "The TRASH_CAN/SYSTEM_ROOT dir (%s) either doesn't exist (and its creation failed) or has insufficient "
-				"permissions which we were unable to change.\ngeneral_failure set.\n", cfg->absolute_trash_system_root);
-#endif
-		cfg->general_failure = YES;
-		return;
-	}
-
-	/* We know everything we need to know. libtrash_init() is done. */
+	/* We know everything we need to know. build_config() is done. */
 
 	return;
 }
@@ -486,55 +1156,62 @@ void libtrash_init(config *cfg)
 /* -------------------------------  */
 
 /* Just like libtrash_init(), this function is always invoked by the wrapper functions before quitting. Its
-   only task is freeing malloc()ed memory: */
+   only task is telling the other threads that the wrapper is done with the configuration snapshot: */
 
 void libtrash_fini(config *cfg)
 {
+	/* The wrappers call us after invoking the real functions, so we mustn't clobber the errno they set: */
+
+	int saved_errno = errno;
 
 	/* If libtrash is disabled and the user wishes to be informed, tell him about it: */
 
-	if (cfg->libtrash_off && cfg->should_warn)
+	if (cfg->libtrash_off && cfg->should_warn && !cfg->user_ignored)
 		fprintf(stderr, "%s\n", WARNING_STRING);
 
-	/* The only thing we need to do is free() the dynamically allocated buffers: */
+	reader_exit();
 
-	if (cfg->absolute_trash_can != NULL)
-		free(cfg->absolute_trash_can);
+	/* If there are snapshots waiting to be free()d, see whether we can do it now (unless another
+	 * thread is already busy with config_lock, in which case it will): */
 
-	if (cfg->absolute_trash_system_root != NULL)
-		free(cfg->absolute_trash_system_root);
+	if (__atomic_load_n(&retired_configs, __ATOMIC_RELAXED) != NULL && reader_depth == 0 &&
+			!building_config && pthread_mutex_trylock(&config_lock) == 0)
+	{
+		reclaim_retired_configs();
+		pthread_mutex_unlock(&config_lock);
+	}
 
-	if (cfg->home != NULL)
-		free(cfg->home);
+	errno = saved_errno;
 
-	if (cfg->temporary_dirs != default_temporary_dirs)
-		free(cfg->temporary_dirs);
+	return;
+}
 
-	if (cfg->user_temporary_dirs != default_user_temporary_dirs)
-		free(cfg->user_temporary_dirs);
+/* -------------------------------- */
 
-	if (cfg->unremovable_dirs != default_unremovable_dirs)
-		free(cfg->unremovable_dirs);
+/* This function free()s a snapshot once nobody references it any more: */
 
-	if (cfg->uncovered_dirs != NULL)
-		free(cfg->uncovered_dirs);
+static void free_config(config *cfg)
+{
+	/* Every string the snapshot owns lives either in its arena or, if the policy came from a
+	 * compiled image, inside the mapping of that image; the rest point to the compile-time
+	 * defaults. So all we have to undo are the two mappings, the memfd we hand down to the
+	 * programs we exec(), the compiled IGNORE_RE patterns and the arena: */
 
-	if (cfg->removable_media_mount_points != default_removable_media_mount_points)
-		free(cfg->removable_media_mount_points);
+	if (cfg->control != NULL)
+		munmap((void *) cfg->control, sizeof(control_page));
 
-	if (cfg->exceptions != default_exceptions)
-		free(cfg->exceptions);
+	if (cfg->policy_map != NULL)
+		munmap(cfg->policy_map, cfg->policy_map_len);
 
-	if (cfg->ignore_extensions != default_ignore_extensions)
-		free(cfg->ignore_extensions);
+#ifdef POLICY_INHERIT
+	policy_release(cfg);
+#endif
 
-	if (cfg->ignore_re != default_ignore_re)
-		free(cfg->ignore_re);
+	free_ignore_re(cfg);
 
-	/* DON'T free() relative_trash_(can|system_root)! The memory they point to has already been free()d by
-	 * libtrash_init() before returning. */
+	arena_free(cfg);
 
-	return;
+	free(cfg);
 }
 
 /* -------------------------------- */
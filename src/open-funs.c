@@ -100,43 +100,40 @@ FdOrFp;
 
 static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...);
 
-/* -------------------- */
-/* Make function pointers global */
-static FILE* (*real_fopen) (const char *path, const char *mode) = NULL;
-static FILE* (*real_fopen64) (const char *path, const char *mode) = NULL;
-static FILE* (*real_freopen) (const char *path, const char *mode, FILE *stream) = NULL;
-static FILE* (*real_freopen64) (const char *path, const char *mode, FILE *stream) = NULL;
-static int (*real_open) (const char *path, int flags, ...) = NULL;
-static int (*real_open64) (const char *path, int flags, ...) = NULL;
+/* These are the types of the real functions, whose addresses get_real_function() keeps for us: */
+
+typedef FILE* (*fopen_function) (const char *path, const char *mode);
+typedef FILE* (*freopen_function) (const char *path, const char *mode, FILE *stream);
+typedef int (*open_function) (const char *path, int flags, ...);
 
 
 /* These are the definitions of the wrappers for the six glibc functions we override: */
 
-FILE* fopen(const char *path, const char *mode)
+PUBLIC FILE* fopen(const char *path, const char *mode)
 {
 	FdOrFp retval = do_fopen_or_freopen_or_open(FOPEN, path, mode);
 	return retval.fp; /* returns a file pointer */
 }
 
-FILE* fopen64(const char *path, const char *mode)
+PUBLIC FILE* fopen64(const char *path, const char *mode)
 {
 	FdOrFp retval = do_fopen_or_freopen_or_open(FOPEN64, path, mode);
 	return retval.fp; /* returns a file pointer */
 }
 
-FILE* freopen(const char *path, const char *mode, FILE *stream)
+PUBLIC FILE* freopen(const char *path, const char *mode, FILE *stream)
 {
 	FdOrFp retval = do_fopen_or_freopen_or_open(FREOPEN, path, mode, stream);
 	return retval.fp; /* returns a file pointer */
 }
 
-FILE* freopen64(const char *path, const char *mode, FILE *stream)
+PUBLIC FILE* freopen64(const char *path, const char *mode, FILE *stream)
 {
 	FdOrFp retval = do_fopen_or_freopen_or_open(FREOPEN64, path, mode, stream);
 	return retval.fp; /* returns a file pointer */
 }
 
-int open(const char *path, int flags, ...)
+PUBLIC int open(const char *path, int flags, ...)
 {
 	FdOrFp retval;
 	/* If (flags & O_CREAT) or (flags & O_TMPFILE), then a third argument should be available: */
@@ -155,7 +152,7 @@ int open(const char *path, int flags, ...)
 	return retval.fd; /* return an integer (file descriptor) */
 }
 
-int open64(const char *path, int flags, ...)
+PUBLIC int open64(const char *path, int flags, ...)
 {
 	FdOrFp retval;
 	/* If (flags & O_CREAT) or (flags & O_TMPFILE), then a third argument should be available: */
@@ -179,19 +176,19 @@ int open64(const char *path, int flags, ...)
  * with flags set to O_CREAT|O_WRONLY|O_TRUNC, we save some trouble by merely redirecting
  * these calls to the right wrapper defined above. */
 
-int creat(const char *pathname, mode_t mode)
+PUBLIC int creat(const char *pathname, mode_t mode)
 {
 	return open(pathname, O_CREAT | O_WRONLY| O_TRUNC, mode);
 }
 
-int creat64(const char *pathname, mode_t mode)
+PUBLIC int creat64(const char *pathname, mode_t mode)
 {  
 	return open64(pathname, O_CREAT | O_WRONLY| O_TRUNC, mode);
 }
 
 #ifdef AT_FUNCTIONS
 
-int openat(int dirfd, const char *arg_pathname, int flags, ...)
+PUBLIC int openat(int dirfd, const char *arg_pathname, int flags, ...)
 {
 	int retval = 0;
 	char *real_path = make_absolute_path_from_dirfd_relpath(dirfd, arg_pathname);
@@ -225,7 +222,7 @@ int openat(int dirfd, const char *arg_pathname, int flags, ...)
 
 /* See important comment above (on top of open()). */
 
-int openat64(int dirfd, const char *arg_pathname, int flags, ...)
+PUBLIC int openat64(int dirfd, const char *arg_pathname, int flags, ...)
 {
 	int retval = 0;
 	char *real_path = make_absolute_path_from_dirfd_relpath(dirfd, arg_pathname);
@@ -281,27 +278,26 @@ FdOrFp return_function_error(int function)
 FdOrFp return_real_function(int function, const char *path, mode_t mode, char *mode_str, int flags, FILE *stream)
 {
 	FdOrFp retval;
-	if (function == FOPEN)
-		retval.fp = (*real_fopen) (path, mode_str);
-	else if (function == FOPEN64)
-		retval.fp = (*real_fopen64) (path, mode_str);
-	else if (function == FREOPEN)
-		retval.fp = (*real_freopen) (path, mode_str, stream);
-	else if (function == FREOPEN64)
-		retval.fp = (*real_freopen64) (path, mode_str, stream);
-	else if (function == OPEN)
+	void *real_function = get_real_function(function); /* after the first call, this is just a load from a table */
+
+	/* If we couldn't get a pointer to the real function, there's nothing else we can do: */
+	if (!real_function)
 	{
-		if (flags & O_CREAT || flags & O_TMPFILE)
-			retval.fd = (*real_open) (path, flags, mode);
-		else
-			retval.fd = (*real_open) (path, flags);
+		retval = return_function_error(function);
+		errno = 0;
+		return retval;
 	}
-	else if (function == OPEN64)
+
+	if (function == FOPEN || function == FOPEN64)
+		retval.fp = ((fopen_function) real_function) (path, mode_str);
+	else if (function == FREOPEN || function == FREOPEN64)
+		retval.fp = ((freopen_function) real_function) (path, mode_str, stream);
+	else /* if (function == OPEN || function == OPEN64) */
 	{
 		if (flags & O_CREAT || flags & O_TMPFILE)
-			retval.fd = (*real_open64) (path, flags, mode);
+			retval.fd = ((open_function) real_function) (path, flags, mode);
 		else
-			retval.fd = (*real_open64) (path, flags);
+			retval.fd = ((open_function) real_function) (path, flags);
 	}
 	return retval;
 }
@@ -323,6 +319,7 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 	int error = 0;
 	char *absolute_path = NULL;
 	int file_should = 0;
+	uint64_t control_flags = 0;
 	FdOrFp return_value;
 
 #ifdef DEBUG
@@ -334,12 +331,12 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 	const char *function_name = NULL;
 #endif
 
-	config cfg;
+	config *cfg = NULL;
 
 	/* This function is different from unlink() and rename(), because it gets invoked by glibc functions called by libtrash_init().
 	 * In order to avoid an infinite loop, we mustn't call libtrash_init() in those situations, but rather invoke the real open
-	 * function. For that reason, this function needs to get a pointer to the "real function" it is playing all by itself
-	 * (that is one of the jobs libtrash_init() does for the other functions).
+	 * function directly (return_real_function() gets a pointer to it from get_real_function(), which doesn't depend on
+	 * libtrash_init() at all).
 	 * How does this function avoid calling libtrash_init() when it has been called by one of the glibc functions called by libtrash_init()?
 	 * Fortunately, those functions only need to open files in read-only mode, so we can simply quit before calling libtrash_init()
 	 * if we were asked to open a file in read-mode, thereby avoiding this problem. If, in the future, the glibc functions
@@ -347,32 +344,12 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 	 * think of a better (and thread-safe) solution.
 	 */
 
-	/* First, get a pointer to the real functions: (if this fails, we quit because
-	 * there's nothing else we can do) */
-	if (function == FOPEN && !( real_fopen = get_real_function(function) ) )
-		error = 1;
-	else if (function == FOPEN64 && !( real_fopen64 = get_real_function(function) ) )
-		error = 1;
-	else if (function == FREOPEN && !( real_freopen = get_real_function(function) ) )
-		error = 1;
-	else if (function == FREOPEN64 && !( real_freopen64 = get_real_function(function) ) )
-		error = 1;
-	else if (function == OPEN && !( real_open = get_real_function(function) ) ) 
-		error = 1;
-	else if (function == OPEN64 && !( real_open64 = get_real_function(function) ) )
-		error = 1;
-
-	if (error) {
-		return_value = return_function_error(function);
-		errno = 0;
-		goto done;
-	}
 	/* Get the missing arguments and store them in the above mentioned variables: */
 
 	va_start(arg_list, path);
 	if (function == FOPEN || function == FREOPEN || function == FOPEN64 || function == FREOPEN64)
 		mode_str = va_arg(arg_list, char*);
-	if (function == FOPEN || function == FREOPEN)
+	if (function == FREOPEN || function == FREOPEN64)
 		stream = va_arg(arg_list, FILE*);
 	if (function == OPEN || function == OPEN64)
 	{
@@ -417,31 +394,34 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 	}
 
 	/* First we call libtrash_init(), which will set the configuration variables: */
-	libtrash_init(&cfg);
+	cfg = libtrash_init();
+
+	/* From this point on, we always leave through "done", where libtrash_fini() is called. */
+	/* Is cfg->libtrash_off set to true or cfg->intercept_(real_function) set to false (or does the control page say so)? If so, just
+	 * invoke the real function: */
+	control_flags = CONTROL_FLAGS(cfg);
 
-	/* From this point on, we always call libtrash_fini() before quittting. */
-	/* Is cfg.libtrash_off set to true or cfg.intercept_(real_function) set to false? If so, just invoke the real function: */
-	if (cfg.libtrash_off || ((function == FOPEN || function == FOPEN64) ? !cfg.intercept_fopen : 
-				((function == FREOPEN || function == FREOPEN64) ? !cfg.intercept_freopen : !cfg.intercept_open) ))
+	if (cfg->libtrash_off || (control_flags & CONTROL_OFF) ||
+			((function == FOPEN || function == FOPEN64) ? (!cfg->intercept_fopen || (control_flags & CONTROL_NO_FOPEN)) :
+			 ((function == FREOPEN || function == FREOPEN64) ? (!cfg->intercept_freopen || (control_flags & CONTROL_NO_FREOPEN)) :
+			  (!cfg->intercept_open || (control_flags & CONTROL_NO_OPEN))) ))
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Passing request to the real function because libtrash_off = true or intercept_%s = false.\n", function_name);
 #endif
-		libtrash_fini(&cfg);
 		return_value = return_real_function(function, path, mode, mode_str, flags, stream);
 		goto done;
 	}
 
-	/* Is cfg.general_failure set? If so, invoke the error handler: */
-	if (cfg.general_failure)
+	/* Is cfg->general_failure set? If so, invoke the error handler: */
+	if (cfg->general_failure)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Invoking %s_handle_error() because general_failure is set.\n", function_name);
 #endif
-		libtrash_fini(&cfg);
-		if(cfg.in_case_of_failure == ALLOW_DESTRUCTION)
+		if(cfg->in_case_of_failure == ALLOW_DESTRUCTION)
 			return_value = return_real_function(function, path, mode, mode_str, flags, stream);
-		else {	/* if (cfg.in_case_of_failure == PROTECT) */
+		else {	/* if (cfg->in_case_of_failure == PROTECT) */
 			return_value = return_function_error(function);
 			errno = 0;
 		}
@@ -466,7 +446,6 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 			(!error && (function == OPEN || function == OPEN64) && 
 			 (flags & O_NOFOLLOW) && S_ISLNK(file_stat.st_mode) ) )
 	{
-		libtrash_fini(&cfg);
 		return_value = return_real_function(function, path, mode, mode_str, flags, stream);
 		goto done;
 	}
@@ -488,10 +467,9 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 #ifdef DEBUG
 		fprintf(stderr, "Unable to build absolute_path\nInvoking DO_HANDLE_ERROR() inside %s.\n", function_name);
 #endif
-		libtrash_fini(&cfg);
-		if(cfg.in_case_of_failure == ALLOW_DESTRUCTION)
+		if(cfg->in_case_of_failure == ALLOW_DESTRUCTION)
 			return_value = return_real_function(function, path, mode, mode_str, flags, stream);
-		else {	/* if (cfg.in_case_of_failure == PROTECT) */
+		else {	/* if (cfg->in_case_of_failure == PROTECT) */
 			return_value = return_function_error(function);
 			errno = 0;
 		}
@@ -505,7 +483,7 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 
 	/* We now need to decide whether to warrant protection to this file which is about to be truncated; we
 	 * do so by invoking the function decide_action() and analysing its return value: */
-	file_should = decide_action(absolute_path, &cfg);
+	file_should = decide_action(absolute_path, cfg);
 
 	switch (file_should)
 	{
@@ -515,7 +493,6 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 			fprintf(stderr, "decide_action() told %s() to permanently destroy file %s.\n", function_name, absolute_path);
 #endif
 			free(absolute_path);
-			libtrash_fini(&cfg);
 			return_value = return_real_function(function, path, mode, mode_str, flags, stream);
 			break;
 		case BE_LEFT_UNTOUCHED: /* free memory, return error code and DON'T call real function: */
@@ -524,7 +501,6 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 					absolute_path);
 #endif
 			free(absolute_path);
-			libtrash_fini(&cfg);
 			return_value = return_function_error(function); /* setting errno to EACCES so that the caller interprets this error as being due to "insufficient permissions" */
 			errno = EACCES;
 			break;
@@ -534,10 +510,7 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 			fprintf(stderr, "decide_action() told %s() to save a copy of %s in the trash can and then invoke the real function.\n",
 					function_name, absolute_path);
 #endif
-			if (found_under_dir(absolute_path, cfg.home))
-				error = graft_file(cfg.absolute_trash_can, absolute_path, cfg.home, &cfg);
-			else
-				error = graft_file(cfg.absolute_trash_system_root, absolute_path, NULL, &cfg);
+			error = save_in_trash(absolute_path, cfg);
 
 			free(absolute_path);
 			if (error) /* graft_file() failed, look at in_case_of_failure and decide what to do: */
@@ -545,10 +518,9 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 #ifdef DEBUG
 				fprintf(stderr, "graft_file() failed, %s() invoking DO_HANDLE_ERROR().\n", function_name);
 #endif
-				libtrash_fini(&cfg);
-				if(cfg.in_case_of_failure == ALLOW_DESTRUCTION)
+				if(cfg->in_case_of_failure == ALLOW_DESTRUCTION)
 					return_value = return_real_function(function, path, mode, mode_str, flags, stream);
-				else {	/* if (cfg.in_case_of_failure == PROTECT) */
+				else {	/* if (cfg->in_case_of_failure == PROTECT) */
 					return_value = return_function_error(function);
 					errno = 0;
 				}
@@ -565,11 +537,13 @@ static FdOrFp do_fopen_or_freopen_or_open(int function, const char *path, ...)
 					flags |= O_CREAT;
 					mode = file_stat.st_mode;
 				}
-				libtrash_fini(&cfg);
 				return_value = return_real_function(function, path, mode, mode_str, flags, stream);
 			}
 			break;
 	}
 done:
+	/* If we got hold of a configuration snapshot, release it (libtrash_fini() leaves errno untouched): */
+	if (cfg)
+		libtrash_fini(cfg);
 	return return_value;
 }
@@ -0,0 +1,326 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* This file implements lex_path(), the single pass over a path which decide_action() and
+ * decide_action_from_path() (in helpers.c) base all their tests on (see lexed_path in trash.h).
+ *
+ * lex_path_scalar() looks at the path a byte at a time. With --enable-simd-scan, on x86, there
+ * are two more versions, which look at it 16 (SSE2) or 32 (AVX2) bytes at a time: each block is
+ * compared with '/', '.' and '\0' at once, the comparisons are turned into bit masks, and the
+ * masks tell where the components end (the slashes), whether one of them starts with a '.' (a dot
+ * right after a slash, i.e. a "/.") and where the last dot is; only the components themselves
+ * are then looked at one by one, to tell whether the path is clean. The blocks are aligned, so
+ * that a load never crosses into a page the path doesn't reach (the bytes before the path and
+ * after its '\0' are loaded, but ignored). Which version is used is decided the first time
+ * lex_path() is called, from what the CPU supports (CPUID); in debug builds, every result of a
+ * vector version is checked against lex_path_scalar()'s. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "trash.h"
+
+#if defined(SIMD_SCAN) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_LEX_PATH 1
+#include <immintrin.h>
+#endif
+
+/* lex_path() goes through path once, recording where each of its components ends, where its
+ * basename and the extension of that start, whether any component but the first starts with a
+ * '.' and how long it is. It also tells whether path is "clean": whether it starts with a slash
+ * and contains no "//", "/./" or "/../", nor ends in "/", "/." or "/.." (the root dir itself
+ * isn't clean, then). */
+
+static void lex_path_scalar(const char *path, lexed_path *lexed)
+{
+	const char *c = path, *component = path, *dot = NULL;
+	unsigned count = 0;
+	int clean = (*path == '/'), hidden = NO;
+
+	for (;; c++)
+	{
+		if (*c == '/' || *c == '\0')
+		{
+			/* (The first component is the empty one before the leading slash:) */
+
+			if (count > 0 && (c == component ||
+						(component[0] == '.' && (c == component + 1 ||
+									 (component[1] == '.' && c == component + 2)))))
+				clean = NO;
+
+			if (count < LEXED_PATH_COMPONENTS)
+				lexed->component_end[count] = c - path;
+
+			count++;
+
+			if (*c == '\0')
+				break;
+
+			component = c + 1;
+			dot = NULL;
+		}
+		else if (*c == '.')
+		{
+			if (c == component && count > 0)
+				hidden = YES;
+
+			dot = c;
+		}
+	}
+
+	lexed->path = path;
+	lexed->length = c - path;
+	lexed->basename = component;
+	lexed->extension = (dot && dot[1] != '\0') ? dot + 1 : NULL;
+	lexed->extension_length = lexed->extension ? (size_t) (c - dot - 1) : 0;
+	lexed->hidden = hidden;
+	lexed->clean = clean;
+	lexed->component_count = count;
+}
+
+#ifdef VECTOR_LEX_PATH
+
+/* What the vector versions carry from one block to the next (offsets are from the start of the
+ * path): */
+
+typedef struct
+{
+	const char *path;
+	lexed_path *lexed;
+	unsigned count;
+	ptrdiff_t component;	/* where the current component starts */
+	ptrdiff_t dot;		/* the last '.' in it, or -1 */
+	int clean;
+	int hidden;
+	uint32_t carry;		/* 1 if the last byte of the previous block was a '/' */
+}
+lex_state;
+
+static inline int highest_bit(uint32_t mask)
+{
+	return 31 - __builtin_clz(mask);
+}
+
+/* The component which started at state->component ends at offset end: */
+
+static inline void end_component(lex_state *state, ptrdiff_t end)
+{
+	const char *component = state->path + state->component;
+	ptrdiff_t length = end - state->component;
+
+	if (state->count > 0 && (length == 0 ||
+				(component[0] == '.' && (length == 1 || (length == 2 && component[1] == '.')))))
+		state->clean = NO;
+
+	if (state->count < LEXED_PATH_COMPONENTS)
+		state->lexed->component_end[state->count] = end;
+
+	state->count++;
+	state->component = end + 1;
+	state->dot = -1;
+}
+
+/* Takes the slashes and dots of a block of width bytes which starts at offset (bit i of each
+ * mask stands for byte offset + i; the bytes which aren't part of the path have already been
+ * cleared): */
+
+static inline void lex_block(lex_state *state, ptrdiff_t offset, uint32_t slashes, uint32_t dots, int width)
+{
+	uint32_t dots_after = dots;
+
+	if (dots & ((slashes << 1) | state->carry))
+		state->hidden = YES;
+
+	state->carry = (slashes >> (width - 1)) & 1;
+
+	/* Only the dots after the last slash can be the one which starts the extension: */
+
+	if (slashes)
+		dots_after &= (~(uint32_t) 0 << highest_bit(slashes)) << 1;
+
+	for (; slashes; slashes &= slashes - 1)
+		end_component(state, offset + __builtin_ctz(slashes));
+
+	if (dots_after)
+		state->dot = offset + highest_bit(dots_after);
+}
+
+/* The '\0' is at offset end: */
+
+static inline void lex_finish(lex_state *state, ptrdiff_t end)
+{
+	lexed_path *lexed = state->lexed;
+	ptrdiff_t basename = state->component, dot = state->dot;
+
+	end_component(state, end);
+
+	lexed->path = state->path;
+	lexed->length = end;
+	lexed->basename = state->path + basename;
+	lexed->extension = (dot >= 0 && dot + 1 < end) ? state->path + dot + 1 : NULL;
+	lexed->extension_length = lexed->extension ? (size_t) (end - dot - 1) : 0;
+	lexed->hidden = state->hidden;
+	lexed->clean = state->clean;
+	lexed->component_count = state->count;
+}
+
+static inline void lex_start(lex_state *state, const char *path, lexed_path *lexed)
+{
+	state->path = path;
+	state->lexed = lexed;
+	state->count = 0;
+	state->component = 0;
+	state->dot = -1;
+	state->clean = (*path == '/');
+	state->hidden = NO;
+	state->carry = 0;
+}
+
+__attribute__ ((target ("sse2")))
+static void lex_path_sse2(const char *path, lexed_path *lexed)
+{
+	const __m128i slash = _mm_set1_epi8('/'), dot = _mm_set1_epi8('.'), nul = _mm_setzero_si128();
+	const char *block = (const char *) ((uintptr_t) path & ~(uintptr_t) 15);
+	uint32_t valid = 0xffffU << (path - block);
+	uint32_t slashes = 0, dots = 0, ends = 0;
+	int end = 0;
+	lex_state state;
+	__m128i bytes;
+
+	lex_start(&state, path, lexed);
+
+	for (;; block += 16, valid = 0xffffU)
+	{
+		bytes = _mm_load_si128((const __m128i *) block);
+
+		slashes = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, slash)) & valid;
+		dots = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, dot)) & valid;
+		ends = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nul)) & valid;
+
+		if (ends)
+			break;
+
+		lex_block(&state, block - path, slashes, dots, 16);
+	}
+
+	end = __builtin_ctz(ends);
+	ends = (ends & -ends) - 1; /* the bytes before the '\0' */
+
+	lex_block(&state, block - path, slashes & ends, dots & ends, 16);
+	lex_finish(&state, block - path + end);
+}
+
+__attribute__ ((target ("avx2")))
+static void lex_path_avx2(const char *path, lexed_path *lexed)
+{
+	const __m256i slash = _mm256_set1_epi8('/'), dot = _mm256_set1_epi8('.'), nul = _mm256_setzero_si256();
+	const char *block = (const char *) ((uintptr_t) path & ~(uintptr_t) 31);
+	uint32_t valid = ~(uint32_t) 0 << (path - block);
+	uint32_t slashes = 0, dots = 0, ends = 0;
+	int end = 0;
+	lex_state state;
+	__m256i bytes;
+
+	lex_start(&state, path, lexed);
+
+	for (;; block += 32, valid = ~(uint32_t) 0)
+	{
+		bytes = _mm256_load_si256((const __m256i *) block);
+
+		slashes = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, slash)) & valid;
+		dots = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, dot)) & valid;
+		ends = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, nul)) & valid;
+
+		if (ends)
+			break;
+
+		lex_block(&state, block - path, slashes, dots, 32);
+	}
+
+	end = __builtin_ctz(ends);
+	ends = (ends & -ends) - 1; /* the bytes before the '\0' */
+
+	lex_block(&state, block - path, slashes & ends, dots & ends, 32);
+	lex_finish(&state, block - path + end);
+}
+
+#endif /* VECTOR_LEX_PATH */
+
+typedef void (*lex_path_function)(const char *path, lexed_path *lexed);
+
+static lex_path_function chosen_lex_path = NULL;
+
+static lex_path_function choose_lex_path(void)
+{
+#ifdef VECTOR_LEX_PATH
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return lex_path_avx2;
+
+	if (__builtin_cpu_supports("sse2"))
+		return lex_path_sse2;
+#endif
+	return lex_path_scalar;
+}
+
+void lex_path(const char *path, lexed_path *lexed)
+{
+	lex_path_function function = __atomic_load_n(&chosen_lex_path, __ATOMIC_RELAXED);
+
+	/* (Two threads may both make the choice the first time; they make the same one:) */
+
+	if (!function)
+	{
+		function = choose_lex_path();
+
+		__atomic_store_n(&chosen_lex_path, function, __ATOMIC_RELAXED);
+	}
+
+	function(path, lexed);
+
+#ifdef DEBUG
+	if (function != lex_path_scalar)
+	{
+		lexed_path scalar;
+		unsigned i = 0;
+		int same = 0;
+
+		lex_path_scalar(path, &scalar);
+
+		same = scalar.length == lexed->length && scalar.basename == lexed->basename &&
+			scalar.extension == lexed->extension && scalar.extension_length == lexed->extension_length &&
+			scalar.hidden == lexed->hidden && scalar.clean == lexed->clean &&
+			scalar.component_count == lexed->component_count;
+
+		for (i = 0; same && i < scalar.component_count && i < LEXED_PATH_COMPONENTS; i++)
+			same = scalar.component_end[i] == lexed->component_end[i];
+
+		if (!same)
+			fprintf(stderr, "lex_path(): the vector and the scalar scans of %s disagree.\n", path);
+	}
+#endif
+}
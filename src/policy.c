@@ -0,0 +1,1206 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* This file implements the compiled form of the policy: a binary image of
+ * everything build_config() derives from the configuration file and the
+ * user's home directory (flags, lists, absolute trash paths, and the lists
+ * already split up into the directory trie and the extension set), which
+ * can be read in one go and used as it is, without parsing anything.
+ *
+ * The image is position independent: strings, trie nodes and set slots are
+ * referenced through offsets from the beginning of the image, so it can be
+ * used wherever it ends up in memory. It records the identity of the
+ * configuration file it was compiled from, the effective uid it belongs to
+ * and a fingerprint of the compile-time defaults, and it is discarded (and
+ * rebuilt) as soon as any of those no longer match.
+ *
+ * The image is written to POLICY_CACHE_FILE in the user's home directory.
+ * It is always written to a temporary file which is then rename()d over the
+ * old one, so a process never reads a half-written image. It is read()
+ * into the arena of the snapshot rather than mmap()ed: the file belongs to
+ * the user, and a mapping of it would turn a truncation by any of his other
+ * processes into a SIGBUS inside unlink(). If libtrash was configured with
+ * --enable-policy-inherit, it is also handed down to the programs we exec() in a
+ * sealed memfd (see policy_publish() below), which can't shrink and is
+ * therefore safe to map. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trash.h"
+
+#ifdef POLICY_CACHE
+
+/* Bump this whenever the layout of policy_header changes: */
+
+#define POLICY_VERSION 6
+
+/* Larger images are neither written nor read (they would have to come from huge lists): */
+
+#define POLICY_MAX_SIZE (1 << 20)
+
+#define POLICY_MAGIC "LTPOLICY"
+
+/* Indexes of the strings stored in the image: */
+
+enum
+{
+	POLICY_IGNORE_EXTENSIONS,
+	POLICY_RELATIVE_TRASH_CAN,
+	POLICY_RELATIVE_TRASH_SYSTEM_ROOT,
+	POLICY_UNREMOVABLE_DIRS,
+	POLICY_TEMPORARY_DIRS,
+	POLICY_USER_TEMPORARY_DIRS,
+	POLICY_REMOVABLE_MEDIA_MOUNT_POINTS,
+	POLICY_EXCEPTIONS,
+	POLICY_IGNORE_RE,
+	POLICY_IGNORE_GLOB,
+	POLICY_ABSOLUTE_TRASH_CAN,
+	POLICY_ABSOLUTE_TRASH_SYSTEM_ROOT,
+	POLICY_HOME,
+	POLICY_NUMBER_OF_STRINGS
+};
+
+/* How the identity of a configuration file is recorded in the image (all zeroes if the file
+ * didn't exist), so that it can be compared with memcmp(): */
+
+typedef struct
+{
+	uint64_t exists;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t uid;
+	uint64_t mode;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+}
+policy_file_identity;
+
+/* A node of the directory trie and a slot of the extension set, as stored in the image (see
+ * struct dir_trie_node and struct extension_slot in trash.h, which they are turned back into):
+ * names are offsets from the beginning of the image, and an empty slot has a name of 0. */
+
+typedef struct
+{
+	uint32_t name;
+	uint32_t length;
+	uint32_t lists;
+	uint32_t children;
+	uint32_t child_count;
+}
+policy_dir_trie_node;
+
+typedef struct
+{
+	uint32_t name;
+	uint32_t length;
+	uint32_t hash;
+}
+policy_extension_slot;
+
+/* The image begins with this header, and the strings (each one terminated by '\0') follow it,
+ * then the trie and the set (each of them aligned on POLICY_ALIGNMENT bytes): */
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t total_size;
+	uint64_t checksum;          /* of everything which follows this field */
+	uint64_t defaults;          /* fingerprint of the compile-time defaults */
+
+	/* Identity of the sources the image was compiled from: */
+
+	uint64_t euid;
+	policy_file_identity conf;
+	policy_file_identity system_conf;
+
+	/* The policy itself: */
+
+	int32_t in_case_of_failure;
+	int32_t global_protection;
+	int32_t should_warn;
+	int32_t ignore_hidden;
+	int32_t ignore_editor_backup;
+	int32_t ignore_editor_temporary;
+	int32_t protect_trash;
+	int32_t libtrash_config_file_unremovable;
+	int32_t intercept_unlink;
+	int32_t intercept_rename;
+	int32_t intercept_fopen;
+	int32_t intercept_freopen;
+	int32_t intercept_open;
+	int32_t trash_check_interval;
+	int32_t home_from_environment;  /* the publisher was told to trust $HOME */
+	uint64_t preserve_files_larger_than_limit;
+
+	uint32_t strings[POLICY_NUMBER_OF_STRINGS]; /* offsets from the beginning of the image, 0 means NULL */
+
+	/* The lists, split up (offsets of 0 mean that the image has no trie or no set, in which
+	 * case the process which uses it builds them itself): */
+
+	uint32_t baked_lists;       /* the BAKED_LIST_xxx bits the trie and the set were built with */
+	uint32_t dir_trie;          /* offset of dir_trie_nodes policy_dir_trie_nodes */
+	uint32_t dir_trie_nodes;
+	uint32_t extension_set;     /* offset of extension_set_size policy_extension_slots */
+	uint32_t extension_set_size;
+}
+policy_header;
+
+#define POLICY_ALIGNMENT 8
+
+#define POLICY_ALIGN(offset) (((offset) + POLICY_ALIGNMENT - 1) & ~(size_t) (POLICY_ALIGNMENT - 1))
+
+/* The checksum covers everything from the field which follows it to the end of the image: */
+
+#define CHECKSUM_START (offsetof(policy_header, checksum) + sizeof(uint64_t))
+
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+/* Every compile-time default which might end up in an image: if libtrash is rebuilt with
+ * different defaults, images compiled by the previous build are ignored. */
+
+static const char compile_time_defaults[] =
+	TRASH_CAN "\n" TRASH_SYSTEM_ROOT "\n" IGNORE_EXTENSIONS "\n" UNREMOVABLE_DIRS "\n"
+	TEMPORARY_DIRS "\n" USER_TEMPORARY_DIRS "\n" REMOVABLE_MEDIA_MOUNT_POINTS "\n"
+	EXCEPTIONS "\n" IGNORE_RE "\n" IGNORE_GLOB "\n" PERSONAL_CONF_FILE "\n" SYSTEM_CONF_FILE "\n"
+	XSTR(IN_CASE_OF_FAILURE) XSTR(SHOULD_WARN) XSTR(IGNORE_HIDDEN) XSTR(IGNORE_EDITOR_BACKUP)
+	XSTR(IGNORE_EDITOR_TEMPORARY) XSTR(PROTECT_TRASH) XSTR(GLOBAL_PROTECTION)
+	XSTR(LIBTRASH_CONFIG_FILE_UNREMOVABLE) XSTR(INTERCEPT_UNLINK) XSTR(INTERCEPT_RENAME)
+	XSTR(INTERCEPT_FOPEN) XSTR(INTERCEPT_FREOPEN) XSTR(INTERCEPT_OPEN) XSTR(TRASH_CHECK_INTERVAL);
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash);
+
+static char* policy_cache_path(const char *home);
+
+static char** policy_string_field(config *cfg, int index);
+
+static void encode_file_identity(const file_identity *identity, policy_file_identity *encoded);
+
+static int policy_check_image(const char *image, size_t size, config *cfg);
+
+static int policy_check_split_lists(const char *image, size_t size);
+
+static void policy_use_image(config *cfg, const char *image);
+
+static int read_image(int fd, char *image, size_t size);
+
+static uint32_t image_offset_of(const char *name, unsigned length, const char *const *strings,
+		const size_t *lengths, const uint32_t *offsets);
+
+static char* policy_compile(config *cfg, size_t *size);
+
+static int write_image(int fd, const char *image, size_t size);
+
+/* ------------------------------------------------------------------------ */
+
+/* 64-bit FNV-1a, used both for the payload checksum and for the defaults fingerprint: */
+
+static uint64_t fnv1a(const void *data, size_t len, uint64_t hash)
+{
+	const unsigned char *ptr = data;
+
+	while (len--)
+	{
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+/* ------------------------------------------------------------------------ */
+
+static void encode_file_identity(const file_identity *identity, policy_file_identity *encoded)
+{
+	memset(encoded, 0, sizeof(policy_file_identity));
+
+	if (!identity->exists)
+		return;
+
+	encoded->exists = 1;
+	encoded->dev = identity->dev;
+	encoded->ino = identity->ino;
+	encoded->size = identity->size;
+	encoded->uid = identity->uid;
+	encoded->mode = identity->mode;
+	encoded->mtime_sec = identity->mtime.tv_sec;
+	encoded->mtime_nsec = identity->mtime.tv_nsec;
+	encoded->ctime_sec = identity->ctime.tv_sec;
+	encoded->ctime_nsec = identity->ctime.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns a malloc()ed string holding the path to the image in the directory home: */
+
+static char* policy_cache_path(const char *home)
+{
+	char *path = malloc(strlen(home) + 1 + strlen(POLICY_CACHE_FILE) + 1);
+
+	if (path)
+	{
+		strcpy(path, home);
+		strcat(path, "/");
+		strcat(path, POLICY_CACHE_FILE);
+	}
+
+	return path;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Maps each of the indexes above to the corresponding field of the configuration: */
+
+static char** policy_string_field(config *cfg, int index)
+{
+	switch (index)
+	{
+		case POLICY_IGNORE_EXTENSIONS:            return &cfg->ignore_extensions;
+		case POLICY_RELATIVE_TRASH_CAN:           return &cfg->relative_trash_can;
+		case POLICY_RELATIVE_TRASH_SYSTEM_ROOT:   return &cfg->relative_trash_system_root;
+		case POLICY_UNREMOVABLE_DIRS:             return &cfg->unremovable_dirs;
+		case POLICY_TEMPORARY_DIRS:               return &cfg->temporary_dirs;
+		case POLICY_USER_TEMPORARY_DIRS:          return &cfg->user_temporary_dirs;
+		case POLICY_REMOVABLE_MEDIA_MOUNT_POINTS: return &cfg->removable_media_mount_points;
+		case POLICY_EXCEPTIONS:                   return &cfg->exceptions;
+		case POLICY_IGNORE_RE:                    return &cfg->ignore_re;
+		case POLICY_IGNORE_GLOB:                  return &cfg->ignore_glob;
+		case POLICY_ABSOLUTE_TRASH_CAN:           return &cfg->absolute_trash_can;
+		case POLICY_ABSOLUTE_TRASH_SYSTEM_ROOT:   return &cfg->absolute_trash_system_root;
+		case POLICY_HOME:                         return &cfg->home;
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* policy_check_image() makes sure that the size bytes at image are a well-formed image, compiled
+ * by this build of libtrash for the effective uid in cfg, and that every string in it ends inside
+ * of it. It doesn't look at the configuration files the image was compiled from. */
+
+static int policy_check_image(const char *image, size_t size, config *cfg)
+{
+	const policy_header *header = (const policy_header *) image;
+	int i = 0;
+
+	if (size < sizeof(policy_header)                                                   ||
+			memcmp(header->magic, POLICY_MAGIC, sizeof(header->magic))                 ||
+			header->version != POLICY_VERSION                                          ||
+			header->header_size != sizeof(policy_header)                               ||
+			header->total_size != (uint64_t) size                                      ||
+			header->defaults != fnv1a(compile_time_defaults, sizeof(compile_time_defaults), FNV_OFFSET_BASIS) ||
+			header->euid != (uint64_t) cfg->euid                                       ||
+			header->checksum != fnv1a(image + CHECKSUM_START, size - CHECKSUM_START, FNV_OFFSET_BASIS))
+		return 0;
+
+	for (i = 0; i < POLICY_NUMBER_OF_STRINGS; i++)
+		if (header->strings[i] != 0 &&
+				(header->strings[i] < sizeof(policy_header) || header->strings[i] >= size ||
+				 !memchr(image + header->strings[i], '\0', size - header->strings[i])))
+			return 0;
+
+	return header->strings[POLICY_HOME] != 0 && policy_check_split_lists(image, size);
+}
+
+/* Makes sure that the trie and the set of the image (if it has them) lie inside of it, that every
+ * name they point to does too, and that the set has at least one empty slot (every lookup stops
+ * at one): */
+
+static int policy_check_split_lists(const char *image, size_t size)
+{
+	const policy_header *header = (const policy_header *) image;
+	const policy_dir_trie_node *nodes = NULL;
+	const policy_extension_slot *slots = NULL;
+	uint32_t i = 0, empty_slots = 0;
+
+	if (header->dir_trie != 0)
+	{
+		if (header->dir_trie % POLICY_ALIGNMENT || header->dir_trie > size || header->dir_trie_nodes == 0 ||
+				header->dir_trie_nodes > (size - header->dir_trie) / sizeof(policy_dir_trie_node))
+			return 0;
+
+		nodes = (const policy_dir_trie_node *) (image + header->dir_trie);
+
+		for (i = 0; i < header->dir_trie_nodes; i++)
+			if (nodes[i].name > size || nodes[i].length > size - nodes[i].name ||
+					nodes[i].children > header->dir_trie_nodes ||
+					nodes[i].child_count > header->dir_trie_nodes - nodes[i].children)
+				return 0;
+	}
+
+	if (header->extension_set != 0)
+	{
+		if (header->extension_set % POLICY_ALIGNMENT || header->extension_set > size ||
+				header->extension_set_size == 0 ||
+				(header->extension_set_size & (header->extension_set_size - 1)) ||
+				header->extension_set_size > (size - header->extension_set) / sizeof(policy_extension_slot))
+			return 0;
+
+		slots = (const policy_extension_slot *) (image + header->extension_set);
+
+		for (i = 0; i < header->extension_set_size; i++)
+			if (slots[i].name == 0)
+				empty_slots++;
+			else if (slots[i].name > size || slots[i].length > size - slots[i].name)
+				return 0;
+
+		if (empty_slots == 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Points the configuration fields of cfg at the (already checked) image: */
+
+static void policy_use_image(config *cfg, const char *image)
+{
+	const policy_header *header = (const policy_header *) image;
+	int i = 0;
+
+	cfg->in_case_of_failure = header->in_case_of_failure;
+	cfg->global_protection = header->global_protection;
+	cfg->should_warn = header->should_warn;
+	cfg->ignore_hidden = header->ignore_hidden;
+	cfg->ignore_editor_backup = header->ignore_editor_backup;
+	cfg->ignore_editor_temporary = header->ignore_editor_temporary;
+	cfg->protect_trash = header->protect_trash;
+	cfg->libtrash_config_file_unremovable = header->libtrash_config_file_unremovable;
+	cfg->intercept_unlink = header->intercept_unlink;
+	cfg->intercept_rename = header->intercept_rename;
+	cfg->intercept_fopen = header->intercept_fopen;
+	cfg->intercept_freopen = header->intercept_freopen;
+	cfg->intercept_open = header->intercept_open;
+	cfg->preserve_files_larger_than_limit = header->preserve_files_larger_than_limit;
+	cfg->trash_check_interval = header->trash_check_interval;
+
+	/* (The strings are never written to: the fields are only char * because the ones which don't
+	 * come from an image may be.) */
+
+	for (i = 0; i < POLICY_NUMBER_OF_STRINGS; i++)
+		*policy_string_field(cfg, i) = header->strings[i] ? (char *) image + header->strings[i] : NULL;
+
+	cfg->policy_image = image;
+}
+
+/* policy_split_lists() is called by build_config() once the lists of a snapshot which uses an
+ * image are final (mark_baked_lists() included). It turns the directory trie and the extension set
+ * the image holds into the ones the snapshot uses, unless the image has none or they don't apply
+ * any more: the entries of UNCOVER_DIRS belong in the trie but not in the image, and the lists
+ * which are baked in are left out of both. Whatever it leaves NULL, build_config() builds. */
+
+void policy_split_lists(config *cfg)
+{
+	const policy_header *header = (const policy_header *) cfg->policy_image;
+	const policy_dir_trie_node *nodes = NULL;
+	const policy_extension_slot *slots = NULL;
+	struct dir_trie_node *trie = NULL;
+	struct extension_slot *set = NULL;
+	char *memory = NULL;
+	uint32_t i = 0;
+
+	if (!header || header->baked_lists != (uint32_t) cfg->baked_lists)
+		return;
+
+	/* (The arena makes no promise about alignment, so we align both arrays ourselves.) */
+
+	if (header->dir_trie != 0 && !cfg->uncovered_dirs)
+		memory = arena_alloc(cfg, header->dir_trie_nodes * sizeof(struct dir_trie_node) + sizeof(void *) - 1);
+
+	if (memory)
+	{
+		trie = (struct dir_trie_node *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+		nodes = (const policy_dir_trie_node *) (cfg->policy_image + header->dir_trie);
+
+		for (i = 0; i < header->dir_trie_nodes; i++)
+		{
+			trie[i].name = cfg->policy_image + nodes[i].name;
+			trie[i].length = nodes[i].length;
+			trie[i].lists = nodes[i].lists;
+			trie[i].children = nodes[i].children;
+			trie[i].child_count = nodes[i].child_count;
+		}
+
+		cfg->dir_trie = trie;
+		cfg->dir_trie_nodes = header->dir_trie_nodes;
+	}
+
+	memory = NULL;
+
+	if (header->extension_set != 0)
+		memory = arena_alloc(cfg, header->extension_set_size * sizeof(struct extension_slot) + sizeof(void *) - 1);
+
+	if (memory)
+	{
+		set = (struct extension_slot *) (((uintptr_t) memory + sizeof(void *) - 1) & ~(uintptr_t) (sizeof(void *) - 1));
+		slots = (const policy_extension_slot *) (cfg->policy_image + header->extension_set);
+
+		for (i = 0; i < header->extension_set_size; i++)
+		{
+			set[i].name = slots[i].name ? cfg->policy_image + slots[i].name : NULL;
+			set[i].length = slots[i].length;
+			set[i].hash = slots[i].hash;
+		}
+
+		cfg->extension_set = set;
+		cfg->extension_set_mask = header->extension_set_size - 1;
+	}
+
+#ifdef DEBUG
+	fprintf(stderr, "Compiled policy: %s directory trie, %s extension set.\n",
+			cfg->dir_trie ? "using its" : "building the", cfg->extension_set ? "using its" : "building the");
+#endif
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* policy_load() looks for an image in the directory home which matches the sources described
+ * in cfg (effective uid and configuration files identities, which build_config() has already
+ * filled in). If it finds one, it maps it, points the configuration fields at it and returns 1;
+ * build_config() then has nothing left to do but check the trash can. Otherwise it returns 0
+ * and leaves cfg untouched. */
+
+int policy_load(config *cfg, const char *home)
+{
+	char *path = NULL;
+	int fd = -1;
+	struct stat image_stat;
+	char *memory = NULL, *image = NULL;
+	const policy_header *header = NULL;
+	policy_file_identity conf_identity, system_conf_identity;
+
+	encode_file_identity(&cfg->conf_identity, &conf_identity);
+	encode_file_identity(&cfg->system_conf_identity, &system_conf_identity);
+
+	path = policy_cache_path(home);
+
+	if (!path)
+		return 0;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+	free(path);
+
+	if (fd == -1)
+		return 0;
+
+	/* The image must belong to this user and must not be writable by anybody else, or else
+	 * another user could hand us a policy of his own choosing: */
+
+	if (fstat(fd, &image_stat)                            ||
+			!S_ISREG(image_stat.st_mode)                  ||
+			image_stat.st_uid != cfg->euid                ||
+			(image_stat.st_mode & (S_IWGRP | S_IWOTH))    ||
+			image_stat.st_size < (off_t) sizeof(policy_header) ||
+			image_stat.st_size > POLICY_MAX_SIZE)
+	{
+		close(fd);
+		return 0;
+	}
+
+	/* Read it into the arena (aligned, since it's read as a policy_header). If it turns out to be
+	 * unusable, the room it took there is only given back with the snapshot; it's small. A file
+	 * which changes while we read it fails the checksum: */
+
+	memory = arena_alloc(cfg, image_stat.st_size + POLICY_ALIGNMENT - 1);
+
+	if (memory)
+		image = (char *) (((uintptr_t) memory + POLICY_ALIGNMENT - 1) & ~(uintptr_t) (POLICY_ALIGNMENT - 1));
+
+	if (!image || !read_image(fd, image, image_stat.st_size))
+	{
+		close(fd);
+		return 0;
+	}
+
+	close(fd);
+
+	header = (const policy_header *) image;
+
+	if (!policy_check_image(image, image_stat.st_size, cfg)                             ||
+			memcmp(&header->conf, &conf_identity, sizeof(policy_file_identity))        ||
+			memcmp(&header->system_conf, &system_conf_identity, sizeof(policy_file_identity)))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Compiled policy in %s/%s is out of date or invalid, ignoring it.\n", home, POLICY_CACHE_FILE);
+#endif
+		return 0;
+	}
+
+	/* The image was compiled for a home dir other than the one we were given (the password database
+	 * changed, or it was written by a process which trusted a different $HOME): */
+
+	if (strcmp(image + header->strings[POLICY_HOME], home))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Compiled policy in %s/%s belongs to another home dir, ignoring it.\n", home, POLICY_CACHE_FILE);
+#endif
+		return 0;
+	}
+
+	/* The image is good: */
+
+	policy_use_image(cfg, image);
+
+#ifdef DEBUG
+	fprintf(stderr, "Using compiled policy from %s/%s.\n", home, POLICY_CACHE_FILE);
+#endif
+
+	return 1;
+}
+
+/* Reads exactly size bytes from fd into image, returning 1 if it got all of them: */
+
+static int read_image(int fd, char *image, size_t size)
+{
+	size_t offset = 0;
+	ssize_t count = 0;
+
+	for (offset = 0; offset < size; offset += count)
+	{
+		count = read(fd, image + offset, size - offset);
+
+		if (count < 0 && errno == EINTR)
+			count = 0;
+		else if (count <= 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns the offset in the image of name (length characters), which points into one of the
+ * strings being compiled into it (strings[i], lengths[i] characters long, which ends up at
+ * offsets[i]), or 0 if it doesn't. (An empty name can be anywhere.) */
+
+static uint32_t image_offset_of(const char *name, unsigned length, const char *const *strings,
+		const size_t *lengths, const uint32_t *offsets)
+{
+	uintptr_t start = (uintptr_t) name;
+	int i = 0;
+
+	if (length == 0)
+		return sizeof(policy_header);
+
+	for (i = 0; i < POLICY_NUMBER_OF_STRINGS; i++)
+		if (strings[i] && start >= (uintptr_t) strings[i] && start + length <= (uintptr_t) strings[i] + lengths[i])
+			return offsets[i] + (start - (uintptr_t) strings[i]);
+
+	return 0;
+}
+
+/* policy_compile() returns a malloc()ed image of the (fully built) configuration cfg, and stores
+ * its size in *size. It returns NULL if we run out of memory. */
+
+static char* policy_compile(config *cfg, size_t *size)
+{
+	policy_header header;
+	const char *strings[POLICY_NUMBER_OF_STRINGS];
+	size_t lengths[POLICY_NUMBER_OF_STRINGS];
+	size_t total_size = sizeof(policy_header);
+	size_t offset = 0, trie_offset = 0, set_offset = 0;
+	policy_dir_trie_node *nodes = NULL;
+	policy_extension_slot *slots = NULL;
+	char *image = NULL;
+	unsigned j = 0;
+	int i = 0;
+
+	memset(&header, 0, sizeof(header));
+
+	for (i = 0; i < POLICY_NUMBER_OF_STRINGS; i++)
+	{
+		strings[i] = *policy_string_field(cfg, i);
+		lengths[i] = strings[i] ? strlen(strings[i]) : 0;
+
+		if (strings[i])
+			total_size += lengths[i] + 1;
+	}
+
+	/* The trie and the set come after the strings. (If UNCOVER_DIRS is set, its entries are in
+	 * the trie, and they aren't part of the policy: the processes which use the image build the
+	 * trie themselves, then.) */
+
+	if (cfg->dir_trie && !cfg->uncovered_dirs)
+	{
+		trie_offset = POLICY_ALIGN(total_size);
+		total_size = trie_offset + cfg->dir_trie_nodes * sizeof(policy_dir_trie_node);
+	}
+
+	if (cfg->extension_set)
+	{
+		set_offset = POLICY_ALIGN(total_size);
+		total_size = set_offset + (cfg->extension_set_mask + 1) * sizeof(policy_extension_slot);
+	}
+
+	if (total_size > POLICY_MAX_SIZE)
+		return NULL;
+
+	image = calloc(1, total_size); /* (the padding is part of the checksum) */
+
+	if (!image)
+		return NULL;
+
+	/* Strings: */
+
+	offset = sizeof(policy_header);
+
+	for (i = 0; i < POLICY_NUMBER_OF_STRINGS; i++)
+		if (strings[i])
+		{
+			header.strings[i] = offset;
+			memcpy(image + offset, strings[i], lengths[i] + 1);
+			offset += lengths[i] + 1;
+		}
+
+	/* The trie and the set, whose names all point into the strings above: */
+
+	header.baked_lists = cfg->baked_lists;
+
+	if (trie_offset)
+	{
+		header.dir_trie = trie_offset;
+		header.dir_trie_nodes = cfg->dir_trie_nodes;
+
+		nodes = (policy_dir_trie_node *) (image + trie_offset);
+
+		for (j = 0; j < cfg->dir_trie_nodes; j++)
+		{
+			nodes[j].name = image_offset_of(cfg->dir_trie[j].name, cfg->dir_trie[j].length, strings, lengths, header.strings);
+			nodes[j].length = cfg->dir_trie[j].length;
+			nodes[j].lists = cfg->dir_trie[j].lists;
+			nodes[j].children = cfg->dir_trie[j].children;
+			nodes[j].child_count = cfg->dir_trie[j].child_count;
+
+			if (nodes[j].name == 0)
+				header.dir_trie = 0;
+		}
+	}
+
+	if (set_offset)
+	{
+		header.extension_set = set_offset;
+		header.extension_set_size = cfg->extension_set_mask + 1;
+
+		slots = (policy_extension_slot *) (image + set_offset);
+
+		for (j = 0; j < header.extension_set_size; j++)
+			if (cfg->extension_set[j].name)
+			{
+				slots[j].name = image_offset_of(cfg->extension_set[j].name, cfg->extension_set[j].length,
+						strings, lengths, header.strings);
+				slots[j].length = cfg->extension_set[j].length;
+				slots[j].hash = cfg->extension_set[j].hash;
+
+				if (slots[j].name == 0)
+					header.extension_set = 0;
+			}
+	}
+
+	/* Header: */
+
+	memcpy(header.magic, POLICY_MAGIC, sizeof(header.magic));
+	header.version = POLICY_VERSION;
+	header.header_size = sizeof(policy_header);
+	header.total_size = total_size;
+	header.defaults = fnv1a(compile_time_defaults, sizeof(compile_time_defaults), FNV_OFFSET_BASIS);
+
+	header.euid = cfg->euid;
+	encode_file_identity(&cfg->conf_identity, &header.conf);
+	encode_file_identity(&cfg->system_conf_identity, &header.system_conf);
+	header.home_from_environment = cfg->env_trust_home != NULL;
+
+	header.in_case_of_failure = cfg->in_case_of_failure;
+	header.global_protection = cfg->global_protection;
+	header.should_warn = cfg->should_warn;
+	header.ignore_hidden = cfg->ignore_hidden;
+	header.ignore_editor_backup = cfg->ignore_editor_backup;
+	header.ignore_editor_temporary = cfg->ignore_editor_temporary;
+	header.protect_trash = cfg->protect_trash;
+	header.libtrash_config_file_unremovable = cfg->libtrash_config_file_unremovable;
+	header.intercept_unlink = cfg->intercept_unlink;
+	header.intercept_rename = cfg->intercept_rename;
+	header.intercept_fopen = cfg->intercept_fopen;
+	header.intercept_freopen = cfg->intercept_freopen;
+	header.intercept_open = cfg->intercept_open;
+	header.preserve_files_larger_than_limit = cfg->preserve_files_larger_than_limit;
+	header.trash_check_interval = cfg->trash_check_interval;
+
+	memcpy(image, &header, sizeof(header));
+
+	header.checksum = fnv1a(image + CHECKSUM_START, total_size - CHECKSUM_START, FNV_OFFSET_BASIS);
+
+	memcpy(image, &header, sizeof(header));
+
+	*size = total_size;
+
+	return image;
+}
+
+/* Writes the size bytes at image to fd, returning 1 if all of them made it there: */
+
+static int write_image(int fd, const char *image, size_t size)
+{
+	size_t offset = 0;
+	ssize_t written = 0;
+
+	for (offset = 0; offset < size; offset += written)
+	{
+		written = write(fd, image + offset, size - offset);
+
+		if (written < 0 && errno == EINTR)
+			written = 0;
+		else if (written <= 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* policy_save() compiles the (fully built) configuration cfg into an image and stores it in the
+ * directory home, replacing any previous one. Failing to do so isn't an error: the next process
+ * will simply parse the configuration file again. */
+
+void policy_save(config *cfg, const char *home)
+{
+	size_t total_size = 0;
+	char *image = NULL;
+	char *path = NULL, *tmp_path = NULL;
+	int fd = -1;
+	int written = 0;
+
+	if (!cfg->real_rename || !cfg->real_unlink)
+		return;
+
+	image = policy_compile(cfg, &total_size);
+
+	if (!image)
+		return;
+
+	/* Write it to a temporary file and rename() that over the image: */
+
+	path = policy_cache_path(home);
+
+	if (path)
+		tmp_path = malloc(strlen(path) + 1 + 3 * sizeof(pid_t) + 1);
+
+	if (!path || !tmp_path)
+		goto done;
+
+	sprintf(tmp_path, "%s.%d", path, (int) getpid());
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+
+	if (fd == -1)
+		goto done;
+
+	written = write_image(fd, image, total_size);
+
+	if (close(fd) || !written || (*cfg->real_rename) (tmp_path, path))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to store the compiled policy in %s.\n", path);
+#endif
+		(*cfg->real_unlink) (tmp_path);
+	}
+
+done:
+	free(tmp_path);
+	free(path);
+	free(image);
+}
+
+#ifdef POLICY_INHERIT
+
+/* ------------------------------------------------------------------------ */
+
+/* Inheriting the policy across exec():
+ *
+ * policy_publish() copies the image of a freshly built configuration into an anonymous memfd,
+ * which it makes read-only and seals against any further change, and keeps it in the snapshot
+ * (cfg->policy_fd), with FD_CLOEXEC set, so that no process gets it unless we hand it down. That
+ * only happens when a program is about to be run with libtrash preloaded: the exec() wrappers (see
+ * exec.c) call policy_exec_fd(), which makes sure that the fd is still the memfd of the most recent
+ * snapshot (handed_down_fd, below) and clears its FD_CLOEXEC, and pass the new program a copy of
+ * its environment in which POLICY_FD_VARIABLE names it (policy_exec_environment()). Neither
+ * touches environ, which other threads may be reading with getenv() (config_still_valid() among
+ * them), or allocates memory: the wrappers may be running in a child of vfork(), or of fork() in a
+ * multithreaded program. Children which never exec() anything, and programs which won't have
+ * libtrash loaded, never see the fd or the variable. policy_inherit() then finds the image there
+ * and maps it, instead of looking up the home dir, reading the configuration files and building the
+ * paths again; and sets FD_CLOEXEC on the fd again, so that it is only handed further down the
+ * same way.
+ *
+ * Before using it, policy_inherit() makes sure that the fd really is a sealed file which belongs
+ * to our effective uid and holds a well-formed image compiled by this build for this euid,
+ * and that both configuration files are still the ones the image was compiled from. If any of
+ * this isn't true, we build the configuration the usual way and publish the result. Both
+ * functions are only called by build_config(), with config_lock held. */
+
+#define POLICY_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+/* The memfd of the most recent snapshot which has one, and its identity, for the exec() wrappers,
+ * which can't safely look at a snapshot (it might be free()d under them, and they mustn't register
+ * as readers in a child of vfork(), which shares our memory). They are only ever set together
+ * by remember_handed_down_fd(), with config_lock held, and if a wrapper reads them half-way
+ * through, the identity won't match: */
+
+static int handed_down_fd = -1;
+
+static dev_t handed_down_dev = 0;
+
+static ino_t handed_down_ino = 0;
+
+static int sealed_image_fd(int fd, uid_t euid, struct stat *image_stat);
+
+static void remember_handed_down_fd(const config *cfg);
+
+static int preloaded_after_exec(char *const envp[]);
+
+/* Returns 1 if fd is a sealed, read-only file which belongs to euid and which is large enough to
+ * hold an image (its details are stored in image_stat), 0 otherwise: */
+
+static int sealed_image_fd(int fd, uid_t euid, struct stat *image_stat)
+{
+	int seals = fcntl(fd, F_GET_SEALS);
+
+	return seals != -1 && (seals & POLICY_SEALS) == POLICY_SEALS &&
+		!fstat(fd, image_stat)                                    &&
+		S_ISREG(image_stat->st_mode)                              &&
+		image_stat->st_uid == euid                                &&
+		!(image_stat->st_mode & (S_IWGRP | S_IWOTH))              &&
+		image_stat->st_size >= (off_t) sizeof(policy_header);
+}
+
+/* policy_inherit() returns 1 if it found a usable image in the fd named by POLICY_FD_VARIABLE,
+ * in which case cfg now uses it (cfg->home and cfg->conf_file_path included) and build_config()
+ * only has to check the trash can. Otherwise it returns 0 and leaves cfg untouched. */
+
+int policy_inherit(config *cfg)
+{
+	const char *value = getenv(POLICY_FD_VARIABLE);
+	char *end = NULL;
+	long fd = -1;
+	struct stat image_stat;
+	void *map = MAP_FAILED;
+	const policy_header *header = NULL;
+	const char *home = NULL;
+	char *our_home = NULL, *conf_file_path = NULL;
+	file_identity conf_identity;
+	policy_file_identity encoded_conf_identity, encoded_system_conf_identity;
+	int same_home = NO;
+
+	if (!value || *value == '\0')
+		return 0;
+
+	errno = 0;
+
+	fd = strtol(value, &end, 10);
+
+	if (*end != '\0' || errno || fd < 0 || fd > INT_MAX || !sealed_image_fd(fd, cfg->euid, &image_stat))
+		return 0;
+
+	map = mmap(NULL, image_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED)
+		return 0;
+
+	if (!policy_check_image(map, image_stat.st_size, cfg))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Inherited policy in fd %ld is invalid, ignoring it.\n", fd);
+#endif
+		munmap(map, image_stat.st_size);
+		return 0;
+	}
+
+	/* It's an image published by libtrash, which we only hand down through exec(): */
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	header = map;
+	home = (const char *) map + header->strings[POLICY_HOME];
+
+	/* The publisher found its home dir in the password database, just like we would, unless
+	 * it was told to trust $HOME. If it was (or if we are), we have to ask get_home_dir(): */
+
+	if (header->home_from_environment || cfg->env_trust_home)
+	{
+		our_home = get_home_dir(cfg->euid);
+
+		same_home = our_home && !strcmp(our_home, home);
+
+		free(our_home);
+
+		if (!same_home)
+			goto stale;
+	}
+
+	conf_file_path = personal_conf_path(cfg, home);
+
+	if (!conf_file_path)
+		goto stale;
+
+	/* (build_config() has already stat()ed the system-wide file.) */
+
+	get_file_identity(conf_file_path, &conf_identity);
+
+	encode_file_identity(&conf_identity, &encoded_conf_identity);
+	encode_file_identity(&cfg->system_conf_identity, &encoded_system_conf_identity);
+
+	if (memcmp(&header->conf, &encoded_conf_identity, sizeof(policy_file_identity)) ||
+			memcmp(&header->system_conf, &encoded_system_conf_identity, sizeof(policy_file_identity)))
+		goto stale; /* (conf_file_path stays in the arena until the snapshot goes away) */
+
+	/* The image is good: */
+
+	cfg->conf_file_path = conf_file_path;
+	cfg->conf_identity = conf_identity;
+
+	policy_use_image(cfg, map);
+
+	cfg->policy_map = map;
+	cfg->policy_map_len = image_stat.st_size;
+
+	cfg->policy_fd = fd;
+	cfg->policy_fd_dev = image_stat.st_dev;
+	cfg->policy_fd_ino = image_stat.st_ino;
+
+	remember_handed_down_fd(cfg);
+
+#ifdef DEBUG
+	fprintf(stderr, "Using policy inherited in fd %ld.\n", fd);
+#endif
+
+	return 1;
+
+stale:
+#ifdef DEBUG
+	fprintf(stderr, "Inherited policy in fd %ld is out of date, ignoring it.\n", fd);
+#endif
+	munmap(map, image_stat.st_size);
+	return 0;
+}
+
+/* policy_publish() compiles the (fully built) configuration cfg into a sealed memfd, which the
+ * exec() wrappers will hand down to the programs we run. Failing to do so isn't an error: they
+ * will simply build their configuration themselves. */
+
+void policy_publish(config *cfg)
+{
+	char *image = NULL;
+	size_t size = 0;
+	int fd = -1;
+	struct stat image_stat;
+
+	/* Programs running with privileges other than their user's don't hand them down: */
+
+	if (getuid() != geteuid() || getgid() != getegid())
+		return;
+
+	image = policy_compile(cfg, &size);
+
+	if (!image)
+		return;
+
+	fd = memfd_create("libtrash-policy", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+
+	if (fd == -1 || !write_image(fd, image, size) || fchmod(fd, S_IRUSR) ||
+			fcntl(fd, F_ADD_SEALS, POLICY_SEALS | F_SEAL_SEAL) || fstat(fd, &image_stat))
+	{
+#ifdef DEBUG
+		fprintf(stderr, "Unable to publish the compiled policy in a memfd.\n");
+#endif
+		if (fd != -1)
+			close(fd);
+
+		free(image);
+		return;
+	}
+
+	free(image);
+
+	cfg->policy_fd = fd;
+	cfg->policy_fd_dev = image_stat.st_dev;
+	cfg->policy_fd_ino = image_stat.st_ino;
+
+	remember_handed_down_fd(cfg);
+
+#ifdef DEBUG
+	fprintf(stderr, "Published the compiled policy in fd %d.\n", fd);
+#endif
+}
+
+/* Makes the memfd of cfg the one the exec() wrappers hand down (the fd goes first, so that a
+ * wrapper which sees the new number also sees its identity): */
+
+static void remember_handed_down_fd(const config *cfg)
+{
+	__atomic_store_n(&handed_down_fd, -1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&handed_down_dev, cfg->policy_fd_dev, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&handed_down_ino, cfg->policy_fd_ino, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&handed_down_fd, cfg->policy_fd, __ATOMIC_SEQ_CST);
+}
+
+/* Returns 1 if the program run with the environment envp will have libtrash loaded: either envp
+ * preloads it, or nobody preloaded it here (so it came from /etc/ld.so.preload, which applies to
+ * every program). Otherwise the new program couldn't use the image, and mustn't get the fd: */
+
+static int preloaded_after_exec(char *const envp[])
+{
+	const char *ours = getenv("LD_PRELOAD");
+	size_t length = strlen("LD_PRELOAD=");
+
+	for (; envp && *envp; envp++)
+		if (!strncmp(*envp, "LD_PRELOAD=", length))
+			return strstr(*envp + length, "libtrash") != NULL;
+
+	return !ours || !strstr(ours, "libtrash");
+}
+
+/* policy_exec_fd() is called by the exec() wrappers before running a program with the environment
+ * envp: if we have a memfd to hand down, the program will have libtrash loaded and the fd is still
+ * the one we published (or inherited) and not some other file the program has opened with the
+ * same number since, the fd is kept open across exec() and returned. Otherwise we return -1. */
+
+int policy_exec_fd(char *const envp[])
+{
+	int fd = __atomic_load_n(&handed_down_fd, __ATOMIC_SEQ_CST);
+	struct stat image_stat;
+
+	if (fd == -1 || !preloaded_after_exec(envp) || fstat(fd, &image_stat) ||
+			image_stat.st_dev != __atomic_load_n(&handed_down_dev, __ATOMIC_SEQ_CST) ||
+			image_stat.st_ino != __atomic_load_n(&handed_down_ino, __ATOMIC_SEQ_CST) ||
+			fcntl(fd, F_SETFD, 0))
+		return -1;
+
+	return fd;
+}
+
+/* Returns how many bytes the array policy_exec_environment() builds from envp takes: */
+
+size_t policy_exec_environment_size(char *const envp[])
+{
+	size_t count = 0;
+
+	while (envp && envp[count])
+		count++;
+
+	return (count + 2) * sizeof(char *);
+}
+
+/* Returns the environment a program exec()ed with envp must get: envp itself if fd is -1 (there is
+ * nothing to hand down), otherwise environment (policy_exec_environment_size() bytes, which the
+ * caller allocates) filled in with envp and POLICY_FD_VARIABLE set to fd, in variable
+ * (POLICY_FD_ENTRY_SIZE bytes), instead of whatever value it had there: */
+
+char* const* policy_exec_environment(char *const envp[], char **environment, char *variable, int fd)
+{
+	size_t length = strlen(POLICY_FD_VARIABLE), count = 0;
+	char digits[3 * sizeof(int)];
+	int i = 0;
+
+	if (fd == -1)
+		return envp;
+
+	/* (By hand: snprintf() isn't async-signal-safe, and we may be in a child of fork()) */
+
+	do
+		digits[i++] = '0' + fd % 10;
+	while ((fd /= 10) > 0);
+
+	memcpy(variable, POLICY_FD_VARIABLE "=", length + 1);
+
+	for (count = length + 1; i > 0; count++)
+		variable[count] = digits[--i];
+
+	variable[count] = '\0';
+	count = 0;
+
+	for (; envp && *envp; envp++)
+		if (strncmp(*envp, POLICY_FD_VARIABLE, length) || (*envp)[length] != '=')
+			environment[count++] = *envp;
+
+	environment[count++] = variable;
+	environment[count] = NULL;
+
+	return environment;
+}
+
+/* Called by the exec() wrappers when exec() has failed: fd (if it isn't -1) goes back to being
+ * closed on exec(), so that it doesn't leak into whatever the program runs next some other way.
+ * errno is left alone. */
+
+void policy_exec_failed(int fd)
+{
+	int saved_errno = errno;
+
+	if (fd != -1)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	errno = saved_errno;
+}
+
+/* policy_release() closes the memfd of the snapshot cfg, which is going away, if it is still
+ * the one we published or inherited: */
+
+void policy_release(config *cfg)
+{
+	struct stat image_stat;
+	int fd = cfg->policy_fd;
+
+	if (fd == -1)
+		return;
+
+	/* (If it is the one the exec() wrappers hand down, they mustn't any more:) */
+
+	__atomic_compare_exchange_n(&handed_down_fd, &fd, -1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+	if (!fstat(cfg->policy_fd, &image_stat) &&
+			image_stat.st_dev == cfg->policy_fd_dev && image_stat.st_ino == cfg->policy_fd_ino)
+		close(cfg->policy_fd);
+}
+
+#endif /* POLICY_INHERIT */
+
+#endif /* POLICY_CACHE */
@@ -0,0 +1,1065 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* This file implements the built-in IGNORE_RE matcher (--enable-re-dfa): a single DFA for all
+ * the patterns listed in IGNORE_RE, which tells whether a path matches any of them (and which
+ * one) in a single pass over the path, however long it is and however many patterns there are.
+ * regexec() stays the reference; the DFA answers exactly as regexec() would, and whenever we
+ * can't be sure of that we leave the question to regexec():
+ *
+ * - re_dfa_compile() only takes the patterns which use nothing but the part of the POSIX extended
+ *   syntax which is used in practice and whose meaning doesn't depend on the locale: ASCII
+ *   characters, '.', bracket expressions without character classes, equivalence classes or
+ *   collating symbols (and whose ranges run between two digits, two lower-case or two upper-case
+ *   letters), escaped punctuation, '^', '$', '|', '(' ')', '*', '+', '?' and intervals. The others
+ *   (GNU extensions such as \w or \<, back-references, non-ASCII characters, ...) are left out,
+ *   and matched with regexec().
+ *
+ * - re_dfa_matches() returns RE_DFA_UNSURE for a path with a non-ASCII byte in it (in a
+ *   multibyte locale '.' or a negated bracket expression may match a whole character there).
+ *
+ * Each pattern is first turned into a position (Glushkov) automaton: every character, '.' or
+ * bracket expression in the pattern is a position, which matches a set of symbols, and the
+ * follow list of a position holds the positions which may come right after it. '^' and '$' are
+ * positions too, which match two extra symbols, RE_DFA_BEGIN and RE_DFA_END, which the path is
+ * wrapped in; this turns the anchors into ordinary characters, which is exactly right as long as
+ * no match can go through two anchors in a row (re_dfa_compile() leaves out patterns like "^^"
+ * or "$^"). The positions of all the patterns are then put together, each one remembering the
+ * pattern it comes from, and since a pattern may match anywhere in the path, a match of any of
+ * them may start at every symbol.
+ *
+ * The DFA is built lazily, as paths are matched: a state is a set of positions, and a transition
+ * is only worked out the first time it is taken. Symbols which no position tells apart share a
+ * class, so the table of transitions has a column per class rather than one per symbol. There
+ * are at most RE_DFA_MAX_STATES states (holding at most RE_DFA_POOL_SIZE positions between
+ * them); once they are all used, the rest of a path which needs a new one is matched by going
+ * from set of positions to set of positions, as the DFA would, but without remembering them.
+ *
+ * A snapshot (and so its DFA) is shared by every thread of the process, so the table is filled
+ * in without locks (which fork() could leave held): a new state is given a slot with an atomic
+ * increment, filled in and only then marked ready, and a transition is set with a
+ * compare-and-swap from NO_TRANSITION, so that a thread sees either nothing or a complete state.
+ * Two threads may add the same state at the same time; that merely wastes a slot. The DFA is
+ * freed along with the snapshot (see free_ignore_re() in helpers.c). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trash.h"
+
+#ifdef RE_DFA
+
+/* The symbols the DFA reads: the ASCII characters, and the beginning and the end of the path: */
+
+#define RE_DFA_BEGIN              128
+#define RE_DFA_END                129
+#define RE_DFA_SYMBOLS            130
+
+#define RE_DFA_PATTERN_POSITIONS  256	/* in a single pattern */
+#define RE_DFA_WORDS              (RE_DFA_PATTERN_POSITIONS / 64)
+#define RE_DFA_MAX_POSITIONS      16384	/* in all the patterns together */
+#ifndef RE_DFA_MAX_STATES		/* (tests/test-re-dfa-4 sets it to 4, to run out of states) */
+#define RE_DFA_MAX_STATES         4096
+#endif
+#define RE_DFA_POOL_SIZE          65536	/* positions in all the states together */
+#define RE_DFA_MAX_DEPTH          32	/* nested parentheses */
+#define RE_DFA_MAX_REPEAT         255	/* the largest bound of an interval we expand */
+
+#define RE_DFA_NO_MAX             (-1)	/* interval without an upper bound */
+
+#define NO_STATE                  (-1)	/* no slot left for a new state */
+
+/* A transition holds one plus the offset of the row of the next state in transitions (i.e., the
+ * state times classes), minus one plus the number of the pattern which matches if the next state
+ * is an accepting one, or: */
+
+#define NO_TRANSITION             0	/* not worked out yet */
+
+struct re_dfa
+{
+	unsigned positions;
+	unsigned classes;
+	unsigned char symbol_class[RE_DFA_SYMBOLS];
+	unsigned char class_symbol[RE_DFA_SYMBOLS];	/* a symbol of each class */
+	unsigned char idle[256];	/* characters which leave state 0 where it is (see re_dfa_matches()) */
+	struct symbol_set *symbols;	/* per position */
+	unsigned *pattern;		/* per position: the number of the pattern it comes from */
+	unsigned char *last;		/* per position: may a match of its pattern end there? */
+	uint32_t *follow_start;		/* per position, and one more: where its follow list starts in follow */
+	uint16_t *follow;
+	uint16_t *first;		/* the positions a match may start with */
+	unsigned first_count;
+
+	/* Filled in as paths are matched (see above); state 0 is the empty set: */
+
+	int32_t *transitions;		/* classes per state (see NO_TRANSITION) */
+	uint32_t *state_start;		/* where the positions of each state start in state_positions */
+	uint32_t *state_length;
+	uint32_t *state_hash;
+	unsigned char *state_ready;
+	uint16_t *state_positions;
+	unsigned state_count;		/* slots handed out (may end up a little over RE_DFA_MAX_STATES) */
+	unsigned pool_used;		/* entries of state_positions handed out (likewise) */
+};
+
+typedef struct symbol_set
+{
+	uint32_t bits[(RE_DFA_SYMBOLS + 31) / 32];
+}
+symbol_set;
+
+/* What re_dfa_compile() parses each pattern into: */
+
+typedef struct
+{
+	unsigned positions;
+	symbol_set symbols[RE_DFA_PATTERN_POSITIONS];
+	uint64_t follow[RE_DFA_PATTERN_POSITIONS][RE_DFA_WORDS];
+	int depth;
+	int unsupported;
+}
+re_parser;
+
+/* A parsed subexpression: can it match the empty string, and which positions may it start and
+ * end with? */
+
+typedef struct
+{
+	int nullable;
+	uint64_t first[RE_DFA_WORDS];
+	uint64_t last[RE_DFA_WORDS];
+}
+re_fragment;
+
+static void parse_alternation(re_parser *p, const char **s, re_fragment *f);
+
+/* ------------------------------------------------------------------------ */
+
+static void add_symbol(symbol_set *set, unsigned symbol)
+{
+	set->bits[symbol / 32] |= (uint32_t) 1 << (symbol % 32);
+}
+
+static int has_symbol(const symbol_set *set, unsigned symbol)
+{
+	return (set->bits[symbol / 32] >> (symbol % 32)) & 1;
+}
+
+static void add_positions(uint64_t *set, const uint64_t *other, unsigned words)
+{
+	unsigned w = 0;
+
+	for (w = 0; w < words; w++)
+		set[w] |= other[w];
+}
+
+static void empty_fragment(re_fragment *f)
+{
+	memset(f, 0, sizeof(re_fragment));
+	f->nullable = YES;
+}
+
+/* Every position in last is followed by every position in first: */
+
+static void link_positions(re_parser *p, const uint64_t *last, const uint64_t *first)
+{
+	unsigned position = 0;
+
+	for (position = 0; position < p->positions; position++)
+		if ((last[position / 64] >> (position % 64)) & 1)
+			add_positions(p->follow[position], first, RE_DFA_WORDS);
+}
+
+/* a becomes a followed by b: */
+
+static void concatenate(re_parser *p, re_fragment *a, const re_fragment *b)
+{
+	link_positions(p, a->last, b->first);
+
+	if (a->nullable)
+		add_positions(a->first, b->first, RE_DFA_WORDS);
+
+	if (b->nullable)
+		add_positions(a->last, b->last, RE_DFA_WORDS);
+	else
+		memcpy(a->last, b->last, sizeof(a->last));
+
+	a->nullable = a->nullable && b->nullable;
+}
+
+/* a becomes a+ (a* once it is made nullable): */
+
+static void repeat(re_parser *p, re_fragment *a)
+{
+	link_positions(p, a->last, a->first);
+}
+
+static void unsupported(re_parser *p)
+{
+	p->unsupported = YES;
+}
+
+static int is_anchor(const re_parser *p, unsigned position)
+{
+	return has_symbol(&p->symbols[position], RE_DFA_BEGIN) || has_symbol(&p->symbols[position], RE_DFA_END);
+}
+
+static int ascii_alnum(unsigned c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* Both ends of a range must be digits, lower-case or upper-case letters, so that the range means
+ * the same in every locale: */
+
+static int portable_range(unsigned from, unsigned to)
+{
+	return from <= to &&
+		((from >= '0' && to <= '9') || (from >= 'a' && to <= 'z') || (from >= 'A' && to <= 'Z'));
+}
+
+/* *s points right after the '[': */
+
+static void parse_bracket(re_parser *p, const char **s, symbol_set *symbols)
+{
+	const char *c = *s;
+	int negated = NO;
+	unsigned symbol = 0;
+
+	if (*c == '^')
+	{
+		negated = YES;
+		c++;
+	}
+
+	/* A ']' right after the '[' (or the '^') stands for itself: */
+
+	do
+	{
+		if (*c == '\0' || (*c == '[' && (c[1] == ':' || c[1] == '=' || c[1] == '.')))
+		{
+			unsupported(p);
+			return;
+		}
+
+		if (c[1] == '-' && c[2] != ']' && c[2] != '\0')
+		{
+			if (!portable_range((unsigned char) c[0], (unsigned char) c[2]))
+			{
+				unsupported(p);
+				return;
+			}
+
+			for (symbol = (unsigned char) c[0]; symbol <= (unsigned char) c[2]; symbol++)
+				add_symbol(symbols, symbol);
+
+			c += 3;
+		}
+		else
+			add_symbol(symbols, (unsigned char) *c++);
+	}
+	while (*c != ']');
+
+	if (negated)
+		for (symbol = 1; symbol < 128; symbol++)
+			symbols->bits[symbol / 32] ^= (uint32_t) 1 << (symbol % 32);
+
+	*s = c + 1;
+}
+
+/* A single character, '.', bracket expression, anchor or parenthesised subexpression: */
+
+static void parse_atom(re_parser *p, const char **s, re_fragment *f)
+{
+	symbol_set symbols;
+	unsigned c = (unsigned char) **s;
+
+	memset(&symbols, 0, sizeof(symbols));
+
+	switch (c)
+	{
+		case '(':
+			if (++p->depth > RE_DFA_MAX_DEPTH || (*s)[1] == ')')
+			{
+				unsupported(p);
+				return;
+			}
+
+			(*s)++;
+			parse_alternation(p, s, f);
+
+			if (p->unsupported || **s != ')')
+			{
+				unsupported(p);
+				return;
+			}
+
+			(*s)++;
+			p->depth--;
+			return;
+
+		case '.':
+			for (c = 1; c < 128; c++)
+				add_symbol(&symbols, c);
+			(*s)++;
+			break;
+
+		case '^':
+			add_symbol(&symbols, RE_DFA_BEGIN);
+			(*s)++;
+			break;
+
+		case '$':
+			add_symbol(&symbols, RE_DFA_END);
+			(*s)++;
+			break;
+
+		case '[':
+			(*s)++;
+			parse_bracket(p, s, &symbols);
+			break;
+
+		case '\\':
+			/* Only escaped punctuation stands for itself; \w, \<, \1 and friends mean
+			 * something else: */
+
+			c = (unsigned char) (*s)[1];
+
+			if (c == '\0' || ascii_alnum(c) || c == '`' || c == '\'' || c == '<' || c == '>')
+			{
+				unsupported(p);
+				return;
+			}
+
+			add_symbol(&symbols, c);
+			*s += 2;
+			break;
+
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+		case '|':
+		case ')':
+		case '\0':
+			unsupported(p);
+			return;
+
+		default:
+			add_symbol(&symbols, c);
+			(*s)++;
+	}
+
+	if (p->unsupported)
+		return;
+
+	if (p->positions == RE_DFA_PATTERN_POSITIONS)
+	{
+		unsupported(p);
+		return;
+	}
+
+	p->symbols[p->positions] = symbols;
+
+	memset(f, 0, sizeof(re_fragment));
+	f->first[p->positions / 64] = f->last[p->positions / 64] = (uint64_t) 1 << (p->positions % 64);
+
+	p->positions++;
+}
+
+/* The number at *c (at most RE_DFA_MAX_REPEAT + 1, so that it can't overflow): */
+
+static int parse_bound(const char **c)
+{
+	int bound = 0;
+
+	for (; **c >= '0' && **c <= '9'; (*c)++)
+		if (bound <= RE_DFA_MAX_REPEAT)
+			bound = bound * 10 + (**c - '0');
+
+	return bound > RE_DFA_MAX_REPEAT ? RE_DFA_MAX_REPEAT + 1 : bound;
+}
+
+/* *s points at the '{'; only {m}, {m,} and {m,n} are accepted: */
+
+static int parse_interval(const char **s, int *min, int *max)
+{
+	const char *c = *s + 1;
+
+	if (*c < '0' || *c > '9')
+		return NO;
+
+	*min = *max = parse_bound(&c);
+
+	if (*c == ',')
+	{
+		c++;
+		*max = (*c >= '0' && *c <= '9') ? parse_bound(&c) : RE_DFA_NO_MAX;
+	}
+
+	if (*c != '}' || *min > RE_DFA_MAX_REPEAT || *max > RE_DFA_MAX_REPEAT ||
+			(*max != RE_DFA_NO_MAX && *max < *min))
+		return NO;
+
+	*s = c + 1;
+
+	return YES;
+}
+
+/* An atom and its quantifier, if any: */
+
+static void parse_piece(re_parser *p, const char **s, re_fragment *f)
+{
+	const char *atom = *s, *copy_end = NULL;
+	re_fragment copy;
+	unsigned first_position = p->positions, position = 0;
+	int min = 0, max = 0, copies = 0, i = 0;
+
+	parse_atom(p, s, f);
+
+	if (p->unsupported)
+		return;
+
+	/* GNU libc doesn't treat anchors inside a repeated subexpression as anchors (e.g., "(^a)+"
+	 * matches "aa"), so we leave those to it: */
+
+	if (**s == '*' || **s == '+' || **s == '?' || **s == '{')
+		for (position = first_position; position < p->positions; position++)
+			if (is_anchor(p, position))
+			{
+				unsupported(p);
+				return;
+			}
+
+	switch (**s)
+	{
+		case '*':
+			repeat(p, f);
+			f->nullable = YES;
+			(*s)++;
+			break;
+
+		case '+':
+			repeat(p, f);
+			(*s)++;
+			break;
+
+		case '?':
+			f->nullable = YES;
+			(*s)++;
+			break;
+
+		case '{':
+			if (!parse_interval(s, &min, &max))
+			{
+				unsupported(p);
+				return;
+			}
+
+			/* a{m,n} becomes m copies of a followed by n - m optional ones, and a{m,} becomes
+			 * m copies of a, the last of which is repeated (a* if m is 0). Every copy gets
+			 * positions of its own, so the atom is parsed again for each one: */
+
+			copies = (max == RE_DFA_NO_MAX) ? (min > 0 ? min : 1) : max;
+
+			if (copies == 0)
+			{
+				unsupported(p);
+				return;
+			}
+
+			copy = *f;
+			empty_fragment(f);
+
+			for (i = 1; i <= copies; i++)
+			{
+				if (i > 1)
+				{
+					copy_end = atom;
+					parse_atom(p, &copy_end, &copy);
+
+					if (p->unsupported)
+						return;
+				}
+
+				if (i == copies && max == RE_DFA_NO_MAX)
+					repeat(p, &copy);
+
+				if (i > min)
+					copy.nullable = YES;
+
+				concatenate(p, f, &copy);
+			}
+			break;
+
+		default:
+			return;
+	}
+
+	/* GNU libc accepts things like "a+?" or "a**"; we leave them to it: */
+
+	if (**s == '*' || **s == '+' || **s == '?' || **s == '{')
+		unsupported(p);
+}
+
+static void parse_branch(re_parser *p, const char **s, re_fragment *f)
+{
+	re_fragment piece;
+
+	empty_fragment(f);
+
+	if (**s == '|' || **s == ')' || **s == '\0')
+	{
+		unsupported(p);
+		return;
+	}
+
+	while (**s != '|' && **s != ')' && **s != '\0')
+	{
+		parse_piece(p, s, &piece);
+
+		if (p->unsupported)
+			return;
+
+		concatenate(p, f, &piece);
+	}
+}
+
+static void parse_alternation(re_parser *p, const char **s, re_fragment *f)
+{
+	re_fragment branch;
+
+	parse_branch(p, s, f);
+
+	while (!p->unsupported && **s == '|')
+	{
+		(*s)++;
+		parse_branch(p, s, &branch);
+
+		if (p->unsupported)
+			return;
+
+		f->nullable = f->nullable || branch.nullable;
+		add_positions(f->first, branch.first, RE_DFA_WORDS);
+		add_positions(f->last, branch.last, RE_DFA_WORDS);
+	}
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Parses a single pattern into p; returns NO if the DFA can't take it (see above). */
+
+static int parse_pattern(re_parser *p, const char *pattern, re_fragment *top)
+{
+	const char *s = pattern;
+	unsigned position = 0, i = 0;
+
+	for (s = pattern; *s != '\0'; s++)
+		if ((unsigned char) *s >= 128)
+			return NO;
+
+	memset(p, 0, sizeof(re_parser));
+
+	s = pattern;
+	parse_alternation(p, &s, top);
+
+	/* A pattern which matches the empty string matches every path, so there is nothing to gain;
+	 * and neither can we tell apart "^^" and friends from what they mean (see above): */
+
+	if (p->unsupported || *s != '\0' || top->nullable)
+		return NO;
+
+	for (position = 0; position < p->positions; position++)
+		if (is_anchor(p, position))
+			for (i = 0; i < p->positions; i++)
+				if (((p->follow[position][i / 64] >> (i % 64)) & 1) && is_anchor(p, i))
+					return NO;
+
+	return YES;
+}
+
+static int grow(void **array, size_t size)
+{
+	void *bigger = realloc(*array, size);
+
+	if (!bigger)
+		return NO;
+
+	*array = bigger;
+
+	return YES;
+}
+
+/* Makes sure *array (of *capacity elements of size bytes) can hold needed elements: */
+
+static int reserve(void **array, unsigned *capacity, unsigned needed, size_t size)
+{
+	unsigned new_capacity = *capacity ? *capacity : 64;
+
+	if (needed <= *capacity)
+		return YES;
+
+	while (new_capacity < needed)
+		new_capacity *= REALLOC_FACTOR;
+
+	if (!grow(array, (size_t) new_capacity * size))
+		return NO;
+
+	*capacity = new_capacity;
+
+	return YES;
+}
+
+/* Adds the positions in p, those of the pattern number pattern, to dfa: */
+
+static int add_pattern(struct re_dfa *dfa, const re_parser *p, const re_fragment *top, unsigned pattern,
+		unsigned *positions_capacity, unsigned *follow_capacity, unsigned *first_capacity)
+{
+	unsigned base = dfa->positions, position = 0, i = 0;
+	unsigned follow_count = dfa->follow_start[base];
+	unsigned capacity = *positions_capacity ? *positions_capacity : 64;
+
+	/* All the per-position arrays have the same capacity (follow_start has one more entry): */
+
+	if (base + p->positions > *positions_capacity)
+	{
+		while (capacity < base + p->positions)
+			capacity *= REALLOC_FACTOR;
+
+		if (!grow((void **) &dfa->symbols, capacity * sizeof(symbol_set)) ||
+				!grow((void **) &dfa->pattern, capacity * sizeof(unsigned)) ||
+				!grow((void **) &dfa->last, capacity) ||
+				!grow((void **) &dfa->follow_start, (capacity + 1) * sizeof(uint32_t)))
+			return NO;
+
+		*positions_capacity = capacity;
+	}
+
+	for (position = 0; position < p->positions; position++)
+	{
+		dfa->symbols[base + position] = p->symbols[position];
+		dfa->pattern[base + position] = pattern;
+		dfa->last[base + position] = (top->last[position / 64] >> (position % 64)) & 1;
+
+		for (i = 0; i < p->positions; i++)
+			if ((p->follow[position][i / 64] >> (i % 64)) & 1)
+			{
+				if (!reserve((void **) &dfa->follow, follow_capacity, follow_count + 1, sizeof(uint16_t)))
+					return NO;
+
+				dfa->follow[follow_count++] = base + i;
+			}
+
+		dfa->follow_start[base + position + 1] = follow_count;
+	}
+
+	for (position = 0; position < p->positions; position++)
+		if ((top->first[position / 64] >> (position % 64)) & 1)
+		{
+			if (!reserve((void **) &dfa->first, first_capacity, dfa->first_count + 1, sizeof(uint16_t)))
+				return NO;
+
+			dfa->first[dfa->first_count++] = base + position;
+		}
+
+	dfa->positions += p->positions;
+
+	return YES;
+}
+
+void re_dfa_free(struct re_dfa *dfa)
+{
+	if (!dfa)
+		return;
+
+	free(dfa->symbols);
+	free(dfa->pattern);
+	free(dfa->last);
+	free(dfa->follow_start);
+	free(dfa->follow);
+	free(dfa->first);
+	free(dfa->transitions);
+	free(dfa->state_start);
+	free(dfa->state_length);
+	free(dfa->state_hash);
+	free(dfa->state_ready);
+	free(dfa->state_positions);
+	free(dfa);
+}
+
+/* Compiles those of the count patterns (which regcomp() has already accepted) which it can into
+ * a single DFA, and sets compiled[i] for each one it took; NULL patterns are left out. Returns NULL if it took none of them,
+ * or if we run out of memory. */
+
+struct re_dfa* re_dfa_compile(const char *const *patterns, unsigned count, int *compiled)
+{
+	struct re_dfa *dfa = NULL;
+	re_parser *p = NULL;
+	re_fragment top;
+	unsigned positions_capacity = 0, follow_capacity = 0, first_capacity = 0;
+	unsigned char split[2][RE_DFA_SYMBOLS];
+	unsigned pattern = 0, position = 0, symbol = 0, classes = 0, i = 0;
+	int member = 0;
+
+	for (pattern = 0; pattern < count; pattern++)
+		compiled[pattern] = NO;
+
+	dfa = calloc(1, sizeof(struct re_dfa));
+	p = malloc(sizeof(re_parser));
+
+	if (!dfa || !p || !(dfa->follow_start = calloc(1, sizeof(uint32_t))))
+		goto fail_re_dfa_compile;
+
+	for (pattern = 0; pattern < count; pattern++)
+	{
+		if (!patterns[pattern])
+			continue;
+
+		if (!parse_pattern(p, patterns[pattern], &top) || dfa->positions + p->positions > RE_DFA_MAX_POSITIONS)
+		{
+#ifdef DEBUG
+			fprintf(stderr, "IGNORE_RE pattern %s can't be turned into a DFA, regexec() will be used for it.\n",
+					patterns[pattern]);
+#endif
+			continue;
+		}
+
+		if (!add_pattern(dfa, p, &top, pattern, &positions_capacity, &follow_capacity, &first_capacity))
+			goto fail_re_dfa_compile;
+
+		compiled[pattern] = YES;
+	}
+
+	if (dfa->positions == 0)
+		goto fail_re_dfa_compile;
+
+	/* Symbols matched by the same positions share a class: starting from a single class, every
+	 * position splits each class into the symbols it matches and those it doesn't. */
+
+	memset(dfa->symbol_class, 0, sizeof(dfa->symbol_class));
+	classes = 1;
+
+	for (position = 0; position < dfa->positions; position++)
+	{
+		memset(split, 0xff, sizeof(split));
+		classes = 0;
+
+		for (symbol = 0; symbol < RE_DFA_SYMBOLS; symbol++)
+		{
+			member = has_symbol(&dfa->symbols[position], symbol);
+
+			if (split[member][dfa->symbol_class[symbol]] == 0xff)
+				split[member][dfa->symbol_class[symbol]] = classes++;
+
+			dfa->symbol_class[symbol] = split[member][dfa->symbol_class[symbol]];
+		}
+	}
+
+	dfa->classes = classes;
+
+	for (symbol = 0; symbol < RE_DFA_SYMBOLS; symbol++)
+		dfa->class_symbol[dfa->symbol_class[symbol]] = symbol;
+
+	/* From state 0, a character no match can start with leads back to state 0: */
+
+	for (symbol = 0; symbol < 256; symbol++)
+	{
+		dfa->idle[symbol] = (symbol != '\0' && symbol < 128);
+
+		for (i = 0; i < dfa->first_count && dfa->idle[symbol]; i++)
+			if (has_symbol(&dfa->symbols[dfa->first[i]], symbol))
+				dfa->idle[symbol] = NO;
+	}
+
+	/* The part which is filled in as paths are matched; calloc() leaves every transition set to
+	 * NO_TRANSITION, and the pages nobody gets to untouched. State 0, the empty set, is where
+	 * every path starts: */
+
+	dfa->transitions = calloc((size_t) RE_DFA_MAX_STATES * classes, sizeof(int32_t));
+	dfa->state_start = calloc(RE_DFA_MAX_STATES, sizeof(uint32_t));
+	dfa->state_length = calloc(RE_DFA_MAX_STATES, sizeof(uint32_t));
+	dfa->state_hash = calloc(RE_DFA_MAX_STATES, sizeof(uint32_t));
+	dfa->state_ready = calloc(RE_DFA_MAX_STATES, 1);
+	dfa->state_positions = calloc(RE_DFA_POOL_SIZE, sizeof(uint16_t));
+
+	if (!dfa->transitions || !dfa->state_start || !dfa->state_length || !dfa->state_hash ||
+			!dfa->state_ready || !dfa->state_positions)
+		goto fail_re_dfa_compile;
+
+	dfa->state_hash[0] = 2166136261U;	/* that of the empty list (see list_positions()) */
+	dfa->state_ready[0] = YES;
+	dfa->state_count = 1;
+
+#ifdef DEBUG
+	fprintf(stderr, "IGNORE_RE compiled into a DFA: %u positions, %u symbol classes.\n", dfa->positions, classes);
+#endif
+
+	free(p);
+
+	return dfa;
+
+fail_re_dfa_compile:
+	for (pattern = 0; pattern < count; pattern++)
+		compiled[pattern] = NO;
+
+	free(p);
+	re_dfa_free(dfa);
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Marks in next (a bitmap of all the positions) the positions we are in after reading a symbol
+ * of class class in the set of the length positions in set. If any of them is the last position
+ * of a match, we don't need the set: the number of its pattern plus one is returned instead
+ * (that of the first pattern listed, if several match); otherwise 0. */
+
+static unsigned next_positions(const struct re_dfa *dfa, const uint16_t *set, unsigned length, unsigned class,
+		uint64_t *next)
+{
+	const symbol_set *symbols = dfa->symbols;
+	unsigned symbol = dfa->class_symbol[class];
+	unsigned i = 0, j = 0, w = 0, position = 0;
+	uint64_t bits = 0;
+
+	memset(next, 0, (dfa->positions + 63) / 64 * sizeof(uint64_t));
+
+	for (i = 0; i < dfa->first_count; i++)
+		if (has_symbol(&symbols[dfa->first[i]], symbol))
+			next[dfa->first[i] / 64] |= (uint64_t) 1 << (dfa->first[i] % 64);
+
+	for (i = 0; i < length; i++)
+		for (j = dfa->follow_start[set[i]]; j < dfa->follow_start[set[i] + 1]; j++)
+			if (has_symbol(&symbols[dfa->follow[j]], symbol))
+				next[dfa->follow[j] / 64] |= (uint64_t) 1 << (dfa->follow[j] % 64);
+
+	/* (Positions are numbered in the order their patterns are listed.) */
+
+	for (w = 0; w < (dfa->positions + 63) / 64; w++)
+		for (bits = next[w]; bits; bits &= bits - 1)
+		{
+			position = w * 64 + __builtin_ctzll(bits);
+
+			if (dfa->last[position])
+				return dfa->pattern[position] + 1;
+		}
+
+	return 0;
+}
+
+/* Turns the bitmap next into a list of positions in set; returns its length: */
+
+static unsigned list_positions(const struct re_dfa *dfa, const uint64_t *next, uint16_t *set, uint32_t *hash)
+{
+	uint64_t bits = 0;
+	unsigned w = 0, length = 0;
+
+	*hash = 2166136261U;
+
+	for (w = 0; w < (dfa->positions + 63) / 64; w++)
+		for (bits = next[w]; bits; bits &= bits - 1)
+		{
+			set[length] = w * 64 + __builtin_ctzll(bits);
+			*hash = (*hash ^ set[length]) * 16777619U;
+			length++;
+		}
+
+	return length;
+}
+
+/* The state holding the length positions in set, which is added if there is none yet; NO_STATE if
+ * there is no room left: */
+
+static int find_state(struct re_dfa *dfa, const uint16_t *set, unsigned length, uint32_t hash)
+{
+	unsigned count = __atomic_load_n(&dfa->state_count, __ATOMIC_ACQUIRE);
+	unsigned state = 0, start = 0;
+
+	for (state = 0; state < count && state < RE_DFA_MAX_STATES; state++)
+		if (__atomic_load_n(&dfa->state_ready[state], __ATOMIC_ACQUIRE) &&
+				dfa->state_hash[state] == hash && dfa->state_length[state] == length &&
+				!memcmp(dfa->state_positions + dfa->state_start[state], set, length * sizeof(uint16_t)))
+			return state;
+
+	if (count >= RE_DFA_MAX_STATES || __atomic_load_n(&dfa->pool_used, __ATOMIC_RELAXED) + length > RE_DFA_POOL_SIZE)
+		return NO_STATE;
+
+	state = __atomic_fetch_add(&dfa->state_count, 1, __ATOMIC_RELAXED);
+	start = __atomic_fetch_add(&dfa->pool_used, length, __ATOMIC_RELAXED);
+
+	if (state >= RE_DFA_MAX_STATES || start + length > RE_DFA_POOL_SIZE)
+		return NO_STATE;
+
+	memcpy(dfa->state_positions + start, set, length * sizeof(uint16_t));
+	dfa->state_start[state] = start;
+	dfa->state_length[state] = length;
+	dfa->state_hash[state] = hash;
+
+	__atomic_store_n(&dfa->state_ready[state], YES, __ATOMIC_RELEASE);
+
+	return state;
+}
+
+/* Works out the transition of the state whose row starts at row on class, which nobody has taken
+ * yet. Returns it, or NO_TRANSITION if there is no room left for the state it leads to. set is
+ * room for a list of all the positions. */
+
+static int add_transition(struct re_dfa *dfa, int row, unsigned class, uint16_t *set)
+{
+	int32_t *slot = dfa->transitions + row + class;
+	int32_t expected = NO_TRANSITION;
+	uint64_t next[RE_DFA_MAX_POSITIONS / 64];
+	unsigned state = row / dfa->classes, accepting = 0, length = 0;
+	uint32_t hash = 0;
+	int value = NO_TRANSITION, next_state = 0;
+
+	accepting = next_positions(dfa, dfa->state_positions + dfa->state_start[state], dfa->state_length[state],
+			class, next);
+
+	if (accepting)
+		value = -(int) accepting;
+	else
+	{
+		length = list_positions(dfa, next, set, &hash);
+		next_state = find_state(dfa, set, length, hash);
+
+		if (next_state == NO_STATE)
+			return NO_TRANSITION;
+
+		value = next_state * (int) dfa->classes + 1;
+	}
+
+	/* If another thread got there first, we use its state: */
+
+	if (!__atomic_compare_exchange_n(slot, &expected, value, NO, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		value = expected;
+
+	return value;
+}
+
+/* Matches the rest of the path, from symbol on, going from set to set, once we have run out of
+ * room for states in the state whose row starts at row: */
+
+static int match_without_states(const struct re_dfa *dfa, int row, unsigned symbol, const unsigned char *c,
+		uint16_t *set)
+{
+	uint64_t next[RE_DFA_MAX_POSITIONS / 64];
+	unsigned state = row / dfa->classes, length = dfa->state_length[state], accepting = 0;
+	uint32_t hash = 0;
+
+	memcpy(set, dfa->state_positions + dfa->state_start[state], length * sizeof(uint16_t));
+
+	for (;;)
+	{
+		accepting = next_positions(dfa, set, length, dfa->symbol_class[symbol], next);
+
+		if (accepting)
+			return accepting;
+
+		if (symbol == RE_DFA_END)
+			return NO;
+
+		length = list_positions(dfa, next, set, &hash);
+
+		if (*c >= 128)
+			return RE_DFA_UNSURE;
+
+		symbol = *c ? *c++ : RE_DFA_END;
+	}
+}
+
+/* Does path match any of the patterns? Returns 0 if it doesn't, the number of the (first listed)
+ * pattern which matches plus one if it does, or RE_DFA_UNSURE (see above).
+ *
+ * The beginning of the path, every character in it and its end take a transition each, which is
+ * a single load once it has been taken before: transitions hold the rows of the next states
+ * rather than their numbers, and lead straight to the number of the pattern which matches rather
+ * than to an accepting state. In state 0 we skip the characters which would leave us there (for
+ * "\.o$", everything but the dots) without looking at transitions at all, so that those don't
+ * wait on a load each. The fields of dfa we need are copied into locals first, since the atomic
+ * loads would otherwise have them read again for every character. */
+
+int re_dfa_matches(struct re_dfa *dfa, const char *path)
+{
+	const unsigned char *c = (const unsigned char *) path;
+	const unsigned char *symbol_class = dfa->symbol_class;
+	const unsigned char *idle = dfa->idle;
+	const int32_t *transitions = dfa->transitions;
+	uint16_t *set = NULL;
+	unsigned symbol = RE_DFA_BEGIN;
+	int row = 0, next = 0;
+
+	for (;;)
+	{
+		next = __atomic_load_n(&transitions[row + symbol_class[symbol]], __ATOMIC_ACQUIRE);
+
+		if (next <= 0)
+		{
+			/* A new transition needs a list of positions, which may be too big for the
+			 * stack: */
+
+			if (next == NO_TRANSITION)
+			{
+				if (!(set = malloc(dfa->positions * sizeof(uint16_t))))
+					return RE_DFA_UNSURE;
+
+				next = add_transition(dfa, row, symbol_class[symbol], set);
+
+				if (next == NO_TRANSITION)
+				{
+					next = match_without_states(dfa, row, symbol, c, set);
+					free(set);
+					return next;
+				}
+
+				free(set);
+			}
+
+			if (next < 0)
+				return -next;
+		}
+
+		if (symbol == RE_DFA_END)
+			return NO;
+
+		row = next - 1;
+
+		if (row == 0)
+			while (idle[*c])
+				c++;
+
+		symbol = *c;
+
+		if (symbol >= 128)
+			return RE_DFA_UNSURE;
+
+		if (symbol == '\0')
+			symbol = RE_DFA_END;
+		else
+			c++;
+	}
+}
+
+#endif /* RE_DFA */
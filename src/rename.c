@@ -46,7 +46,7 @@ static int rename_handle_error(const char *oldpath, const char *newpath,
  *
  */
 
-int rename(const char *oldpath, const char *newpath)
+PUBLIC int rename(const char *oldpath, const char *newpath)
 {
 
 	struct stat path_stat;
@@ -55,51 +55,65 @@ int rename(const char *oldpath, const char *newpath)
 	int error = 0;
 	int retval = 0;
 	int file_should = 0;
-	config cfg;
+	config *cfg = NULL;
 #ifdef DEBUG
 	fprintf(stderr, "\nEntering rename().\n");
 #endif
 	/* First we call libtrash_init(), which will set the configuration variables: */
-	libtrash_init(&cfg);
+	cfg = libtrash_init();
 
 	/* We always call libtrash_fini() before quitting. */
 	/* If real_rename is unavailable, we must return -1 because there's nothing else we can do: */
-	if (!cfg.real_rename)
+	if (!cfg->real_rename)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "real_rename is unavailable.\nrename returning -1.\n");
 #endif
 		errno = 0; /* we set errno to zero so that, if errno was previously set to some other value, it
 			      doesn't confuse the caller. */
-		libtrash_fini(&cfg);
+		libtrash_fini(cfg);
 		return -1;
 	}
 
 
-	/* If libtrash_off is set to true or intercept_rename is set to false, the user has asked us to become temporarily inactive an let the
-	 * real rename() perform its task. Alternatively, we might have been passed a NULL pointer and let the real rename handle that:*/
+	/* If libtrash_off is set to true or intercept_rename is set to false (or the control page says so), the user has asked us to become
+	 * temporarily inactive an let the real rename() perform its task. Alternatively, we might have been passed a NULL pointer and let the
+	 * real rename handle that:*/
 
-	if (cfg.libtrash_off || !cfg.intercept_rename ||
+	if (cfg->libtrash_off || !cfg->intercept_rename || (CONTROL_FLAGS(cfg) & (CONTROL_OFF | CONTROL_NO_RENAME)) ||
 			oldpath == NULL || newpath == NULL)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Passing request to rename(%s, %s) to the real rename() because libtrash_off = true or intercept_rename = false (OR: one of the args is NULL).\n",
 				oldpath, newpath);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_rename) (oldpath, newpath); /* real rename() sets errno. */
+		retval = (*cfg->real_rename) (oldpath, newpath); /* real rename() sets errno. */
+		libtrash_fini(cfg);
+		return retval;
 	}
 	/* If general_failure is set, we know that something went wrong in _init, and we do whatever in_case_of_failure
 	 * specifies, returning the appropriate error code.*/
-	if (cfg.general_failure)
+	if (cfg->general_failure)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "general_failure is set in rename(), invoking rename_handle_error().\n"
-				"in_case_of_failure has value %d.\n", cfg.in_case_of_failure);
+				"in_case_of_failure has value %d.\n", cfg->in_case_of_failure);
 #endif
-		libtrash_fini(&cfg);
-		return rename_handle_error(oldpath, newpath, cfg.real_rename, cfg.in_case_of_failure); /* either the real rename() sets errno, or we return -1 and errno is
+		retval = rename_handle_error(oldpath, newpath, cfg->real_rename, cfg->in_case_of_failure); /* either the real rename() sets errno, or we return -1 and errno is
 													* set to 0. */
+		libtrash_fini(cfg);
+		return retval;
+	}
+	/* If newpath is enough to tell that the file it names (if any) can simply be replaced, we don't need to look
+	 * at either file (see decide_action_from_path()): */
+	if (decide_action_from_path(newpath, cfg) == BE_REMOVED)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "decide_action_from_path() told rename() that %s can be replaced.\n", newpath);
+#endif
+		retval = (*cfg->real_rename) (oldpath, newpath); /* errno set by real rename(). */
+		libtrash_fini(cfg);
+		return retval;
 	}
 	/* First of all: does a regular file called newpath already exist? If it doesn't, we don't need to
 	 * do anything:
@@ -114,8 +128,9 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 		fprintf(stderr, "newpath (%s) either doesn't exit, or is a special file (non-symlink) or is a directory.\nCalling the \"real\" rename().\n", newpath);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_rename) (oldpath, newpath); /* errno set by real rename(). */
+		retval = (*cfg->real_rename) (oldpath, newpath); /* errno set by real rename(). */
+		libtrash_fini(cfg);
+		return retval;
 	}
 
 
@@ -141,8 +156,9 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 		fprintf(stderr, "oldpath (%s) either  doesn't exist or is a directory.\nCalling the \"real\" rename().\n", oldpath);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_rename) (oldpath, newpath); /* errno set by real rename() */
+		retval = (*cfg->real_rename) (oldpath, newpath); /* errno set by real rename() */
+		libtrash_fini(cfg);
+		return retval;
 	}
 
 
@@ -182,8 +198,9 @@ int rename(const char *oldpath, const char *newpath)
 		fprintf(stderr, "We don't have write-access to the dir which contains oldpath (%s).\n"
 				"Calling the \"real\" rename().\n", oldpath);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_rename) (oldpath, newpath); /* errno set by real rename() */
+		retval = (*cfg->real_rename) (oldpath, newpath); /* errno set by real rename() */
+		libtrash_fini(cfg);
+		return retval;
 	}
 	/* By now we know that our services are needed: rename(oldpath, newpath) might cause the loss of the file originally
 	 * called newpath, because both exist and we have write-permission to the dirs which contain them.
@@ -199,10 +216,11 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 		fprintf(stderr, "Unable to build absolute_newpath.\nInvoking rename_handle_error().\n");
 #endif
-		libtrash_fini(&cfg);
-		return rename_handle_error(oldpath, newpath, cfg.real_rename,
-				cfg.in_case_of_failure); /* errno set either by the real rename() or set to 0 (just like the other
+		retval = rename_handle_error(oldpath, newpath, cfg->real_rename,
+				cfg->in_case_of_failure); /* errno set either by the real rename() or set to 0 (just like the other
 							  * call to rename_handle_error() above). */
+		libtrash_fini(cfg);
+		return retval;
 	}
 
 	/* Independently of the way in which the argument was written, absolute_newpath now holds the absolute
@@ -216,7 +234,7 @@ int rename(const char *oldpath, const char *newpath)
 	/* By now we want to know whether the file at newpath "qualifies" to be stored in the trash can rather than
 	   permanently lost (another possible option is this file being considered "unremovable"). This decision is
 	   taken according to the user's preferences by the function decide_action(): */
-	file_should = decide_action(absolute_newpath, &cfg);
+	file_should = decide_action(absolute_newpath, cfg);
 	switch (file_should)
 	{
 
@@ -224,7 +242,7 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 			fprintf(stderr, "decide_action() told rename() to permanently destroy file %s.\n", absolute_newpath);
 #endif
-			retval = (*cfg.real_rename) (oldpath, newpath); /* errno set by real rename() */
+			retval = (*cfg->real_rename) (oldpath, newpath); /* errno set by real rename() */
 			break;
 		case BE_LEFT_UNTOUCHED:
 #ifdef DEBUG
@@ -244,23 +262,20 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 				fprintf(stderr, " but its suggestion is being ignored because %s is just a symlink.\n", absolute_newpath);
 #endif
-				retval = (*cfg.real_rename) (oldpath, newpath); /* real rename() sets errno. */
+				retval = (*cfg->real_rename) (oldpath, newpath); /* real rename() sets errno. */
 			}
 			else /* if absolute_newpath isn't a symlink */
 			{
 				/* (See below for information on this code.) */
-				if (found_under_dir(absolute_newpath, cfg.home)) /* (a) */
-					error = graft_file(cfg.absolute_trash_can, absolute_newpath, cfg.home, &cfg);
-				else /* (b) */
-					error = graft_file(cfg.absolute_trash_system_root, absolute_newpath, NULL, &cfg);
+				error = save_in_trash(absolute_newpath, cfg); /* (a) or (b) */
 
 				if (error) /* graft_file() failed. */
 				{
 #ifdef DEBUG
 					fprintf(stderr, "graft_file() failed, invoking rename_handle_error().\n");
 #endif
-					retval = rename_handle_error(oldpath, newpath, cfg.real_rename,
-							cfg.in_case_of_failure); /* about errno: see explanation near the previous call to
+					retval = rename_handle_error(oldpath, newpath, cfg->real_rename,
+							cfg->in_case_of_failure); /* about errno: see explanation near the previous call to
 										  * rename_handle_error(). */
 				}
 				else /* graft_file() succeeded, we just need to perform the "real" operation: */
@@ -268,7 +283,7 @@ int rename(const char *oldpath, const char *newpath)
 #ifdef DEBUG
 					fprintf(stderr, "graft_file(), called by rename(), succeeded.\n");
 #endif
-					retval = (*cfg.real_rename) (oldpath, newpath); /* real rename() setting errno. */
+					retval = (*cfg->real_rename) (oldpath, newpath); /* real rename() setting errno. */
 				}
 			}
 			break;
@@ -286,7 +301,7 @@ int rename(const char *oldpath, const char *newpath)
 
 	/* Free memory before quitting: */
 	free(absolute_newpath);
-	libtrash_fini(&cfg);
+	libtrash_fini(cfg);
 	return retval; /* By now, errno has been set to a meaningful value in one of the cases above. */
 }
 
@@ -298,10 +313,10 @@ int rename(const char *oldpath, const char *newpath)
 
 #ifdef AT_FUNCTIONS
 
-int renameat(int olddirfd, const char *arg_oldpathname,
+PUBLIC int renameat(int olddirfd, const char *arg_oldpathname,
 		int newdirfd, const char *arg_newpathnam);
 
-int renameat(int olddirfd, const char *arg_oldpathname,
+PUBLIC int renameat(int olddirfd, const char *arg_oldpathname,
 		int newdirfd, const char *arg_newpathname)
 {
 	int retval = 0;
@@ -20,12 +20,25 @@
 /* Must be put here so that the pointer to fopen can be declared in this file: */
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "control.h"
+
+/* With --with-baked-policy, the lists set in the configuration file baked in at build time
+ * replace the corresponding compile-time defaults, and come with matchers of their own (see
+ * bake-policy.awk): */
+
+#ifdef BAKED_POLICY
+#include "baked-policy.h"
+#endif
 
 /* Various macros which are supposed to make the code more readable: */
 
 #define ALLOW_DESTRUCTION  1
 #define PROTECT            0
 
+#define UNDECIDED          0 /* never returned by decide_action(), only by decide_action_from_path() */
 #define BE_REMOVED         1
 #define BE_SAVED           2
 #define BE_LEFT_UNTOUCHED  3
@@ -33,8 +46,22 @@
 #define YES                1
 #define NO                 0
 
-#define NOMEM              1
-#define FERROR             2
+/* Bits of config.baked_lists, which says which lists are still the ones baked in at build time: */
+
+#define BAKED_LIST_UNREMOVABLE_DIRS              (1 << 0)
+#define BAKED_LIST_TEMPORARY_DIRS                (1 << 1)
+#define BAKED_LIST_REMOVABLE_MEDIA_MOUNT_POINTS  (1 << 2)
+#define BAKED_LIST_EXCEPTIONS                    (1 << 3)
+#define BAKED_LIST_IGNORE_EXTENSIONS             (1 << 4)
+
+/* libtrash is built with -fvisibility=hidden, so that the dynamic linker has nothing to bind
+ * but the functions it wraps (and libtrash_init()/libtrash_fini(), which have always been
+ * exported): everything else is called directly, without going through the PLT, and doesn't
+ * need to be looked up (or relocated) when a process starts. Every function the library
+ * exports must be marked with PUBLIC: */
+
+#define PUBLIC             __attribute__ ((visibility ("default")))
+
 #define REALLOC_FACTOR     2  /* defines by how much we multitply the size of a buffer when it needs to be reallocated */
 
 
@@ -48,6 +75,12 @@
 #define OPEN64       8
 #define OPENAT       9
 #define OPENAT64    10
+#define RENAMEAT    11
+#define UNLINKAT    12
+#define EXECVE      13 /* only looked up with --enable-policy-inherit (see exec.c) */
+#define EXECVPE     14
+
+#define NUMBER_OF_REAL_FUNCTIONS 15 /* one more than the highest of the values above */
 
 /* You probably don't want to change this value, unless you spend _lots_ of time deleting
  * files with the same name in the same dir, and  you have that dir covered by libtrash.
@@ -58,22 +91,90 @@
 
 /* -------------------------------------------------------------- */
 
-/* Define a structure which holds all configuration settings: */
+/* What we know about a configuration file; if any of this changes, so may its contents (see
+ * config_still_valid() in main.c): */
 
 typedef struct
 {
-	/* Configuration variables: */
-	int in_case_of_failure;
-	int global_protection;
-	int should_warn;
-	int ignore_hidden;
-	int ignore_editor_backup;
-	int ignore_editor_temporary;
-	int protect_trash;
-	int libtrash_config_file_unremovable;
+	int exists;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	uid_t uid;
+	mode_t mode;
+	struct timespec mtime;
+	struct timespec ctime;
+}
+file_identity;
+
+/* What lex_path() (in path-scan.c) finds out about a path in its single pass over it, which
+ * decide_action() and its tests then use instead of going through the path again: */
+
+#define LEXED_PATH_COMPONENTS 64 /* the ends of deeper components aren't recorded */
+
+typedef struct
+{
+	const char *path;
+	size_t length;
+	const char *basename;		/* what follows the last '/' */
+	const char *extension;		/* what follows the last '.' of the basename; NULL if none */
+	size_t extension_length;
+	int hidden;			/* some component after a '/' starts with a '.' */
+	int clean;			/* see lex_path() */
+	unsigned component_count;	/* including the empty one before a leading '/' */
+	unsigned component_end[LEXED_PATH_COMPONENTS]; /* offset of the '/' or '\0' which ends each one */
+}
+lexed_path;
+
+/* The first block of a snapshot's arena is allocated together with the snapshot; this is its
+ * size when we have no better guess (see libtrash_init() in main.c): */
+
+#define ARENA_SIZE 2048
+
+struct arena_block; /* defined in helpers.c */
+
+/* A node of the trie all the directory lists of a snapshot are compiled into, and a slot of the
+ * hash set ignore_extensions is compiled into (see build_dir_trie() and build_extension_set() in
+ * helpers.c; a compiled policy image holds both, see policy.c): */
+
+struct dir_trie_node
+{
+	const char *name;	/* not null-terminated */
+	unsigned length;
+	unsigned lists;		/* DIR_LIST_xxx bits of the lists with an entry which ends here */
+	unsigned children;	/* index of the first child */
+	unsigned child_count;
+};
+
+struct extension_slot
+{
+	const char *name;	/* not null-terminated; NULL if the slot is empty */
+	unsigned length;
+	unsigned hash;
+};
+
+struct ignore_pattern; /* defined in helpers.c */
+
+struct glob_pattern; /* defined in helpers.c */
+
+struct re_dfa; /* defined in re-dfa.c */
+
+/* re_dfa_matches() returns this when only regexec() can tell: */
+
+#define RE_DFA_UNSURE         (-1)
+
+/* Define a structure which holds all configuration settings. The fields every wrapper reads
+ * on every call come first, so that they share as few cache lines as possible; then come the
+ * ones decide_action() reads for every file, and then everything else: */
+
+typedef struct config
+{
+	/* Read by every wrapper: */
 
 	int libtrash_off;
 	int general_failure;
+	int in_case_of_failure;
+	int user_ignored;	/* euid is listed in IGNORE_USERS or IGNORE_UIDS (libtrash_off is set too) */
 
 	int intercept_unlink;
 	int intercept_rename;
@@ -81,6 +182,11 @@ typedef struct
 	int intercept_freopen;
 	int intercept_open;
 
+	/* The run-time control page of the effective uid (see control.h), or NULL if it couldn't be
+	 * mapped: */
+
+	const control_page *control;
+
 	/* we store pointers for these three (but not the rest) because the code in
 	   libtrash actually needs these three functions. */
 
@@ -88,40 +194,183 @@ typedef struct
 	int (*real_rename) (const char*, const char*);
 	FILE* (*real_fopen) (const char*, const char*);
 
-	char *ignore_extensions;
-	char *relative_trash_can;
-	char *relative_trash_system_root;
+	/* Read by decide_action() and save_in_trash(): */
+
+	int global_protection;
+	int should_warn;
+	int ignore_hidden;
+	int ignore_editor_backup;
+	int ignore_editor_temporary;
+	int protect_trash;
+	int libtrash_config_file_unremovable;
+	int trash_check_interval;	/* seconds between checks of the trash dirs, 0 means on every call */
+	int baked_lists;		/* BAKED_LIST_xxx bits (always 0 without --with-baked-policy) */
+	const struct dir_trie_node *dir_trie;	/* all the directory lists below in one trie (see build_dir_trie() in helpers.c), or NULL */
+	unsigned dir_trie_nodes;
+	const struct extension_slot *extension_set;	/* ignore_extensions as a hash set (see build_extension_set() in helpers.c), or NULL */
+	unsigned extension_set_mask;
+	struct ignore_pattern *ignore_patterns;	/* the patterns in ignore_re, compiled once per snapshot (see compile_ignore_re() in helpers.c), or NULL */
+	unsigned ignore_pattern_count;
+	struct re_dfa *ignore_re_dfa;	/* all of them at once as a DFA (see re-dfa.c), or NULL (always, without --enable-re-dfa) */
+	const struct glob_pattern *glob_patterns;	/* the patterns in ignore_glob, split into segments (see compile_ignore_glob() in helpers.c), or NULL */
+	unsigned glob_pattern_count;
+	unsigned long generation;	/* tells this snapshot from all the others (see replace_config() in main.c); 0 in failed_config */
+	unsigned long long preserve_files_larger_than_limit;
+
+	char *absolute_trash_can;
+	char *absolute_trash_system_root;
+	char *home;
 	char *unremovable_dirs;
 	char *uncovered_dirs;
+	char *exceptions;
 	char *temporary_dirs;
 	char *user_temporary_dirs;
-	char *removable_media_mount_points;
-	char *exceptions;
+	char *ignore_extensions;
 	char *ignore_re;
-	char *absolute_trash_can;
-	char *absolute_trash_system_root;
-	char *home;
-	unsigned long long preserve_files_larger_than_limit;
+	char *ignore_glob;
+	char *removable_media_mount_points;
+
+	/* What we found out about absolute_trash_can and absolute_trash_system_root the last time we
+	 * checked them (see trash_dirs_ok() in helpers.c). Unlike the rest of the snapshot,
+	 * trash_dirs_checked is updated after the snapshot has been published, so it must only be
+	 * accessed with __atomic builtins: */
+
+	long trash_dirs_checked;	/* CLOCK_MONOTONIC_COARSE seconds, 0 means "check them next time" */
+	dev_t trash_can_dev;
+	ino_t trash_can_ino;
+	dev_t trash_system_root_dev;
+	ino_t trash_system_root_ino;
+
+	/* Only needed while the snapshot is being built: */
+
+	char *relative_trash_can;
+	char *relative_trash_system_root;
+
+	/* Identity of the sources this snapshot was built from (see config_still_valid() in main.c): */
+
+	uid_t euid;
+	uid_t *ignored_uids;	/* IGNORE_USERS and IGNORE_UIDS as a hash set (see euid_ignored() in helpers.c), or NULL */
+	unsigned ignored_uids_mask;
+	char *env_trash_off;
+	char *env_uncover_dirs;
+	char *env_trust_home;
+	char *env_home;		/* only recorded if TRASH_TRUST_HOME is set */
+	char *conf_file_path;
+	file_identity conf_identity;
+	file_identity system_conf_identity;
+	long long conf_checked;	/* CLOCK_MONOTONIC_COARSE nanoseconds of the last look at both files; accessed atomically */
+
+	/* If the policy was loaded from a compiled image (see policy.c), the strings above point into
+	 * policy_image: a copy of the image in the arena, or (if it was inherited) the read-only
+	 * mapping of a sealed memfd, which has to be unmapped when the snapshot goes away: */
+
+	const char *policy_image;
+	void *policy_map;
+	size_t policy_map_len;
+
+	/* The sealed memfd which holds the image we hand down to the programs we exec() (see
+	 * policy_publish()), or -1, and its identity (the program might close it and reuse the number): */
+
+	int policy_fd;
+	dev_t policy_fd_dev;
+	ino_t policy_fd_ino;
+
+	/* Once the snapshot has been replaced, it waits in a list (see main.c) until no wrapper can
+	 * still be using it; retired_epoch is the epoch in which it was replaced: */
+
+	struct config *retired_next;
+	unsigned long retired_epoch;
+
+	/* Every string the snapshot owns lives in its arena (see arena_alloc() in helpers.c), so that
+	 * it costs a single malloc() and a single free(). The first arena_size bytes of the arena are
+	 * arena[], at the very end of the snapshot; if they run out, arena_alloc() chains extra
+	 * blocks to arena_overflow. */
+
+	size_t arena_size;
+	size_t arena_used;
+	struct arena_block *arena_overflow;
+	char arena[];
 }
 config;
 
 /* Initialization/exit routines: */
-void libtrash_init(config * cfg);
+PUBLIC config* libtrash_init(void);
 
-void libtrash_fini(config * cfg);
+PUBLIC void libtrash_fini(config * cfg);
+
+void register_fork_handlers(void);
 
 /* Helper functions (defined in helpers.c):  */
-char * convert_relative_into_absolute_paths(const char *relative_paths);
+char* arena_alloc(config *cfg, size_t size);
+char* arena_strdup(config *cfg, const char *str);
+void arena_free(config *cfg);
+size_t arena_total(config *cfg);
+char * convert_relative_into_absolute_paths(config *cfg, const char *relative_paths, const char *home);
+char* get_home_dir(uid_t euid);
+void lock_passwd_cache(void);
+void unlock_passwd_cache(void);
+void lock_ignore_re(config *cfg);
+void unlock_ignore_re(config *cfg);
+char* personal_conf_path(config *cfg, const char *home);
+const control_page* map_control_page(uid_t euid);
+int control_page_appeared(uid_t euid);
+int trash_dirs_ok(config *cfg, int record);
+int trash_dirs_need_check(config *cfg);
+int save_in_trash(const char *absolute_path, config *cfg);
+void get_file_identity(const char *path, file_identity *identity);
+int same_file_identity(const file_identity *a, const file_identity *b);
+int system_conf_trusted(const file_identity *identity);
+int euid_ignored(config *cfg);
+int uid_ignored(const config *cfg, uid_t uid);
+long long coarse_nanoseconds(void);
 int found_under_dir(const char *absolute_path, const char *dir_list);
 int dir_ok(const char *pathname, int *name_collision);
 int graft_file(const char *new_top_dir, const char *old_path, const char *what_to_cut, config *cfg);
-int hidden_file(const char *absolute_path);
-int ends_in_ignored_extension(const char *pathname, config *cfg);
+int ends_in_ignored_extension(const char *extension, size_t length, config *cfg);
 char* build_absolute_path(const char *path, int should_follow_final_symlink);
 int decide_action(const char *absolute_path, config *cfg);
+int decide_action_from_path(const char *pathname, config *cfg);
+void mark_baked_lists(config *cfg);
+void build_dir_trie(config *cfg);
+void build_extension_set(config *cfg);
+void compile_ignore_re(config *cfg);
+void free_ignore_re(config *cfg);
+void compile_ignore_glob(config *cfg);
+int matches_ignored_glob(const lexed_path *lexed, config *cfg);
+void remember_canonical_dir(const char *dir);
 int can_write_to_dir(const char *filepath);
 void get_config_from_file(config *cfg);
 char* make_absolute_path_from_dirfd_relpath(int dirfd, const char *arg_pathname);
 void* get_real_function(int function_name);
+void real_functions_after_fork(void);
+
+/* Compiled policy images (defined in policy.c): */
+#ifdef POLICY_CACHE
+int policy_load(config *cfg, const char *home);
+void policy_split_lists(config *cfg);
+void policy_save(config *cfg, const char *home);
+#endif
+#ifdef POLICY_INHERIT
+int policy_inherit(config *cfg);
+void policy_publish(config *cfg);
+void policy_release(config *cfg);
+int policy_exec_fd(char *const envp[]);
+size_t policy_exec_environment_size(char *const envp[]);
+char* const* policy_exec_environment(char *const envp[], char **environment, char *variable, int fd);
+void policy_exec_failed(int fd);
+
+/* Room for "POLICY_FD_VARIABLE=<fd>" (see policy_exec_environment()): */
+#define POLICY_FD_ENTRY_SIZE (sizeof(POLICY_FD_VARIABLE "=") + 3 * sizeof(int))
+#endif
+
+/* The single pass over a path decide_action() makes (defined in path-scan.c): */
+void lex_path(const char *path, lexed_path *lexed);
+
+/* The built-in IGNORE_RE matcher (defined in re-dfa.c): */
+#ifdef RE_DFA
+struct re_dfa* re_dfa_compile(const char *const *patterns, unsigned count, int *compiled);
+int re_dfa_matches(struct re_dfa *dfa, const char *path);
+void re_dfa_free(struct re_dfa *dfa);
+#endif
 
 /* -------------------------------------------------------------------------------------------- */
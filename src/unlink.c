@@ -45,7 +45,7 @@ static int unlink_handle_error(const char *pathname, int (*real_unlink) (const c
  *
  */
 
-int unlink(const char *pathname)
+PUBLIC int unlink(const char *pathname)
 {
 	struct stat path_stat;
 	char *absolute_path = NULL;
@@ -53,46 +53,59 @@ int unlink(const char *pathname)
 	int error = 0;
 	int retval = 0;
 	int file_should = 0;
-	/* Create a config structure, in which all configuration settings will be placed: */
-	config cfg;
+	/* Pointer to the configuration snapshot, in which all configuration settings are placed: */
+	config *cfg = NULL;
 #ifdef DEBUG
 	fprintf(stderr, "\nEntering unlink().\n");
 #endif
-	/* Run libtrash_init(), which sets all the global variables: */
-	libtrash_init(&cfg);
+	/* Run libtrash_init(), which returns the current configuration snapshot: */
+	cfg = libtrash_init();
 	/* We always call libtrash_fini() before quitting. */
 	/* Isn't a pointer to GNU libc's unlink() available? In that case, there's nothing we can do: */
-	if (!cfg.real_unlink)
+	if (!cfg->real_unlink)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "real_unlink unavailable. unlink() returning error code.\n");
 #endif
 		errno = 0;
-		libtrash_fini(&cfg);
+		libtrash_fini(cfg);
 		return -1; /* errno set to 0 in order to avoid confusing the caller. */
 	}
 
-	/* If libtrash_off is set to true or intercept_unlink set to false, the user has asked us to become temporarily inactive an let the real
-	 * unlink() perform its task.
+	/* If libtrash_off is set to true or intercept_unlink set to false (or the control page says so), the user has asked us to become
+	 * temporarily inactive an let the real unlink() perform its task.
 	 * Alternatively, if we were passed a NULL pointer we also call the real unlink: */
-	if (cfg.libtrash_off || !cfg.intercept_unlink)
+	if (cfg->libtrash_off || !cfg->intercept_unlink || (CONTROL_FLAGS(cfg) & (CONTROL_OFF | CONTROL_NO_UNLINK)))
 	{
 #ifdef DEBUG
 		fprintf(stderr, "Passing request to unlink %s to the real unlink because libtrash_off = true or intercept_unlink = false.\n", pathname);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_unlink) (pathname); /* real unlink() sets errno */
+		retval = (*cfg->real_unlink) (pathname); /* real unlink() sets errno */
+		libtrash_fini(cfg);
+		return retval;
 	}
 	/* If general_failure is set, something went wrong while initializing and we should just invoke the real function: */
-	if (cfg.general_failure)
+	if (cfg->general_failure)
 	{
 #ifdef DEBUG
 		fprintf(stderr, "general_failure is set in unlink(), invoking unlink_handle_error().\n"
-				"in_case_of_failure has value %d.\n", cfg.in_case_of_failure);
+				"in_case_of_failure has value %d.\n", cfg->in_case_of_failure);
 #endif
-		libtrash_fini(&cfg);
-		return unlink_handle_error(pathname, cfg.real_unlink, cfg.in_case_of_failure); /* If in_case_of_failure is set to PROTECT, we return -1 with errno set to 0;
+		retval = unlink_handle_error(pathname, cfg->real_unlink, cfg->in_case_of_failure); /* If in_case_of_failure is set to PROTECT, we return -1 with errno set to 0;
 												  otherwise, the real unlink() sets errno. */
+		libtrash_fini(cfg);
+		return retval;
+	}
+	/* If the path we were passed is enough to tell that this file can simply be removed (e.g., it is in /tmp or is
+	 * called foo.o), we don't need to look at the file at all (see decide_action_from_path()): */
+	if (decide_action_from_path(pathname, cfg) == BE_REMOVED)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "decide_action_from_path() told unlink() to permanently destroy file %s.\n", pathname);
+#endif
+		retval = (*cfg->real_unlink) (pathname); /* real unlink() sets errno. */
+		libtrash_fini(cfg);
+		return retval;
 	}
 	/* First of all: has the user mistakenly asked us to remove either a missing file, a special file or a directory?
 	 * In any of these cases we, just let the normal unlink() complain about it and save ourselves the
@@ -105,8 +118,9 @@ int unlink(const char *pathname)
 #ifdef DEBUG
 		fprintf(stderr, "%s either doesn't exit, or is a special file (non-symlink) or is a directory.\nCalling the \"real\" unlink().\n", pathname);
 #endif
-		libtrash_fini(&cfg);
-		return (*cfg.real_unlink) (pathname); /* real unlink() sets errno. */
+		retval = (*cfg->real_unlink) (pathname); /* real unlink() sets errno. */
+		libtrash_fini(cfg);
+		return retval;
 	}
 
 	/* If this is a symlink, we set symlink. We don't call the real unlink() immediately because we don't remove
@@ -140,8 +154,9 @@ int unlink(const char *pathname)
 #ifdef DEBUG
 		fprintf(stderr, "Unable to build absolute_path.\nInvoking unlink_handle_error().\n");
 #endif
-		libtrash_fini(&cfg);
-		return unlink_handle_error(pathname, cfg.real_unlink, cfg.in_case_of_failure); /* about errno: the same as in the other call to unlink_handle_error() above. */
+		retval = unlink_handle_error(pathname, cfg->real_unlink, cfg->in_case_of_failure); /* about errno: the same as in the other call to unlink_handle_error() above. */
+		libtrash_fini(cfg);
+		return retval;
 	}
 
 	/* Independently of the way in which the argument was written, absolute_path now holds the absolute
@@ -155,14 +170,14 @@ int unlink(const char *pathname)
 	/* By now we want to know whether this file "qualifies" to be stored in the trash can rather than deleted (another
 	   possible option is this file being considered "unremovable"). This decision is taken according to the user's preferences
 	   by the function decide_action(): */
-	file_should = decide_action(absolute_path, &cfg);
+	file_should = decide_action(absolute_path, cfg);
 	switch (file_should)
 	{
 		case BE_REMOVED:
 #ifdef DEBUG
 			fprintf(stderr, "decide_action() told unlink() to permanently destroy file %s.\n", absolute_path);
 #endif
-			retval = (*cfg.real_unlink) (pathname); /* real unlink() sets errno. */
+			retval = (*cfg->real_unlink) (pathname); /* real unlink() sets errno. */
 			break;
 		case BE_LEFT_UNTOUCHED:
 #ifdef DEBUG
@@ -182,16 +197,13 @@ int unlink(const char *pathname)
 #ifdef DEBUG
 				fprintf(stderr, " but its suggestion is being ignored because %s is just a symlink.\n", absolute_path);
 #endif
-				retval = (*cfg.real_unlink) (pathname); /* real unlink() sets errno. */
+				retval = (*cfg->real_unlink) (pathname); /* real unlink() sets errno. */
 			}
 			else
 			{
 				/* (See below for information on this code.) */
 				/* see (0) */
-				if (found_under_dir(absolute_path, cfg.home))
-					retval = graft_file(cfg.absolute_trash_can, absolute_path, cfg.home, &cfg);
-				else
-					retval = graft_file(cfg.absolute_trash_system_root, absolute_path, NULL, &cfg);
+				retval = save_in_trash(absolute_path, cfg);
 
 				if (retval == -2) /* see (1) */
 					retval = -1;
@@ -228,7 +240,7 @@ int unlink(const char *pathname)
 
 	/* Free memory before quitting: */
 	free(absolute_path);
-	libtrash_fini(&cfg);
+	libtrash_fini(cfg);
 	return retval;
 }
 
@@ -240,9 +252,9 @@ int unlink(const char *pathname)
  * our wrapping of the *at() functions. */
 
 #ifdef AT_FUNCTIONS
-int unlinkat(int dirfd, const char *arg_pathname, int flags);
+PUBLIC int unlinkat(int dirfd, const char *arg_pathname, int flags);
 
-int unlinkat(int dirfd, const char *arg_pathname, int flags)
+PUBLIC int unlinkat(int dirfd, const char *arg_pathname, int flags)
 {
 	int retval = 0;
 	char *real_path = make_absolute_path_from_dirfd_relpath(dirfd, arg_pathname);
@@ -0,0 +1,171 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-calls: what libtrash adds to each call it intercepts, in the cases a `make clean` or an
+ * `rm -rf` runs into: files which don't exist, files under TEMPORARY_DIRS, files with an
+ * extension listed in IGNORE_EXTENSIONS (all of which are really destroyed), files which end up
+ * in the trash can, renames and truncating fopen()s. Every call after the first one should find
+ * the configuration snapshot built by the first one; run with LIBTRASH_BASELINE pointing at an
+ * older build to see what it costs to rebuild it on every call instead. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+static void make_dir(const char *format, const char *home, char *dir, size_t size)
+{
+	snprintf(dir, size, format, home, (long) getpid());
+
+	if (mkdir(dir, 0755))
+		fail("unable to create %s: %s", dir, strerror(errno));
+}
+
+/* Times n calls of one kind (the files they need are made beforehand) and prints the time per
+ * call in nanoseconds: */
+
+static void run(const char *kind, long n)
+{
+	const char *home = getenv("HOME");
+	char dir[4096], path[4096], other[4096];
+	long long start = 0, end = 0;
+	FILE *file = NULL;
+	long i = 0;
+
+	if (!strcmp(kind, "unlink-temporary") || !strcmp(kind, "fopen-temporary"))
+		make_dir("%s/temporary/%ld", home, dir, sizeof(dir));
+	else
+		make_dir("%s/work/%ld", home, dir, sizeof(dir));
+
+	if (strcmp(kind, "unlink-missing"))
+		for (i = 0; i < n; i++)
+		{
+			snprintf(path, sizeof(path), "%s/f%ld.%s", dir, i, !strcmp(kind, "unlink-ignored") ? "o" : "txt");
+			make_file(path);
+
+			if (!strcmp(kind, "rename") || !strcmp(kind, "fopen-temporary"))
+				break;
+		}
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < n; i++)
+	{
+		if (!strcmp(kind, "rename"))
+		{
+			snprintf(path, sizeof(path), "%s/f%ld.txt", dir, i);
+			snprintf(other, sizeof(other), "%s/f%ld.txt", dir, i + 1);
+
+			if (rename(path, other))
+				fail("rename(%s, %s): %s", path, other, strerror(errno));
+
+			continue;
+		}
+
+		if (!strcmp(kind, "fopen-temporary"))
+		{
+			snprintf(path, sizeof(path), "%s/f0.txt", dir);
+
+			file = fopen(path, "w");
+
+			if (!file)
+				fail("fopen(%s): %s", path, strerror(errno));
+
+			fclose(file);
+
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/f%ld.%s", dir, i, !strcmp(kind, "unlink-ignored") ? "o" : "txt");
+
+		if (unlink(path) && strcmp(kind, "unlink-missing"))
+			fail("unlink(%s): %s", path, strerror(errno));
+	}
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / n);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		const char *kind;
+		const char *what;
+	}
+	calls[] =
+	{
+		{ "unlink-missing",   "unlink() of a missing file"              },
+		{ "unlink-temporary", "unlink() under TEMPORARY_DIRS"           },
+		{ "unlink-ignored",   "unlink() of a file with an ignored ext." },
+		{ "unlink-saved",     "unlink() of a file saved in the trash"   },
+		{ "rename",           "rename() to a new name"                  },
+		{ "fopen-temporary",  "fopen(\"w\") under TEMPORARY_DIRS"       },
+		{ NULL,               NULL                                      }
+	};
+
+	char *home = NULL, path[4096];
+	int i = 0;
+
+	if (argc == 3)
+	{
+		run(argv[1], atol(argv[2]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	write_config(home,
+			"TEMPORARY_DIRS = %s/temporary\n"
+			"USER_TEMPORARY_DIRS =\n"
+			"IGNORE_EXTENSIONS = o\n"
+			"IGNORE_RE =\n"
+			"IGNORE_GLOB =\n"
+			"GLOBAL_PROTECTION = NO\n", home);
+
+	snprintf(path, sizeof(path), "%s/temporary", home);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/work", home);
+	mkdir(path, 0755);
+
+	for (i = 0; calls[i].kind; i++)
+	{
+		char count[32];
+		char *arguments[] = { argv[0], (char *) calls[i].kind, count, NULL };
+
+		snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+		benchmark(calls[i].what, arguments);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-decide: how the cost of deciding a file's fate grows with the lists it is decided by.
+ * Every scenario writes a configuration file with one long list and times unlink()s of files
+ * which the last entry of that list tells libtrash to destroy (the worst case for a linear scan
+ * of the list; the files which aren't under a TEMPORARY_DIRS are made in home/plain): the
+ * difference between the "without" and the "with" columns is then mostly the decision. Run with
+ * LIBTRASH_BASELINE pointing at an older build to compare its matching with the current one. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "harness.h"
+
+/* (The lists baked in with --with-baked-policy, for baked_scenarios():) */
+
+#ifdef BAKED_POLICY
+#include "baked-policy.h"
+#endif
+
+#define DEFAULT_ITERATIONS 20000
+
+/* Where the files of the deep IGNORE_RE scenario go (under home), so that their paths are over
+ * 200 bytes long: */
+
+#define DEEP_DIR "plain/src/components/authentication/providers/enterprise-single-sign-on/" \
+	"configuration/generated/intermediate-build-artifacts/x86_64-unknown-linux-gnu/release"
+
+/* Times n unlink()s of files called f<i><suffix> in a dir of its own under home/dir, and prints
+ * the time per call in nanoseconds: */
+
+static void run(const char *dir, const char *suffix, long n)
+{
+	const char *home = getenv("HOME");
+	char work[4096], path[4096];
+	long long start = 0, end = 0;
+	long i = 0;
+
+	snprintf(work, sizeof(work), "%s/%s/%ld", home, dir, (long) getpid());
+
+	if (mkdir(work, 0755))
+		fail("unable to create %s: %s", work, strerror(errno));
+
+	for (i = 0; i < n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%ld%s", work, i, suffix);
+		make_file(path);
+	}
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%ld%s", work, i, suffix);
+
+		if (unlink(path))
+			fail("unlink(%s): %s", path, strerror(errno));
+	}
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / n);
+}
+
+/* Appends entry to the list in buffer: */
+
+static void append_entry(char *buffer, size_t size, const char *entry)
+{
+	size_t length = strlen(buffer);
+
+	if (length > 0 && length + 1 < size)
+		buffer[length++] = ';';
+
+	if ((size_t) snprintf(buffer + length, size - length, "%s", entry) >= size - length)
+		fail("the list doesn't fit in %lu bytes", (unsigned long) size);
+}
+
+/* Writes a configuration file in which key is set to list and every other list is empty: */
+
+static void write_scenario(const char *home, const char *key, const char *list)
+{
+	static const char *keys[] = { "TEMPORARY_DIRS", "USER_TEMPORARY_DIRS", "IGNORE_EXTENSIONS", "IGNORE_RE", "IGNORE_GLOB", NULL };
+	char other[256] = "";
+	int i = 0;
+
+	for (i = 0; keys[i]; i++)
+		if (strcmp(keys[i], key))
+		{
+			strcat(other, keys[i]);
+			strcat(other, " =\n");
+		}
+
+	write_config(home, "%s%s = %s\nGLOBAL_PROTECTION = NO\n", other, key, list);
+}
+
+/* Times unlink()s under the last of count dirs in TEMPORARY_DIRS: */
+
+static void dir_scenario(char *program, const char *home, int count)
+{
+	static char list[256 * 1024];
+	char last[64], what[64], n[32];
+	char *arguments[] = { program, last, ".txt", n, NULL };
+	char path[4096];
+	int i = 0;
+
+	list[0] = '\0';
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(path, sizeof(path), "%s/dirs/d%d", home, i);
+		append_entry(list, sizeof(list), path);
+	}
+
+	write_scenario(home, "TEMPORARY_DIRS", list);
+
+	snprintf(last, sizeof(last), "dirs/d%d", count - 1);
+	snprintf(path, sizeof(path), "%s/%s", home, last);
+	mkdir(path, 0755);
+
+	snprintf(what, sizeof(what), "unlink() under the last of %d TEMPORARY_DIRS", count);
+	snprintf(n, sizeof(n), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	benchmark(what, arguments);
+}
+
+/* Times unlink()s of files with the last of count extensions in IGNORE_EXTENSIONS: */
+
+static void extension_scenario(char *program, const char *home, int count)
+{
+	char list[4096], extension[32], suffix[32], what[64], n[32];
+	char *arguments[] = { program, "plain", suffix, n, NULL };
+	int i = 0;
+
+	list[0] = '\0';
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(extension, sizeof(extension), "e%d", i);
+		append_entry(list, sizeof(list), extension);
+	}
+
+	write_scenario(home, "IGNORE_EXTENSIONS", list);
+
+	snprintf(suffix, sizeof(suffix), ".e%d", count - 1);
+	snprintf(what, sizeof(what), "unlink() with the last of %d IGNORE_EXTENSIONS", count);
+	snprintf(n, sizeof(n), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	benchmark(what, arguments);
+}
+
+/* Times unlink()s of files in dir (under home) which match only the last of count expressions in
+ * IGNORE_RE: */
+
+static void expression_scenario(char *program, const char *home, const char *dir, int count)
+{
+	char list[4096], expression[32], suffix[32], what[64], n[32];
+	char *arguments[] = { program, (char *) dir, suffix, n, NULL };
+	int i = 0;
+
+	list[0] = '\0';
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(expression, sizeof(expression), "/f[0-9]+\\.r%d$", i);
+		append_entry(list, sizeof(list), expression);
+	}
+
+	write_scenario(home, "IGNORE_RE", list);
+
+	snprintf(suffix, sizeof(suffix), ".r%d", count - 1);
+
+	if (!strcmp(dir, "plain"))
+		snprintf(what, sizeof(what), "unlink() matching the last of %d IGNORE_RE", count);
+	else
+		snprintf(what, sizeof(what), "the same, %lu bytes deep", (unsigned long) (strlen(home) + strlen(dir) + 16));
+
+	snprintf(n, sizeof(n), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	benchmark(what, arguments);
+}
+
+/* Times unlink()s of files in node_modules dirs, with four patterns in IGNORE_GLOB and then the
+ * same four as IGNORE_RE (only the last one matches): */
+
+static void glob_scenarios(char *program, const char *home)
+{
+	char n[32];
+	char *arguments[] = { program, "plain/node_modules", ".txt", n, NULL };
+
+	snprintf(n, sizeof(n), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	write_scenario(home, "IGNORE_GLOB", "*/.cache/*;*.tmp.*;/var/build/**/*.log;*/node_modules/*");
+	benchmark("unlink() matching the last of 4 IGNORE_GLOB", arguments);
+
+	write_scenario(home, "IGNORE_RE", "/\\.cache/;\\.tmp\\.;^/var/build/(.*/)?[^/]*\\.log(/|$);/node_modules/");
+	benchmark("unlink() matching the same 4 as IGNORE_RE", arguments);
+}
+
+/* With --with-baked-policy (and without --enable-frozen-policy), times unlink()s of files with the
+ * last of the baked IGNORE_EXTENSIONS with nothing but the baked lists, and then with every one of
+ * them set to the same entries in the configuration file. Those lists no longer compare equal to
+ * the baked ones (their first entry is repeated at the end), so mark_baked_lists() turns the
+ * generated matchers off and the extension set and the trie are used instead. (Which dir lists a
+ * file is under is only worked out once per dir, so it is the extension which is timed.) */
+
+static void baked_scenarios(char *program, const char *home)
+{
+#if defined(BAKED_IGNORE_EXTENSIONS) && !defined(FROZEN_POLICY)
+	static const struct
+	{
+		const char *key;
+		const char *list;
+	}
+	baked[] =
+	{
+#ifdef BAKED_UNREMOVABLE_DIRS
+		{ "UNREMOVABLE_DIRS",             UNREMOVABLE_DIRS             },
+#endif
+#ifdef BAKED_TEMPORARY_DIRS
+		{ "TEMPORARY_DIRS",               TEMPORARY_DIRS               },
+#endif
+#ifdef BAKED_REMOVABLE_MEDIA_MOUNT_POINTS
+		{ "REMOVABLE_MEDIA_MOUNT_POINTS", REMOVABLE_MEDIA_MOUNT_POINTS },
+#endif
+#ifdef BAKED_EXCEPTIONS
+		{ "EXCEPTIONS",                   EXCEPTIONS                   },
+#endif
+		{ "IGNORE_EXTENSIONS",            IGNORE_EXTENSIONS            },
+		{ NULL,                           NULL                         }
+	};
+
+	char overridden[16384] = "", suffix[64], n[32];
+	char *arguments[] = { program, "plain", suffix, n, NULL };
+	const char *last = strrchr(IGNORE_EXTENSIONS, ';');
+	size_t length = 0;
+	int i = 0;
+
+	snprintf(suffix, sizeof(suffix), ".%s", last ? last + 1 : IGNORE_EXTENSIONS);
+	snprintf(n, sizeof(n), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	for (i = 0; baked[i].key; i++)
+	{
+		length = strlen(overridden);
+		snprintf(overridden + length, sizeof(overridden) - length, "%s = %s;%.*s\n", baked[i].key, baked[i].list,
+				(int) strcspn(baked[i].list, ";"), baked[i].list);
+	}
+
+	write_config(home, "GLOBAL_PROTECTION = NO\n");
+	benchmark("unlink() of a baked extension, baked lists", arguments);
+
+	write_config(home, "%sGLOBAL_PROTECTION = NO\n", overridden);
+	benchmark("unlink() of it, same lists in ~/.libtrash", arguments);
+#else
+	printf("baked lists against the same lists set in ~/.libtrash: not tried (libtrash wasn't configured "
+			"--with-baked-policy setting IGNORE_EXTENSIONS, or was configured --enable-frozen-policy)\n");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	char *home = NULL, path[4096];
+	const char *deep = NULL;
+
+	if (argc == 4)
+	{
+		run(argv[1], argv[2], atol(argv[3]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	snprintf(path, sizeof(path), "%s/dirs", home);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/plain", home);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/plain/node_modules", home);
+	mkdir(path, 0755);
+
+	for (deep = strchr(DEEP_DIR, '/'); deep; deep = strchr(deep + 1, '/'))
+	{
+		snprintf(path, sizeof(path), "%s/%.*s", home, (int) (deep - DEEP_DIR), DEEP_DIR);
+		mkdir(path, 0755);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", home, DEEP_DIR);
+	mkdir(path, 0755);
+
+	dir_scenario(argv[0], home, 10);
+	dir_scenario(argv[0], home, 100);
+	dir_scenario(argv[0], home, 1000);
+
+	extension_scenario(argv[0], home, 1);
+	extension_scenario(argv[0], home, 80);
+
+	expression_scenario(argv[0], home, "plain", 1);
+	expression_scenario(argv[0], home, "plain", 20);
+	expression_scenario(argv[0], home, DEEP_DIR, 20);
+
+	glob_scenarios(argv[0], home);
+
+	baked_scenarios(argv[0], home);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-open: the read-only opens, which are the calls libtrash intercepts most often and which
+ * it only has to hand on to libc (through the table of real functions it fills once). Each one
+ * is followed by a close(), which libtrash doesn't intercept and which is timed in the "without"
+ * column as well. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 200000
+
+/* Times n opens of one kind of the file path and prints the time per open in nanoseconds: */
+
+static void run(const char *kind, const char *path, long n)
+{
+	long long start = 0, end = 0;
+	FILE *file = NULL;
+	long i = 0;
+	int fd = -1;
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < n; i++)
+	{
+		if (!strcmp(kind, "fopen"))
+		{
+			file = fopen(path, "r");
+
+			if (!file)
+				fail("fopen(%s): %s", path, strerror(errno));
+
+			fclose(file);
+
+			continue;
+		}
+
+		if (!strcmp(kind, "openat"))
+			fd = openat(AT_FDCWD, path, O_RDONLY);
+		else
+			fd = open(path, O_RDONLY);
+
+		if (fd < 0)
+			fail("open(%s): %s", path, strerror(errno));
+
+		close(fd);
+	}
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / n);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		const char *kind;
+		const char *what;
+	}
+	opens[] =
+	{
+		{ "open",   "open(O_RDONLY) + close()"   },
+		{ "openat", "openat(O_RDONLY) + close()" },
+		{ "fopen",  "fopen(\"r\") + fclose()"    },
+		{ NULL,     NULL                         }
+	};
+
+	char *home = NULL, path[4096];
+	int i = 0;
+
+	if (argc == 4)
+	{
+		run(argv[1], argv[2], atol(argv[3]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	write_config(home, "GLOBAL_PROTECTION = NO\n");
+
+	snprintf(path, sizeof(path), "%s/file.txt", home);
+	make_file(path);
+
+	for (i = 0; opens[i].kind; i++)
+	{
+		char count[32];
+		char *arguments[] = { argv[0], (char *) opens[i].kind, path, count, NULL };
+
+		snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+		benchmark(opens[i].what, arguments);
+	}
+
+	return EXIT_SUCCESS;
+}
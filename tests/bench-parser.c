@@ -0,0 +1,137 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-parser: what it costs to rebuild the configuration snapshot, which is mostly reading and
+ * parsing ~/.libtrash, with the shipped libtrash.conf (LIBTRASH_CONF: 20K of mostly comments) and
+ * with one ten times as long. Every unlink() timed (of a file with an extension listed in
+ * IGNORE_EXTENSIONS there, which older versions also had to parse the file for) finds the
+ * snapshot stale, because UNCOVER_DIRS changes between any two of them. (With --enable-policy-cache, what is
+ * timed is reading the compiled image instead.) */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 5000
+
+/* Times n unlink()s, each of which rebuilds the snapshot, and prints the time per unlink() in
+ * nanoseconds: */
+
+static void run(long n)
+{
+	const char *home = getenv("HOME");
+	long long start = 0, end = 0;
+	char path[4096];
+	long i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%ld.o", home, i);
+		make_file(path);
+	}
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < n; i++)
+	{
+		if (i % 2)
+			setenv("UNCOVER_DIRS", "/nonexistent", 1);
+		else
+			unsetenv("UNCOVER_DIRS");
+
+		snprintf(path, sizeof(path), "%s/f%ld.o", home, i);
+
+		if (unlink(path))
+			fail("unlink(%s): %s", path, strerror(errno));
+	}
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / n);
+}
+
+int main(int argc, char **argv)
+{
+	const char *sample_path = getenv("LIBTRASH_CONF");
+	char *home = NULL, *sample = NULL, *config = NULL, count[32];
+	char *arguments[] = { argv[0], count, NULL };
+	FILE *file = NULL;
+	size_t size = 0;
+	int copies = 0, i = 0;
+
+	if (argc == 2)
+	{
+		run(atol(argv[1]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	file = sample_path ? fopen(sample_path, "r") : NULL;
+
+	if (!file)
+		skip("LIBTRASH_CONF doesn't name the shipped libtrash.conf");
+
+	sample = malloc(1024 * 1024);
+
+	if (!sample)
+		fail("out of memory");
+
+	size = fread(sample, 1, 1024 * 1024 - 1, file);
+	sample[size] = '\0';
+	fclose(file);
+
+	config = malloc(10 * size + 1);
+
+	if (!config)
+		fail("out of memory");
+
+	home = scratch_home();
+
+	snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	for (copies = 1; copies <= 10; copies *= 10)
+	{
+		char what[64];
+
+		config[0] = '\0';
+
+		for (i = 0; i < copies; i++)
+			strcat(config, sample);
+
+		write_config(home, "%s", config);
+
+		snprintf(what, sizeof(what), "rebuild with a %zuK libtrash.conf", copies * size / 1024);
+
+		benchmark(what, arguments);
+	}
+
+	free(config);
+	free(sample);
+
+	return EXIT_SUCCESS;
+}
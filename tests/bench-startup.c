@@ -0,0 +1,118 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-startup: what preloading libtrash adds to the start of every process, i.e. what loading
+ * and relocating it costs a program which never calls anything libtrash intercepts (`true`), and
+ * what the first intercepted call costs on top of that, when the configuration snapshot is built
+ * (`rm -f` of a missing file). The programs are started with posix_spawnp(), which doesn't run
+ * the fork handlers libtrash installs, so that only the spawned program's startup is timed. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 500
+
+extern char **environ;
+
+/* Starts the program of one kind n times, waiting for each one to exit, and prints the time per
+ * program in nanoseconds: */
+
+static void run(const char *kind, long n)
+{
+	char missing[4096];
+	char *true_arguments[] = { "true", NULL };
+	char *rm_arguments[] = { "rm", "-f", missing, NULL };
+	char **arguments = strcmp(kind, "rm") ? true_arguments : rm_arguments;
+	long long start = 0, end = 0;
+	int status = 0, error = 0;
+	pid_t pid = 0;
+	long i = 0;
+
+	snprintf(missing, sizeof(missing), "%s/missing.txt", getenv("HOME"));
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < n; i++)
+	{
+		error = posix_spawnp(&pid, arguments[0], NULL, NULL, arguments, environ);
+
+		if (error)
+			fail("posix_spawnp(%s): %s", arguments[0], strerror(error));
+
+		if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+			fail("%s didn't exit successfully", arguments[0]);
+	}
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / n);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		const char *kind;
+		const char *what;
+	}
+	programs[] =
+	{
+		{ "true", "start and exit of `true`"                  },
+		{ "rm",   "start and exit of `rm -f` of a missing file" },
+		{ NULL,   NULL                                         }
+	};
+
+	char *home = NULL;
+	int i = 0;
+
+	if (argc == 3)
+	{
+		run(argv[1], atol(argv[2]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	write_config(home, "GLOBAL_PROTECTION = NO\n");
+
+	for (i = 0; programs[i].kind; i++)
+	{
+		char count[32];
+		char *arguments[] = { argv[0], (char *) programs[i].kind, count, NULL };
+
+		snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+		benchmark(programs[i].what, arguments);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* bench-threads: how the intercepted calls scale with the number of threads making them, from 1
+ * to 64. Every thread writes a log file (fopen("w"), fputs(), fclose()) and rotates it over the
+ * previous one with rename(), over and over, in a dir of its own under TEMPORARY_DIRS; all of
+ * them share one configuration snapshot, which they only ever read. What is reported is the wall
+ * time per operation (one fopen() and one rename()) for all the threads together: as long as
+ * there are at least as many cores as threads, it should go down in proportion to the number of
+ * threads, with libtrash just as without it. (With fewer cores, it can't go down any further, and
+ * the numbers only tell whether the threads get in each other's way.) */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 64000
+
+#define MAX_THREADS 64
+
+static pthread_barrier_t start_barrier;
+
+static long operations_per_thread = 0;
+
+static void* rotate_logs(void *argument)
+{
+	const char *home = getenv("HOME");
+	char dir[4096], log[4096], rotated[4096];
+	FILE *file = NULL;
+	long i = 0;
+
+	snprintf(dir, sizeof(dir), "%s/temporary/%ld-%ld", home, (long) getpid(), (long) argument);
+
+	if (mkdir(dir, 0755))
+		fail("unable to create %s: %s", dir, strerror(errno));
+
+	snprintf(log, sizeof(log), "%s/log", dir);
+	snprintf(rotated, sizeof(rotated), "%s/log.1", dir);
+
+	pthread_barrier_wait(&start_barrier);
+
+	for (i = 0; i < operations_per_thread; i++)
+	{
+		file = fopen(log, "w");
+
+		if (!file)
+			fail("fopen(%s): %s", log, strerror(errno));
+
+		fputs("x\n", file);
+		fclose(file);
+
+		if (rename(log, rotated))
+			fail("rename(%s, %s): %s", log, rotated, strerror(errno));
+	}
+
+	return NULL;
+}
+
+/* Runs n operations spread over threads threads, and prints the wall time per operation in
+ * nanoseconds: */
+
+static void run(long threads, long n)
+{
+	pthread_t thread[MAX_THREADS];
+	long long start = 0, end = 0;
+	long i = 0;
+
+	operations_per_thread = n / threads;
+
+	pthread_barrier_init(&start_barrier, NULL, threads + 1);
+
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&thread[i], NULL, rotate_logs, (void *) i))
+			fail("unable to create thread %ld", i);
+
+	pthread_barrier_wait(&start_barrier);
+
+	start = now_nanoseconds();
+
+	for (i = 0; i < threads; i++)
+		pthread_join(thread[i], NULL);
+
+	end = now_nanoseconds();
+
+	printf("%.1f\n", (double) (end - start) / (operations_per_thread * threads));
+}
+
+int main(int argc, char **argv)
+{
+	char *home = NULL, path[4096], count[32], threads[32];
+	char *arguments[] = { argv[0], threads, count, NULL };
+	long i = 0;
+
+	if (argc == 3)
+	{
+		run(atol(argv[1]), atol(argv[2]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	write_config(home,
+			"TEMPORARY_DIRS = %s/temporary\n"
+			"GLOBAL_PROTECTION = NO\n", home);
+
+	snprintf(path, sizeof(path), "%s/temporary", home);
+	mkdir(path, 0755);
+
+	snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	printf("(%ld cores online: more threads than that can't run any faster)\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (i = 1; i <= MAX_THREADS; i *= 2)
+	{
+		char what[64];
+
+		snprintf(threads, sizeof(threads), "%ld", i);
+		snprintf(what, sizeof(what), "fopen(\"w\") + rename(), %ld thread%s", i, i > 1 ? "s" : "");
+
+		benchmark(what, arguments);
+	}
+
+	return EXIT_SUCCESS;
+}
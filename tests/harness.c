@@ -0,0 +1,317 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* The tests and benchmarks in this directory run a program (usually themselves, with an argument
+ * which tells them which part to play) with libtrash preloaded. The library which gets preloaded
+ * is the one named by LIBTRASH: `make check` and `make bench` point it at the one just built in
+ * ../src. The benchmarks also run the same program without any library preloaded and, if
+ * LIBTRASH_BASELINE names another build of libtrash (an older one, say), with that one, and
+ * report the three timings side by side.
+ *
+ * Every test gets a scratch home dir of its own (under TEST_SCRATCH_DIR, or under the current
+ * dir), which libtrash is told to use through HOME and TRASH_TRUST_HOME: neither the real home
+ * dir nor the real ~/.libtrash is ever touched, and the configuration file is whatever the test
+ * writes with write_config(). (A library built with --enable-frozen-policy ignores the lists
+ * set there, so some of the benchmarks measure something else with such a build; and a
+ * LIBTRASH_BASELINE which predates TRASH_TRUST_HOME reads the real ~/.libtrash instead.) */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE /* for asprintf(), canonicalize_file_name() and nftw() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "harness.h"
+
+/* The scratch home dir, and the process which created it (the only one which removes it): */
+
+static char *scratch = NULL;
+
+static pid_t scratch_owner = 0;
+
+static void remove_scratch_home(void);
+
+void fail(const char *format, ...)
+{
+	va_list arguments;
+
+	va_start(arguments, format);
+	fputs("FAIL: ", stdout);
+	vprintf(format, arguments);
+	putchar('\n');
+	va_end(arguments);
+
+	exit(EXIT_FAILURE);
+}
+
+void skip(const char *format, ...)
+{
+	va_list arguments;
+
+	va_start(arguments, format);
+	fputs("SKIP: ", stdout);
+	vprintf(format, arguments);
+	putchar('\n');
+	va_end(arguments);
+
+	exit(EXIT_SKIP);
+}
+
+/* Returns the path of the library to preload, or skips the test if there is none: */
+
+const char* libtrash_under_test(void)
+{
+	const char *library = getenv("LIBTRASH");
+
+	if (!library || access(library, R_OK))
+		skip("LIBTRASH doesn't name a readable library (run me through `make check` or `make bench`)");
+
+	return library;
+}
+
+long long now_nanoseconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* How many operations a benchmark should time: BENCH_ITERATIONS if set, fallback otherwise: */
+
+long iterations(long fallback)
+{
+	const char *value = getenv("BENCH_ITERATIONS");
+
+	return (value && atol(value) > 0) ? atol(value) : fallback;
+}
+
+/* Creates the scratch home dir and makes it the one libtrash uses (in this process and in every
+ * process it runs from now on). It is removed when the process which created it exits: */
+
+char* scratch_home(void)
+{
+	const char *base = getenv("TEST_SCRATCH_DIR");
+	char *template = NULL;
+
+	if (asprintf(&template, "%s/scratch.XXXXXX", (base && *base) ? base : ".") < 0 || !mkdtemp(template))
+		fail("unable to create a scratch dir: %s", strerror(errno));
+
+	/* libtrash only trusts a canonical $HOME which nobody else can write to: */
+
+	scratch = canonicalize_file_name(template);
+
+	if (!scratch || chmod(scratch, 0700))
+		fail("unable to set up the scratch dir %s: %s", template, strerror(errno));
+
+	free(template);
+
+	scratch_owner = getpid();
+	atexit(remove_scratch_home);
+
+	setenv("HOME", scratch, 1);
+	setenv("TRASH_TRUST_HOME", "YES", 1);
+
+	unsetenv("TRASH_OFF");
+	unsetenv("UNCOVER_DIRS");
+	unsetenv(POLICY_FD_VARIABLE);
+
+	return scratch;
+}
+
+static void remove_scratch_home(void)
+{
+	if (scratch && getpid() == scratch_owner)
+		remove_tree(scratch);
+}
+
+/* Replaces the configuration file in home (with a new file, so that libtrash notices at once): */
+
+void write_config(const char *home, const char *format, ...)
+{
+	char *path = NULL, *temporary = NULL;
+	va_list arguments;
+	FILE *file = NULL;
+
+	if (asprintf(&path, "%s/%s", home, PERSONAL_CONF_FILE) < 0 ||
+			asprintf(&temporary, "%s.new", path) < 0)
+		fail("out of memory");
+
+	file = fopen(temporary, "w");
+
+	if (!file)
+		fail("unable to create %s: %s", temporary, strerror(errno));
+
+	va_start(arguments, format);
+	vfprintf(file, format, arguments);
+	va_end(arguments);
+
+	if (fclose(file) || rename(temporary, path))
+		fail("unable to write %s: %s", path, strerror(errno));
+
+	free(temporary);
+	free(path);
+}
+
+/* Creates the (new) file path, one byte long: */
+
+void make_file(const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+	if (fd < 0 || write(fd, "x", 1) != 1 || close(fd))
+		fail("unable to create %s: %s", path, strerror(errno));
+}
+
+static int remove_entry(const char *path, const struct stat *status, int type, struct FTW *ftw)
+{
+	remove(path);
+
+	return 0;
+}
+
+void remove_tree(const char *path)
+{
+	nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Runs this very program with the arguments argv, with library preloaded (or with nothing
+ * preloaded, if library is NULL), and waits for it. Whatever it prints to its standard output
+ * ends up in output (if output isn't NULL). Returns its exit status, or -1 if it was killed: */
+
+int run_self(const char *library, char *const argv[], char *output, size_t size)
+{
+	int channel[2];
+	size_t length = 0;
+	ssize_t count = 0;
+	int status = 0;
+	pid_t pid = 0;
+
+	if (pipe(channel))
+		fail("pipe(): %s", strerror(errno));
+
+	fflush(stdout);
+
+	pid = fork();
+
+	if (pid < 0)
+		fail("fork(): %s", strerror(errno));
+
+	if (pid == 0)
+	{
+		if (library)
+			setenv("LD_PRELOAD", library, 1);
+		else
+			unsetenv("LD_PRELOAD");
+
+		dup2(channel[1], STDOUT_FILENO);
+		close(channel[0]);
+		close(channel[1]);
+
+		execv("/proc/self/exe", argv);
+		_exit(127);
+	}
+
+	close(channel[1]);
+
+	while (1)
+	{
+		char discard[256];
+
+		if (output && length + 1 < size)
+			count = read(channel[0], output + length, size - length - 1);
+		else
+			count = read(channel[0], discard, sizeof(discard));
+
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+			break;
+
+		if (output && length + 1 < size)
+			length += count;
+	}
+
+	if (output)
+		output[length] = '\0';
+
+	close(channel[0]);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			fail("waitpid(): %s", strerror(errno));
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* Runs argv (which must print how many nanoseconds an operation took, and nothing else)
+ * BENCHMARK_ROUNDS times and returns the fastest time: */
+
+static double fastest_run(const char *library, char *const argv[])
+{
+	double best = -1, time = 0;
+	char output[64];
+	int round = 0;
+
+	for (round = 0; round < BENCHMARK_ROUNDS; round++)
+	{
+		if (run_self(library, argv, output, sizeof(output)) || sscanf(output, "%lf", &time) != 1)
+			fail("%s didn't run to completion (with %s preloaded)", argv[0], library ? library : "nothing");
+
+		if (best < 0 || time < best)
+			best = time;
+	}
+
+	return best;
+}
+
+/* Reports how long what argv does takes without libtrash, with the libtrash under test and with
+ * LIBTRASH_BASELINE (if set): */
+
+void benchmark(const char *what, char *const argv[])
+{
+	const char *baseline = getenv("LIBTRASH_BASELINE");
+	double without = fastest_run(NULL, argv);
+	double with = fastest_run(libtrash_under_test(), argv);
+
+	printf("%-48s %9.0f ns without, %9.0f ns with libtrash (%+.0f)", what, without, with, with - without);
+
+	if (baseline)
+	{
+		double before = fastest_run(baseline, argv);
+
+		printf(", %9.0f ns with the baseline (%+.0f)", before, before - without);
+	}
+
+	putchar('\n');
+	fflush(stdout);
+}
@@ -0,0 +1,52 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* What the tests and benchmarks in this directory have in common (see harness.c): */
+
+#include <stddef.h>
+
+/* The exit status with which a test tells `make check` that it was skipped: */
+
+#define EXIT_SKIP 77
+
+/* How many times each benchmark is run (the fastest run is the one reported): */
+
+#define BENCHMARK_ROUNDS 5
+
+void fail(const char *format, ...) __attribute__ ((noreturn, format (printf, 1, 2)));
+
+void skip(const char *format, ...) __attribute__ ((noreturn, format (printf, 1, 2)));
+
+const char* libtrash_under_test(void);
+
+long long now_nanoseconds(void);
+
+long iterations(long fallback);
+
+char* scratch_home(void);
+
+void write_config(const char *home, const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+
+void make_file(const char *path);
+
+void remove_tree(const char *path);
+
+int run_self(const char *library, char *const argv[], char *output, size_t size);
+
+void benchmark(const char *what, char *const argv[]);
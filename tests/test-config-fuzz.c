@@ -0,0 +1,332 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* test-config-fuzz: whatever ~/.libtrash contains, reading it must neither crash nor hang the
+ * process. A child with libtrash preloaded replaces the configuration file again and again with
+ * garbage: random bytes, the shipped libtrash.conf (LIBTRASH_CONF) with bytes flipped, inserted or
+ * cut off, and lines which set the known keys to odd values (empty, huge, without '=', with NULs,
+ * with CRs...). After each one it unlink()s a file, which makes libtrash read the new file (the
+ * snapshot is made stale by changing UNCOVER_DIRS, rather than by waiting for the clock to tick).
+ * Finally, with a sane configuration file again, a file must end up in the trash can as usual.
+ * Set FUZZ_SEED to replay a run (the seed is printed). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "harness.h"
+
+#define DEFAULT_ITERATIONS 2000
+
+#define MAX_CONFIG_SIZE (256 * 1024)
+
+static const char *keys[] =
+{
+	"TRASH_CAN", "IN_CASE_OF_FAILURE", "SHOULD_WARN", "IGNORE_HIDDEN", "IGNORE_EDITOR_BACKUP",
+	"PROTECT_TRASH", "GLOBAL_PROTECTION", "TRASH_SYSTEM_ROOT", "TEMPORARY_DIRS",
+	"USER_TEMPORARY_DIRS", "UNREMOVABLE_DIRS", "IGNORE_EXTENSIONS", "INTERCEPT_UNLINK",
+	"INTERCEPT_RENAME", "INTERCEPT_FOPEN", "INTERCEPT_FREOPEN", "INTERCEPT_OPEN",
+	"LIBTRASH_CONFIG_FILE_UNREMOVABLE", "REMOVABLE_MEDIA_MOUNT_POINTS", "IGNORE_EDITOR_TEMPORARY",
+	"EXCEPTIONS", "IGNORE_RE", "PRESERVE_FILES_LARGER_THAN", "TRASH_CHECK_INTERVAL",
+	"IGNORE_USERS", "IGNORE_UIDS", "IGNORE_GLOB"
+};
+
+#define NUMBER_OF_KEYS (sizeof(keys) / sizeof(keys[0]))
+
+/* What the configuration files are made of when they aren't made of the shipped one (no '.', so
+ * that TRASH_CAN never names "..", nor anything outside the scratch home): */
+
+static const char alphabet[] = "abcXYZ019 \t\n\r=;#/*?[]^$(){}|\\~-_\"'";
+
+static char *sample = NULL;
+
+static size_t sample_size = 0;
+
+/* The shipped libtrash.conf (or, if LIBTRASH_CONF doesn't name it, a few lines of it): */
+
+static void load_sample(void)
+{
+	const char *path = getenv("LIBTRASH_CONF");
+	FILE *file = path ? fopen(path, "r") : NULL;
+
+	sample = malloc(MAX_CONFIG_SIZE);
+
+	if (!sample)
+		fail("out of memory");
+
+	if (file)
+	{
+		sample_size = fread(sample, 1, MAX_CONFIG_SIZE / 2, file);
+		fclose(file);
+	}
+
+	if (!sample_size)
+		sample_size = snprintf(sample, MAX_CONFIG_SIZE,
+				"# libtrash.conf\n\nTRASH_CAN = Trash\nIN_CASE_OF_FAILURE = PROTECT\n"
+				"IGNORE_EXTENSIONS= o;~;aux;log\nTEMPORARY_DIRS = /tmp;/var/tmp\n"
+				"IGNORE_RE = \\.swp$\nGLOBAL_PROTECTION = YES\n");
+}
+
+static long between(long low, long high)
+{
+	return low + random() % (high - low + 1);
+}
+
+static char random_byte(void)
+{
+	return random() % 4 ? alphabet[random() % (sizeof(alphabet) - 1)] : (char) random();
+}
+
+/* Appends a value for a key to config (at length, at most size bytes in all) and returns the new
+ * length: */
+
+static size_t append_value(char *config, size_t length, size_t size)
+{
+	long count = 0, i = 0;
+
+	switch (random() % 6)
+	{
+		case 0: /* nothing */
+			return length;
+
+		case 1: /* a yes/no, a number */
+			return length + snprintf(config + length, size - length, "%s",
+					random() % 2 ? "YES" : (random() % 2 ? "NO" : "-2147483649"));
+
+		case 2: /* a long list */
+			count = between(1, 2000);
+
+			for (i = 0; i < count && length + 32 < size; i++)
+				length += snprintf(config + length, size - length, "%s/d%ld;", random() % 2 ? "" : "/tmp", i);
+
+			return length;
+
+		default: /* anything */
+			count = between(1, random() % 8 ? 64 : 20000);
+
+			for (i = 0; i < count && length + 1 < size; i++)
+				config[length++] = random_byte();
+
+			return length;
+	}
+}
+
+/* Fills config with the garbage for one round and returns its size: */
+
+static size_t make_garbage(char *config, size_t size)
+{
+	size_t length = 0, position = 0;
+	long count = 0, i = 0;
+
+	switch (random() % 4)
+	{
+		case 0: /* random bytes */
+			length = between(0, 8192);
+
+			for (i = 0; i < (long) length; i++)
+				config[i] = random_byte();
+
+			return length;
+
+		case 1: /* the sample, mutated */
+			memcpy(config, sample, sample_size);
+			length = sample_size;
+			count = between(1, 16);
+
+			for (i = 0; i < count && length > 0; i++)
+			{
+				position = random() % length;
+
+				switch (random() % 3)
+				{
+					case 0:
+						config[position] = random_byte();
+						break;
+
+					case 1:
+						if (length + 1 < size)
+						{
+							memmove(config + position + 1, config + position, length - position);
+							config[position] = random_byte();
+							length++;
+						}
+						break;
+
+					default:
+						memmove(config + position, config + position + 1, length - position - 1);
+						length--;
+				}
+			}
+
+			return length;
+
+		case 2: /* the sample, cut short */
+			length = random() % (sample_size + 1);
+			memcpy(config, sample, length);
+
+			return length;
+
+		default: /* known keys with odd values */
+			count = between(1, 40);
+
+			for (i = 0; i < count && length + 256 < size; i++)
+			{
+				const char *separator[] = { " = ", "=", " ", "\t=\t", " == " };
+
+				length += snprintf(config + length, size - length, "%s%s%s", random() % 8 ? "" : "  ",
+						keys[random() % NUMBER_OF_KEYS], separator[random() % 5]);
+				length = append_value(config, length, size - 2);
+
+				if (random() % 16)
+					config[length++] = random() % 8 ? '\n' : '\r';
+			}
+
+			return length;
+	}
+}
+
+/* Writes size bytes of data to the new file path. The child makes its own files with syscall(),
+ * past libtrash: a garbled configuration file may well make libtrash fail (on purpose, if
+ * IN_CASE_OF_FAILURE is PROTECT) every open() which creates a file, as well as the rename()s
+ * over the configuration file (if LIBTRASH_CONFIG_FILE_UNREMOVABLE is set): */
+
+static void create_file(const char *path, const char *data, size_t size)
+{
+	int fd = syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0 || write(fd, data, size) != (ssize_t) size || close(fd))
+		fail("unable to write %s: %s", path, strerror(errno));
+}
+
+/* Replaces the configuration file in home with size bytes of config: */
+
+static void replace_config(const char *home, const char *config, size_t size)
+{
+	char path[4096], temporary[4096];
+
+	snprintf(path, sizeof(path), "%s/%s", home, PERSONAL_CONF_FILE);
+	snprintf(temporary, sizeof(temporary), "%s.new", path);
+
+	create_file(temporary, config, size);
+
+	if (syscall(SYS_renameat, AT_FDCWD, temporary, AT_FDCWD, path))
+		fail("unable to replace %s: %s", path, strerror(errno));
+}
+
+/* The child: n rounds of garbage, then a sane configuration file: */
+
+static void fuzz(unsigned long seed, long n)
+{
+	const char *home = getenv("HOME");
+	char *config = malloc(MAX_CONFIG_SIZE);
+	char path[4096];
+	long i = 0;
+
+	if (!config)
+		fail("out of memory");
+
+	srandom(seed);
+	load_sample();
+
+	for (i = 0; i < n; i++)
+	{
+		replace_config(home, config, make_garbage(config, MAX_CONFIG_SIZE));
+
+		if (i % 2)
+			setenv("UNCOVER_DIRS", "/nonexistent", 1);
+		else
+			unsetenv("UNCOVER_DIRS");
+
+		snprintf(path, sizeof(path), "%s/work/f%ld.txt", home, i);
+		create_file(path, "x", 1);
+		unlink(path);
+	}
+
+	unsetenv("UNCOVER_DIRS");
+
+	strcpy(config, "TRASH_CAN = Trash\nTEMPORARY_DIRS =\nGLOBAL_PROTECTION = NO\n");
+	replace_config(home, config, strlen(config));
+
+	snprintf(path, sizeof(path), "%s/work/saved.txt", home);
+	make_file(path);
+
+	if (unlink(path))
+		fail("unlink(%s): %s", path, strerror(errno));
+
+#ifndef FROZEN_POLICY
+	/* (A frozen policy ignores TEMPORARY_DIRS above, and the home dir might be under one of its own:) */
+
+	snprintf(path, sizeof(path), "%s/Trash/work/saved.txt", home);
+
+	if (access(path, F_OK))
+		fail("after the garbage, %s wasn't saved in the trash can", path);
+#endif
+
+	free(config);
+}
+
+int main(int argc, char **argv)
+{
+	char *home = NULL, path[4096], seed[32], count[32], output[4096];
+	char *arguments[] = { argv[0], seed, count, NULL };
+	int status = 0;
+
+	if (argc == 3)
+	{
+		fuzz(strtoul(argv[1], NULL, 10), atol(argv[2]));
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	snprintf(path, sizeof(path), "%s/work", home);
+	mkdir(path, 0755);
+
+	snprintf(seed, sizeof(seed), "%lu", getenv("FUZZ_SEED") ? strtoul(getenv("FUZZ_SEED"), NULL, 10) :
+			(unsigned long) time(NULL) ^ (unsigned long) getpid());
+	snprintf(count, sizeof(count), "%ld", iterations(DEFAULT_ITERATIONS));
+
+	printf("FUZZ_SEED=%s, %s configuration files\n", seed, count);
+
+	status = run_self(libtrash_under_test(), arguments, output, sizeof(output));
+
+	fputs(output, stdout);
+
+	if (status < 0)
+		fail("the child was killed (FUZZ_SEED=%s)", seed);
+
+	if (status != 0)
+		fail("the child exited with status %d (FUZZ_SEED=%s)", status, seed);
+
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+}
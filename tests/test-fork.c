@@ -0,0 +1,337 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+/* test-fork: a program whose threads keep unlink()ing and rename()ing files must be able to fork()
+ * at any moment, and its children must go on using the configuration snapshot they inherited
+ * instead of building their own. The program (run with libtrash preloaded) builds its snapshot,
+ * starts LOAD_THREADS threads which unlink() and rename() files as fast as they can, and fork()s
+ * children one after another from its main thread. Each child unlink()s and rename()s a file of
+ * its own and exits; if it hangs (on a lock some other thread held when fork() was called), an
+ * alarm kills it. The main thread is traced with ptrace() (and so are its children, but not the
+ * other threads). A child which opens the configuration file, the compiled policy or the password
+ * database, or which looks at the trash can (which is checked whenever a snapshot is built, and
+ * otherwise only every TRASH_CHECK_INTERVAL seconds; the children's files have an extension listed
+ * in IGNORE_EXTENSIONS, so nothing of theirs goes there), has rebuilt the snapshot. None of them
+ * may, but for the last one, which changes UNCOVER_DIRS first and therefore has to: that one shows
+ * that the tracing would notice. Unless the policy is frozen, each child also unlink()s a file
+ * which only IGNORE_RE says to destroy, with a pattern only regexec() can match (see re-dfa.c):
+ * the load threads, whose files go to the trash, try that pattern on every one of them, so they
+ * are often inside regexec() when fork() is called, and a child which inherited regexec()'s own
+ * lock held would hang on it.
+ * Skipped where ptrace() isn't available, or on anything but x86-64 Linux. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "harness.h"
+#include "trace.h"
+
+#ifdef CAN_TRACE
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#endif
+
+#define DEFAULT_ITERATIONS 20
+
+#define MAX_CHILDREN 1000
+
+#define LOAD_THREADS 4
+
+/* How long (in seconds) a child, and the whole program, may take: */
+
+#define CHILD_TIMEOUT 10
+
+#define PROGRAM_TIMEOUT 120
+
+static int stop = 0; /* accessed atomically */
+
+/* What each of the load threads does until it is told to stop: */
+
+static void* load(void *argument)
+{
+	const char *home = getenv("HOME");
+	char dir[4096], path[4096], other[4096];
+	long i = 0;
+
+	snprintf(dir, sizeof(dir), "%s/work/load-%ld", home, (long) argument);
+
+	if (mkdir(dir, 0755))
+		fail("unable to create %s: %s", dir, strerror(errno));
+
+	for (i = 0; !__atomic_load_n(&stop, __ATOMIC_RELAXED); i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%ld.txt", dir, i);
+		snprintf(other, sizeof(other), "%s/g%ld.txt", dir, i);
+
+		make_file(path);
+
+		if (rename(path, other))
+			fail("rename(%s, %s): %s", path, other, strerror(errno));
+
+		if (unlink(other))
+			fail("unlink(%s): %s", other, strerror(errno));
+	}
+
+	return NULL;
+}
+
+/* What each child does (the last one rebuilds the snapshot on purpose): */
+
+static void child(long number, int rebuild)
+{
+	const char *home = getenv("HOME");
+	char path[4096], other[4096];
+
+	alarm(CHILD_TIMEOUT);
+
+	if (rebuild)
+		setenv("UNCOVER_DIRS", "/nonexistent", 1);
+
+	snprintf(path, sizeof(path), "%s/work/child-%ld.o", home, number);
+	snprintf(other, sizeof(other), "%s/work/child-%ld-renamed.o", home, number);
+
+	make_file(path);
+
+	if (rename(path, other))
+		fail("child %ld: rename(%s, %s): %s", number, path, other, strerror(errno));
+
+	if (unlink(other))
+		fail("child %ld: unlink(%s): %s", number, other, strerror(errno));
+
+#ifndef FROZEN_POLICY
+	snprintf(path, sizeof(path), "%s/work/child-%ld.scratch", home, number);
+
+	make_file(path);
+
+	if (unlink(path))
+		fail("child %ld: unlink(%s): %s", number, path, strerror(errno));
+#endif
+}
+
+/* The program which is traced: */
+
+static void fork_under_load(long children)
+{
+	const char *home = getenv("HOME");
+	pthread_t thread[LOAD_THREADS];
+	char path[4096];
+	int status = 0;
+	long i = 0;
+	pid_t pid = 0;
+
+	alarm(PROGRAM_TIMEOUT);
+
+	snprintf(path, sizeof(path), "%s/work/first.txt", home);
+	make_file(path);
+
+	if (unlink(path))
+		fail("unlink(%s): %s", path, strerror(errno));
+
+	for (i = 0; i < LOAD_THREADS; i++)
+		if (pthread_create(&thread[i], NULL, load, (void *) i))
+			fail("unable to create thread %ld", i);
+
+	for (i = 0; i < children; i++)
+	{
+		fflush(stdout);
+
+		pid = fork();
+
+		if (pid < 0)
+			fail("fork(): %s", strerror(errno));
+
+		if (pid == 0)
+		{
+			child(i, i == children - 1);
+			_exit(EXIT_SUCCESS);
+		}
+
+		while (waitpid(pid, &status, 0) < 0)
+			if (errno != EINTR)
+				fail("waitpid(): %s", strerror(errno));
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			fail("child %ld %s", i, WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM ? "hung" : "failed");
+	}
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < LOAD_THREADS; i++)
+		pthread_join(thread[i], NULL);
+}
+
+#ifdef CAN_TRACE
+
+/* Returns 1 if the system call (whose registers are registers) the traced process pid is about to
+ * make shows that it is building a snapshot, 0 otherwise: */
+
+static int builds_snapshot(pid_t pid, const struct user_regs_struct *registers, const char *home)
+{
+	char conf_file[4096], cache_file[4096], trash_can[4096];
+	unsigned long long path = path_argument(registers);
+
+	snprintf(conf_file, sizeof(conf_file), "%s/%s", home, PERSONAL_CONF_FILE);
+	snprintf(cache_file, sizeof(cache_file), "%s/%s", home, POLICY_CACHE_FILE);
+	snprintf(trash_can, sizeof(trash_can), "%s/Trash", home);
+
+	if (names_path(pid, path, trash_can))
+		return 1;
+
+	/* (The configuration files are stat()ed every now and then anyway:) */
+
+	if (registers->orig_rax != SYS_open && registers->orig_rax != SYS_openat)
+		return 0;
+
+	return names_path(pid, path, conf_file) || names_path(pid, path, cache_file) ||
+		names_path(pid, path, "/etc/passwd");
+}
+
+#endif /* CAN_TRACE */
+
+int main(int argc, char **argv)
+{
+	char *home = NULL, path[4096], count[32];
+	char *arguments[] = { argv[0], count, NULL };
+	long children = iterations(DEFAULT_ITERATIONS);
+
+	if (argc == 2)
+	{
+		fork_under_load(atol(argv[1]));
+		return EXIT_SUCCESS;
+	}
+
+#ifndef CAN_TRACE
+	skip("system calls are only traced on x86-64 Linux");
+#else
+	{
+		pid_t child_pid[MAX_CHILDREN];
+		int rebuilt[MAX_CHILDREN];
+		struct user_regs_struct registers;
+		long forked = 0, rebuilds = 0, i = 0;
+		int status = 0;
+		pid_t program = 0, pid = 0;
+
+		libtrash_under_test();
+
+		if (children < 2 || children > MAX_CHILDREN)
+			fail("BENCH_ITERATIONS must be between 2 and %d", MAX_CHILDREN);
+
+		home = scratch_home();
+
+		write_config(home,
+				"TRASH_CAN = Trash\n"
+				"IGNORE_EXTENSIONS = o\n"
+				"IGNORE_RE = /child-[[:digit:]]+\\.scratch$\n"
+				"GLOBAL_PROTECTION = NO\n"
+				"TRASH_CHECK_INTERVAL = 3600\n");
+
+		snprintf(path, sizeof(path), "%s/work", home);
+		mkdir(path, 0755);
+
+		snprintf(count, sizeof(count), "%ld", children);
+
+		program = trace_self(arguments, PTRACE_O_TRACEFORK);
+
+		if (ptrace(PTRACE_SYSCALL, program, NULL, NULL))
+			fail("ptrace(PTRACE_SYSCALL): %s", strerror(errno));
+
+		while (1)
+		{
+			int signal = 0;
+
+			pid = waitpid(-1, &status, __WALL);
+
+			if (pid < 0)
+				fail("waitpid(): %s", strerror(errno));
+
+			if (WIFEXITED(status) || WIFSIGNALED(status))
+			{
+				if (pid == program)
+					break;
+
+				continue;
+			}
+
+			if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8)))
+			{
+				unsigned long new_pid = 0;
+
+				if (ptrace(PTRACE_GETEVENTMSG, pid, NULL, &new_pid) || forked >= MAX_CHILDREN)
+					fail("unable to follow the fork()");
+
+				child_pid[forked] = new_pid;
+				rebuilt[forked++] = 0;
+			}
+			else if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+			{
+				if (pid != program)
+				{
+					if (ptrace(PTRACE_GETREGS, pid, NULL, &registers))
+						fail("ptrace(PTRACE_GETREGS): %s", strerror(errno));
+
+					if (at_syscall_entry(&registers) && builds_snapshot(pid, &registers, home))
+						for (i = 0; i < forked; i++)
+							if (child_pid[i] == pid)
+								rebuilt[i] = 1;
+				}
+			}
+			else if (WSTOPSIG(status) != SIGTRAP && (WSTOPSIG(status) != SIGSTOP || pid == program))
+				signal = WSTOPSIG(status); /* (a signal for the process, which we hand on) */
+
+			if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) signal) && errno != ESRCH)
+				fail("ptrace(PTRACE_SYSCALL): %s", strerror(errno));
+		}
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			fail("the program which forks didn't exit normally");
+
+		if (forked != children)
+			fail("%ld fork()s were seen instead of %ld", forked, children);
+
+		for (i = 0; i < forked - 1; i++)
+			rebuilds += rebuilt[i];
+
+		printf("%ld children forked under load, %ld of them rebuilt the snapshot; the one which "
+				"changed UNCOVER_DIRS %s\n", forked - 1, rebuilds, rebuilt[forked - 1] ? "did" : "didn't");
+
+		if (rebuilds)
+			fail("%ld children rebuilt the snapshot they had inherited", rebuilds);
+
+		if (!rebuilt[forked - 1])
+			fail("the child which changed UNCOVER_DIRS wasn't seen rebuilding the snapshot");
+
+		printf("PASS\n");
+
+		return EXIT_SUCCESS;
+	}
+#endif
+}
@@ -0,0 +1,194 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* test-path-scan: the vector versions of lex_path() (path-scan.c, which is built into this program
+ * with SIMD_SCAN whether or not libtrash was configured with --enable-simd-scan) must find out
+ * exactly what lex_path_scalar() does about every path. Random paths (mostly slashes and dots,
+ * some of them deeper than LEXED_PATH_COMPONENTS) are put at every offset from 0 to 63 in a
+ * buffer aligned to 64 bytes, so that they start and end everywhere in a 16- and a 32-byte block,
+ * with random slashes, dots and NULs right before them and right after their '\0' (which the
+ * vector versions load, and must ignore). The versions the CPU can't run are skipped, and so is
+ * the whole test anywhere but on x86 with GCC. Set FUZZ_SEED to replay a run (the seed is
+ * printed). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef SIMD_SCAN
+#define SIMD_SCAN 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#include "path-scan.c"
+
+#define DEFAULT_ITERATIONS 2000		/* paths, each of them at every offset */
+
+#define OFFSETS 64
+
+#define MAX_PATH 320
+
+#ifdef VECTOR_LEX_PATH
+
+static long between(long low, long high)
+{
+	return low + random() % (high - low + 1);
+}
+
+static char random_byte(void)
+{
+	static const char alphabet[] = "//////....abc\xe9";
+
+	return alphabet[random() % (sizeof(alphabet) - 1)];
+}
+
+/* Writes a random path, of at most size - 1 bytes, to path. Now and then it has no slashes or
+ * no dots in it (the vector versions then find none in a whole block): */
+
+static void random_path(char *path, size_t size)
+{
+	size_t length = random() % 4 ? between(0, 80) : between(0, size - 1), i = 0;
+	int kind = random() % 8;
+
+	for (i = 0; i < length; i++)
+	{
+		path[i] = random_byte();
+
+		if ((kind == 0 && path[i] == '/') || (kind == 1 && path[i] == '.'))
+			path[i] = 'x';
+	}
+
+	/* (Most paths are absolute, as those lex_path() is given:) */
+
+	if (length > 0 && kind > 2)
+		path[0] = '/';
+
+	path[length] = '\0';
+}
+
+/* Returns 1 if lex_path_scalar() and version tell the same about path: */
+
+static int same_lexing(lex_path_function version, const char *path)
+{
+	lexed_path scalar, vector;
+	unsigned i = 0;
+
+	lex_path_scalar(path, &scalar);
+	version(path, &vector);
+
+	if (scalar.path != vector.path || scalar.length != vector.length || scalar.basename != vector.basename ||
+			scalar.extension != vector.extension || scalar.extension_length != vector.extension_length ||
+			scalar.hidden != vector.hidden || scalar.clean != vector.clean ||
+			scalar.component_count != vector.component_count)
+		return 0;
+
+	for (i = 0; i < scalar.component_count && i < LEXED_PATH_COMPONENTS; i++)
+		if (scalar.component_end[i] != vector.component_end[i])
+			return 0;
+
+	return 1;
+}
+
+#endif /* VECTOR_LEX_PATH */
+
+int main(int argc, char **argv)
+{
+#ifndef VECTOR_LEX_PATH
+	skip("the vector versions of lex_path() are only built on x86, with GCC");
+#else
+	static char buffer[OFFSETS + MAX_PATH + 64] __attribute__ ((aligned (64)));
+	static const struct
+	{
+		const char *name;
+		const char *feature;
+		lex_path_function function;
+	}
+	versions[] =
+	{
+		{ "SSE2", "sse2", lex_path_sse2 },
+		{ "AVX2", "avx2", lex_path_avx2 },
+		{ NULL,   NULL,   NULL          }
+	};
+
+	unsigned long seed = getenv("FUZZ_SEED") ? strtoul(getenv("FUZZ_SEED"), NULL, 10) :
+		(unsigned long) time(NULL) ^ (unsigned long) getpid();
+	long paths = iterations(DEFAULT_ITERATIONS), p = 0;
+	char path[MAX_PATH];
+	size_t i = 0, offset = 0, length = 0;
+	int v = 0, tried = 0;
+
+	printf("FUZZ_SEED=%lu, %ld paths at each of %d offsets\n", seed, paths, OFFSETS);
+
+	__builtin_cpu_init();
+
+	for (v = 0; versions[v].name; v++)
+	{
+		/* (__builtin_cpu_supports() only takes a string literal:) */
+
+		if (!strcmp(versions[v].feature, "sse2") ? !__builtin_cpu_supports("sse2") : !__builtin_cpu_supports("avx2"))
+		{
+			printf("%s: not supported by this CPU, not tried\n", versions[v].name);
+			continue;
+		}
+
+		srandom(seed);
+
+		for (p = 0; p < paths; p++)
+		{
+			random_path(path, sizeof(path));
+			length = strlen(path);
+
+			for (offset = 0; offset < OFFSETS; offset++)
+			{
+				/* The bytes around the path (as far as a block can reach) are '/', '.' and
+				 * '\0' as often as not: */
+
+				for (i = 0; i < offset; i++)
+					buffer[i] = random() % 2 ? "/.\0"[random() % 3] : random_byte();
+
+				memcpy(buffer + offset, path, length + 1);
+
+				for (i = offset + length + 1; i < offset + length + 1 + 32; i++)
+					buffer[i] = random() % 2 ? "/.\0"[random() % 3] : random_byte();
+
+				if (!same_lexing(versions[v].function, buffer + offset))
+					fail("%s: \"%s\" at offset %lu isn't lexed as lex_path_scalar() lexes it (FUZZ_SEED=%lu)",
+							versions[v].name, path, (unsigned long) offset, seed);
+			}
+		}
+
+		printf("%s: agrees with lex_path_scalar()\n", versions[v].name);
+		tried++;
+	}
+
+	if (!tried)
+		skip("this CPU has neither SSE2 nor AVX2");
+
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+#endif
+}
@@ -0,0 +1,209 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* test-policy-cache: a process which finds a compiled policy in POLICY_CACHE_FILE must decide
+ * exactly what a process which parsed the configuration file decides, whatever state the image is
+ * in (good, truncated, garbled), and must keep working if the image is truncated while its
+ * snapshot is still in use. Skipped unless libtrash was configured with --enable-policy-cache. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "harness.h"
+
+/* Deletes a file which belongs in the trash, one with an ignored extension and one under
+ * TEMPORARY_DIRS, all of them named after round. If truncate is set, the image is truncated
+ * between the first call (which builds the snapshot) and the others: */
+
+static void delete_files(const char *round, int truncate)
+{
+	const char *home = getenv("HOME");
+	char path[4096];
+	int fd = -1;
+
+	snprintf(path, sizeof(path), "%s/saved-%s.txt", home, round);
+	make_file(path);
+
+	if (unlink(path))
+		fail("unlink(%s): %s", path, strerror(errno));
+
+	if (truncate)
+	{
+		snprintf(path, sizeof(path), "%s/%s", home, POLICY_CACHE_FILE);
+
+		fd = open(path, O_WRONLY);
+
+		if (fd < 0 || ftruncate(fd, 0) || close(fd))
+			fail("unable to truncate %s: %s", path, strerror(errno));
+	}
+
+	snprintf(path, sizeof(path), "%s/ignored-%s.o", home, round);
+	make_file(path);
+
+	if (unlink(path))
+		fail("unlink(%s): %s", path, strerror(errno));
+
+	snprintf(path, sizeof(path), "%s/temporary/temporary-%s.txt", home, round);
+	make_file(path);
+
+	if (unlink(path))
+		fail("unlink(%s): %s", path, strerror(errno));
+}
+
+/* Runs delete_files() in a child with libtrash preloaded and returns which of the files it
+ * deleted ended up in the trash: */
+
+#define SAVED      (1 << 0)
+#define IGNORED    (1 << 1)
+#define TEMPORARY  (1 << 2)
+
+static int run_round(char *program, const char *home, const char *round, int truncate)
+{
+	char *arguments[] = { program, (char *) round, truncate ? (char *) "truncate" : NULL, NULL };
+	char path[4096];
+	int status = run_self(libtrash_under_test(), arguments, NULL, 0);
+	int in_trash = 0;
+
+	if (status != 0)
+		fail("round %s: the child exited with status %d", round, status);
+
+	snprintf(path, sizeof(path), "%s/Trash/saved-%s.txt", home, round);
+
+	if (!access(path, F_OK))
+		in_trash |= SAVED;
+
+	snprintf(path, sizeof(path), "%s/Trash/ignored-%s.o", home, round);
+
+	if (!access(path, F_OK))
+		in_trash |= IGNORED;
+
+	snprintf(path, sizeof(path), "%s/Trash/temporary/temporary-%s.txt", home, round);
+
+	if (!access(path, F_OK))
+		in_trash |= TEMPORARY;
+
+	return in_trash;
+}
+
+/* Checks that a round decides what the first one (in which the configuration file was parsed)
+ * decided: */
+
+static int expected = 0;
+
+static void check_round(char *program, const char *home, const char *round, int truncate)
+{
+	int in_trash = run_round(program, home, round, truncate);
+
+	if (in_trash != expected)
+		fail("round %s: the files saved were 0x%x instead of 0x%x", round, in_trash, expected);
+}
+
+/* Overwrites the size bytes of the image after offset with garbage: */
+
+static void garble_image(const char *path, off_t offset, size_t size)
+{
+	char garbage[64];
+	int fd = open(path, O_WRONLY);
+
+	memset(garbage, 0x5a, sizeof(garbage));
+
+	if (fd < 0 || pwrite(fd, garbage, size < sizeof(garbage) ? size : sizeof(garbage), offset) < 0 || close(fd))
+		fail("unable to garble %s: %s", path, strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+	char *home = NULL, image[4096], path[4096];
+	struct stat image_stat;
+
+	if (argc >= 2)
+	{
+		delete_files(argv[1], argc == 3);
+		return EXIT_SUCCESS;
+	}
+
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	write_config(home,
+			"TEMPORARY_DIRS = %s/temporary\n"
+			"UNREMOVABLE_DIRS = /etc;%s/unremovable\n"
+			"IGNORE_EXTENSIONS = o;pyc\n"
+			"GLOBAL_PROTECTION = NO\n", home, home);
+
+	snprintf(path, sizeof(path), "%s/temporary", home);
+	mkdir(path, 0755);
+
+	snprintf(image, sizeof(image), "%s/%s", home, POLICY_CACHE_FILE);
+
+	/* The first process parses the configuration file and compiles the image: */
+
+	expected = run_round(argv[0], home, "parsed", 0);
+
+#ifndef FROZEN_POLICY
+	/* (A frozen policy ignores the lists set above.) */
+
+	if (expected != SAVED)
+		fail("the files saved were 0x%x instead of 0x%x", expected, SAVED);
+#endif
+
+	if (stat(image, &image_stat))
+		skip("no compiled policy was written (libtrash was built without --enable-policy-cache)");
+
+	/* The next ones use it: */
+
+	check_round(argv[0], home, "compiled", 0);
+
+	/* A truncated image is ignored (and rewritten): */
+
+	if (truncate(image, image_stat.st_size / 2))
+		fail("unable to truncate %s: %s", image, strerror(errno));
+
+	check_round(argv[0], home, "truncated", 0);
+
+	/* So is a garbled one, wherever it's garbled: */
+
+	garble_image(image, 0, 8);
+	check_round(argv[0], home, "garbled-magic", 0);
+
+	garble_image(image, image_stat.st_size / 2, 64);
+	check_round(argv[0], home, "garbled-middle", 0);
+
+	garble_image(image, image_stat.st_size - 16, 16);
+	check_round(argv[0], home, "garbled-end", 0);
+
+	/* And truncating it under the feet of a process which uses it doesn't hurt that process: */
+
+	check_round(argv[0], home, "rewritten", 0);
+	check_round(argv[0], home, "truncated-in-use", 1);
+
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* test-re-dfa: the built-in IGNORE_RE matcher (re-dfa.c, which is built into this program
+ * whether or not libtrash was configured with --enable-re-dfa) must answer exactly as regexec()
+ * does. Random sets of random patterns (made of what the DFA takes, and of a few things it must
+ * leave to regexec()) are compiled both ways, and random paths are matched against them: if the
+ * DFA says a pattern matches, regexec() must agree; if it says none of its patterns does,
+ * regexec() must find none either; and it may only be unsure of a path with a non-ASCII byte in
+ * it. All of this is done in the C locale and again in C.UTF-8 (if there is one), since regcomp()
+ * depends on the locale and the DFA must not. test-re-dfa-4 is the same program with a DFA of at
+ * most 4 states, so that most paths run out of states half-way. Set FUZZ_SEED to replay a run
+ * (the seed is printed). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef RE_DFA
+#define RE_DFA 1
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <locale.h>
+#include <regex.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+#include "re-dfa.c"
+
+#define DEFAULT_ITERATIONS 2000		/* sets of patterns, in each locale */
+
+#define MAX_PATTERNS 4			/* in a set */
+
+#define PATHS_PER_SET 64
+
+#define MAX_PATTERN 256
+
+#define MAX_PATH 96
+
+/* What was tried, in the current locale: */
+
+static long patterns_tried = 0, patterns_taken = 0, paths_matched = 0, paths_unsure = 0;
+
+static long between(long low, long high)
+{
+	return low + random() % (high - low + 1);
+}
+
+/* Appends a random pattern of at most depth levels of parentheses to pattern: */
+
+static void random_alternation(char *pattern, size_t size, int depth);
+
+static void random_atom(char *pattern, size_t size, int depth)
+{
+	static const char *atoms[] =
+	{
+		"a", "b", "o", "x", "0", "1", "-", "_", "/", "\\.", ".", "[abo]", "[^/]", "[a-c]", "[0-9]",
+		"[^.a]", "[]a]", "[-x]", "\\/", "\\-",
+		/* Which the DFA leaves to regexec(): */
+		"[[:digit:]]", "[[:alpha:]/]", "\\w", "[[.a.]]", "[[=b=]]", "\xc3\xa9", "[^[:space:]]"
+	};
+
+	if (depth > 0 && random() % 5 == 0)
+	{
+		strncat(pattern, "(", size - strlen(pattern) - 1);
+		random_alternation(pattern, size, depth - 1);
+		strncat(pattern, ")", size - strlen(pattern) - 1);
+	}
+	else
+		strncat(pattern, atoms[random() % (random() % 8 ? 20 : sizeof(atoms) / sizeof(atoms[0]))],
+				size - strlen(pattern) - 1);
+}
+
+static void random_piece(char *pattern, size_t size, int depth)
+{
+	static const char *operators[] = { "*", "+", "?", "{2}", "{1,3}", "{0,1}", "{2,}" };
+	char *end = pattern + strlen(pattern);
+
+	random_atom(pattern, size, depth);
+
+	/* (An interval may not follow '^' or '$', which random_branch() puts on their own:) */
+
+	if (random() % 4 == 0 && strcmp(end, "^") && strcmp(end, "$"))
+		strncat(pattern, operators[random() % (sizeof(operators) / sizeof(operators[0]))], size - strlen(pattern) - 1);
+}
+
+static void random_branch(char *pattern, size_t size, int depth)
+{
+	long pieces = between(1, 4), i = 0;
+
+	if (random() % 4 == 0)
+		strncat(pattern, "^", size - strlen(pattern) - 1);
+
+	for (i = 0; i < pieces; i++)
+		random_piece(pattern, size, depth);
+
+	if (random() % 3 == 0)
+		strncat(pattern, "$", size - strlen(pattern) - 1);
+}
+
+static void random_alternation(char *pattern, size_t size, int depth)
+{
+	random_branch(pattern, size, depth);
+
+	while (random() % 4 == 0)
+	{
+		strncat(pattern, "|", size - strlen(pattern) - 1);
+		random_branch(pattern, size, depth);
+	}
+}
+
+/* Writes a random path to path (of the characters the patterns use, and now and then a
+ * non-ASCII one): */
+
+static void random_path(char *path, size_t size)
+{
+	static const char alphabet[] = "/////.....aaabbboooxx01-_c";
+	size_t length = between(0, size - 3), i = 0;
+
+	if (random() % 2)
+		path[i++] = '/';
+
+	for (; i < length; i++)
+		path[i] = alphabet[random() % (sizeof(alphabet) - 1)];
+
+	if (length > 0 && random() % 8 == 0)
+		path[random() % length] = (char) between(128, 255);
+
+	path[i] = '\0';
+}
+
+/* Compiles a random set of patterns both ways and checks what they say about PATHS_PER_SET random
+ * paths: */
+
+static void check_set(const char *locale, long set)
+{
+	char patterns[MAX_PATTERNS][MAX_PATTERN], path[MAX_PATH];
+	const char *sources[MAX_PATTERNS];
+	regex_t compiled[MAX_PATTERNS];
+	int in_dfa[MAX_PATTERNS], matches[MAX_PATTERNS];
+	unsigned count = between(1, MAX_PATTERNS), i = 0;
+	struct re_dfa *dfa = NULL;
+	int answer = 0, non_ascii = 0, any = 0;
+	long p = 0;
+	char *c = NULL;
+
+	for (i = 0; i < count; i++)
+	{
+		patterns[i][0] = '\0';
+		random_alternation(patterns[i], sizeof(patterns[i]), 2);
+
+		/* The DFA only ever gets the patterns regcomp() accepts (see compile_ignore_re()): */
+
+		sources[i] = regcomp(&compiled[i], patterns[i], REG_EXTENDED | REG_NOSUB) ? NULL : patterns[i];
+	}
+
+	/* (There is no DFA if it takes none of them:) */
+
+	dfa = re_dfa_compile(sources, count, in_dfa);
+
+	for (i = 0; i < count; i++)
+	{
+		patterns_tried++;
+		patterns_taken += in_dfa[i];
+	}
+
+	for (p = 0; dfa && p < PATHS_PER_SET; p++)
+	{
+		random_path(path, sizeof(path));
+
+		for (non_ascii = NO, c = path; *c; c++)
+			if ((unsigned char) *c >= 128)
+				non_ascii = YES;
+
+		for (any = NO, i = 0; i < count; i++)
+		{
+			matches[i] = sources[i] && in_dfa[i] && !regexec(&compiled[i], path, 0, NULL, 0);
+			any = any || matches[i];
+		}
+
+		answer = re_dfa_matches(dfa, path);
+
+		if (answer == RE_DFA_UNSURE)
+		{
+			if (!non_ascii)
+				fail("%s, set %ld: the DFA isn't sure about the ASCII path \"%s\"", locale, set, path);
+
+			paths_unsure++;
+		}
+		else if (answer > 0)
+		{
+			paths_matched++;
+
+			if (answer > (int) count || !in_dfa[answer - 1] || !matches[answer - 1])
+				fail("%s, set %ld: the DFA says pattern %d matches \"%s\", regexec() doesn't (patterns: %s%s%s%s%s%s%s)",
+						locale, set, answer, path, patterns[0], count > 1 ? ", " : "", count > 1 ? patterns[1] : "",
+						count > 2 ? ", " : "", count > 2 ? patterns[2] : "", count > 3 ? ", " : "", count > 3 ? patterns[3] : "");
+		}
+		else if (any)
+		{
+			for (i = 0; !matches[i]; i++)
+				;
+
+			fail("%s, set %ld: the DFA says \"%s\" matches nothing, regexec() says it matches %s",
+					locale, set, path, patterns[i]);
+		}
+	}
+
+	re_dfa_free(dfa);
+
+	for (i = 0; i < count; i++)
+		if (sources[i])
+			regfree(&compiled[i]);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *locales[] = { "C", "C.UTF-8", NULL };
+	unsigned long seed = getenv("FUZZ_SEED") ? strtoul(getenv("FUZZ_SEED"), NULL, 10) :
+		(unsigned long) time(NULL) ^ (unsigned long) getpid();
+	long sets = iterations(DEFAULT_ITERATIONS), set = 0;
+	int i = 0;
+
+	printf("FUZZ_SEED=%lu, %ld sets of patterns of a DFA of at most %d states\n", seed, sets, RE_DFA_MAX_STATES);
+
+	for (i = 0; locales[i]; i++)
+	{
+		if (!setlocale(LC_ALL, locales[i]))
+		{
+			printf("no %s locale here, not tried\n", locales[i]);
+			continue;
+		}
+
+		srandom(seed);
+		patterns_tried = patterns_taken = paths_matched = paths_unsure = 0;
+
+		for (set = 0; set < sets; set++)
+			check_set(locales[i], set);
+
+		printf("%s: the DFA took %ld of %ld patterns; %ld paths matched, %ld were left to regexec()\n",
+				locales[i], patterns_taken, patterns_tried, paths_matched, paths_unsure);
+	}
+
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+}
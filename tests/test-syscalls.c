@@ -0,0 +1,283 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/* test-syscalls: once the trash dirs have been checked, the unlink()s which follow must not look at
+ * them again (stat(), access(), mkdir(), chmod()...) until TRASH_CHECK_INTERVAL seconds have gone by;
+ * with TRASH_CHECK_INTERVAL = 0, every one of them does. The child which does the unlink()s is
+ * traced with ptrace(), and every system call it makes between two markers (getppid() calls, which
+ * libtrash never makes) is counted, as are those which are given the path of the trash can. The
+ * counts per unlink() are reported. The unlink()s of files right in one of the TEMPORARY_DIRS must
+ * not look at that dir (or at the files) at all, once the first of them has. Skipped where
+ * ptrace() isn't available, or on anything but x86-64 Linux. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "harness.h"
+#include "trace.h"
+
+#ifdef CAN_TRACE
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#endif
+
+#define DEFAULT_ITERATIONS 200
+
+/* Unlinks n files of one kind (after a first one, which builds the snapshot and checks the trash
+ * dirs), between two markers: */
+
+static void unlink_files(const char *kind, long n)
+{
+	const char *home = getenv("HOME");
+	char dir[4096], path[4096];
+	int top = !strcmp(kind, "top-temporary"), temporary = top || !strcmp(kind, "temporary");
+	long pid = (long) getpid(), i = 0;
+
+	/* (The files of a top-temporary kind lie right in the temporary dir:) */
+
+	if (top)
+		snprintf(dir, sizeof(dir), "%s/temporary", home);
+	else
+	{
+		snprintf(dir, sizeof(dir), "%s/%s/%ld", home, temporary ? "temporary" : "work", pid);
+
+		if (mkdir(dir, 0755))
+			fail("unable to create %s: %s", dir, strerror(errno));
+	}
+
+	if (temporary)
+		for (i = 0; i <= n; i++)
+		{
+			snprintf(path, sizeof(path), "%s/f%ld-%ld.txt", dir, pid, i);
+			make_file(path);
+		}
+
+	snprintf(path, sizeof(path), "%s/f%ld-%ld.txt", dir, pid, n);
+	unlink(path);
+
+	getppid();
+
+	for (i = 0; i < n; i++)
+	{
+		snprintf(path, sizeof(path), "%s/f%ld-%ld.txt", dir, pid, i);
+
+		if (unlink(path) && strcmp(kind, "missing"))
+			fail("unlink(%s): %s", path, strerror(errno));
+	}
+
+	getppid();
+}
+
+#ifdef CAN_TRACE
+
+/* Runs unlink_files(kind, n) in a traced child with libtrash preloaded, and counts the system calls
+ * it makes between the markers, and those of them which name trash_can (or whatever path is
+ * passed there): */
+
+static void trace_unlinks(char *program, const char *kind, long n, const char *trash_can,
+		long *calls, long *trash_calls)
+{
+	char count[32];
+	char *arguments[] = { program, (char *) kind, count, NULL };
+	struct user_regs_struct registers;
+	int status = 0, markers = 0;
+	pid_t pid = 0;
+
+	snprintf(count, sizeof(count), "%ld", n);
+
+	*calls = *trash_calls = 0;
+
+	pid = trace_self(arguments, 0);
+
+	while (1)
+	{
+		int signal = 0;
+
+		if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL))
+			fail("ptrace(PTRACE_SYSCALL): %s", strerror(errno));
+
+		if (waitpid(pid, &status, 0) < 0)
+			fail("waitpid(): %s", strerror(errno));
+
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+
+		if (WSTOPSIG(status) != (SIGTRAP | 0x80))
+		{
+			/* (A signal for the child, which we hand on:) */
+
+			signal = WSTOPSIG(status) == SIGTRAP ? 0 : WSTOPSIG(status);
+
+			if (signal && ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) signal))
+				fail("ptrace(PTRACE_SYSCALL): %s", strerror(errno));
+
+			if (signal && waitpid(pid, &status, 0) < 0)
+				fail("waitpid(): %s", strerror(errno));
+
+			if (signal && (WIFEXITED(status) || WIFSIGNALED(status)))
+				break;
+
+			continue;
+		}
+
+		if (ptrace(PTRACE_GETREGS, pid, NULL, &registers))
+			fail("ptrace(PTRACE_GETREGS): %s", strerror(errno));
+
+		/* Only the stops on entry count: */
+
+		if (!at_syscall_entry(&registers))
+			continue;
+
+		if (registers.orig_rax == SYS_getppid)
+		{
+			markers++;
+			continue;
+		}
+
+		if (markers != 1)
+			continue;
+
+		(*calls)++;
+
+		if (names_path(pid, path_argument(&registers), trash_can))
+			(*trash_calls)++;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fail("the traced child (%s) didn't exit normally", kind);
+
+	if (markers != 2)
+		fail("the traced child (%s) made %d marker calls instead of 2", kind, markers);
+}
+
+#endif /* CAN_TRACE */
+
+int main(int argc, char **argv)
+{
+	static const char *kinds[] =
+	{
+		"missing",
+#ifndef FROZEN_POLICY
+		"temporary",	/* (a frozen policy ignores TEMPORARY_DIRS below) */
+#endif
+		NULL
+	};
+
+	char *home = NULL, path[4096], trash_can[4096];
+	long n = iterations(DEFAULT_ITERATIONS);
+	int i = 0;
+
+	if (argc == 3)
+	{
+		unlink_files(argv[1], atol(argv[2]));
+		return EXIT_SUCCESS;
+	}
+
+#ifndef CAN_TRACE
+	skip("system calls are only traced on x86-64 Linux");
+#else
+	libtrash_under_test();
+
+	home = scratch_home();
+
+	snprintf(path, sizeof(path), "%s/temporary", home);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/work", home);
+	mkdir(path, 0755);
+
+	snprintf(trash_can, sizeof(trash_can), "%s/Trash", home);
+
+	for (i = 0; kinds[i]; i++)
+	{
+		long calls = 0, trash_calls = 0, unchecked_calls = 0, unchecked_trash_calls = 0;
+
+		/* With the default interval, the trash can is only looked at by the first unlink(): */
+
+		write_config(home,
+				"TRASH_CAN = Trash\n"
+				"TEMPORARY_DIRS = %s/temporary\n"
+				"GLOBAL_PROTECTION = NO\n"
+				"TRASH_CHECK_INTERVAL = 3600\n", home);
+
+		trace_unlinks(argv[0], kinds[i], n, trash_can, &calls, &trash_calls);
+
+		/* With none, by every one of them: */
+
+		write_config(home,
+				"TRASH_CAN = Trash\n"
+				"TEMPORARY_DIRS = %s/temporary\n"
+				"GLOBAL_PROTECTION = NO\n"
+				"TRASH_CHECK_INTERVAL = 0\n", home);
+
+		trace_unlinks(argv[0], kinds[i], n, trash_can, &unchecked_calls, &unchecked_trash_calls);
+
+		printf("unlink() of a %s file: %.2f system calls (%.2f on the trash can) each, "
+				"%.2f (%.2f) with TRASH_CHECK_INTERVAL = 0\n", kinds[i],
+				(double) calls / n, (double) trash_calls / n,
+				(double) unchecked_calls / n, (double) unchecked_trash_calls / n);
+
+		if (trash_calls != 0)
+			fail("%ld unlink()s of %s files looked at the trash can %ld times", n, kinds[i], trash_calls);
+
+		if (unchecked_trash_calls < n)
+			fail("with TRASH_CHECK_INTERVAL = 0, %ld unlink()s of %s files only looked at the trash can %ld times",
+					n, kinds[i], unchecked_trash_calls);
+	}
+
+#ifndef FROZEN_POLICY
+	/* Once an unlink() of a file right in the temporary dir has found that dir unchanged, the
+	 * others don't look at it (or at the files) again (see known_canonical_dir()): */
+
+	snprintf(path, sizeof(path), "%s/temporary", home);
+
+	write_config(home,
+			"TRASH_CAN = Trash\n"
+			"TEMPORARY_DIRS = %s\n"
+			"GLOBAL_PROTECTION = NO\n"
+			"TRASH_CHECK_INTERVAL = 3600\n", path);
+
+	{
+		long calls = 0, temporary_calls = 0;
+
+		trace_unlinks(argv[0], "top-temporary", n, path, &calls, &temporary_calls);
+
+		printf("unlink() of a file right in a temporary dir: %.2f system calls (%.2f on the dir) each\n",
+				(double) calls / n, (double) temporary_calls / n);
+
+		if (temporary_calls > 1)
+			fail("%ld unlink()s of files right in a temporary dir looked at it %ld times", n, temporary_calls);
+	}
+#endif
+
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+#endif
+}
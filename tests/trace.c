@@ -0,0 +1,139 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "harness.h"
+#include "trace.h"
+
+#ifdef CAN_TRACE
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+
+/* Runs this very program with the arguments argv and libtrash preloaded, under ptrace() (with
+ * PTRACE_O_TRACESYSGOOD, PTRACE_O_EXITKILL and whatever else options asks for), and returns its
+ * pid once it has stopped right after exec(). The caller resumes it with PTRACE_SYSCALL. Skips the
+ * test if ptrace() isn't allowed: */
+
+pid_t trace_self(char *const argv[], int options)
+{
+	int status = 0;
+	pid_t pid = 0;
+
+	fflush(stdout);
+
+	pid = fork();
+
+	if (pid < 0)
+		fail("fork(): %s", strerror(errno));
+
+	if (pid == 0)
+	{
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL))
+			_exit(EXIT_SKIP);
+
+		setenv("LD_PRELOAD", libtrash_under_test(), 1);
+		execv("/proc/self/exe", argv);
+		_exit(127);
+	}
+
+	/* The child stops when it execs: */
+
+	if (waitpid(pid, &status, 0) < 0)
+		fail("waitpid(): %s", strerror(errno));
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SKIP)
+		skip("ptrace() isn't allowed here");
+
+	if (!WIFSTOPPED(status) ||
+			ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) (long) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL | options)))
+		fail("unable to trace the child");
+
+	return pid;
+}
+
+/* Tells the stop on entry to a system call (where rax is still -ENOSYS) from the one on exit: */
+
+int at_syscall_entry(const struct user_regs_struct *registers)
+{
+	return registers->rax == (unsigned long long) -ENOSYS;
+}
+
+/* The path argument of the system calls which take one (and through which libtrash might look at
+ * or open a file), or 0: */
+
+unsigned long long path_argument(const struct user_regs_struct *registers)
+{
+	switch (registers->orig_rax)
+	{
+		case SYS_stat: case SYS_lstat: case SYS_access: case SYS_mkdir: case SYS_chmod:
+		case SYS_open: case SYS_chown: case SYS_lchown:
+			return registers->rdi;
+
+		case SYS_newfstatat: case SYS_faccessat: case SYS_mkdirat: case SYS_fchmodat:
+		case SYS_openat: case SYS_statx: case SYS_fchownat:
+#ifdef SYS_faccessat2
+		case SYS_faccessat2:
+#endif
+			return registers->rsi;
+
+		default:
+			return 0;
+	}
+}
+
+/* Returns 1 if the string at address in the traced process pid is the path prefix, or starts with
+ * prefix followed by a slash, 0 otherwise: */
+
+int names_path(pid_t pid, unsigned long long address, const char *prefix)
+{
+	size_t length = strlen(prefix), i = 0;
+	char string[4096 + sizeof(long)];
+
+	if (!address || length >= 4096)
+		return 0;
+
+	for (i = 0; i <= length; i += sizeof(long))
+	{
+		long word = 0;
+
+		errno = 0;
+		word = ptrace(PTRACE_PEEKDATA, pid, (void *) (address + i), NULL);
+
+		if (errno)
+			return 0;
+
+		memcpy(string + i, &word, sizeof(long));
+	}
+
+	return !strncmp(string, prefix, length) && (string[length] == '\0' || string[length] == '/');
+}
+
+#endif /* CAN_TRACE */
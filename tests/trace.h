@@ -0,0 +1,40 @@
+/* Copyright 2001, 2002, 2003, 2004, 2005, 2006, 2007 Manuel Arriaga
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+
+/* What the tests which trace the system calls of a program running libtrash have in common (see
+ * trace.c). Tracing is only done on x86-64 Linux: elsewhere, CAN_TRACE isn't defined, and those
+ * tests skip themselves. */
+
+#if defined(__linux__) && defined(__x86_64__)
+
+#define CAN_TRACE 1
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+pid_t trace_self(char *const argv[], int options);
+
+int at_syscall_entry(const struct user_regs_struct *registers);
+
+unsigned long long path_argument(const struct user_regs_struct *registers);
+
+int names_path(pid_t pid, unsigned long long address, const char *prefix);
+
+#endif